@@ -1,5 +1,7 @@
 let ws;
 let lastUpdateTime = 0;
+let telemetry = {};     // All fields so far, the ESP only sends changed ones
+let telemetrySchema = null;
 
 // Safe DOM element access helper
 function getElement(id) {
@@ -30,6 +32,50 @@ function updateElementClass(id, className) {
     }
 }
 
+// The first message after connecting has all fields, later ones only
+// what changed. Sections are always rendered from the merged state.
+function mergeTelemetry(data) {
+    return Object.assign(telemetry, data);
+}
+
+// Binary telemetry frame (see src/telemetry_publisher.h), little endian:
+// u8 type 0x01, u16 schema id, u64 field mask, then per field in the mask
+// i32 (int, float scaled by 10^decimals), u8 (bool) or u8 length + text
+function decodeTelemetryFrame(schema, buffer) {
+    const view = new DataView(buffer);
+    if (!schema || view.byteLength < 11 || view.getUint8(0) !== 0x01) return null;
+    if (view.getUint16(1, true) !== schema.id) return null;    // Firmware changed, wait for the new schema
+
+    const maskLow = view.getUint32(3, true);
+    const maskHigh = view.getUint32(7, true);
+    const values = {};
+    let offset = 11;
+
+    for (let i = 0; i < schema.fields.length; i++) {
+        const bit = i < 32 ? (maskLow >>> i) & 1 : (maskHigh >>> (i - 32)) & 1;
+        if (!bit) continue;
+
+        const [key, type, decimals] = schema.fields[i];
+        if (type === 'i' || type === 'f') {
+            const raw = view.getInt32(offset, true);
+            offset += 4;
+            if (type === 'i') {
+                values[key] = raw;
+            } else {
+                values[key] = raw === -2147483648 ? null : raw / Math.pow(10, decimals);
+            }
+        } else if (type === 'b') {
+            values[key] = view.getUint8(offset) !== 0;
+            offset += 1;
+        } else {
+            const length = view.getUint8(offset);
+            values[key] = new TextDecoder().decode(new Uint8Array(buffer, offset + 1, length));
+            offset += 1 + length;
+        }
+    }
+    return values;
+}
+
 function hasDebugData(data) {
     return data.debug && typeof data.debug.level !== 'undefined' && typeof data.debug.message !== 'undefined';
 }
@@ -41,18 +87,40 @@ function updateDebugData(data) {
 }
 
 function connectWS() {
+    telemetry = {};
+    telemetrySchema = null;
     ws = new WebSocket('ws://' + location.hostname + '/ws');
+    ws.binaryType = 'arraybuffer';
+    ws.onopen = function() {
+        // Compact binary frames instead of JSON text
+        ws.send(JSON.stringify({ telemetry: 'binary' }));
+    };
     ws.onmessage = function(event) {
         try {
+            if (event.data instanceof ArrayBuffer) {
+                const values = decodeTelemetryFrame(telemetrySchema, event.data);
+                if (values) {
+                    updateData(mergeTelemetry(values));
+                    lastUpdateTime = Date.now();
+                }
+                return;
+            }
+
             const data = JSON.parse(event.data);
 
             // Handle debug messages
             if (hasDebugData(data)) {
                 updateDebugData(data);
+                return;
+            }
+
+            if (data.schema) {
+                telemetrySchema = data.schema;
+                return;
             }
 
             // Handle regular data updates
-            updateData(data);
+            updateData(mergeTelemetry(data));
             lastUpdateTime = Date.now();
         } catch (e) {
             console.error('Error parsing WebSocket data:', e);
@@ -200,12 +268,12 @@ function updateAllValues(data) {
     }
 
     // MQTT Status - only update if data is available
-    if (data.mqtt) {
-        const mqttConnected = data.mqtt.connected || false;
+    if (typeof data.mqtt_connected !== 'undefined') {
+        const mqttConnected = data.mqtt_connected || false;
         updateElement('mqtt_status', mqttConnected ? 'Verbunden' : 'Getrennt');
         updateElementStyle('mqtt_status', 'color', mqttConnected ? 'var(--victron-green)' : 'var(--victron-red)');
-        updateElement('mqtt_server', data.mqtt.server || '---');
-        updateElement('mqtt_port', data.mqtt.port || '---');
+        updateElement('mqtt_server', data.mqtt_server || '---');
+        updateElement('mqtt_port', data.mqtt_port || '---');
         updateElement('mqtt_last_message', new Date().toLocaleTimeString());
     }
 
@@ -331,7 +399,7 @@ function hasSystemData(data) {
 }
 
 function hasMQTTData(data) {
-    return data.mqtt && typeof data.mqtt.connected !== 'undefined';
+    return typeof data.mqtt_connected !== 'undefined';
 }
 
 function hasProtectionData(data) {
@@ -467,11 +535,11 @@ function updateSystemData(data) {
 }
 
 function updateMQTTData(data) {
-    const mqttConnected = data.mqtt.connected || false;
+    const mqttConnected = data.mqtt_connected || false;
     updateElement('mqtt_status', mqttConnected ? 'Verbunden' : 'Getrennt');
     updateElementStyle('mqtt_status', 'color', mqttConnected ? 'var(--victron-green)' : 'var(--victron-red)');
-    updateElement('mqtt_server', data.mqtt.server || '---');
-    updateElement('mqtt_port', data.mqtt.port || '---');
+    updateElement('mqtt_server', data.mqtt_server || '---');
+    updateElement('mqtt_port', data.mqtt_port || '---');
     updateElement('mqtt_last_message', new Date().toLocaleTimeString());
 }
 
@@ -526,18 +594,40 @@ function clearDebugConsole() {
 
 // Extend WebSocket message handler to process debug messages
 function connectWS() {
+    telemetry = {};
+    telemetrySchema = null;
     ws = new WebSocket('ws://' + location.hostname + '/ws');
+    ws.binaryType = 'arraybuffer';
+    ws.onopen = function() {
+        // Compact binary frames instead of JSON text
+        ws.send(JSON.stringify({ telemetry: 'binary' }));
+    };
     ws.onmessage = function(event) {
         try {
+            if (event.data instanceof ArrayBuffer) {
+                const values = decodeTelemetryFrame(telemetrySchema, event.data);
+                if (values) {
+                    updateData(mergeTelemetry(values));
+                    lastUpdateTime = Date.now();
+                }
+                return;
+            }
+
             const data = JSON.parse(event.data);
 
             // Handle debug messages
             if (hasDebugData(data)) {
                 updateDebugData(data);
+                return;
+            }
+
+            if (data.schema) {
+                telemetrySchema = data.schema;
+                return;
             }
 
             // Handle regular data updates
-            updateData(data);
+            updateData(mergeTelemetry(data));
             lastUpdateTime = Date.now();
         } catch (e) {
             console.error('Error parsing WebSocket data:', e);
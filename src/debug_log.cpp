@@ -0,0 +1,114 @@
+/*
+ * Debug Log Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "debug_log.h"
+#include <stdio.h>
+
+DebugLog::DebugLog() : taskHandle(nullptr) {
+    for (uint8_t i = 0; i < LOG_MODULE_COUNT; i++) {
+        moduleLevels[i] = DEBUG_LOG_DEFAULT_LEVEL;
+    }
+    for (uint8_t i = 0; i < LOG_SINK_COUNT; i++) {
+        sinks[i].function = nullptr;
+        sinks[i].minLevel = LOG_LEVEL_DEBUG;
+        sinks[i].stats.sent = 0;
+        sinks[i].stats.limited = 0;
+    }
+    setSink(LOG_SINK_SERIAL, writeSerial, LOG_LEVEL_DEBUG, DEBUG_LOG_SERIAL_RATE, DEBUG_LOG_SERIAL_BURST);
+}
+
+bool DebugLog::begin() {
+    if (taskHandle != nullptr) {
+        return true;
+    }
+    if (!halTaskCreate(taskWrapper, "DebugLog", DEBUG_LOG_TASK_STACK_SIZE, this,
+                       DEBUG_LOG_TASK_PRIORITY, DEBUG_LOG_TASK_CORE, &taskHandle)) {
+        halConsoleWrite("DebugLog: failed to create task\n");
+        taskHandle = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void DebugLog::log(LogLevel level, LogModule module, const char* format,
+                   int32_t arg0, int32_t arg1, int32_t arg2, int32_t arg3) {
+    LogRecord record;
+    record.timeMs = halMillis();
+    record.level = level;
+    record.module = module;
+    record.reserved = 0;
+    record.format = format;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    record.args[3] = arg3;
+    ring.push(record);
+}
+
+void DebugLog::setModuleLevel(LogModule module, uint8_t level) {
+    if (module >= LOG_MODULE_COUNT) return;
+    moduleLevels[module] = level > LOG_LEVEL_COUNT ? (uint8_t)LOG_LEVEL_COUNT : level;
+}
+
+void DebugLog::setSink(LogSinkId id, LogSinkFunction function, LogLevel minLevel, uint16_t rate, uint16_t burst) {
+    if (id >= LOG_SINK_COUNT) return;
+    sinks[id].function = function;
+    sinks[id].minLevel = minLevel;
+    sinks[id].limiter.configure(rate, burst);
+}
+
+DebugLogStats DebugLog::getStats() const {
+    DebugLogStats stats;
+    stats.ring = ring.getStats();
+    for (uint8_t i = 0; i < LOG_SINK_COUNT; i++) {
+        stats.sinks[i] = sinks[i].stats;
+    }
+    return stats;
+}
+
+void DebugLog::taskWrapper(void* parameter) {
+    static_cast<DebugLog*>(parameter)->task();
+}
+
+void DebugLog::task() {
+    for (;;) {
+        drain();
+        halDelayMs(DEBUG_LOG_DRAIN_INTERVAL_MS);
+    }
+}
+
+void DebugLog::drain() {
+    LogRecord record;
+    char text[LOG_TEXT_MAX];
+
+    while (ring.pop(record)) {
+        bool formatted = false;
+        uint32_t now = halMillis();
+        for (uint8_t i = 0; i < LOG_SINK_COUNT; i++) {
+            Sink& sink = sinks[i];
+            if (sink.function == nullptr || record.level < sink.minLevel) {
+                continue;
+            }
+            if (!sink.limiter.allow(now)) {
+                sink.stats.limited++;
+                continue;
+            }
+            if (!formatted) {
+                formatLogRecord(record, text, sizeof(text));
+                formatted = true;
+            }
+            sink.function(record, text);
+            sink.stats.sent++;
+        }
+    }
+}
+
+void DebugLog::writeSerial(const LogRecord& record, const char* text) {
+    char line[LOG_TEXT_MAX + 16];
+    snprintf(line, sizeof(line), "%lu %s\n", (unsigned long)record.timeMs, text);
+    halConsoleWrite(line);
+}
@@ -0,0 +1,191 @@
+/*
+ * Debug Log
+ *
+ * Replaces the synchronous publishDebugMessage(): log() only puts a binary
+ * record into the LogRing (log_ring.h) and returns, so the VE.Bus task no
+ * longer builds JSON, allocates Strings or waits for the UART, WebSocket or
+ * MQTT client. A low-priority task drains the ring every
+ * DEBUG_LOG_DRAIN_INTERVAL_MS, formats each record once and hands it to the
+ * sinks: Serial (built in), WebSocket and MQTT (set by main.cpp). Every sink
+ * has a minimum level and a token bucket; records over the rate are counted
+ * as limited instead of being sent.
+ *
+ * Log sites use the LOG_DEBUG() ... LOG_ERROR() macros with a module:
+ *
+ *   LOG_INFO(LOG_MODULE_VEBUS, "Sent frame #%d", frameNumber);
+ *
+ * Sites below LOG_BUILD_LEVEL and of modules missing in LOG_BUILD_MODULES
+ * end up in a constant false branch: the arguments are type checked but not
+ * evaluated, and neither code nor the format string is emitted. Without an
+ * explicit LOG_BUILD_LEVEL it follows CORE_DEBUG_LEVEL like the Arduino core
+ * (0 none, 1 error, 2 warning, 3 info, 4/5 debug). Sites that are compiled
+ * in are checked against the runtime level of their module
+ * (setModuleLevel(), POST /api/log/level) before anything is queued.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include "hal.h"
+#include "log_ring.h"
+
+#define DEBUG_LOG_TASK_STACK_SIZE 4096
+#define DEBUG_LOG_TASK_PRIORITY 1
+#define DEBUG_LOG_TASK_CORE 0
+#define DEBUG_LOG_DRAIN_INTERVAL_MS 20
+#define DEBUG_LOG_DEFAULT_LEVEL LOG_LEVEL_INFO  // Runtime level of every module after boot
+
+// Build-time threshold, numeric for the preprocessor; order of LogLevel
+#define LOG_BUILD_DEBUG 0
+#define LOG_BUILD_INFO 1
+#define LOG_BUILD_SUCCESS 2
+#define LOG_BUILD_WARNING 3
+#define LOG_BUILD_ERROR 4
+#define LOG_BUILD_NONE 5
+
+#ifndef LOG_BUILD_LEVEL
+#if !defined(CORE_DEBUG_LEVEL) || CORE_DEBUG_LEVEL >= 4
+#define LOG_BUILD_LEVEL LOG_BUILD_DEBUG
+#elif CORE_DEBUG_LEVEL == 3
+#define LOG_BUILD_LEVEL LOG_BUILD_INFO
+#elif CORE_DEBUG_LEVEL == 2
+#define LOG_BUILD_LEVEL LOG_BUILD_WARNING
+#elif CORE_DEBUG_LEVEL == 1
+#define LOG_BUILD_LEVEL LOG_BUILD_ERROR
+#else
+#define LOG_BUILD_LEVEL LOG_BUILD_NONE
+#endif
+#endif
+
+// Bit (1 << LogModule) per module that is compiled in
+#ifndef LOG_BUILD_MODULES
+#define LOG_BUILD_MODULES 0xFFFFFFFFUL
+#endif
+
+static_assert(LOG_BUILD_DEBUG == LOG_LEVEL_DEBUG && LOG_BUILD_ERROR == LOG_LEVEL_ERROR &&
+              LOG_BUILD_NONE == LOG_LEVEL_COUNT, "LOG_BUILD_* must match LogLevel");
+
+// Sink defaults: messages per second, burst
+#define DEBUG_LOG_SERIAL_RATE 50
+#define DEBUG_LOG_SERIAL_BURST 100
+#define DEBUG_LOG_WEBSOCKET_RATE 20
+#define DEBUG_LOG_WEBSOCKET_BURST 40
+#define DEBUG_LOG_MQTT_RATE 5
+#define DEBUG_LOG_MQTT_BURST 10
+
+enum LogSinkId : uint8_t {
+    LOG_SINK_SERIAL,
+    LOG_SINK_WEBSOCKET,
+    LOG_SINK_MQTT,
+    LOG_SINK_COUNT
+};
+
+// Called from the log task with the formatted "[MODULE] message"
+typedef void (*LogSinkFunction)(const LogRecord& record, const char* text);
+
+struct LogSinkStats {
+    uint32_t sent;
+    uint32_t limited;                   // Over the rate limit, not sent
+};
+
+struct DebugLogStats {
+    LogRingStats ring;
+    LogSinkStats sinks[LOG_SINK_COUNT];
+};
+
+class DebugLog {
+private:
+    volatile uint8_t moduleLevels[LOG_MODULE_COUNT];
+
+    struct Sink {
+        LogSinkFunction function;
+        uint8_t minLevel;
+        LogRateLimiter limiter;
+        LogSinkStats stats;
+    };
+
+    LogRing ring;
+    Sink sinks[LOG_SINK_COUNT];
+    HalTaskHandle taskHandle;
+
+    static void taskWrapper(void* parameter);
+    void task();
+    void drain();
+    static void writeSerial(const LogRecord& record, const char* text);
+
+public:
+    DebugLog();
+
+    // Starts the drain task; records logged before are kept in the ring
+    bool begin();
+
+    // Any task, never blocks; format must be a string literal (see log_ring.h).
+    // Use the LOG_* macros, they also check isEnabled().
+    void log(LogLevel level, LogModule module, const char* format,
+             int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0, int32_t arg3 = 0);
+
+    bool isEnabled(LogLevel level, LogModule module) const {
+        return module < LOG_MODULE_COUNT && level >= moduleLevels[module];
+    }
+
+    // Runtime level, any task; LOG_LEVEL_COUNT turns a module off
+    void setModuleLevel(LogModule module, uint8_t level);
+    uint8_t getModuleLevel(LogModule module) const { return module < LOG_MODULE_COUNT ? moduleLevels[module] : (uint8_t)LOG_LEVEL_COUNT; }
+
+    // Before begin()
+    void setSink(LogSinkId id, LogSinkFunction function, LogLevel minLevel, uint16_t rate, uint16_t burst);
+
+    DebugLogStats getStats() const;
+};
+
+extern DebugLog debugLog;
+
+#define LOG_MODULE_BUILT(module) ((LOG_BUILD_MODULES >> (module)) & 1)
+
+#define LOG_SITE(level, module, ...) do { \
+        if (LOG_MODULE_BUILT(module) && debugLog.isEnabled(level, module)) { \
+            debugLog.log(level, module, __VA_ARGS__); \
+        } \
+    } while (0)
+
+// Arguments are still type checked but never evaluated, no code or string is emitted
+#define LOG_DISABLED_SITE(level, module, ...) do { \
+        if (0) { \
+            debugLog.log(level, module, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if LOG_BUILD_LEVEL <= LOG_BUILD_DEBUG
+#define LOG_DEBUG(module, ...) LOG_SITE(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#else
+#define LOG_DEBUG(module, ...) LOG_DISABLED_SITE(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+#endif
+
+#if LOG_BUILD_LEVEL <= LOG_BUILD_INFO
+#define LOG_INFO(module, ...) LOG_SITE(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#else
+#define LOG_INFO(module, ...) LOG_DISABLED_SITE(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#endif
+
+#if LOG_BUILD_LEVEL <= LOG_BUILD_SUCCESS
+#define LOG_SUCCESS(module, ...) LOG_SITE(LOG_LEVEL_SUCCESS, module, __VA_ARGS__)
+#else
+#define LOG_SUCCESS(module, ...) LOG_DISABLED_SITE(LOG_LEVEL_SUCCESS, module, __VA_ARGS__)
+#endif
+
+#if LOG_BUILD_LEVEL <= LOG_BUILD_WARNING
+#define LOG_WARNING(module, ...) LOG_SITE(LOG_LEVEL_WARNING, module, __VA_ARGS__)
+#else
+#define LOG_WARNING(module, ...) LOG_DISABLED_SITE(LOG_LEVEL_WARNING, module, __VA_ARGS__)
+#endif
+
+#if LOG_BUILD_LEVEL <= LOG_BUILD_ERROR
+#define LOG_ERROR(module, ...) LOG_SITE(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#else
+#define LOG_ERROR(module, ...) LOG_DISABLED_SITE(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#endif
+
+#endif // DEBUG_LOG_H
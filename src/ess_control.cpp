@@ -0,0 +1,76 @@
+/*
+ * ESS Setpoint Control Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "ess_control.h"
+
+// Battery current limit in watts, capped by the inverter limit
+static int32_t powerLimit(float currentLimit, float voltage, int32_t maxPower) {
+    if (currentLimit <= 0 || voltage <= 0) {
+        return 0;
+    }
+    float watts = currentLimit * voltage;
+    return watts < (float)maxPower ? (int32_t)watts : maxPower;
+}
+
+EssControlOutput essControlStep(const EssControlParams& params, const EssControlInput& input) {
+    EssControlOutput output;
+    output.setpoint = 0;
+    output.unclamped = 0;
+    output.chargeLimit = 0;
+    output.dischargeLimit = 0;
+    output.gridTarget = params.gridTarget;
+    output.limit = ESS_LIMIT_NONE;
+
+    if (input.meterImportOnly && output.gridTarget < 0) {
+        output.gridTarget = 0;
+    }
+
+    if (!input.meterValid) {
+        output.limit = ESS_LIMIT_NO_METER;
+        return output;
+    }
+    if (!input.batteryValid) {
+        output.limit = ESS_LIMIT_NO_BATTERY;
+        return output;
+    }
+
+    int32_t maxPower = params.maxPower < INT16_MAX ? params.maxPower : INT16_MAX;
+    output.chargeLimit = powerLimit(input.chargeCurrentLimit, input.batteryVoltage, maxPower);
+    output.dischargeLimit = powerLimit(input.dischargeCurrentLimit, input.batteryVoltage, maxPower);
+
+    // Integrate the grid error only when the meter has seen the last setpoint
+    int32_t setpoint = input.lastSetpoint;
+    if (input.meterFresh) {
+        int32_t error = input.meterPower - output.gridTarget;
+        if (error > params.deadband || error < -params.deadband) {
+            setpoint += error * params.gainPercent / 100;
+        }
+    }
+    output.unclamped = setpoint;
+
+    if (setpoint > output.dischargeLimit) {
+        setpoint = output.dischargeLimit;
+        output.limit = output.dischargeLimit < maxPower ? ESS_LIMIT_DISCHARGE_CURRENT : ESS_LIMIT_MAX_POWER;
+    } else if (setpoint < -output.chargeLimit) {
+        setpoint = -output.chargeLimit;
+        output.limit = output.chargeLimit < maxPower ? ESS_LIMIT_CHARGE_CURRENT : ESS_LIMIT_MAX_POWER;
+    }
+    output.setpoint = (int16_t)setpoint;
+    return output;
+}
+
+const char* essControlLimitName(EssControlLimit limit) {
+    switch (limit) {
+        case ESS_LIMIT_NONE:              return "none";
+        case ESS_LIMIT_MAX_POWER:         return "max_power";
+        case ESS_LIMIT_CHARGE_CURRENT:    return "charge_current";
+        case ESS_LIMIT_DISCHARGE_CURRENT: return "discharge_current";
+        case ESS_LIMIT_NO_METER:          return "no_meter";
+        case ESS_LIMIT_NO_BATTERY:        return "no_battery";
+    }
+    return "unknown";
+}
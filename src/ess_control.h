@@ -0,0 +1,76 @@
+/*
+ * ESS Setpoint Control
+ *
+ * One step of the grid feed-in controller as a pure function: meter power
+ * and battery limits in, ESS setpoint out. The controller integrates the
+ * grid error on every new meter sample (the meter sees the effect of the
+ * previous setpoint) and holds the setpoint in between. The result is
+ * clamped to the inverter limit and to the battery charge/discharge current
+ * limits (CCL/DCL) reported by the BMS, converted to watts.
+ *
+ * Sign conventions:
+ *   meter power  - positive = import from the grid, negative = feed-in
+ *   ESS setpoint - positive = discharge into AC, negative = charge the battery
+ *
+ * Without a valid meter sample or battery data the setpoint is 0. A meter
+ * that cannot see feed-in (impulse meter) reads 0 W while feeding in, so a
+ * feed-in target would never be reached and the integrator would wind up
+ * to full discharge; with such a meter the grid target is raised to 0.
+ * No hardware dependencies, recorded traces can be replayed on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ESS_CONTROL_H
+#define ESS_CONTROL_H
+
+#include <stdint.h>
+
+#define ESS_CONTROL_GAIN_PERCENT 50     // Share of the grid error corrected per meter sample
+#define ESS_CONTROL_DEADBAND_W 10       // Grid errors below this are ignored
+#define ESS_CONTROL_METER_TIMEOUT_MS 5000   // Older meter samples are not acted on
+
+// What limited the last setpoint
+enum EssControlLimit : uint8_t {
+    ESS_LIMIT_NONE = 0,
+    ESS_LIMIT_MAX_POWER,        // Inverter power limit
+    ESS_LIMIT_CHARGE_CURRENT,   // Battery CCL
+    ESS_LIMIT_DISCHARGE_CURRENT,// Battery DCL
+    ESS_LIMIT_NO_METER,         // Meter sample missing or too old
+    ESS_LIMIT_NO_BATTERY        // BMS data missing
+};
+
+struct EssControlParams {
+    int32_t gridTarget;         // W at the meter, negative = feed-in
+    int32_t maxPower;           // W, inverter limit in both directions
+    uint8_t gainPercent;
+    int32_t deadband;           // W
+};
+
+struct EssControlInput {
+    int32_t meterPower;             // W at the grid meter
+    bool meterFresh;                // New meter sample since the last step
+    bool meterValid;                // Meter sample recent enough to act on
+    bool batteryValid;              // BMS online and limits known
+    float batteryVoltage;           // V
+    float chargeCurrentLimit;       // A (CCL)
+    float dischargeCurrentLimit;    // A (DCL)
+    int16_t lastSetpoint;           // Setpoint last queued to the inverter
+    bool meterImportOnly;           // Meter without direction, feed-in reads as 0 W
+};
+
+struct EssControlOutput {
+    int16_t setpoint;           // W, ESS power for the Multiplus
+    int32_t unclamped;          // W, setpoint before the limits
+    int32_t chargeLimit;        // W, largest allowed charge power
+    int32_t dischargeLimit;     // W, largest allowed discharge power
+    int32_t gridTarget;         // W, target applied, never below 0 for an import only meter
+    EssControlLimit limit;
+};
+
+EssControlOutput essControlStep(const EssControlParams& params, const EssControlInput& input);
+
+const char* essControlLimitName(EssControlLimit limit);
+
+#endif // ESS_CONTROL_H
@@ -0,0 +1,225 @@
+/*
+ * ESS Controller Task Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "ess_controller.h"
+#include "system_data.h"
+#include "pylontech_can.h"
+
+EssController::EssController() {
+    veBus = nullptr;
+    taskHandle = nullptr;
+    isRunning = false;
+    enabled = false;
+    params.gridTarget = 0;
+    params.maxPower = 5000;
+    params.gainPercent = ESS_CONTROL_GAIN_PERCENT;
+    params.deadband = ESS_CONTROL_DEADBAND_W;
+    meterSequence = 0;
+    lastMeterSequence = 0;
+    lastWakeUs = 0;
+    lastSentMs = 0;
+    wasEnabled = false;
+    status = EssControllerStatus();
+}
+
+EssController::~EssController() {
+    end();
+}
+
+bool EssController::begin(VeBusHandler* veBusHandler) {
+    veBus = veBusHandler;
+    isRunning = true;   // Before the task starts, it preempts us on this core
+
+    BaseType_t result = xTaskCreatePinnedToCore(
+        taskWrapper,
+        "EssControl",
+        ESS_CONTROL_TASK_STACK_SIZE,
+        this,
+        ESS_CONTROL_TASK_PRIORITY,
+        &taskHandle,
+        ESS_CONTROL_TASK_CORE
+    );
+
+    if (result != pdPASS) {
+        Serial.println("ESS: Failed to create control task");
+        taskHandle = nullptr;
+        isRunning = false;
+        return false;
+    }
+
+    // Wake the control loop on every sync frame
+    veBus->setSyncListener(taskHandle);
+
+    Serial.printf("ESS: Control loop started, period %d us\n", ESS_CONTROL_PERIOD_US);
+    return true;
+}
+
+void EssController::end() {
+    isRunning = false;
+
+    if (veBus != nullptr) {
+        veBus->setSyncListener(nullptr);
+    }
+    if (taskHandle != nullptr) {
+        vTaskDelete(taskHandle);
+        taskHandle = nullptr;
+    }
+}
+
+void EssController::configure(bool enable, float targetFeedIn, float maxPower) {
+    portENTER_CRITICAL(&paramsLock);
+    enabled = enable;
+    params.gridTarget = -(int32_t)targetFeedIn;
+    params.maxPower = (int32_t)maxPower;
+    portEXIT_CRITICAL(&paramsLock);
+}
+
+void EssController::publishMeterPower(int32_t watts, bool importOnly) {
+    EssMeterSample sample;
+    sample.power = watts;
+    sample.importOnly = importOnly;
+    sample.timeMs = millis();
+    sample.sequence = ++meterSequence;
+    meter.write(sample);
+}
+
+void EssController::refreshMeterPower() {
+    EssMeterSample sample = meter.read();
+    if (sample.sequence == 0) {
+        return;
+    }
+    sample.timeMs = millis();
+    meter.write(sample);
+}
+
+void EssController::taskWrapper(void* parameter) {
+    EssController* controller = static_cast<EssController*>(parameter);
+    controller->controlTask();
+}
+
+void EssController::controlTask() {
+    while (isRunning) {
+        // Sync frame notification from the VE.Bus task, timeout if the bus is quiet
+        bool synced = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ESS_CONTROL_SYNC_TIMEOUT_MS)) > 0;
+        iterate(synced);
+    }
+
+    vTaskDelete(nullptr);
+}
+
+void EssController::iterate(bool synced) {
+    uint32_t startUs = micros();
+    uint32_t nowMs = millis();
+
+    portENTER_CRITICAL(&paramsLock);
+    EssControlParams stepParams = params;
+    bool stepEnabled = enabled;
+    portEXIT_CRITICAL(&paramsLock);
+
+    // Meter, battery and inverter snapshots
+    EssMeterSample sample = meter.read();
+    PylontechBatteryState battery = pylontechCAN.getBattery();
+
+    EssControlInput input;
+    input.meterPower = sample.power;
+    input.meterFresh = sample.sequence != lastMeterSequence;
+    input.meterValid = sample.sequence != 0 && (nowMs - sample.timeMs) < ESS_CONTROL_METER_TIMEOUT_MS;
+    input.batteryValid = battery.age(PYLONTECH_FRAME_MEASUREMENTS, nowMs) < CAN_BATTERY_TIMEOUT_MS &&
+                         battery.age(PYLONTECH_FRAME_LIMITS, nowMs) < CAN_BATTERY_TIMEOUT_MS &&
+                         battery.voltage > 0;
+    input.batteryVoltage = battery.voltage;
+    input.chargeCurrentLimit = battery.chargeCurrentLimit;
+    input.dischargeCurrentLimit = battery.dischargeCurrentLimit;
+    // Integrate from what the Multiplus got, so offline or rejected steps don't wind up
+    input.lastSetpoint = status.sentSetpoint;
+    input.meterImportOnly = sample.importOnly;
+    lastMeterSequence = sample.sequence;
+
+    EssControlOutput output = essControlStep(stepParams, input);
+
+    if (stepEnabled && veBus->isDeviceOnline()) {
+        // Only changes go out, plus a periodic refresh of an unchanged value
+        if (!wasEnabled || output.setpoint != status.sentSetpoint || nowMs - lastSentMs >= ESS_CONTROL_REFRESH_MS) {
+            sendSetpoint(output.setpoint);
+        }
+    } else if (wasEnabled && !stepEnabled) {
+        // Hand the Multiplus back a neutral setpoint when control is switched off
+        sendSetpoint(0);
+        output.setpoint = 0;
+    }
+    wasEnabled = stepEnabled;
+
+    // Not locked - only this task writes systemData.essControl
+    systemData.essControl.powerTmp = output.unclamped > INT16_MAX ? INT16_MAX
+                                   : output.unclamped < INT16_MIN ? INT16_MIN : output.unclamped;
+    systemData.essControl.powerTmp2 = output.setpoint;
+    systemData.essControl.powerDesired = output.setpoint;
+    systemData.essControl.essTarget = output.gridTarget;
+
+    uint32_t endUs = micros();
+
+    portENTER_CRITICAL(&statusLock);
+    status.enabled = stepEnabled;
+    status.setpoint = stepEnabled ? output.setpoint : 0;
+    status.unclamped = output.unclamped;
+    status.gridTarget = output.gridTarget;
+    status.chargeLimit = output.chargeLimit;
+    status.dischargeLimit = output.dischargeLimit;
+    status.limit = output.limit;
+    status.meterPower = sample.power;
+    status.meterAgeMs = sample.sequence != 0 ? nowMs - sample.timeMs : 0;
+    status.iterations++;
+    if (!synced) {
+        status.syncTimeouts++;
+    }
+    portEXIT_CRITICAL(&statusLock);
+
+    if (lastWakeUs != 0) {
+        uint32_t interval = startUs - lastWakeUs;
+        jitter.record(interval > ESS_CONTROL_PERIOD_US ? interval - ESS_CONTROL_PERIOD_US
+                                                       : ESS_CONTROL_PERIOD_US - interval);
+    }
+    execution.record(endUs - startUs);
+
+    lastWakeUs = startUs;
+}
+
+void EssController::sendSetpoint(int16_t setpoint) {
+    bool queued = veBus->sendEssPowerCommand(setpoint);
+
+    portENTER_CRITICAL(&statusLock);
+    if (queued) {
+        status.sentSetpoint = setpoint;
+        status.setpointsSent++;
+    } else {
+        status.setpointsRejected++;
+    }
+    portEXIT_CRITICAL(&statusLock);
+
+    if (queued) {
+        lastSentMs = millis();
+        systemData.multiplus.esspower = setpoint;
+    }
+}
+
+EssControllerStatus EssController::getStatus() {
+    portENTER_CRITICAL(&statusLock);
+    EssControllerStatus copy = status;
+    portEXIT_CRITICAL(&statusLock);
+    return copy;
+}
+
+void EssController::resetStatistics() {
+    portENTER_CRITICAL(&statusLock);
+    status.iterations = 0;
+    status.syncTimeouts = 0;
+    status.setpointsSent = 0;
+    status.setpointsRejected = 0;
+    portEXIT_CRITICAL(&statusLock);
+    jitter.reset();
+    execution.reset();
+}
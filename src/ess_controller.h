@@ -0,0 +1,124 @@
+/*
+ * ESS Controller Task
+ *
+ * Fixed rate control loop for the ESS setpoint. The task is woken by the
+ * VE.Bus task on every Multiplus sync frame (20 ms), so a new setpoint is
+ * queued right at the start of a sync period and goes out in the next
+ * transmit slot. Without sync frames it runs on a timeout of the same period.
+ *
+ * Each iteration reads the latest meter sample, the BMS limits and the
+ * VE.Bus device state, runs essControlStep() and queues the setpoint when
+ * it changed (or as a periodic refresh). The VE.Bus command queue keeps
+ * only the newest setpoint, so a slow bus never builds up a backlog.
+ *
+ * Wake-up jitter and execution time of every iteration are recorded in
+ * histograms, see getJitter() and getExecution().
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ESS_CONTROLLER_H
+#define ESS_CONTROLLER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "ess_control.h"
+#include "perf_histogram.h"
+#include "seqlock.h"
+#include "vebus_handler.h"
+
+#define ESS_CONTROL_TASK_STACK_SIZE 3072
+#define ESS_CONTROL_TASK_PRIORITY 2
+#define ESS_CONTROL_TASK_CORE 1
+#define ESS_CONTROL_PERIOD_US 20000         // One VE.Bus sync period
+#define ESS_CONTROL_SYNC_TIMEOUT_MS 25      // Run without sync frame after this
+#define ESS_CONTROL_REFRESH_MS 1000         // Resend an unchanged setpoint after this
+
+// Latest grid meter reading, written by the meter source
+struct EssMeterSample {
+    int32_t power;          // W, positive = import
+    uint32_t timeMs;        // millis() of the reading
+    uint32_t sequence;      // Incremented per reading
+    bool importOnly;        // Meter without direction, never negative
+};
+
+struct EssControllerStatus {
+    bool enabled;
+    int16_t setpoint;           // Last computed setpoint
+    int16_t sentSetpoint;       // Last setpoint queued on the VE.Bus
+    int32_t unclamped;
+    int32_t gridTarget;
+    int32_t chargeLimit;
+    int32_t dischargeLimit;
+    EssControlLimit limit;
+    int32_t meterPower;
+    uint32_t meterAgeMs;
+    uint32_t iterations;
+    uint32_t syncTimeouts;      // Iterations not triggered by a sync frame
+    uint32_t setpointsSent;
+    uint32_t setpointsRejected; // Command queue did not take the setpoint
+};
+
+class EssController {
+private:
+    VeBusHandler* veBus;
+    TaskHandle_t taskHandle;
+    bool isRunning;
+
+    // Settings, written by the web server and MQTT
+    EssControlParams params;
+    bool enabled;
+    portMUX_TYPE paramsLock = portMUX_INITIALIZER_UNLOCKED;
+
+    SeqLock<EssMeterSample> meter;
+    uint32_t meterSequence;     // Writer side counter
+
+    // Task state
+    uint32_t lastMeterSequence;
+    uint32_t lastWakeUs;
+    uint32_t lastSentMs;
+    bool wasEnabled;
+
+    EssControllerStatus status;
+    portMUX_TYPE statusLock = portMUX_INITIALIZER_UNLOCKED;
+
+    // Recorded by the control task only, in microseconds
+    PerfHistogram jitter;       // |wake interval - period|
+    PerfHistogram execution;    // Time of one iteration
+
+    static void taskWrapper(void* parameter);
+    void controlTask();
+    void iterate(bool synced);
+    void sendSetpoint(int16_t setpoint);
+
+public:
+    EssController();
+    ~EssController();
+
+    bool begin(VeBusHandler* veBusHandler);
+    void end();
+    bool isTaskRunning() const { return isRunning; }
+
+    // Feed-in settings: target feed-in power and inverter limit in watts
+    void configure(bool enable, float targetFeedIn, float maxPower);
+
+    // New grid meter reading. One meter source may call this at a time.
+    // importOnly: the meter cannot see feed-in, feed-in targets are raised to 0.
+    void publishMeterPower(int32_t watts, bool importOnly = false);
+
+    // The last reading still holds: keeps it valid for another
+    // ESS_CONTROL_METER_TIMEOUT_MS without integrating it again
+    void refreshMeterPower();
+
+    EssControllerStatus getStatus();
+    const PerfHistogram& getJitter() const { return jitter; }
+    const PerfHistogram& getExecution() const { return execution; }
+    void resetStatistics();
+};
+
+// Global instance
+extern EssController essController;
+
+#endif // ESS_CONTROLLER_H
@@ -0,0 +1,352 @@
+/*
+ * Event Log Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "event_log.h"
+#include "system_data.h"
+#include "pylontech_can.h"
+#include <esp_system.h>
+#include <time.h>
+
+#define EVENT_LOG_VALID_TIME 1600000000UL   // Clock was set (NTP), not counting from 1970
+
+static const char* const eventNames[] = {
+    "", "boot", "ota_start", "ota_done", "ota_failed", "restart", "log_formatted"
+};
+
+const char* eventCodeName(uint16_t code) {
+    return code < sizeof(eventNames) / sizeof(eventNames[0]) ? eventNames[code] : "unknown";
+}
+
+bool PartitionLogFlash::read(uint32_t address, void* data, size_t length) {
+    return esp_partition_read(partition, address, data, length) == ESP_OK;
+}
+
+bool PartitionLogFlash::write(uint32_t address, const void* data, size_t length) {
+    return esp_partition_write(partition, address, data, length) == ESP_OK;
+}
+
+bool PartitionLogFlash::eraseSector(uint32_t address) {
+    return esp_partition_erase_range(partition, address, getSectorSize()) == ESP_OK;
+}
+
+EventLog::EventLog() {
+    flash = nullptr;
+    log = nullptr;
+    mutex = nullptr;
+    memset(&state, 0, sizeof(state));
+    lastStateSave = 0;
+    oldestPendingEvent = 0;
+}
+
+uint32_t EventLog::now() {
+    return millis() / 1000;
+}
+
+uint32_t EventLog::wallTime() {
+    time_t t = time(nullptr);
+    return t >= (time_t)EVENT_LOG_VALID_TIME ? (uint32_t)t : 0;
+}
+
+bool EventLog::begin() {
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        Serial.println("Event log: failed to create mutex");
+        return false;
+    }
+
+    collectState();
+    state.hour = 0xFF;
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)EVENT_LOG_PARTITION_SUBTYPE, EVENT_LOG_PARTITION_LABEL);
+    if (partition == nullptr) {
+        Serial.println("Event log: no '" EVENT_LOG_PARTITION_LABEL "' partition, counters are not persisted");
+        return false;
+    }
+
+    flash = new PartitionLogFlash(partition);
+    log = new RecordLog(flash);
+    bool formatted = false;
+    if (!log->mount()) {
+        Serial.println("Event log: unreadable, formatting");
+        formatted = log->format();
+        if (!formatted) {
+            Serial.println("Event log: format failed");
+            delete log;
+            delete flash;
+            log = nullptr;
+            flash = nullptr;
+            return false;
+        }
+    }
+
+    restoreState();
+    lastStateSave = now();
+
+    RecordLogStats stats = log->getStats();
+    Serial.printf("Event log: %u records in %u/%u segments, %u torn\n",
+                  stats.records, stats.usedSegments, stats.segments, stats.tornRecords);
+
+    if (formatted) logEvent(EVENT_LOG_FORMATTED);
+    logEvent(EVENT_BOOT, (int32_t)esp_reset_reason());
+    return true;
+}
+
+void EventLog::restoreState() {
+    EventLogState stored;
+    uint16_t length;
+    if (!log->readLatest(EVENT_LOG_RECORD_STATE, &stored, sizeof(stored), length) ||
+        length != sizeof(stored) || stored.version != EVENT_LOG_STATE_VERSION) {
+        return;
+    }
+    state = stored;
+
+    ElectricMeterData& meter = systemData.electricMeter;
+    meter.consumption24h = 0;
+    meter.feedIn24h = 0;
+    for (uint8_t i = 0; i < 24; i++) {
+        meter.hourlyConsumption[i] = state.hourlyConsumption[i];
+        meter.hourlyFeedIn[i] = state.hourlyFeedIn[i];
+        meter.consumption24h += state.hourlyConsumption[i];
+        meter.feedIn24h += state.hourlyFeedIn[i];
+    }
+
+    BatteryData& battery = systemData.battery;
+    battery.socMin = state.socMin;
+    battery.socMax = state.socMax;
+    battery.socMinTime = state.socMinTime;
+    battery.socMaxTime = state.socMaxTime;
+
+    SystemStatusData& status = systemData.systemStatus;
+    status.batteryTempMin = state.batteryTempMin;
+    status.batteryTempMax = state.batteryTempMax;
+    status.batteryCurrentMin = state.batteryCurrentMin;
+    status.batteryCurrentMax = state.batteryCurrentMax;
+    status.batteryPowerMin = state.batteryPowerMin;
+    status.batteryPowerMax = state.batteryPowerMax;
+    status.dcVoltageMin = state.dcVoltageMin;
+    status.dcVoltageMax = state.dcVoltageMax;
+    status.acVoltageMin = state.acVoltageMin;
+    status.acVoltageMax = state.acVoltageMax;
+    status.timeAcVoltageMin = state.timeAcVoltageMin;
+    status.timeAcVoltageMax = state.timeAcVoltageMax;
+    status.acFrequencyMin = state.acFrequencyMin;
+    status.acFrequencyMax = state.acFrequencyMax;
+    status.timeAcFrequencyMin = state.timeAcFrequencyMin;
+    status.timeAcFrequencyMax = state.timeAcFrequencyMax;
+    status.multiplusTempMin = state.multiplusTempMin;
+    status.multiplusTempMax = state.multiplusTempMax;
+}
+
+// systemData -> state, the hourly bookkeeping lives in state only
+void EventLog::collectState() {
+    const BatteryData& battery = systemData.battery;
+    const SystemStatusData& status = systemData.systemStatus;
+
+    state.version = EVENT_LOG_STATE_VERSION;
+    state.socMin = battery.socMin;
+    state.socMax = battery.socMax;
+    state.socMinTime = battery.socMinTime;
+    state.socMaxTime = battery.socMaxTime;
+    state.batteryTempMin = status.batteryTempMin;
+    state.batteryTempMax = status.batteryTempMax;
+    state.batteryCurrentMin = status.batteryCurrentMin;
+    state.batteryCurrentMax = status.batteryCurrentMax;
+    state.batteryPowerMin = status.batteryPowerMin;
+    state.batteryPowerMax = status.batteryPowerMax;
+    state.dcVoltageMin = status.dcVoltageMin;
+    state.dcVoltageMax = status.dcVoltageMax;
+    state.acVoltageMin = status.acVoltageMin;
+    state.acVoltageMax = status.acVoltageMax;
+    state.timeAcVoltageMin = status.timeAcVoltageMin;
+    state.timeAcVoltageMax = status.timeAcVoltageMax;
+    state.acFrequencyMin = status.acFrequencyMin;
+    state.acFrequencyMax = status.acFrequencyMax;
+    state.timeAcFrequencyMin = status.timeAcFrequencyMin;
+    state.timeAcFrequencyMax = status.timeAcFrequencyMax;
+    state.multiplusTempMin = status.multiplusTempMin;
+    state.multiplusTempMax = status.multiplusTempMax;
+}
+
+void EventLog::updateCounters() {
+    uint32_t wall = wallTime();
+    uint32_t stamp = wall != 0 ? wall : now();
+
+    // Hour of the day once the clock is set, hours since boot before
+    uint8_t hour;
+    if (wall != 0) {
+        time_t t = wall;
+        struct tm local;
+        localtime_r(&t, &local);
+        hour = local.tm_hour;
+    } else {
+        hour = (now() / 3600) % 24;
+    }
+    if (state.hour != hour) {
+        // Slots we pass into hold the values of a day ago
+        uint8_t slot = state.hour < 24 ? state.hour : hour;
+        do {
+            slot = (slot + 1) % 24;
+            state.hourlyConsumption[slot] = 0;
+            state.hourlyFeedIn[slot] = 0;
+        } while (slot != hour);
+        state.hour = hour;
+    }
+
+    ElectricMeterData& meter = systemData.electricMeter;
+    if (meter.consumption > 0) {
+        if (state.lastConsumption > 0 && meter.consumption >= state.lastConsumption) {
+            state.hourlyConsumption[hour] += meter.consumption - state.lastConsumption;
+        }
+        state.lastConsumption = meter.consumption;
+    }
+    if (meter.feedIn > 0) {
+        if (state.lastFeedIn > 0 && meter.feedIn >= state.lastFeedIn) {
+            state.hourlyFeedIn[hour] += meter.feedIn - state.lastFeedIn;
+        }
+        state.lastFeedIn = meter.feedIn;
+    }
+    meter.consumption24h = 0;
+    meter.feedIn24h = 0;
+    for (uint8_t i = 0; i < 24; i++) {
+        meter.hourlyConsumption[i] = state.hourlyConsumption[i];
+        meter.hourlyFeedIn[i] = state.hourlyFeedIn[i];
+        meter.consumption24h += state.hourlyConsumption[i];
+        meter.feedIn24h += state.hourlyFeedIn[i];
+    }
+
+    BatteryData& battery = systemData.battery;
+    SystemStatusData& status = systemData.systemStatus;
+    PylontechBatteryState bms = pylontechCAN.getBattery();
+    if (bms.soc >= 0) {
+        if (bms.soc < battery.socMin) { battery.socMin = bms.soc; battery.socMinTime = stamp; }
+        if (bms.soc > battery.socMax) { battery.socMax = bms.soc; battery.socMaxTime = stamp; }
+        status.batteryTempMin = min(status.batteryTempMin, bms.temperature);
+        status.batteryTempMax = max(status.batteryTempMax, bms.temperature);
+        status.batteryCurrentMin = min(status.batteryCurrentMin, bms.current);
+        status.batteryCurrentMax = max(status.batteryCurrentMax, bms.current);
+        status.batteryPowerMin = min(status.batteryPowerMin, (int)bms.power);
+        status.batteryPowerMax = max(status.batteryPowerMax, (int)bms.power);
+    }
+
+    const MultiplusData& multiplus = systemData.multiplus;
+    if (multiplus.dcVoltage > 0) {
+        status.dcVoltageMin = min(status.dcVoltageMin, multiplus.dcVoltage);
+        status.dcVoltageMax = max(status.dcVoltageMax, multiplus.dcVoltage);
+        status.multiplusTempMin = min(status.multiplusTempMin, multiplus.temp);
+        status.multiplusTempMax = max(status.multiplusTempMax, multiplus.temp);
+        if (multiplus.uMainsRMS > 0) {
+            if (multiplus.uMainsRMS < status.acVoltageMin) { status.acVoltageMin = multiplus.uMainsRMS; status.timeAcVoltageMin = stamp; }
+            if (multiplus.uMainsRMS > status.acVoltageMax) { status.acVoltageMax = multiplus.uMainsRMS; status.timeAcVoltageMax = stamp; }
+        }
+        if (multiplus.acFrequency > 0) {
+            if (multiplus.acFrequency < status.acFrequencyMin) { status.acFrequencyMin = multiplus.acFrequency; status.timeAcFrequencyMin = stamp; }
+            if (multiplus.acFrequency > status.acFrequencyMax) { status.acFrequencyMax = multiplus.acFrequency; status.timeAcFrequencyMax = stamp; }
+        }
+    }
+}
+
+bool EventLog::saveStateLocked() {
+    collectState();
+    bool ok = log->append(EVENT_LOG_RECORD_STATE, &state, sizeof(state)) && log->flush();
+    oldestPendingEvent = 0;
+    lastStateSave = now();
+    return ok;
+}
+
+void EventLog::loop() {
+    if (mutex == nullptr) return;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) return;
+    updateCounters();
+    if (log != nullptr) {
+        uint32_t uptime = now();
+        if (uptime - lastStateSave >= EVENT_LOG_STATE_INTERVAL_S) {
+            if (!saveStateLocked()) Serial.println("Event log: writing counters failed");
+        } else if (oldestPendingEvent != 0 && uptime - oldestPendingEvent >= EVENT_LOG_FLUSH_INTERVAL_S) {
+            if (!log->flush()) Serial.println("Event log: flush failed");
+            oldestPendingEvent = 0;
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+void EventLog::logEvent(uint16_t code, int32_t value) {
+    if (log == nullptr || mutex == nullptr) return;
+
+    EventRecord event;
+    event.uptime = now();
+    event.time = wallTime();
+    event.code = code;
+    event.reserved = 0;
+    event.value = value;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (log->append(EVENT_LOG_RECORD_EVENT, &event, sizeof(event))) {
+            if (oldestPendingEvent == 0) oldestPendingEvent = event.uptime > 0 ? event.uptime : 1;
+            // A nearly full buffer goes out now, a flush costs the same for one or many records
+            if (log->getBuffered() > RECORD_LOG_BUFFER_SIZE / 2) {
+                log->flush();
+                oldestPendingEvent = 0;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+}
+
+void EventLog::saveState() {
+    if (log == nullptr || mutex == nullptr) return;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        updateCounters();
+        if (!saveStateLocked()) Serial.println("Event log: writing counters failed");
+        xSemaphoreGive(mutex);
+    }
+}
+
+void EventLog::readEvents(JsonArray events, uint16_t maxCount) {
+    if (log == nullptr || mutex == nullptr) return;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) return;
+
+    // Two passes over the log instead of a buffer for the newest maxCount
+    LogCursor cursor;
+    LogRecordInfo info;
+    EventRecord event;
+    uint32_t total = 0;
+    log->flush();
+    oldestPendingEvent = 0;
+    log->rewind(cursor);
+    while (log->next(cursor, info, &event, sizeof(event))) {
+        if (info.type == EVENT_LOG_RECORD_EVENT && info.length == sizeof(event)) total++;
+    }
+
+    uint32_t skip = total > maxCount ? total - maxCount : 0;
+    log->rewind(cursor);
+    while (log->next(cursor, info, &event, sizeof(event))) {
+        if (info.type != EVENT_LOG_RECORD_EVENT || info.length != sizeof(event)) continue;
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        JsonObject entry = events.add<JsonObject>();
+        entry["uptime"] = event.uptime;
+        if (event.time != 0) entry["time"] = event.time;
+        entry["event"] = eventCodeName(event.code);
+        entry["value"] = event.value;
+    }
+    xSemaphoreGive(mutex);
+}
+
+RecordLogStats EventLog::getStats() {
+    RecordLogStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (log != nullptr && mutex != nullptr && xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        stats = log->getStats();
+        xSemaphoreGive(mutex);
+    }
+    return stats;
+}
@@ -0,0 +1,148 @@
+/*
+ * Event Log
+ *
+ * Keeps the energy counters, the min/max trackers and a log of system
+ * events across reboots and OTA updates. Everything is stored in a
+ * RecordLog (record_log.h) on the "eventlog" flash partition
+ * (partitions.csv); without that partition the counters are still kept
+ * in RAM but nothing is persisted.
+ *
+ * loop() runs once per second from the main loop. It updates the hourly
+ * consumption/feed-in from the meter totals and the min/max trackers,
+ * writes the counter snapshot every EVENT_LOG_STATE_INTERVAL_S and flushes
+ * buffered events at most EVENT_LOG_FLUSH_INTERVAL_S after they were logged.
+ * Before a planned restart call saveState() so nothing is lost.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "record_log.h"
+
+#define EVENT_LOG_PARTITION_LABEL "eventlog"
+#define EVENT_LOG_PARTITION_SUBTYPE 0x40
+#define EVENT_LOG_STATE_INTERVAL_S 900  // Counter snapshot every 15 min
+#define EVENT_LOG_FLUSH_INTERVAL_S 60   // Events reach the flash within a minute
+#define EVENT_LOG_STATE_VERSION 1
+
+// Record types; below RECORD_LOG_KEYS only the latest one is kept
+enum EventLogRecordType : uint8_t {
+    EVENT_LOG_RECORD_STATE = 0,
+    EVENT_LOG_RECORD_EVENT = 16
+};
+
+enum EventCode : uint16_t {
+    EVENT_BOOT = 1,                     // value = esp_reset_reason()
+    EVENT_OTA_START,                    // value = 0 ArduinoOTA, 1 web upload
+    EVENT_OTA_DONE,
+    EVENT_OTA_FAILED,
+    EVENT_RESTART,                      // Planned restart
+    EVENT_LOG_FORMATTED                 // Log was unreadable and has been erased
+};
+
+const char* eventCodeName(uint16_t code);
+
+struct EventRecord {
+    uint32_t uptime;                    // Seconds since boot
+    uint32_t time;                      // Unix time, 0 if the clock was not set
+    uint16_t code;
+    uint16_t reserved;
+    int32_t value;
+};
+
+// Everything that has to survive a reboot, one snapshot record
+struct EventLogState {
+    uint16_t version;
+    uint8_t hour;                       // Slot of hourlyConsumption being filled
+    uint8_t reserved;
+    double lastConsumption;             // Meter totals the hourly values were taken from
+    double lastFeedIn;
+    double hourlyConsumption[24];
+    double hourlyFeedIn[24];
+    int16_t socMin;
+    int16_t socMax;
+    uint32_t socMinTime;
+    uint32_t socMaxTime;
+    float batteryTempMin;
+    float batteryTempMax;
+    float batteryCurrentMin;
+    float batteryCurrentMax;
+    int32_t batteryPowerMin;
+    int32_t batteryPowerMax;
+    float dcVoltageMin;
+    float dcVoltageMax;
+    float acVoltageMin;
+    float acVoltageMax;
+    uint32_t timeAcVoltageMin;
+    uint32_t timeAcVoltageMax;
+    float acFrequencyMin;
+    float acFrequencyMax;
+    uint32_t timeAcFrequencyMin;
+    uint32_t timeAcFrequencyMax;
+    float multiplusTempMin;
+    float multiplusTempMax;
+};
+
+// RecordLog backend on a data partition
+class PartitionLogFlash : public LogFlash {
+private:
+    const esp_partition_t* partition;
+
+public:
+    explicit PartitionLogFlash(const esp_partition_t* part) : partition(part) {}
+
+    uint32_t getSize() const override { return partition->size; }
+    uint32_t getSectorSize() const override { return 4096; }
+    bool read(uint32_t address, void* data, size_t length) override;
+    bool write(uint32_t address, const void* data, size_t length) override;
+    bool eraseSector(uint32_t address) override;
+};
+
+class EventLog {
+private:
+    PartitionLogFlash* flash;
+    RecordLog* log;
+    SemaphoreHandle_t mutex;
+    EventLogState state;
+    uint32_t lastStateSave;             // Uptime seconds
+    uint32_t oldestPendingEvent;        // Uptime of the oldest unflushed event, 0 = none
+
+    static uint32_t now();
+    static uint32_t wallTime();
+    void restoreState();
+    void collectState();
+    void updateCounters();
+    bool saveStateLocked();
+
+public:
+    EventLog();
+
+    // Mounts the log, restores the counters into systemData and logs the boot
+    bool begin();
+    bool isPersistent() const { return log != nullptr; }
+
+    // From loop(), once per second
+    void loop();
+
+    // Any task; buffered until the next flush
+    void logEvent(uint16_t code, int32_t value = 0);
+
+    // Snapshot and flush now, before a restart
+    void saveState();
+
+    // Newest events, oldest first
+    void readEvents(JsonArray events, uint16_t maxCount);
+    RecordLogStats getStats();
+};
+
+extern EventLog eventLog;
+
+#endif // EVENT_LOG_H
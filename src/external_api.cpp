@@ -1,7 +1,8 @@
 #include "external_api.h"
+#include <memory>
 
-ExternalAPI::ExternalAPI(AsyncWebServer* webServer, VeBusHandler* veBus) 
-    : server(webServer), veBusHandler(veBus) {
+ExternalAPI::ExternalAPI(AsyncWebServer* webServer, VeBusHandler* veBus, EssController* ess, HistoryRecorder* history, EventLog* events) 
+    : server(webServer), veBusHandler(veBus), essController(ess), historyRecorder(history), eventLog(events) {
 }
 
 void ExternalAPI::setup() {
@@ -14,61 +15,113 @@ void ExternalAPI::setup() {
     
     // General status endpoint (simplified for testing without hardware)
     server->on("/api/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetGeneralStatus(request);
     });
     
     // Status and information endpoints
     server->on("/api/vebus/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetStatus(request);
     });
     
     server->on("/api/vebus/version", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetVersion(request);
     });
     
     server->on("/api/vebus/errors", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetErrors(request);
     });
     
     server->on("/api/vebus/warnings", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetWarnings(request);
     });
     
     server->on("/api/vebus/statistics", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleGetStatistics(request);
     });
     
+    server->on("/api/ess/control", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleGetEssControl(request);
+    });
+    
+    server->on("/api/history", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleGetHistory(request);
+    });
+    
+    server->on("/api/events", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleGetEvents(request);
+    });
+    
+    server->on("/api/can/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleGetCanStatus(request);
+    });
+    
+    server->on("/api/log", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleGetLogStats(request);
+    });
+    
+    server->on("/api/log/level", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
+        handleSetLogLevel(request);
+    });
+    
+    server->on("/api/perf", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        handleGetPerf(request);
+    });
+    
+    server->on("/api/perf/reset", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        handleResetPerf(request);
+    });
+    
     // Control endpoints
     server->on("/api/vebus/switch", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetSwitch(request);
     });
     
     server->on("/api/vebus/power", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetPower(request);
     });
     
     server->on("/api/vebus/current", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetCurrent(request);
     });
     
     server->on("/api/vebus/reset", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleReset(request);
     });
     
     server->on("/api/vebus/clear-errors", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleClearErrors(request);
     });
     
     // Configuration endpoints
     server->on("/api/vebus/config/auto-restart", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetAutoRestart(request);
     });
     
     server->on("/api/vebus/config/voltage-range", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetVoltageRange(request);
     });
     
     server->on("/api/vebus/config/frequency-range", HTTP_POST, [this](AsyncWebServerRequest* request) {
+        PerfScope perf(PERF_API_REQUEST);
         handleSetFrequencyRange(request);
     });
     
@@ -98,6 +151,17 @@ bool ExternalAPI::validateJsonRequest(AsyncWebServerRequest* request, JsonDocume
     return error == DeserializationError::Ok;
 }
 
+void ExternalAPI::refreshIfStale(uint8_t command, uint32_t receivedAt) {
+    if (receivedAt != 0 && millis() - receivedAt < API_INFO_MAX_AGE_MS) {
+        return;
+    }
+    if (veBusHandler->isRequestPending(command)) {
+        return;  // Already on its way, e.g. requested by another client
+    }
+    const uint8_t data[] = { 0x00 };
+    veBusHandler->submitRequest(command, data, sizeof(data));
+}
+
 void ExternalAPI::handleGetGeneralStatus(AsyncWebServerRequest* request) {
     JsonDocument doc;
     
@@ -178,22 +242,17 @@ void ExternalAPI::handleGetStatus(AsyncWebServerRequest* request) {
         doc["switch_state"] = deviceState.switchState;
         doc["device_status"] = deviceState.switchState;
         
-        Serial.println("[API] Attempting to get detailed device status");
-        
-        // Get detailed device status - with error handling
-        VeBusDeviceStatusInfo status;
-        if (veBusHandler->requestDeviceStatus(status)) {
-            Serial.println("[API] Device status request successful");
-            doc["device_state"] = status.state;
-            doc["device_mode"] = status.mode;
-            doc["device_alarm"] = status.alarm;
-            doc["device_warnings"] = status.warnings;
+        // Detailed device status from the last response, refreshed in the background
+        refreshIfStale(VEBUS_CMD_GET_DEVICE_STATUS, deviceState.statusTime);
+        const VeBusDeviceStatusInfo& status = deviceState.statusInfo;
+        doc["device_state"] = status.state;
+        doc["device_mode"] = status.mode;
+        doc["device_alarm"] = status.alarm;
+        doc["device_warnings"] = status.warnings;
+        if (deviceState.statusTime != 0) {
+            doc["device_status_age_ms"] = millis() - deviceState.statusTime;
         } else {
-            Serial.println("[API] Device status request failed - using defaults");
-            doc["device_state"] = 0;
-            doc["device_mode"] = 0;
-            doc["device_alarm"] = 0;
-            doc["device_warnings"] = 0;
+            doc["device_status_age_ms"] = nullptr;
         }
         
         doc["api_version"] = "MK2-Extended-1.0";
@@ -217,20 +276,25 @@ void ExternalAPI::handleGetVersion(AsyncWebServerRequest* request) {
         return;
     }
     
-    VeBusVersionInfo versionInfo;
-    if (veBusHandler->requestVersionInfo(versionInfo)) {
+    VeBusDeviceState deviceState = veBusHandler->getDeviceState();
+    refreshIfStale(VEBUS_CMD_GET_VERSION, deviceState.versionTime);
+    
+    if (deviceState.versionTime != 0) {
+        const VeBusVersionInfo& versionInfo = deviceState.versionInfo;
         doc["product_id"] = versionInfo.productId;
         doc["firmware_version"] = versionInfo.firmwareVersion;
         doc["protocol_version"] = versionInfo.protocolVersion;
         doc["api_version"] = "MK2-Extended-1.0";
+        doc["age_ms"] = millis() - deviceState.versionTime;
         doc["success"] = true;
     } else {
         doc["success"] = false;
-        doc["error"] = "Failed to retrieve version information";
+        doc["pending"] = true;
+        doc["error"] = "Version information requested, retry later";
     }
     
     doc["timestamp"] = millis();
-    sendJsonResponse(request, doc);
+    sendJsonResponse(request, doc, deviceState.versionTime != 0 ? 200 : 202);
 }
 
 void ExternalAPI::handleSetSwitch(AsyncWebServerRequest* request) {
@@ -358,20 +422,25 @@ void ExternalAPI::handleGetErrors(AsyncWebServerRequest* request) {
         return;
     }
     
-    VeBusErrorInfo errorInfo;
-    if (veBusHandler->requestErrorInfo(errorInfo)) {
+    VeBusDeviceState deviceState = veBusHandler->getDeviceState();
+    refreshIfStale(VEBUS_CMD_GET_ERROR_INFO, deviceState.errorTime);
+    
+    if (deviceState.errorTime != 0) {
+        const VeBusErrorInfo& errorInfo = deviceState.errorInfo;
         doc["error_code"] = errorInfo.errorCode;
         doc["error_sub_code"] = errorInfo.errorSubCode;
         doc["error_counter"] = errorInfo.errorCounter;
         doc["timestamp"] = errorInfo.timestamp;
+        doc["age_ms"] = millis() - deviceState.errorTime;
         doc["success"] = true;
     } else {
         doc["success"] = false;
-        doc["error"] = "Failed to retrieve error information";
+        doc["pending"] = true;
+        doc["error"] = "Error information requested, retry later";
     }
     
     doc["request_timestamp"] = millis();
-    sendJsonResponse(request, doc);
+    sendJsonResponse(request, doc, deviceState.errorTime != 0 ? 200 : 202);
 }
 
 void ExternalAPI::handleGetWarnings(AsyncWebServerRequest* request) {
@@ -382,21 +451,26 @@ void ExternalAPI::handleGetWarnings(AsyncWebServerRequest* request) {
         return;
     }
     
-    VeBusWarningInfo warningInfo;
-    if (veBusHandler->requestWarningInfo(warningInfo)) {
+    VeBusDeviceState deviceState = veBusHandler->getDeviceState();
+    refreshIfStale(VEBUS_CMD_GET_WARNING_INFO, deviceState.warningTime);
+    
+    if (deviceState.warningTime != 0) {
+        const VeBusWarningInfo& warningInfo = deviceState.warningInfo;
         doc["warning_flags"] = warningInfo.warningFlags;
         doc["battery_voltage_warning"] = warningInfo.batteryVoltageWarning;
         doc["temperature_warning"] = warningInfo.temperatureWarning;
         doc["overload_warning"] = warningInfo.overloadWarning;
         doc["dc_ripple_warning"] = warningInfo.dcRippleWarning;
+        doc["age_ms"] = millis() - deviceState.warningTime;
         doc["success"] = true;
     } else {
         doc["success"] = false;
-        doc["error"] = "Failed to retrieve warning information";
+        doc["pending"] = true;
+        doc["error"] = "Warning information requested, retry later";
     }
     
     doc["timestamp"] = millis();
-    sendJsonResponse(request, doc);
+    sendJsonResponse(request, doc, deviceState.warningTime != 0 ? 200 : 202);
 }
 
 void ExternalAPI::handleSetAutoRestart(AsyncWebServerRequest* request) {
@@ -515,6 +589,16 @@ void ExternalAPI::handleGetStatistics(AsyncWebServerRequest* request) {
     doc["checksum_errors"] = stats.checksumErrors;
     doc["timeout_errors"] = stats.timeoutErrors;
     doc["retransmissions"] = stats.retransmissions;
+    doc["sync_frames"] = stats.syncFrames;
+    doc["slots_missed"] = stats.slotsMissed;
+    doc["last_tx_offset_us"] = stats.lastTxOffsetUs;
+    doc["max_tx_offset_us"] = stats.maxTxOffsetUs;
+    doc["tx_slot_window_us"] = veBusHandler->getTxSlotWindow();
+    doc["commands_coalesced"] = stats.commandsCoalesced;
+    doc["commands_dropped"] = stats.commandsDropped;
+    doc["setpoint_latency_us"] = stats.setpointLatencyUs;
+    doc["max_setpoint_latency_us"] = stats.maxSetpointLatencyUs;
+    doc["setpoints_acknowledged"] = stats.setpointsAcknowledged;
     doc["last_reset_time"] = stats.lastResetTime;
     doc["communication_quality"] = veBusHandler->getCommunicationQuality();
     doc["device_online"] = veBusHandler->isDeviceOnline();
@@ -524,6 +608,246 @@ void ExternalAPI::handleGetStatistics(AsyncWebServerRequest* request) {
     sendJsonResponse(request, doc);
 }
 
+void ExternalAPI::handleGetEssControl(AsyncWebServerRequest* request) {
+    JsonDocument doc;
+    
+    if (essController == nullptr || !essController->isTaskRunning()) {
+        sendErrorResponse(request, "ESS control loop not running", 503);
+        return;
+    }
+    
+    EssControllerStatus status = essController->getStatus();
+    
+    doc["enabled"] = status.enabled;
+    doc["setpoint"] = status.setpoint;
+    doc["sent_setpoint"] = status.sentSetpoint;
+    doc["unclamped"] = status.unclamped;
+    doc["grid_target"] = status.gridTarget;
+    doc["charge_limit"] = status.chargeLimit;
+    doc["discharge_limit"] = status.dischargeLimit;
+    doc["limited_by"] = essControlLimitName(status.limit);
+    doc["meter_power"] = status.meterPower;
+    doc["meter_age_ms"] = status.meterAgeMs;
+    doc["iterations"] = status.iterations;
+    doc["sync_timeouts"] = status.syncTimeouts;
+    doc["setpoints_sent"] = status.setpointsSent;
+    doc["setpoints_rejected"] = status.setpointsRejected;
+    doc["period_us"] = ESS_CONTROL_PERIOD_US;
+    
+    const char* const histogramNames[] = {"jitter", "execution"};
+    const PerfHistogram* const histograms[] = {&essController->getJitter(), &essController->getExecution()};
+    for (uint8_t i = 0; i < 2; i++) {
+        JsonObject target = doc[histogramNames[i]].to<JsonObject>();
+        target["count"] = histograms[i]->getCount();
+        target["min_us"] = histograms[i]->getMin();
+        target["mean_us"] = histograms[i]->getMean();
+        target["p50_us"] = histograms[i]->percentile(50);
+        target["p99_us"] = histograms[i]->percentile(99);
+        target["max_us"] = histograms[i]->getMax();
+    }
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
+void ExternalAPI::handleGetHistory(AsyncWebServerRequest* request) {
+    if (historyRecorder == nullptr) {
+        sendErrorResponse(request, "History not available", 503);
+        return;
+    }
+    if (!request->hasParam("signal")) {
+        sendErrorResponse(request, "Missing signal parameter");
+        return;
+    }
+    int signal = historySignalFromName(request->getParam("signal")->value().c_str());
+    if (signal < 0) {
+        sendErrorResponse(request, "Unknown signal");
+        return;
+    }
+    
+    // Seconds since boot, negative values count back from now; default is the last hour
+    uint32_t now = HistoryRecorder::now();
+    long from = request->hasParam("from") ? request->getParam("from")->value().toInt() : -3600;
+    uint32_t fromTime;
+    if (from >= 0) {
+        fromTime = (uint32_t)from;
+    } else {
+        fromTime = (uint32_t)-from >= now ? 0 : now - (uint32_t)-from;
+    }
+    
+    int tier = -1;
+    if (request->hasParam("tier")) {
+        String name = request->getParam("tier")->value();
+        if (name == "1s") tier = HISTORY_TIER_SECOND;
+        else if (name == "1m") tier = HISTORY_TIER_MINUTE;
+        else if (name == "15m") tier = HISTORY_TIER_QUARTER;
+        else {
+            sendErrorResponse(request, "Invalid tier (1s, 1m or 15m)");
+            return;
+        }
+    } else {
+        tier = historyRecorder->tierFor(signal, fromTime);
+    }
+    
+    // The result is written chunk by chunk straight from the store, never as a whole
+    std::shared_ptr<HistoryQuery> query = std::make_shared<HistoryQuery>();
+    historyRecorder->beginQuery(*query, signal, tier, fromTime);
+    HistoryRecorder* recorder = historyRecorder;
+    AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+        [recorder, query](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+            return recorder->readJson(*query, (char*)buffer, maxLen);
+        });
+    request->send(response);
+}
+
+void ExternalAPI::handleGetEvents(AsyncWebServerRequest* request) {
+    if (eventLog == nullptr || !eventLog->isPersistent()) {
+        sendErrorResponse(request, "Event log not available", 503);
+        return;
+    }
+    
+    long count = request->hasParam("count") ? request->getParam("count")->value().toInt() : 50;
+    if (count < 1 || count > API_EVENTS_MAX_COUNT) {
+        sendErrorResponse(request, "Invalid count. Valid values: 1-200", 400);
+        return;
+    }
+    
+    JsonDocument doc;
+    eventLog->readEvents(doc["events"].to<JsonArray>(), (uint16_t)count);
+    
+    RecordLogStats stats = eventLog->getStats();
+    JsonObject log = doc["log"].to<JsonObject>();
+    log["segments"] = stats.segments;
+    log["used_segments"] = stats.usedSegments;
+    log["records"] = stats.records;
+    log["erases"] = stats.erases;
+    log["torn_records"] = stats.tornRecords;
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
+void ExternalAPI::handleGetCanStatus(AsyncWebServerRequest* request) {
+    if (!pylontechCAN.isTaskRunning()) {
+        sendErrorResponse(request, "CAN task not running", 503);
+        return;
+    }
+    
+    static const char* const stateNames[] = { "stopped", "running", "bus_off", "recovering" };
+    PylontechCanStats stats = pylontechCAN.getStats();
+    
+    JsonDocument doc;
+    doc["online"] = pylontechCAN.isBatteryOnline();
+    doc["state"] = (unsigned)stats.state < 4 ? stateNames[stats.state] : "unknown";
+    doc["frames"] = stats.framesReceived;
+    doc["decoded"] = stats.decoder.decoded;
+    doc["ignored"] = stats.decoder.ignored;
+    doc["too_short"] = stats.decoder.tooShort;
+    doc["cycles"] = stats.cycles;
+    
+    // Age of the newest frame of each kind in the published snapshot, null if never received
+    static const char* const frameNames[PYLONTECH_FRAME_COUNT] = {
+        "limits", "soc", "measurements", "alarms", "request", "manufacturer"
+    };
+    PylontechBatteryState battery = pylontechCAN.getBattery();
+    uint32_t now = millis();
+    JsonObject ages = doc["age_ms"].to<JsonObject>();
+    for (uint8_t i = 0; i < PYLONTECH_FRAME_COUNT; i++) {
+        uint32_t age = battery.age((PylontechFrame)i, now);
+        if (age == UINT32_MAX) {
+            ages[frameNames[i]] = nullptr;
+        } else {
+            ages[frameNames[i]] = age;
+        }
+    }
+    doc["bus_off"] = stats.busOff;
+    doc["error_passive"] = stats.errorPassive;
+    doc["rx_queue_full"] = stats.rxQueueFull;
+    doc["rx_missed"] = stats.rxMissed;
+    doc["rx_overruns"] = stats.rxOverruns;
+    doc["arbitration_lost"] = stats.arbitrationLost;
+    doc["bus_errors"] = stats.busErrors;
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
+void ExternalAPI::handleGetLogStats(AsyncWebServerRequest* request) {
+    static const char* const sinkNames[LOG_SINK_COUNT] = { "serial", "websocket", "mqtt" };
+    DebugLogStats stats = debugLog.getStats();
+    
+    JsonDocument doc;
+    doc["pushed"] = stats.ring.pushed;
+    doc["dropped"] = stats.ring.dropped;
+    doc["ring_size"] = LOG_RING_SIZE;
+    for (uint8_t i = 0; i < LOG_SINK_COUNT; i++) {
+        JsonObject sink = doc["sinks"][sinkNames[i]].to<JsonObject>();
+        sink["sent"] = stats.sinks[i].sent;
+        sink["limited"] = stats.sinks[i].limited;
+    }
+    doc["build_level"] = LOG_BUILD_LEVEL < LOG_LEVEL_COUNT ? logLevelName(LOG_BUILD_LEVEL) : "off";
+    for (uint8_t i = 0; i < LOG_MODULE_COUNT; i++) {
+        uint8_t level = debugLog.getModuleLevel((LogModule)i);
+        doc["levels"][logModuleName(i)] = level < LOG_LEVEL_COUNT ? logLevelName(level) : "off";
+    }
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
+void ExternalAPI::handleSetLogLevel(AsyncWebServerRequest* request) {
+    JsonDocument requestDoc;
+    
+    if (!validateJsonRequest(request, requestDoc)) {
+        sendErrorResponse(request, "Invalid JSON in request body", 400);
+        return;
+    }
+    
+    int module = logModuleFromName(requestDoc["module"] | "");
+    if (module < 0) {
+        sendErrorResponse(request, "Invalid module. Valid values: system, vebus, can, ess, mqtt, web", 400);
+        return;
+    }
+    
+    const char* levelName = requestDoc["level"] | "";
+    int level = strcasecmp(levelName, "off") == 0 ? LOG_LEVEL_COUNT : logLevelFromName(levelName);
+    if (level < 0) {
+        sendErrorResponse(request, "Invalid level. Valid values: debug, info, success, warning, error, off", 400);
+        return;
+    }
+    
+    debugLog.setModuleLevel((LogModule)module, (uint8_t)level);
+    
+    JsonDocument responseDoc;
+    responseDoc["success"] = true;
+    responseDoc["module"] = logModuleName(module);
+    responseDoc["level"] = level < LOG_LEVEL_COUNT ? logLevelName(level) : "off";
+    // Sites below the build level are not in the firmware, they stay silent
+    responseDoc["build_level"] = LOG_BUILD_LEVEL < LOG_LEVEL_COUNT ? logLevelName(LOG_BUILD_LEVEL) : "off";
+    responseDoc["timestamp"] = millis();
+    
+    sendJsonResponse(request, responseDoc);
+}
+
+// Not timed itself, reading the statistics would show up in them
+void ExternalAPI::handleGetPerf(AsyncWebServerRequest* request) {
+    JsonDocument doc;
+    perfMonitor.toJson(doc.to<JsonObject>());
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
+void ExternalAPI::handleResetPerf(AsyncWebServerRequest* request) {
+    perfMonitor.reset();
+    
+    JsonDocument doc;
+    doc["success"] = true;
+    doc["timestamp"] = millis();
+    
+    sendJsonResponse(request, doc);
+}
+
 // Global instance - will be initialized in main.cpp
 // ExternalAPI externalAPI(&server, &veBusHandler);
 
@@ -6,7 +6,13 @@
 #include <ESPAsyncWebServer.h>
 #include <WiFi.h>
 #include "vebus_handler.h"
+#include "ess_controller.h"
 #include "system_data.h"
+#include "history_recorder.h"
+#include "event_log.h"
+#include "pylontech_can.h"
+#include "debug_log.h"
+#include "perf_monitor.h"
 
 /**
  * External API for Multiplus Control via HTTP REST endpoints
@@ -27,20 +33,41 @@
  * POST /api/vebus/config/auto-restart - Enable/disable auto restart
  * POST /api/vebus/config/voltage-range - Set voltage range limits
  * POST /api/vebus/config/frequency-range - Set frequency range limits
+ * GET /api/ess/control - ESS control loop state, jitter and execution time
+ * GET /api/history?signal=meter_power&from=-3600&tier=1m - Recorded history,
+ *     from in seconds since boot or negative relative to now, tier optional
+ * GET /api/events?count=50 - Newest entries of the persistent event log
+ * GET /api/can/status - BMS CAN frame and bus error counters
+ * GET /api/log - Debug log ring and sink counters, runtime level per module
+ * POST /api/log/level - {"module":"vebus","level":"debug"}; level "off" mutes a module
+ * GET /api/perf - Hot path timing per site and FreeRTOS task statistics
+ * POST /api/perf/reset - Restart the hot path timing
+ *
+ * The GET endpoints answer from the last received responses and only
+ * trigger a new request on the bus when that data is older than
+ * API_INFO_MAX_AGE_MS. They never wait for the device, so the async web
+ * server is not stalled; without any data yet they answer 202 (pending).
  */
 
+#define API_INFO_MAX_AGE_MS 5000
+#define API_EVENTS_MAX_COUNT 200
+
 class ExternalAPI {
 private:
     AsyncWebServer* server;
     VeBusHandler* veBusHandler;
+    EssController* essController;
+    HistoryRecorder* historyRecorder;
+    EventLog* eventLog;
     
     // Helper methods
     void sendJsonResponse(AsyncWebServerRequest* request, const JsonDocument& doc, int statusCode = 200);
     void sendErrorResponse(AsyncWebServerRequest* request, const char* message, int statusCode = 400);
     bool validateJsonRequest(AsyncWebServerRequest* request, JsonDocument& doc);
+    void refreshIfStale(uint8_t command, uint32_t receivedAt);
     
 public:
-    ExternalAPI(AsyncWebServer* webServer, VeBusHandler* veBus);
+    ExternalAPI(AsyncWebServer* webServer, VeBusHandler* veBus, EssController* ess, HistoryRecorder* history, EventLog* events);
     void setup();
     
     // API endpoint handlers
@@ -58,6 +85,14 @@ public:
     void handleSetVoltageRange(AsyncWebServerRequest* request);
     void handleSetFrequencyRange(AsyncWebServerRequest* request);
     void handleGetStatistics(AsyncWebServerRequest* request);
+    void handleGetEssControl(AsyncWebServerRequest* request);
+    void handleGetHistory(AsyncWebServerRequest* request);
+    void handleGetEvents(AsyncWebServerRequest* request);
+    void handleGetCanStatus(AsyncWebServerRequest* request);
+    void handleGetLogStats(AsyncWebServerRequest* request);
+    void handleSetLogLevel(AsyncWebServerRequest* request);
+    void handleGetPerf(AsyncWebServerRequest* request);
+    void handleResetPerf(AsyncWebServerRequest* request);
 };
 
 // Global instance declaration
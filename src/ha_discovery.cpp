@@ -0,0 +1,131 @@
+/*
+ * Home Assistant MQTT Discovery Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "ha_discovery.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// Appends to buffer at offset; false (offset unchanged) if it does not fit
+static bool appendf(char* buffer, size_t size, size_t& offset, const char* format, ...) {
+    if (offset >= size) return false;
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(&buffer[offset], size - offset, format, args);
+    va_end(args);
+    if (written < 0 || offset + written >= size) {
+        buffer[offset] = '\0';
+        return false;
+    }
+    offset += written;
+    return true;
+}
+
+const TelemetryField* HaDiscovery::copyFields(TelemetryField* out, const HaEntity* table, uint8_t count) {
+    for (uint8_t i = 0; i < count && i < TELEMETRY_MAX_FIELDS; i++) {
+        out[i].key = table[i].key;
+        out[i].type = table[i].type;
+        out[i].decimals = table[i].decimals;
+        out[i].deadband = table[i].deadband;
+    }
+    return out;
+}
+
+HaDiscovery::HaDiscovery(const HaEntity* entityTable, uint8_t count, const char* base,
+                         const char* const* groups, uint8_t groupTotal)
+    : entities(entityTable),
+      entityCount(count > TELEMETRY_MAX_FIELDS ? TELEMETRY_MAX_FIELDS : count),
+      baseTopic(base),
+      groupNames(groups),
+      groupCount(groupTotal > HA_MAX_GROUPS ? HA_MAX_GROUPS : groupTotal),
+      values(copyFields(fields, entityTable, entityCount), entityCount) {
+    memset(groupMasks, 0, sizeof(groupMasks));
+    memset(lastSent, 0, sizeof(lastSent));
+    for (uint8_t i = 0; i < entityCount; i++) {
+        if (entities[i].group < groupCount) {
+            groupMasks[entities[i].group] |= 1ULL << i;
+        }
+    }
+    pending = 0;
+    sentGroups = 0;
+}
+
+size_t HaDiscovery::serializeConfig(const HaDevice& device, uint8_t index, char* topic, size_t topicSize,
+                                    char* payload, size_t payloadSize) const {
+    if (index >= entityCount || payloadSize == 0) return 0;
+    const HaEntity& entity = entities[index];
+    const char* group = entity.group < groupCount ? groupNames[entity.group] : "";
+
+    size_t length = 0;
+    if (!appendf(topic, topicSize, length, HA_DISCOVERY_PREFIX "/%s/%s/%s_%s/config",
+                 entity.component, device.nodeId, group, entity.key)) {
+        return 0;
+    }
+
+    bool binary = strcmp(entity.component, "binary_sensor") == 0;
+    size_t offset = 0;
+    bool ok = appendf(payload, payloadSize, offset,
+                      "{\"name\":\"%s\",\"uniq_id\":\"%s_%s_%s\",\"stat_t\":\"%s/%s/state\",",
+                      entity.name, device.nodeId, group, entity.key, baseTopic, group);
+    if (binary) {
+        ok = ok && appendf(payload, payloadSize, offset,
+                           "\"val_tpl\":\"{{ 'ON' if value_json.%s else 'OFF' }}\"", entity.key);
+    } else {
+        ok = ok && appendf(payload, payloadSize, offset, "\"val_tpl\":\"{{ value_json.%s }}\"", entity.key);
+    }
+    if (entity.unit != nullptr) {
+        ok = ok && appendf(payload, payloadSize, offset, ",\"unit_of_meas\":\"%s\"", entity.unit);
+    }
+    if (entity.deviceClass != nullptr) {
+        ok = ok && appendf(payload, payloadSize, offset, ",\"dev_cla\":\"%s\"", entity.deviceClass);
+    }
+    if (entity.stateClass != nullptr) {
+        ok = ok && appendf(payload, payloadSize, offset, ",\"stat_cla\":\"%s\"", entity.stateClass);
+    }
+    if (device.availabilityTopic != nullptr) {
+        ok = ok && appendf(payload, payloadSize, offset, ",\"avty_t\":\"%s\"", device.availabilityTopic);
+    }
+    ok = ok && appendf(payload, payloadSize, offset,
+                       ",\"dev\":{\"ids\":[\"%s\"],\"name\":\"%s\",\"mf\":\"Victron Energy\",\"mdl\":\"%s\",\"sw\":\"%s\"}}",
+                       device.nodeId, device.name, device.model, device.swVersion);
+    return ok ? offset : 0;
+}
+
+uint8_t HaDiscovery::takeDueGroups(uint32_t nowMs) {
+    pending |= values.takeChanges();
+
+    uint8_t due = 0;
+    for (uint8_t g = 0; g < groupCount; g++) {
+        uint32_t age = nowMs - lastSent[g];
+        bool changed = (pending & groupMasks[g]) != 0;
+        if (!(sentGroups & (1u << g)) || (changed && age >= HA_MIN_INTERVAL_MS) || age >= HA_HEARTBEAT_MS) {
+            due |= 1u << g;
+            lastSent[g] = nowMs;
+            pending &= ~groupMasks[g];
+        }
+    }
+    sentGroups |= due;
+    return due;
+}
+
+size_t HaDiscovery::serializeState(uint8_t group, char* topic, size_t topicSize,
+                                   char* payload, size_t payloadSize) const {
+    if (group >= groupCount) return 0;
+
+    size_t length = 0;
+    if (!appendf(topic, topicSize, length, "%s/%s/state", baseTopic, groupNames[group])) {
+        return 0;
+    }
+
+    uint64_t mask = groupMasks[group];
+    size_t written = values.serializeJson(payload, payloadSize, mask);
+    return mask == 0 ? written : 0;     // Bits left over did not fit
+}
+
+void HaDiscovery::invalidate() {
+    sentGroups = 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Home Assistant MQTT Discovery
+ *
+ * Describes the sensors once to Home Assistant and publishes their values as
+ * one JSON state message per group instead of one topic per value.
+ *
+ * Discovery: for every entity a retained config message on
+ *   homeassistant/<component>/<node id>/<group>_<key>/config
+ * with the state topic and a value_template that picks the key out of the
+ * group's state JSON. Home Assistant keeps the retained configs, they are
+ * only sent again after a reconnect.
+ *
+ * State: <base>/<group>/state, e.g. ess/battery/state
+ *   {"soc":57,"voltage":52.31,"current":-12.4,"power":-648,...}
+ * A group is sent when one of its values changed beyond the dead band, at
+ * most every HA_MIN_INTERVAL_MS, and otherwise every HA_HEARTBEAT_MS.
+ *
+ * The entity table is given by the caller (static const HaEntity[]), values
+ * are set by index like in TelemetryPublisher, which does the change
+ * detection. Serialization goes into caller supplied buffers.
+ *
+ * No hardware dependencies, can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HA_DISCOVERY_H
+#define HA_DISCOVERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry_publisher.h"
+
+#define HA_DISCOVERY_PREFIX "homeassistant"
+#define HA_MAX_GROUPS 8
+#define HA_MIN_INTERVAL_MS 5000         // Changed groups are sent at most this often
+#define HA_HEARTBEAT_MS 300000          // Unchanged groups are sent again after this
+#define HA_TOPIC_SIZE 96
+#define HA_CONFIG_SIZE 512              // Longest config message is about 420 B
+
+struct HaEntity {
+    const char* key;                    // Key in the state JSON
+    TelemetryType type;
+    uint8_t decimals;
+    float deadband;                     // Float changes below this do not trigger a send
+    uint8_t group;                      // Index into the group names
+    const char* component;              // "sensor" or "binary_sensor"
+    const char* name;
+    const char* unit;                   // nullptr for none, same for the classes
+    const char* deviceClass;
+    const char* stateClass;
+};
+
+struct HaDevice {
+    const char* nodeId;                 // Unique per device, e.g. victron_ess_a1b2c3
+    const char* name;
+    const char* model;
+    const char* swVersion;
+    const char* availabilityTopic;      // "online"/"offline", nullptr for none
+};
+
+class HaDiscovery {
+private:
+    const HaEntity* entities;
+    uint8_t entityCount;
+    const char* baseTopic;
+    const char* const* groupNames;
+    uint8_t groupCount;
+
+    // TelemetryPublisher needs a plain field table; filled before it is constructed
+    TelemetryField fields[TELEMETRY_MAX_FIELDS];
+    TelemetryPublisher values;
+
+    uint64_t groupMasks[HA_MAX_GROUPS];
+    uint64_t pending;                   // Changed fields not sent yet
+    uint32_t lastSent[HA_MAX_GROUPS];
+    uint8_t sentGroups;                 // Groups sent since the last invalidate()
+
+    static const TelemetryField* copyFields(TelemetryField* out, const HaEntity* table, uint8_t count);
+
+public:
+    HaDiscovery(const HaEntity* entityTable, uint8_t count, const char* base,
+                const char* const* groups, uint8_t groupTotal);
+
+    void setInt(uint8_t index, int32_t value) { values.setInt(index, value); }
+    void setFloat(uint8_t index, float value) { values.setFloat(index, value); }
+    void setBool(uint8_t index, bool value) { values.setBool(index, value); }
+    void setText(uint8_t index, const char* value) { values.setText(index, value); }
+
+    uint8_t getEntityCount() const { return entityCount; }
+    uint8_t getGroupCount() const { return groupCount; }
+
+    // Config message of one entity. Returns the payload length, 0 if it does not fit.
+    size_t serializeConfig(const HaDevice& device, uint8_t index, char* topic, size_t topicSize,
+                           char* payload, size_t payloadSize) const;
+
+    // Mask of the groups to send now; they count as sent
+    uint8_t takeDueGroups(uint32_t nowMs);
+
+    // Full state of a group. Returns the payload length, 0 if it does not fit.
+    size_t serializeState(uint8_t group, char* topic, size_t topicSize,
+                          char* payload, size_t payloadSize) const;
+
+    // All groups are due again, e.g. after a reconnect
+    void invalidate();
+};
+
+#endif // HA_DISCOVERY_H
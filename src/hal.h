@@ -0,0 +1,159 @@
+/*
+ * Hardware Abstraction Layer
+ *
+ * The few platform services the protocol code needs, so that it builds for
+ * the ESP32 (Arduino/FreeRTOS) and as a Linux library (PlatformIO env
+ * native) from the same source:
+ *
+ *   clock      halMillis(), halMicros(), halDelayMs()
+ *   cycles     halCycleCount(), halCpuMhz() for PerfMonitor
+ *   tasks      halTaskCreate(), halTaskDelete(), notifications
+ *   locks      HalMutex (may block), HalSpinLock (short critical sections)
+ *   console    halConsoleWrite()
+ *
+ * The byte transport of the VE.Bus handler is VeBusUart (vebus_uart.h),
+ * VeBusUartEsp32 on the target and VeBusUartPosix on the host.
+ *
+ * On the ESP32 everything maps 1:1 to Arduino/FreeRTOS calls and is inline.
+ * On the host, hal_posix.cpp implements it with std::thread and
+ * std::chrono. There, the task priority and core are ignored, and the
+ * cycle counter counts nanoseconds (halCpuMhz() returns 1000).
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(ARDUINO)
+#define HAL_ESP32 1
+#define HAL_POSIX 0
+#else
+#define HAL_ESP32 0
+#define HAL_POSIX 1
+#endif
+
+typedef void (*HalTaskFunction)(void* parameter);
+
+#if HAL_ESP32
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+typedef TaskHandle_t HalTaskHandle;
+
+static inline uint32_t halMillis() { return millis(); }
+static inline uint32_t halMicros() { return micros(); }
+static inline void halDelayMs(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+static inline uint32_t halCycleCount() { return ESP.getCycleCount(); }
+static inline uint32_t halCpuMhz() { return getCpuFrequencyMhz(); }
+static inline void halConsoleWrite(const char* text) { Serial.print(text); }
+
+static inline bool halTaskCreate(HalTaskFunction function, const char* name, uint32_t stackSize, void* parameter,
+                                 uint8_t priority, int8_t core, HalTaskHandle* handle) {
+    return xTaskCreatePinnedToCore(function, name, stackSize, parameter, priority, handle,
+                                   core < 0 ? tskNO_AFFINITY : core) == pdPASS;
+}
+
+// nullptr deletes the calling task and does not return
+static inline void halTaskDelete(HalTaskHandle handle) { vTaskDelete(handle); }
+static inline HalTaskHandle halTaskCurrent() { return xTaskGetCurrentTaskHandle(); }
+static inline void halTaskNotify(HalTaskHandle handle) { xTaskNotifyGive(handle); }
+
+// Waits for a notification of the calling task, returns the count taken (0 = timeout)
+static inline uint32_t halTaskNotifyTake(uint32_t timeoutMs) {
+    return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+}
+
+class HalMutex {
+private:
+    SemaphoreHandle_t handle;
+
+public:
+    HalMutex() : handle(nullptr) {}
+
+    bool create() {
+        if (handle == nullptr) handle = xSemaphoreCreateMutex();
+        return handle != nullptr;
+    }
+    void destroy() {
+        if (handle != nullptr) vSemaphoreDelete(handle);
+        handle = nullptr;
+    }
+    // Blocks until the mutex is taken; false if it was never created
+    bool lock() { return handle != nullptr && xSemaphoreTake(handle, portMAX_DELAY) == pdTRUE; }
+    void unlock() { xSemaphoreGive(handle); }
+};
+
+// Disables interrupts on this core and spins against the other one:
+// a few dozen instructions at most, no blocking calls inside
+class HalSpinLock {
+private:
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+public:
+    void enter() { portENTER_CRITICAL(&mux); }
+    void exit() { portEXIT_CRITICAL(&mux); }
+};
+
+#else // HAL_POSIX
+
+#include <mutex>
+
+struct HalTask;
+typedef HalTask* HalTaskHandle;
+
+uint32_t halMillis();
+uint32_t halMicros();
+void halDelayMs(uint32_t ms);
+uint32_t halCycleCount();
+static inline uint32_t halCpuMhz() { return 1000; }
+void halConsoleWrite(const char* text);
+
+bool halTaskCreate(HalTaskFunction function, const char* name, uint32_t stackSize, void* parameter,
+                   uint8_t priority, int8_t core, HalTaskHandle* handle);
+
+// A thread cannot be killed: halTaskDelete(handle) waits until the task
+// function returned, so it must have been asked to stop first.
+// halTaskDelete(nullptr) does nothing, the task function returns after it.
+void halTaskDelete(HalTaskHandle handle);
+
+// Also works in threads not started by halTaskCreate(), e.g. main()
+HalTaskHandle halTaskCurrent();
+void halTaskNotify(HalTaskHandle handle);
+uint32_t halTaskNotifyTake(uint32_t timeoutMs);
+
+class HalMutex {
+private:
+    std::mutex mutex;
+    bool created = false;
+
+public:
+    bool create() { created = true; return true; }
+    void destroy() { created = false; }
+    bool lock() {
+        if (!created) return false;
+        mutex.lock();
+        return true;
+    }
+    void unlock() { mutex.unlock(); }
+};
+
+class HalSpinLock {
+private:
+    std::mutex mutex;
+
+public:
+    void enter() { mutex.lock(); }
+    void exit() { mutex.unlock(); }
+};
+
+#endif
+
+#endif // HAL_H
@@ -0,0 +1,107 @@
+/*
+ * Hardware Abstraction Layer - POSIX Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "hal.h"
+
+#if HAL_POSIX
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <stdio.h>
+
+struct HalTask {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifications = 0;
+    bool owned = false;                 // Created by halTaskCreate(), freed by halTaskDelete()
+};
+
+static thread_local HalTask* currentTask = nullptr;
+static thread_local HalTask foreignTask;    // For threads not started by halTaskCreate()
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+static uint64_t elapsedNs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint32_t halMillis() {
+    return (uint32_t)(elapsedNs() / 1000000);
+}
+
+uint32_t halMicros() {
+    return (uint32_t)(elapsedNs() / 1000);
+}
+
+void halDelayMs(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+uint32_t halCycleCount() {
+    return (uint32_t)elapsedNs();
+}
+
+void halConsoleWrite(const char* text) {
+    fputs(text, stdout);
+    fflush(stdout);
+}
+
+bool halTaskCreate(HalTaskFunction function, const char* name, uint32_t stackSize, void* parameter,
+                   uint8_t priority, int8_t core, HalTaskHandle* handle) {
+    (void)name;
+    (void)stackSize;
+    (void)priority;
+    (void)core;
+    HalTask* task = new HalTask();
+    task->owned = true;
+    // Set before the thread runs, it may notify itself or be notified right away
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    task->thread = std::thread([task, function, parameter]() {
+        currentTask = task;
+        function(parameter);
+    });
+    return true;
+}
+
+void halTaskDelete(HalTaskHandle handle) {
+    if (handle == nullptr || !handle->owned || handle == currentTask) {
+        return;
+    }
+    if (handle->thread.joinable()) {
+        handle->thread.join();
+    }
+    delete handle;
+}
+
+HalTaskHandle halTaskCurrent() {
+    return currentTask != nullptr ? currentTask : &foreignTask;
+}
+
+void halTaskNotify(HalTaskHandle handle) {
+    {
+        std::lock_guard<std::mutex> guard(handle->mutex);
+        handle->notifications++;
+    }
+    handle->notified.notify_one();
+}
+
+uint32_t halTaskNotifyTake(uint32_t timeoutMs) {
+    HalTask* task = halTaskCurrent();
+    std::unique_lock<std::mutex> guard(task->mutex);
+    task->notified.wait_for(guard, std::chrono::milliseconds(timeoutMs),
+                            [task]() { return task->notifications > 0; });
+    uint32_t taken = task->notifications;
+    task->notifications = 0;
+    return taken;
+}
+
+#endif // HAL_POSIX
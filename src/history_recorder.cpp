@@ -0,0 +1,63 @@
+/*
+ * History Recorder Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history_recorder.h"
+#include "system_data.h"
+#include "pylontech_can.h"
+
+bool HistoryRecorder::begin() {
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        Serial.println("History: failed to create mutex");
+        return false;
+    }
+    Serial.printf("History: %u signals, %u bytes\n", HISTORY_SIGNAL_COUNT, (unsigned)sizeof(store));
+    return true;
+}
+
+void HistoryRecorder::sample() {
+    if (mutex == nullptr) return;
+
+    PylontechBatteryState battery = pylontechCAN.getBattery();
+    int32_t values[HISTORY_SIGNAL_COUNT];
+    values[HISTORY_METER_POWER] = systemData.powerMeter.decisiveMeterPower;
+    values[HISTORY_BATTERY_POWER] = battery.power;
+    values[HISTORY_BATTERY_SOC] = battery.soc;
+    values[HISTORY_INVERTER_POWER] = systemData.multiplus.pinverterFiltered;
+    values[HISTORY_ESS_SETPOINT] = systemData.multiplus.esspower;
+    values[HISTORY_DC_VOLTAGE] = (int32_t)lroundf(systemData.multiplus.dcVoltage * 100);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        store.record(now(), values);
+        xSemaphoreGive(mutex);
+    }
+}
+
+void HistoryRecorder::beginQuery(HistoryQuery& query, uint8_t signal, uint8_t tier, uint32_t from) {
+    if (mutex != nullptr && xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        store.beginQuery(query, signal, tier, from, now());
+        xSemaphoreGive(mutex);
+    }
+}
+
+uint8_t HistoryRecorder::tierFor(uint8_t signal, uint32_t from) {
+    uint8_t tier = HISTORY_TIER_SECOND;
+    if (mutex != nullptr && xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        tier = store.tierFor(signal, from);
+        xSemaphoreGive(mutex);
+    }
+    return tier;
+}
+
+size_t HistoryRecorder::readJson(HistoryQuery& query, char* buffer, size_t size) {
+    size_t length = 0;
+    if (mutex != nullptr && xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        length = store.readJson(query, buffer, size);
+        xSemaphoreGive(mutex);
+    }
+    return length;
+}
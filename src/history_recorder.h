@@ -0,0 +1,42 @@
+/*
+ * History Recorder
+ *
+ * Samples the signals of the history store (history_store.h) once per
+ * second from loop() and answers /api/history queries from the web server
+ * task. The store is shared between the two under a mutex; queries take it
+ * only while one chunk of the response is written.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_RECORDER_H
+#define HISTORY_RECORDER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "history_store.h"
+
+class HistoryRecorder {
+private:
+    HistoryStore store;                 // About 20 kB
+    SemaphoreHandle_t mutex;
+
+public:
+    HistoryRecorder() : mutex(nullptr) {}
+
+    bool begin();
+
+    // From loop(), once per second
+    void sample();
+
+    static uint32_t now() { return millis() / 1000; }
+
+    // Query from the web server; from and the times in the result are seconds since boot
+    void beginQuery(HistoryQuery& query, uint8_t signal, uint8_t tier, uint32_t from);
+    uint8_t tierFor(uint8_t signal, uint32_t from);
+    size_t readJson(HistoryQuery& query, char* buffer, size_t size);
+};
+
+#endif // HISTORY_RECORDER_H
@@ -0,0 +1,357 @@
+/*
+ * History Store Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history_store.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* const signalNames[HISTORY_SIGNAL_COUNT] = {
+    "meter_power", "battery_power", "battery_soc", "inverter_power", "ess_setpoint", "dc_voltage"
+};
+
+static const uint32_t tierPeriods[HISTORY_TIER_COUNT] = { 1, 60, 900 };
+
+const char* historySignalName(uint8_t signal) {
+    return signal < HISTORY_SIGNAL_COUNT ? signalNames[signal] : "";
+}
+
+int historySignalFromName(const char* name) {
+    for (uint8_t i = 0; i < HISTORY_SIGNAL_COUNT; i++) {
+        if (strcmp(name, signalNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+uint32_t historyTierPeriod(uint8_t tier) {
+    return tier < HISTORY_TIER_COUNT ? tierPeriods[tier] : 0;
+}
+
+// Differences are taken modulo 2^32, so any pair of int32 values round-trips
+static inline uint32_t zigzag(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t value) {
+    return (value >> 1) ^ (uint32_t)-(int32_t)(value & 1);
+}
+
+static inline uint8_t putVarint(uint8_t* out, uint32_t value) {
+    uint8_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+// False if the varint runs past the end of the block
+static inline bool getVarint(const uint8_t* data, uint16_t used, uint16_t& offset, uint32_t& value) {
+    value = 0;
+    for (uint8_t shift = 0; shift < 35 && offset < used; shift += 7) {
+        uint8_t byte = data[offset++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void HistoryTier::init(HistoryBlock* storage, uint8_t count, uint32_t seconds, bool isRollup) {
+    blocks = storage;
+    blockCount = count;
+    period = seconds;
+    rollup = isRollup;
+    headSequence = 0;
+    empty = true;
+    lastAvg = 0;
+}
+
+bool HistoryTier::encode(HistoryBlock& block, const HistoryPoint& point) {
+    uint8_t record[15];
+    uint8_t length = putVarint(record, zigzag((uint32_t)point.avg - (uint32_t)lastAvg));
+    if (rollup) {
+        length += putVarint(&record[length], (uint32_t)point.avg - (uint32_t)point.min);
+        length += putVarint(&record[length], (uint32_t)point.max - (uint32_t)point.avg);
+    }
+    if (block.used + length > HISTORY_BLOCK_BYTES) return false;
+
+    memcpy(&block.data[block.used], record, length);
+    block.used += length;
+    block.count++;
+    lastAvg = point.avg;
+    return true;
+}
+
+void HistoryTier::append(const HistoryPoint& point) {
+    if (blockCount == 0) return;
+
+    if (!empty) {
+        HistoryBlock& head = blocks[headSequence % blockCount];
+        if (point.time == head.startTime + head.count * period && encode(head, point)) {
+            return;
+        }
+        // Gap in time or block full
+        headSequence++;
+    }
+
+    HistoryBlock& block = blocks[headSequence % blockCount];
+    block.startTime = point.time;
+    block.count = 0;
+    block.used = 0;
+    lastAvg = 0;
+    empty = false;
+    encode(block, point);
+}
+
+uint32_t HistoryTier::getOldestSequence() const {
+    return headSequence >= blockCount ? headSequence - blockCount + 1 : 0;
+}
+
+uint32_t HistoryTier::getOldestTime() const {
+    return empty ? 0 : blocks[getOldestSequence() % blockCount].startTime;
+}
+
+HistoryUsage HistoryTier::getUsage() const {
+    HistoryUsage usage = { 0, 0, (uint32_t)blockCount * HISTORY_BLOCK_BYTES };
+    if (empty) return usage;
+    for (uint32_t sequence = getOldestSequence(); sequence <= headSequence; sequence++) {
+        usage.records += blocks[sequence % blockCount].count;
+        usage.bytes += blocks[sequence % blockCount].used;
+    }
+    return usage;
+}
+
+void HistoryTier::seek(HistoryCursor& cursor, uint32_t from) const {
+    cursor.from = from;
+    cursor.blockSequence = getOldestSequence();
+    cursor.record = 0;
+    cursor.offset = 0;
+    cursor.lastAvg = 0;
+    if (empty) return;
+
+    // Last block that starts at or before from, records before it are skipped in next()
+    for (uint32_t sequence = cursor.blockSequence + 1; sequence <= headSequence; sequence++) {
+        if (blocks[sequence % blockCount].startTime > from) break;
+        cursor.blockSequence = sequence;
+    }
+}
+
+bool HistoryTier::next(HistoryCursor& cursor, HistoryPoint& point) const {
+    if (empty) return false;
+
+    for (;;) {
+        uint32_t oldest = getOldestSequence();
+        if ((int32_t)(cursor.blockSequence - oldest) < 0) {
+            // Overwritten while the reader paused, continue with what is left
+            cursor.blockSequence = oldest;
+            cursor.record = 0;
+            cursor.offset = 0;
+            cursor.lastAvg = 0;
+        } else if ((int32_t)(cursor.blockSequence - headSequence) > 0) {
+            return false;
+        }
+
+        const HistoryBlock& block = blocks[cursor.blockSequence % blockCount];
+        if (cursor.record >= block.count) {
+            if (cursor.blockSequence == headSequence) return false;
+            cursor.blockSequence++;
+            cursor.record = 0;
+            cursor.offset = 0;
+            cursor.lastAvg = 0;
+            continue;
+        }
+
+        uint32_t delta, below = 0, above = 0;
+        if (!getVarint(block.data, block.used, cursor.offset, delta) ||
+            (rollup && (!getVarint(block.data, block.used, cursor.offset, below) ||
+                        !getVarint(block.data, block.used, cursor.offset, above)))) {
+            // Cannot happen with data written by encode(), skip the rest of the block
+            cursor.record = block.count;
+            continue;
+        }
+
+        cursor.lastAvg = (int32_t)((uint32_t)cursor.lastAvg + unzigzag(delta));
+        point.time = block.startTime + cursor.record * period;
+        point.avg = cursor.lastAvg;
+        point.min = (int32_t)((uint32_t)point.avg - below);
+        point.max = (int32_t)((uint32_t)point.avg + above);
+        cursor.record++;
+
+        if ((int32_t)(point.time - cursor.from) >= 0) return true;
+    }
+}
+
+HistoryStore::HistoryStore() {
+    for (uint8_t i = 0; i < HISTORY_SIGNAL_COUNT; i++) {
+        Series& s = series[i];
+        s.tiers[HISTORY_TIER_SECOND].init(s.secondBlocks, HISTORY_SECOND_BLOCKS, tierPeriods[HISTORY_TIER_SECOND], false);
+        s.tiers[HISTORY_TIER_MINUTE].init(s.minuteBlocks, HISTORY_MINUTE_BLOCKS, tierPeriods[HISTORY_TIER_MINUTE], true);
+        s.tiers[HISTORY_TIER_QUARTER].init(s.quarterBlocks, HISTORY_QUARTER_BLOCKS, tierPeriods[HISTORY_TIER_QUARTER], true);
+        s.minute.count = 0;
+        s.quarter.count = 0;
+    }
+    lastTime = 0;
+    hasSamples = false;
+}
+
+void HistoryStore::accumulate(Accumulator& acc, uint32_t start, int32_t min, int32_t max, int64_t sum, uint32_t count) {
+    if (acc.count == 0) {
+        acc.start = start;
+        acc.min = min;
+        acc.max = max;
+        acc.sum = sum;
+        acc.count = count;
+        return;
+    }
+    if (min < acc.min) acc.min = min;
+    if (max > acc.max) acc.max = max;
+    acc.sum += sum;
+    acc.count += count;
+}
+
+HistoryPoint HistoryStore::finish(const Accumulator& acc) {
+    HistoryPoint point;
+    int64_t half = acc.count / 2;
+    point.time = acc.start;
+    point.min = acc.min;
+    point.max = acc.max;
+    point.avg = (int32_t)((acc.sum >= 0 ? acc.sum + half : acc.sum - half) / (int64_t)acc.count);
+    return point;
+}
+
+void HistoryStore::rollUp(Series& s, uint32_t time, int32_t value) {
+    uint32_t minuteStart = time - time % tierPeriods[HISTORY_TIER_MINUTE];
+
+    if (s.minute.count > 0 && s.minute.start != minuteStart) {
+        HistoryPoint minute = finish(s.minute);
+        s.tiers[HISTORY_TIER_MINUTE].append(minute);
+
+        uint32_t quarterStart = minute.time - minute.time % tierPeriods[HISTORY_TIER_QUARTER];
+        if (s.quarter.count > 0 && s.quarter.start != quarterStart) {
+            s.tiers[HISTORY_TIER_QUARTER].append(finish(s.quarter));
+            s.quarter.count = 0;
+        }
+        // Weighted by samples, a minute with gaps counts less
+        accumulate(s.quarter, quarterStart, minute.min, minute.max, s.minute.sum, s.minute.count);
+        s.minute.count = 0;
+    }
+
+    accumulate(s.minute, minuteStart, value, value, value, 1);
+}
+
+void HistoryStore::record(uint32_t time, const int32_t values[HISTORY_SIGNAL_COUNT]) {
+    if (hasSamples && (int32_t)(time - lastTime) <= 0) return;
+    lastTime = time;
+    hasSamples = true;
+
+    for (uint8_t i = 0; i < HISTORY_SIGNAL_COUNT; i++) {
+        HistoryPoint point = { time, values[i], values[i], values[i] };
+        series[i].tiers[HISTORY_TIER_SECOND].append(point);
+        rollUp(series[i], time, values[i]);
+    }
+}
+
+uint8_t HistoryStore::tierFor(uint8_t signal, uint32_t from) const {
+    if (signal >= HISTORY_SIGNAL_COUNT) return HISTORY_TIER_SECOND;
+
+    // Finest tier that reaches back far enough, else the one reaching back furthest
+    const Series& s = series[signal];
+    uint8_t best = HISTORY_TIER_SECOND;
+    for (uint8_t tier = 0; tier < HISTORY_TIER_COUNT; tier++) {
+        if (s.tiers[tier].isEmpty()) continue;
+        uint32_t oldest = s.tiers[tier].getOldestTime();
+        if ((int32_t)(from - oldest) >= 0) return tier;
+        if (s.tiers[best].isEmpty() || (int32_t)(oldest - s.tiers[best].getOldestTime()) < 0) {
+            best = tier;
+        }
+    }
+    return best;
+}
+
+uint32_t HistoryStore::getOldestTime(uint8_t signal, uint8_t tier) const {
+    if (signal >= HISTORY_SIGNAL_COUNT || tier >= HISTORY_TIER_COUNT) return 0;
+    return series[signal].tiers[tier].getOldestTime();
+}
+
+HistoryUsage HistoryStore::getUsage(uint8_t signal, uint8_t tier) const {
+    if (signal >= HISTORY_SIGNAL_COUNT || tier >= HISTORY_TIER_COUNT) {
+        HistoryUsage none = { 0, 0, 0 };
+        return none;
+    }
+    return series[signal].tiers[tier].getUsage();
+}
+
+void HistoryStore::seek(HistoryCursor& cursor, uint8_t signal, uint8_t tier, uint32_t from) const {
+    cursor.signal = signal < HISTORY_SIGNAL_COUNT ? signal : 0;
+    cursor.tier = tier < HISTORY_TIER_COUNT ? tier : (uint8_t)HISTORY_TIER_SECOND;
+    series[cursor.signal].tiers[cursor.tier].seek(cursor, from);
+}
+
+bool HistoryStore::next(HistoryCursor& cursor, HistoryPoint& point) const {
+    if (cursor.signal >= HISTORY_SIGNAL_COUNT || cursor.tier >= HISTORY_TIER_COUNT) return false;
+    return series[cursor.signal].tiers[cursor.tier].next(cursor, point);
+}
+
+enum HistoryQueryState : uint8_t {
+    QUERY_HEADER = 0,
+    QUERY_POINTS,
+    QUERY_FOOTER,
+    QUERY_DONE
+};
+
+void HistoryStore::beginQuery(HistoryQuery& query, uint8_t signal, uint8_t tier, uint32_t from, uint32_t now) const {
+    seek(query.cursor, signal, tier, from);
+    query.now = now;
+    query.state = QUERY_HEADER;
+    query.first = true;
+    query.pending = false;
+}
+
+size_t HistoryStore::readJson(HistoryQuery& query, char* buffer, size_t size) const {
+    size_t offset = 0;
+    int written;
+
+    if (query.state == QUERY_HEADER) {
+        written = snprintf(buffer, size, "{\"signal\":\"%s\",\"tier\":%lu,\"now\":%lu,\"points\":[",
+                           historySignalName(query.cursor.signal),
+                           (unsigned long)historyTierPeriod(query.cursor.tier), (unsigned long)query.now);
+        if (written < 0 || (size_t)written >= size) return 0;
+        offset = written;
+        query.state = QUERY_POINTS;
+    }
+
+    while (query.state == QUERY_POINTS) {
+        if (!query.pending) {
+            if (!next(query.cursor, query.point)) {
+                query.state = QUERY_FOOTER;
+                break;
+            }
+            query.pending = true;
+        }
+
+        const HistoryPoint& point = query.point;
+        const char* comma = query.first ? "" : ",";
+        if (query.cursor.tier == HISTORY_TIER_SECOND) {
+            written = snprintf(&buffer[offset], size - offset, "%s[%lu,%ld]", comma,
+                               (unsigned long)point.time, (long)point.avg);
+        } else {
+            written = snprintf(&buffer[offset], size - offset, "%s[%lu,%ld,%ld,%ld]", comma,
+                               (unsigned long)point.time, (long)point.min, (long)point.max, (long)point.avg);
+        }
+        if (written < 0 || offset + written >= size) break;     // Stays pending for the next chunk
+        offset += written;
+        query.first = false;
+        query.pending = false;
+    }
+
+    if (query.state == QUERY_FOOTER && offset + 2 <= size) {
+        buffer[offset++] = ']';
+        buffer[offset++] = '}';
+        query.state = QUERY_DONE;
+    }
+    return offset;
+}
@@ -0,0 +1,184 @@
+/*
+ * History Store
+ *
+ * Compact on-device time series for a few signals, sampled once per second.
+ * Every signal keeps three tiers:
+ *   - 1 s   raw samples
+ *   - 1 min min/max/avg rollups
+ *   - 15 min min/max/avg rollups
+ * Rollups are built automatically from the tier below when its interval ends.
+ *
+ * Each tier is a ring of fixed-size blocks. A block starts with an absolute
+ * value, the following records are zigzag varint deltas (raw: value delta;
+ * rollup: avg delta, avg - min, max - avg), so a slowly changing signal costs
+ * one byte per second. Record times are implicit (block start + n * period);
+ * a missed sample starts a new block. When the ring is full the oldest block
+ * is overwritten as a whole.
+ *
+ * Readers walk a tier with a HistoryCursor and can stop and resume at any
+ * point, so a response can be produced in small chunks. A cursor whose block
+ * was overwritten in the meantime continues at the oldest remaining block.
+ * readJson() uses this to write a query result piece by piece:
+ *   {"signal":"meter_power","tier":60,"now":86400,"points":[[t,min,max,avg],...]}
+ * with [t,value] for the 1 s tier; times are seconds since boot.
+ *
+ * No hardware dependencies and no locking; callers serialize record() and
+ * cursor access (HistoryRecorder does).
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HISTORY_BLOCK_BYTES 120         // Encoded records per block
+#define HISTORY_SECOND_BLOCKS 8         // About 15 min of 1 s samples
+#define HISTORY_MINUTE_BLOCKS 10        // About 4-6 h of 1 min rollups
+#define HISTORY_QUARTER_BLOCKS 7        // 28 h or more of 15 min rollups
+
+enum HistoryTierId : uint8_t {
+    HISTORY_TIER_SECOND = 0,
+    HISTORY_TIER_MINUTE,
+    HISTORY_TIER_QUARTER,
+    HISTORY_TIER_COUNT
+};
+
+enum HistorySignal : uint8_t {
+    HISTORY_METER_POWER = 0,            // W, grid meter, positive = import
+    HISTORY_BATTERY_POWER,              // W, from the BMS
+    HISTORY_BATTERY_SOC,                // %
+    HISTORY_INVERTER_POWER,             // W, Multiplus AC power (filtered)
+    HISTORY_ESS_SETPOINT,               // W, last setpoint sent to the Multiplus
+    HISTORY_DC_VOLTAGE,                 // cV, Multiplus DC voltage
+    HISTORY_SIGNAL_COUNT
+};
+
+// Names used in /api/history, e.g. "meter_power"
+const char* historySignalName(uint8_t signal);
+int historySignalFromName(const char* name);    // -1 if unknown
+
+uint32_t historyTierPeriod(uint8_t tier);       // Seconds per record
+
+struct HistoryPoint {
+    uint32_t time;                      // Seconds, start of the interval for rollups
+    int32_t min;
+    int32_t max;
+    int32_t avg;                        // Raw samples: min = max = avg
+};
+
+struct HistoryBlock {
+    uint32_t startTime;
+    uint16_t count;                     // Records in data
+    uint16_t used;                      // Bytes in data
+    uint8_t data[HISTORY_BLOCK_BYTES];
+};
+
+// Fill of a tier, for the footprint report of native_bench.cpp
+struct HistoryUsage {
+    uint32_t records;                   // Records in the ring
+    uint32_t bytes;                     // Encoded bytes of these records
+    uint32_t capacity;                  // Bytes the ring can hold
+};
+
+// Position in a tier; keep it between calls to continue where the last one stopped
+struct HistoryCursor {
+    uint8_t signal;
+    uint8_t tier;
+    uint32_t from;                      // Records before this time are skipped
+    uint32_t blockSequence;
+    uint16_t record;
+    uint16_t offset;
+    int32_t lastAvg;
+};
+
+// State of a query answered with readJson()
+struct HistoryQuery {
+    HistoryCursor cursor;
+    uint32_t now;
+    uint8_t state;                      // Header, points, footer, done
+    bool first;                         // No comma before the next point
+    bool pending;                       // point did not fit into the last chunk
+    HistoryPoint point;
+};
+
+class HistoryTier {
+private:
+    HistoryBlock* blocks;
+    uint8_t blockCount;
+    uint32_t period;
+    bool rollup;
+    uint32_t headSequence;              // Block being written
+    bool empty;
+    int32_t lastAvg;                    // Delta base for the next record in the head block
+
+    bool encode(HistoryBlock& block, const HistoryPoint& point);
+
+public:
+    HistoryTier() : blocks(nullptr), blockCount(0), period(1), rollup(false), headSequence(0), empty(true), lastAvg(0) {}
+
+    void init(HistoryBlock* storage, uint8_t count, uint32_t seconds, bool isRollup);
+
+    void append(const HistoryPoint& point);
+
+    uint32_t getOldestSequence() const;
+    bool isEmpty() const { return empty; }
+    uint32_t getOldestTime() const;
+    uint32_t getPeriod() const { return period; }
+    HistoryUsage getUsage() const;
+
+    void seek(HistoryCursor& cursor, uint32_t from) const;
+    bool next(HistoryCursor& cursor, HistoryPoint& point) const;
+};
+
+class HistoryStore {
+private:
+    struct Accumulator {
+        uint32_t start;
+        int32_t min;
+        int32_t max;
+        int64_t sum;
+        uint32_t count;                 // Samples, also for the 15 min accumulator
+    };
+
+    struct Series {
+        HistoryBlock secondBlocks[HISTORY_SECOND_BLOCKS];
+        HistoryBlock minuteBlocks[HISTORY_MINUTE_BLOCKS];
+        HistoryBlock quarterBlocks[HISTORY_QUARTER_BLOCKS];
+        HistoryTier tiers[HISTORY_TIER_COUNT];
+        Accumulator minute;
+        Accumulator quarter;
+    };
+
+    Series series[HISTORY_SIGNAL_COUNT];
+    uint32_t lastTime;
+    bool hasSamples;
+
+    static void accumulate(Accumulator& acc, uint32_t start, int32_t min, int32_t max, int64_t sum, uint32_t count);
+    static HistoryPoint finish(const Accumulator& acc);
+    void rollUp(Series& s, uint32_t time, int32_t value);
+
+public:
+    HistoryStore();
+
+    // One sample per signal, at most once per second, time in seconds (monotonic)
+    void record(uint32_t time, const int32_t values[HISTORY_SIGNAL_COUNT]);
+
+    // Finest tier that still holds data from the given time
+    uint8_t tierFor(uint8_t signal, uint32_t from) const;
+    uint32_t getOldestTime(uint8_t signal, uint8_t tier) const;
+    HistoryUsage getUsage(uint8_t signal, uint8_t tier) const;
+
+    // Cursor at the first record at or after from; next() returns false at the end
+    void seek(HistoryCursor& cursor, uint8_t signal, uint8_t tier, uint32_t from) const;
+    bool next(HistoryCursor& cursor, HistoryPoint& point) const;
+
+    // Next piece of the JSON result, only complete points; 0 when the query is done
+    void beginQuery(HistoryQuery& query, uint8_t signal, uint8_t tier, uint32_t from, uint32_t now) const;
+    size_t readJson(HistoryQuery& query, char* buffer, size_t size) const;
+};
+
+#endif // HISTORY_STORE_H
@@ -0,0 +1,110 @@
+/*
+ * Impulse Meter Power Estimator Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "impulse_estimator.h"
+
+void ImpulseEstimator::reset() {
+    lastPulseUs = 0;
+    intervalUs = 0;
+    hasPulse = false;
+    hasInterval = false;
+    idle = false;
+    pulses = 0;
+    rejected = 0;
+}
+
+bool ImpulseEstimator::onPulse(uint32_t timestampUs) {
+    if (hasPulse) {
+        uint32_t interval = timestampUs - lastPulseUs;
+        if (interval < IMPULSE_METER_MIN_INTERVAL_US) {
+            rejected++;
+            return false;
+        }
+        intervalUs = interval;
+        hasInterval = true;
+    }
+
+    lastPulseUs = timestampUs;
+    hasPulse = true;
+    idle = false;
+    pulses++;
+    return true;
+}
+
+ImpulseEstimate ImpulseEstimator::estimate(uint32_t nowUs) const {
+    ImpulseEstimate result;
+    result.power = 0;
+    result.ageUs = 0;
+    result.valid = false;
+    result.bounded = false;
+
+    if (!hasPulse) {
+        // After the pulses stopped we know the power is about 0
+        result.valid = idle;
+        result.bounded = idle;
+        return result;
+    }
+
+    uint32_t elapsed = nowUs - lastPulseUs;
+    result.ageUs = elapsed;
+
+    if (elapsed >= IMPULSE_METER_IDLE_US) {
+        result.valid = true;
+        result.bounded = true;
+        return result;
+    }
+    if (!hasInterval) {
+        return result;      // A single pulse says nothing about the power
+    }
+
+    result.valid = true;
+    if (elapsed > intervalUs) {
+        // The next pulse is overdue: power dropped at least to this bound
+        result.power = powerFromInterval(elapsed);
+        result.bounded = true;
+    } else {
+        result.power = powerFromInterval(intervalUs);
+    }
+    return result;
+}
+
+void ImpulseEstimator::expire(uint32_t nowUs) {
+    if (hasPulse && nowUs - lastPulseUs >= IMPULSE_METER_IDLE_US) {
+        hasPulse = false;
+        hasInterval = false;
+        idle = true;
+    }
+}
+
+void ImpulsePublishGate::reset() {
+    lastPublished = 0;
+    lastPublishMs = 0;
+    hasPublished = false;
+}
+
+ImpulsePublish ImpulsePublishGate::check(const ImpulseEstimate& estimate, bool newPulse, uint32_t nowMs) {
+    if (!estimate.valid) {
+        return IMPULSE_PUBLISH_NONE;
+    }
+
+    // A pulse gives a new interval; between pulses the bound is rate limited
+    // so the control loop does not integrate the same missing pulse over and
+    // over, and an unchanged value is only refreshed
+    ImpulsePublish result;
+    if (newPulse || !hasPublished) {
+        result = IMPULSE_PUBLISH_NEW;
+    } else if (nowMs - lastPublishMs < IMPULSE_METER_BOUND_PUBLISH_MS) {
+        return IMPULSE_PUBLISH_NONE;
+    } else {
+        result = estimate.power != lastPublished ? IMPULSE_PUBLISH_NEW : IMPULSE_PUBLISH_REFRESH;
+    }
+
+    lastPublished = estimate.power;
+    lastPublishMs = nowMs;
+    hasPublished = true;
+    return result;
+}
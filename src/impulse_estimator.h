@@ -0,0 +1,101 @@
+/*
+ * Impulse Meter Power Estimator
+ *
+ * Turns the pulse timestamps of an electricity meter's optical impulse
+ * output (10000 pulses per kWh = 360 J per pulse) into a power value.
+ *
+ * The power follows from the last interval between two pulses. Between
+ * pulses the estimate is capped by what the time since the last pulse
+ * allows: if no pulse came for t, the average power over that time was
+ * below 360 J / t. So a sudden load drop shows up as a falling upper bound
+ * long before the next pulse arrives. After IMPULSE_METER_IDLE_US without
+ * pulses the power is 0.
+ *
+ * ImpulsePublishGate decides which estimates go to the control loop: every
+ * new pulse, a changed bound at most every IMPULSE_METER_BOUND_PUBLISH_MS,
+ * and an unchanged value as a refresh at the same rate, so a slow pulse
+ * train never ages out of the loop's meter timeout.
+ *
+ * The meter does not tell the direction, the power is always >= 0.
+ * No hardware dependencies, synthetic pulse trains can be replayed on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef IMPULSE_ESTIMATOR_H
+#define IMPULSE_ESTIMATOR_H
+
+#include <stdint.h>
+
+#define IMPULSE_METER_PULSES_PER_KWH 10000
+#define IMPULSE_METER_JOULES_PER_PULSE (3600000UL / IMPULSE_METER_PULSES_PER_KWH)
+#define IMPULSE_METER_MIN_INTERVAL_US 20000UL       // Debounce, faster than 18 kW is noise
+#define IMPULSE_METER_IDLE_US 600000000UL           // 10 min without pulse: below 0.6 W, report 0
+#define IMPULSE_METER_BOUND_PUBLISH_MS 500          // Bound or unchanged value goes to the control loop this often
+
+struct ImpulseEstimate {
+    int32_t power;          // W
+    uint32_t ageUs;         // Time since the last pulse
+    bool valid;             // Enough pulses seen to say anything
+    bool bounded;           // Power is the upper bound from the time since the last pulse
+};
+
+class ImpulseEstimator {
+private:
+    uint32_t lastPulseUs;
+    uint32_t intervalUs;    // Between the last two accepted pulses
+    bool hasPulse;
+    bool hasInterval;
+    bool idle;              // Pulses stopped for longer than IMPULSE_METER_IDLE_US
+    uint32_t pulses;
+    uint32_t rejected;
+
+public:
+    ImpulseEstimator() { reset(); }
+
+    void reset();
+
+    // Pulse edge at the given time (us, free running). Returns false if it
+    // came too soon after the previous one and was ignored.
+    bool onPulse(uint32_t timestampUs);
+
+    ImpulseEstimate estimate(uint32_t nowUs) const;
+
+    // Forget the last pulse once the pulses stopped, so the free running
+    // microsecond counter can wrap without confusing the next interval
+    void expire(uint32_t nowUs);
+
+    uint32_t getPulses() const { return pulses; }
+    uint32_t getRejected() const { return rejected; }
+    uint32_t getIntervalUs() const { return hasInterval ? intervalUs : 0; }
+
+    static int32_t powerFromInterval(uint32_t intervalUs) {
+        return (int32_t)((uint64_t)IMPULSE_METER_JOULES_PER_PULSE * 1000000ULL / intervalUs);
+    }
+};
+
+enum ImpulsePublish : uint8_t {
+    IMPULSE_PUBLISH_NONE = 0,
+    IMPULSE_PUBLISH_NEW,        // New pulse or changed bound, a new meter sample
+    IMPULSE_PUBLISH_REFRESH     // Same value as before, only keeps the sample valid
+};
+
+class ImpulsePublishGate {
+private:
+    int32_t lastPublished;
+    uint32_t lastPublishMs;
+    bool hasPublished;
+
+public:
+    ImpulsePublishGate() { reset(); }
+
+    void reset();
+
+    // What to do with the estimate of this task run
+    ImpulsePublish check(const ImpulseEstimate& estimate, bool newPulse, uint32_t nowMs);
+
+    int32_t getPublished() const { return lastPublished; }
+};
+
+#endif // IMPULSE_ESTIMATOR_H
@@ -0,0 +1,175 @@
+/*
+ * Optical Impulse Meter Reader Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "impulse_meter.h"
+#include "system_data.h"
+#include <esp_timer.h>
+
+ImpulseMeter::ImpulseMeter() {
+    essController = nullptr;
+    taskHandle = nullptr;
+    isRunning = false;
+    pin = -1;
+    pulseHead = 0;
+    pulseTail = 0;
+    pulsesDropped = 0;
+}
+
+ImpulseMeter::~ImpulseMeter() {
+    end();
+}
+
+bool ImpulseMeter::begin(EssController* ess, int inputPin) {
+    if (inputPin < 0) {
+        Serial.println("Impulse: No input pin configured (IMPULSE_METER_PIN), impulse meter disabled");
+        return false;
+    }
+
+    essController = ess;
+    pin = inputPin;
+    estimator.reset();
+    gate.reset();
+    pulseHead = 0;
+    pulseTail = 0;
+    pulsesDropped = 0;
+
+    isRunning = true;   // Before the task starts, it preempts setup() on this core
+    BaseType_t result = xTaskCreatePinnedToCore(
+        taskWrapper,
+        "ImpulseMeter",
+        IMPULSE_TASK_STACK_SIZE,
+        this,
+        IMPULSE_TASK_PRIORITY,
+        &taskHandle,
+        IMPULSE_TASK_CORE
+    );
+
+    if (result != pdPASS) {
+        Serial.println("Impulse: Failed to create task");
+        isRunning = false;
+        taskHandle = nullptr;
+        pin = -1;
+        return false;
+    }
+
+    // Interrupt only after the task exists, the handler notifies it
+    pinMode(pin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(pin), onPulseEdge, this, IMPULSE_METER_EDGE);
+
+    Serial.printf("Impulse: Meter on IO%d, %d pulses/kWh\n", pin, IMPULSE_METER_PULSES_PER_KWH);
+    return true;
+}
+
+void ImpulseMeter::end() {
+    if (pin >= 0) {
+        detachInterrupt(digitalPinToInterrupt(pin));
+        pin = -1;
+    }
+
+    isRunning = false;
+
+    if (taskHandle != nullptr) {
+        vTaskDelete(taskHandle);
+        taskHandle = nullptr;
+    }
+}
+
+void IRAM_ATTR ImpulseMeter::onPulseEdge(void* arg) {
+    ImpulseMeter* meter = static_cast<ImpulseMeter*>(arg);
+    uint32_t timestamp = (uint32_t)esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&meter->pulseLock);
+    uint8_t next = (meter->pulseHead + 1) & (IMPULSE_METER_QUEUE_SIZE - 1);
+    if (next != meter->pulseTail) {
+        meter->pulseQueue[meter->pulseHead] = timestamp;
+        meter->pulseHead = next;
+    } else {
+        meter->pulsesDropped++;
+    }
+    portEXIT_CRITICAL_ISR(&meter->pulseLock);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(meter->taskHandle, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void ImpulseMeter::taskWrapper(void* parameter) {
+    ImpulseMeter* meter = static_cast<ImpulseMeter*>(parameter);
+    meter->readerTask();
+}
+
+void ImpulseMeter::readerTask() {
+    while (isRunning) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IMPULSE_METER_UPDATE_MS));
+
+        bool newPulse = false;
+        for (;;) {
+            uint32_t timestamp;
+            bool available = false;
+
+            portENTER_CRITICAL(&pulseLock);
+            if (pulseTail != pulseHead) {
+                timestamp = pulseQueue[pulseTail];
+                pulseTail = (pulseTail + 1) & (IMPULSE_METER_QUEUE_SIZE - 1);
+                available = true;
+            }
+            portEXIT_CRITICAL(&pulseLock);
+
+            if (!available) {
+                break;
+            }
+            newPulse |= estimator.onPulse(timestamp);
+        }
+
+        uint32_t nowUs = (uint32_t)esp_timer_get_time();
+        estimator.expire(nowUs);
+        publish(estimator.estimate(nowUs), newPulse);
+    }
+
+    vTaskDelete(nullptr);
+}
+
+void ImpulseMeter::publish(const ImpulseEstimate& estimate, bool newPulse) {
+    OpticalMeterData& optical = systemData.opticalMeter;
+    optical.pulses = estimator.getPulses();
+    optical.pulsesRejected = estimator.getRejected();
+    optical.pulsesDropped = pulsesDropped;
+    optical.pulseIntervalUs = estimator.getIntervalUs();
+    optical.pulseAgeMs = estimate.ageUs / 1000;
+    optical.powerBounded = estimate.bounded;
+
+    uint32_t nowMs = millis();
+    ImpulsePublish action = gate.check(estimate, newPulse, nowMs);
+    if (action == IMPULSE_PUBLISH_NONE) {
+        return;
+    }
+
+    PowerMeterData& powerMeter = systemData.powerMeter;
+    powerMeter.impulseMeterPower = estimate.power;
+    powerMeter.newImpulseMeterPower = true;
+
+    // The SML meter knows the direction and wins while it delivers
+    bool smlActive = powerMeter.smlTelegrams != 0 &&
+                     nowMs - powerMeter.smlLastTelegramTime < ESS_CONTROL_METER_TIMEOUT_MS;
+    if (smlActive) {
+        return;
+    }
+
+    if (action == IMPULSE_PUBLISH_REFRESH) {
+        if (essController != nullptr) {
+            essController->refreshMeterPower();
+        }
+        return;
+    }
+    powerMeter.decisiveMeterPower = estimate.power;
+    powerMeter.newMeterValue = true;
+    if (essController != nullptr) {
+        essController->publishMeterPower(estimate.power, true);
+    }
+}
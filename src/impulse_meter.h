@@ -0,0 +1,78 @@
+/*
+ * Optical Impulse Meter Reader
+ *
+ * Counts the 1/10000 kWh impulses of the electricity meter LED with the
+ * LM393 receiver circuit. Every edge is timestamped in the GPIO interrupt
+ * with the microsecond hardware timer (esp_timer) and queued for the task,
+ * so the interval between pulses does not depend on task scheduling.
+ * The task turns the intervals into power (ImpulseEstimator) and lowers the
+ * value while the next pulse is overdue, so a load drop reaches the ESS
+ * control loop within IMPULSE_METER_BOUND_PUBLISH_MS instead of one pulse later.
+ * An unchanged value is refreshed at the same rate, so pulses further apart
+ * than the loop's meter timeout (below about 72 W) do not switch it off.
+ *
+ * The input pin is set with the IMPULSE_METER_PIN build flag; without it the
+ * reader stays disabled.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef IMPULSE_METER_H
+#define IMPULSE_METER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "impulse_estimator.h"
+#include "ess_controller.h"
+
+#ifndef IMPULSE_METER_PIN
+#define IMPULSE_METER_PIN -1        // LM393 comparator output, -1 = no impulse meter connected
+#endif
+
+#ifndef IMPULSE_METER_EDGE
+#define IMPULSE_METER_EDGE FALLING  // Comparator pulls low while the meter LED is on
+#endif
+
+#define IMPULSE_METER_QUEUE_SIZE 8              // Pulses between two task runs, power of two
+#define IMPULSE_METER_UPDATE_MS 100             // Task wakes at least this often for the bound
+#define IMPULSE_TASK_STACK_SIZE 2048
+#define IMPULSE_TASK_PRIORITY 2
+#define IMPULSE_TASK_CORE 1
+
+class ImpulseMeter {
+private:
+    EssController* essController;
+    TaskHandle_t taskHandle;
+    bool isRunning;
+    int pin;
+    ImpulseEstimator estimator;
+    ImpulsePublishGate gate;
+
+    // Filled by the interrupt, emptied by the task
+    uint32_t pulseQueue[IMPULSE_METER_QUEUE_SIZE];
+    volatile uint8_t pulseHead;
+    volatile uint8_t pulseTail;
+    volatile uint32_t pulsesDropped;
+    portMUX_TYPE pulseLock = portMUX_INITIALIZER_UNLOCKED;
+
+    static void IRAM_ATTR onPulseEdge(void* arg);
+    static void taskWrapper(void* parameter);
+    void readerTask();
+    void publish(const ImpulseEstimate& estimate, bool newPulse);
+
+public:
+    ImpulseMeter();
+    ~ImpulseMeter();
+
+    bool begin(EssController* ess, int inputPin = IMPULSE_METER_PIN);
+    void end();
+    bool isTaskRunning() const { return isRunning; }
+
+    uint32_t getPulses() const { return estimator.getPulses(); }
+    uint32_t getRejected() const { return estimator.getRejected(); }
+    uint32_t getDropped() const { return pulsesDropped; }
+};
+
+#endif // IMPULSE_METER_H
@@ -0,0 +1,144 @@
+/*
+ * Log Ring Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "log_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+static const char* const levelNames[LOG_LEVEL_COUNT] = {
+    "debug", "info", "success", "warning", "error"
+};
+
+static const char* const moduleNames[LOG_MODULE_COUNT] = {
+    "SYSTEM", "VEBUS", "CAN", "ESS", "MQTT", "WEB"
+};
+
+LogRing::LogRing() : head(0), tail(0), pushed(0), dropped(0) {
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool LogRing::push(const LogRecord& record) {
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot& slot = slots[pos & (LOG_RING_SIZE - 1)];
+        uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            // Free slot for this position; claim it unless another producer was faster
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.record = record;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                pushed.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Slot still holds the record of the previous round: full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LogRing::pop(LogRecord& record) {
+    Slot& slot = slots[tail & (LOG_RING_SIZE - 1)];
+    uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+    if (seq != tail + 1) {
+        return false;
+    }
+    record = slot.record;
+    slot.sequence.store(tail + LOG_RING_SIZE, std::memory_order_release);
+    tail++;
+    return true;
+}
+
+LogRingStats LogRing::getStats() const {
+    LogRingStats stats;
+    stats.pushed = pushed.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+LogRateLimiter::LogRateLimiter(uint16_t rate, uint16_t maxBurst) {
+    configure(rate, maxBurst);
+}
+
+void LogRateLimiter::configure(uint16_t rate, uint16_t maxBurst) {
+    ratePerSecond = rate;
+    burst = maxBurst > 0 ? maxBurst : 1;
+    tokensMilli = (uint32_t)burst * 1000;
+    lastMs = 0;
+    started = false;
+}
+
+bool LogRateLimiter::allow(uint32_t nowMs) {
+    if (ratePerSecond == 0) {
+        return true;
+    }
+    if (started) {
+        // rate tokens per 1000 ms = rate milli-tokens per ms
+        uint32_t elapsed = nowMs - lastMs;
+        uint32_t limit = (uint32_t)burst * 1000;
+        uint64_t refill = (uint64_t)elapsed * ratePerSecond;
+        tokensMilli = refill >= limit - tokensMilli ? limit : tokensMilli + (uint32_t)refill;
+    }
+    started = true;
+    lastMs = nowMs;
+
+    if (tokensMilli < 1000) {
+        return false;
+    }
+    tokensMilli -= 1000;
+    return true;
+}
+
+const char* logLevelName(uint8_t level) {
+    return level < LOG_LEVEL_COUNT ? levelNames[level] : "unknown";
+}
+
+const char* logModuleName(uint8_t module) {
+    return module < LOG_MODULE_COUNT ? moduleNames[module] : "?";
+}
+
+int logLevelFromName(const char* name) {
+    for (uint8_t i = 0; name != nullptr && i < LOG_LEVEL_COUNT; i++) {
+        if (strcasecmp(name, levelNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+int logModuleFromName(const char* name) {
+    for (uint8_t i = 0; name != nullptr && i < LOG_MODULE_COUNT; i++) {
+        if (strcasecmp(name, moduleNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+size_t formatLogRecord(const LogRecord& record, char* out, size_t size) {
+    if (size == 0) return 0;
+
+    int length = snprintf(out, size, "[%s] ", logModuleName(record.module));
+    if (length < 0) length = 0;
+    if ((size_t)length >= size) return size - 1;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+    // Unused arguments are ignored by printf
+    int text = snprintf(out + length, size - length, record.format != nullptr ? record.format : "",
+                        record.args[0], record.args[1], record.args[2], record.args[3]);
+#pragma GCC diagnostic pop
+    if (text < 0) return (size_t)length;
+    length += text;
+    return (size_t)length >= size ? size - 1 : (size_t)length;
+}
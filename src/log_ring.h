@@ -0,0 +1,128 @@
+/*
+ * Log Ring
+ *
+ * Bounded multi-producer, single-consumer queue of fixed-size binary log
+ * records. Producers (any task, including the VE.Bus task) only store the
+ * time, level, module, a pointer to the format string and up to
+ * LOG_MAX_ARGS integer arguments; formatting and sending to Serial,
+ * WebSocket and MQTT happens later in a low-priority task (DebugLog).
+ *
+ * Each slot has a sequence number (Vyukov's bounded queue): a producer
+ * claims a position with one compare-and-swap on the head, copies its record
+ * and releases the slot by setting the sequence. No locks, no allocation.
+ * When the ring is full the new record is dropped and counted; producers
+ * never wait for the consumer. A producer preempted between claiming and
+ * releasing a slot only holds up the consumer, not other producers.
+ *
+ * The format string must outlive the record, i.e. be a string literal.
+ * Arguments are 32 bit integers (%d %u %x %c); no strings, no floats -
+ * pass scaled values instead.
+ *
+ * LogRateLimiter is the token bucket for the sinks.
+ *
+ * No hardware dependencies, can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_RING_SIZE 128               // Power of two, 32 B per record on the ESP32
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_MAX 160                // Formatted message incl. terminator
+
+// Ascending severity; the names are the levels of the web debug console
+enum LogLevel : uint8_t {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_SUCCESS,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_COUNT
+};
+
+enum LogModule : uint8_t {
+    LOG_MODULE_SYSTEM,
+    LOG_MODULE_VEBUS,
+    LOG_MODULE_CAN,
+    LOG_MODULE_ESS,
+    LOG_MODULE_MQTT,
+    LOG_MODULE_WEB,
+    LOG_MODULE_COUNT
+};
+
+struct LogRecord {
+    uint32_t timeMs;
+    uint8_t level;
+    uint8_t module;
+    uint16_t reserved;
+    const char* format;                 // String literal, never freed
+    int32_t args[LOG_MAX_ARGS];
+};
+
+struct LogRingStats {
+    uint32_t pushed;
+    uint32_t dropped;                   // Ring was full
+};
+
+class LogRing {
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        LogRecord record;
+    };
+
+    Slot slots[LOG_RING_SIZE];
+    std::atomic<uint32_t> head;         // Next position to claim, producers
+    uint32_t tail;                      // Next position to read, consumer only
+    std::atomic<uint32_t> pushed;
+    std::atomic<uint32_t> dropped;
+
+public:
+    LogRing();
+
+    // Any thread; false (and counted) if the ring is full
+    bool push(const LogRecord& record);
+
+    // Consumer only; false if nothing is ready
+    bool pop(LogRecord& record);
+
+    LogRingStats getStats() const;
+};
+
+// Token bucket: ratePerSecond messages on average, bursts up to burst
+class LogRateLimiter {
+private:
+    uint16_t ratePerSecond;
+    uint16_t burst;
+    uint32_t tokensMilli;               // Tokens in 1/1000
+    uint32_t lastMs;
+    bool started;
+
+public:
+    LogRateLimiter(uint16_t rate = 0, uint16_t maxBurst = 0);
+
+    // 0 = unlimited
+    void configure(uint16_t rate, uint16_t maxBurst);
+
+    // Takes a token if one is available
+    bool allow(uint32_t nowMs);
+};
+
+const char* logLevelName(uint8_t level);
+const char* logModuleName(uint8_t module);
+
+// Case-insensitive, -1 if unknown
+int logLevelFromName(const char* name);
+int logModuleFromName(const char* name);
+
+// "[MODULE] message", returns the length (truncated to size - 1)
+size_t formatLogRecord(const LogRecord& record, char* out, size_t size);
+
+#endif // LOG_RING_H
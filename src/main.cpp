@@ -29,14 +29,33 @@
 #include "external_api.h"
 #include "wifi_provisioning.h"
 #include "mqtt_minimal.h"
+#include "ess_controller.h"
+#include "sml_meter.h"
+#include "impulse_meter.h"
+#include "telemetry_fields.h"
+#include "stream_server.h"
+#include "history_recorder.h"
+#include "event_log.h"
+#include "ha_discovery.h"
+#include "mqtt_router.h"
+#include "debug_log.h"
+#include "perf_monitor.h"
 
 // Global objects
+DebugLog debugLog;
+PerfMonitor perfMonitor;
 VeBusHandler veBusHandler;
+EssController essController;
+SmlMeter smlMeter;
+ImpulseMeter impulseMeter;
 StatusLED statusLED;
 PylontechCAN pylontechCAN;
 AsyncWebServer webServer(80);
 AsyncWebSocket ws("/ws");
-ExternalAPI externalAPI(&webServer, &veBusHandler);
+SignalStreamServer streamServer;
+HistoryRecorder historyRecorder;
+EventLog eventLog;
+ExternalAPI externalAPI(&webServer, &veBusHandler, &essController, &historyRecorder, &eventLog);
 SystemData systemData;
 MQTTMinimal mqttClient;
 
@@ -53,6 +72,11 @@ float targetFeedInPower = 0.0;  // Target feed-in power in watts
 float maxFeedInPower = 5000.0;  // Maximum allowed feed-in power in watts
 bool feedInControlEnabled = false;  // Enable/disable feed-in control
 
+// Hand the feed-in settings to the ESS control loop
+void applyFeedInSettings() {
+  essController.configure(feedInControlEnabled, targetFeedInPower, maxFeedInPower);
+}
+
 // SPIFFS configuration functions for MQTT persistence
 void loadConfigFromSPIFFS() {
   if (!SPIFFS.exists("/mqtt_config.json")) {
@@ -124,115 +148,412 @@ void setupWebServer();
 void setupOTA();
 void setupWiFiManager();
 void onTimer();
-void publishDebugMessage(const String& message, const String& level);
+void sendLogToWebSocket(const LogRecord& record, const char* text);
+void sendLogToMqtt(const LogRecord& record, const char* text);
 
-// Memory-efficient JSON creation for WebSocket updates
-void sendFullStatusToClient(AsyncWebSocketClient *client) {
-  JsonDocument doc;
-  String wsJson;
-  wsJson.reserve(1024); // Larger buffer for all data
-  
-  // Battery data
-  doc["battery_soc"] = systemData.battery.soc;
-  doc["battery_voltage"] = systemData.battery.voltage;
-  doc["battery_current"] = systemData.battery.current;
-  doc["battery_power"] = systemData.battery.power;
-  doc["battery_temperature"] = systemData.battery.temperature;
-  doc["battery_soh"] = systemData.battery.soh;
-  doc["battery_chargeVoltage"] = systemData.battery.chargeVoltage;
-  doc["battery_chargeCurrentLimit"] = systemData.battery.chargeCurrentLimit;
-  doc["battery_dischargeCurrentLimit"] = systemData.battery.dischargeCurrentLimit;
-  doc["battery_manufacturer"] = systemData.battery.manufacturer;
-  doc["battery_protectionFlags1"] = systemData.battery.protectionFlags1;
-  doc["battery_protectionFlags2"] = systemData.battery.protectionFlags2;
-  doc["battery_warningFlags1"] = systemData.battery.warningFlags1;
-  doc["battery_warningFlags2"] = systemData.battery.warningFlags2;
-  doc["battery_requestFlags"] = systemData.battery.requestFlags;
-  serializeJson(doc, wsJson);
-  ws.textAll(wsJson);
-  doc.clear();
-  
-  // MultiPlus data
-  doc["multiplusDcVoltage"] = systemData.multiplus.dcVoltage;
-  doc["multiplusDcCurrent"] = systemData.multiplus.dcCurrent;
-  doc["multiplusUMainsRMS"] = systemData.multiplus.uMainsRMS;
-  doc["multiplusAcFrequency"] = systemData.multiplus.acFrequency;
-  doc["multiplusPinverterFiltered"] = systemData.multiplus.pinverterFiltered;
-  doc["multiplusPmainsFiltered"] = systemData.multiplus.pmainsFiltered;
-  doc["multiplusPowerFactor"] = systemData.multiplus.powerFactor;
-  doc["multiplusTemp"] = systemData.multiplus.temp;
-  doc["multiplusStatus80"] = systemData.multiplus.status80;
-  doc["masterMultiLED_ActualInputCurrentLimit"] = systemData.multiplus.masterMultiLED_ActualInputCurrentLimit;
-  doc["multiplusESSpower"] = systemData.multiplus.esspower;
-  serializeJson(doc, wsJson);
-  ws.textAll(wsJson);
-  doc.clear();
-  
-  // VE.Bus data
+#define TELEMETRY_BUFFER_SIZE 2048          // Schema is about 1.4 kB, JSON snapshot 1.2 kB
+#define TELEMETRY_BINARY_BUFFER_SIZE 512    // Binary snapshot is about 200 B
+#define TELEMETRY_MAX_CLIENTS 8             // DEFAULT_MAX_WS_CLIENTS of AsyncWebSocket
+
+TelemetryPublisher telemetry(telemetryFields, TM_FIELD_COUNT);
+static char telemetryBuffer[TELEMETRY_BUFFER_SIZE];
+static uint8_t telemetryBinaryBuffer[TELEMETRY_BINARY_BUFFER_SIZE];
+
+// Connected WebSocket clients, changed in the async TCP task and served from loop()
+struct TelemetryClient {
+  uint32_t id;
+  bool binary;          // Asked for binary frames with {"telemetry":"binary"}
+  bool needsSnapshot;   // Connected or switched format since the last loop()
+};
+static TelemetryClient telemetryClients[TELEMETRY_MAX_CLIENTS];
+static uint8_t telemetryClientCount = 0;
+static portMUX_TYPE telemetryClientsLock = portMUX_INITIALIZER_UNLOCKED;
+
+void addTelemetryClient(uint32_t id) {
+  bool added = false;
+  portENTER_CRITICAL(&telemetryClientsLock);
+  if (telemetryClientCount < TELEMETRY_MAX_CLIENTS) {
+    TelemetryClient& entry = telemetryClients[telemetryClientCount++];
+    entry.id = id;
+    entry.binary = false;
+    entry.needsSnapshot = true;
+    added = true;
+  }
+  portEXIT_CRITICAL(&telemetryClientsLock);
+
+  if (!added) {
+    Serial.printf("WebSocket client #%u gets no telemetry, too many clients\n", id);
+  }
+}
+
+void removeTelemetryClient(uint32_t id) {
+  portENTER_CRITICAL(&telemetryClientsLock);
+  for (uint8_t i = 0; i < telemetryClientCount; i++) {
+    if (telemetryClients[i].id == id) {
+      telemetryClients[i] = telemetryClients[--telemetryClientCount];
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&telemetryClientsLock);
+}
+
+void setTelemetryFormat(uint32_t id, bool binary) {
+  portENTER_CRITICAL(&telemetryClientsLock);
+  for (uint8_t i = 0; i < telemetryClientCount; i++) {
+    if (telemetryClients[i].id == id && telemetryClients[i].binary != binary) {
+      telemetryClients[i].binary = binary;
+      telemetryClients[i].needsSnapshot = true;
+    }
+  }
+  portEXIT_CRITICAL(&telemetryClientsLock);
+}
+
+// Copy of the client table; takes the pending snapshot flags with it
+uint8_t copyTelemetryClients(TelemetryClient* clients) {
+  portENTER_CRITICAL(&telemetryClientsLock);
+  uint8_t count = telemetryClientCount;
+  for (uint8_t i = 0; i < count; i++) {
+    clients[i] = telemetryClients[i];
+    telemetryClients[i].needsSnapshot = false;
+  }
+  portEXIT_CRITICAL(&telemetryClientsLock);
+  return count;
+}
+
+void sampleTelemetry() {
   auto veBusStats = veBusHandler.getStatistics();
-  Serial.printf("DEBUG: VE.Bus stats - framesSent: %u, framesReceived: %u, isRunning: %d\n",
-                veBusStats.framesSent, veBusStats.framesReceived, veBusHandler.isTaskRunning());
-  doc["veBus_isOnline"] = veBusHandler.isTaskRunning();
-  doc["veBus_communicationQuality"] = veBusHandler.getCommunicationQuality();
-  doc["veBus_framesSent"] = veBusStats.framesSent;
-  doc["veBus_framesReceived"] = veBusStats.framesReceived;
-  doc["veBus_checksumErrors"] = veBusStats.checksumErrors;
-  doc["veBus_timeoutErrors"] = veBusStats.timeoutErrors;
-  
-  // ESS Control data
-  doc["switchMode"] = systemData.essControl.switchMode;
-  doc["essPowerStrategy"] = systemData.essControl.essStrategy;
-  doc["secondsInMinStrategy"] = systemData.essControl.secondsInMinStrategy;
-  doc["secondsInMaxStrategy"] = systemData.essControl.secondsInMaxStrategy;
-  doc["bmsPowerAverage"] = systemData.battery.power; // Placeholder
-  serializeJson(doc, wsJson);
-  ws.textAll(wsJson);
-  doc.clear();
-  
-  // Feed-in control
-  doc["feedInControl_enabled"] = feedInControlEnabled;
-  doc["feedInControl_current"] = systemData.multiplus.esspower;
-  doc["feedInControl_target"] = targetFeedInPower;
-  doc["feedInControl_max"] = maxFeedInPower;
-  
-  // Status LED
-  doc["statusLED_mode"] = 3; // Normal operation
-  
-  // MQTT status
-  doc["mqtt"]["connected"] = mqttClient.isConnected();
-  doc["mqtt"]["server"] = mqttClient.mqttServer;
-  doc["mqtt"]["port"] = mqttClient.mqttPort;
-  
-  serializeJson(doc, wsJson);
-  ws.textAll(wsJson);
-  doc.clear();
+
+  sampleSystemTelemetry(telemetry, systemData, pylontechCAN.getBattery());
+
+  telemetry.setBool(TM_VEBUS_ONLINE, veBusHandler.isTaskRunning());
+  telemetry.setFloat(TM_VEBUS_QUALITY, veBusHandler.getCommunicationQuality());
+  telemetry.setInt(TM_VEBUS_FRAMES_SENT, veBusStats.framesSent);
+  telemetry.setInt(TM_VEBUS_FRAMES_RECEIVED, veBusStats.framesReceived);
+  telemetry.setInt(TM_VEBUS_CHECKSUM_ERRORS, veBusStats.checksumErrors);
+  telemetry.setInt(TM_VEBUS_TIMEOUT_ERRORS, veBusStats.timeoutErrors);
+
+  telemetry.setBool(TM_FEEDIN_ENABLED, feedInControlEnabled);
+  telemetry.setFloat(TM_FEEDIN_TARGET, targetFeedInPower);
+  telemetry.setFloat(TM_FEEDIN_MAX, maxFeedInPower);
+
+  telemetry.setInt(TM_STATUS_LED_MODE, 3); // Normal operation
+
+  telemetry.setBool(TM_MQTT_CONNECTED, mqttClient.isConnected());
+  telemetry.setText(TM_MQTT_SERVER, mqttClient.mqttServer);
+  telemetry.setInt(TM_MQTT_PORT, mqttClient.mqttPort);
+}
+
+// Full snapshot for clients that connected or switched format since the last call
+void sendPendingSnapshots() {
+  bool pending = false;
+  portENTER_CRITICAL(&telemetryClientsLock);
+  for (uint8_t i = 0; i < telemetryClientCount; i++) {
+    pending |= telemetryClients[i].needsSnapshot;
+  }
+  portEXIT_CRITICAL(&telemetryClientsLock);
+  if (!pending) {
+    return;
+  }
+
+  TelemetryClient clients[TELEMETRY_MAX_CLIENTS];
+  uint8_t count = copyTelemetryClients(clients);
+  size_t jsonLength = 0;
+  size_t binaryLength = 0;
+
+  sampleTelemetry();
+  for (uint8_t i = 0; i < count; i++) {
+    if (!clients[i].needsSnapshot) continue;
+
+    AsyncWebSocketClient* client = ws.client(clients[i].id);
+    if (client == nullptr) continue;
+
+    if (clients[i].binary) {
+      if (binaryLength == 0) {
+        binaryLength = telemetry.serializeBinary(telemetryBinaryBuffer, sizeof(telemetryBinaryBuffer), telemetry.allFields());
+      }
+      // The schema goes first; it overwrites a JSON snapshot in the text buffer
+      size_t schemaLength = telemetry.serializeSchema(telemetryBuffer, sizeof(telemetryBuffer));
+      jsonLength = 0;
+      client->text(telemetryBuffer, schemaLength);
+      client->binary(telemetryBinaryBuffer, binaryLength);
+    } else {
+      if (jsonLength == 0) {
+        uint64_t fields = telemetry.allFields();
+        jsonLength = telemetry.serializeJson(telemetryBuffer, sizeof(telemetryBuffer), fields);
+      }
+      client->text(telemetryBuffer, jsonLength);
+    }
+  }
+}
+
+// Changed fields to all clients, each in its format
+void sendTelemetryUpdate() {
+  PerfScope perf(PERF_WS_TELEMETRY);
+  TelemetryClient clients[TELEMETRY_MAX_CLIENTS];
+  uint8_t count = copyTelemetryClients(clients);
+  uint8_t binaryClients = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (clients[i].binary) binaryClients++;
+  }
+
+  sampleTelemetry();
+  uint64_t changes = telemetry.takeChanges();
+  if (changes == 0) {
+    return;
+  }
+
+  size_t jsonLength = 0;
+  if (binaryClients < count) {
+    uint64_t unsent = changes;
+    jsonLength = telemetry.serializeJson(telemetryBuffer, sizeof(telemetryBuffer), unsent);
+    telemetry.invalidate(unsent);   // Did not fit, next time
+  }
+  size_t binaryLength = 0;
+  if (binaryClients > 0) {
+    binaryLength = telemetry.serializeBinary(telemetryBinaryBuffer, sizeof(telemetryBinaryBuffer), changes);
+  }
+
+  if (binaryClients == 0) {
+    // One shared buffer for everybody
+    if (jsonLength > 0) {
+      ws.textAll(telemetryBuffer, jsonLength);
+    }
+    return;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    AsyncWebSocketClient* client = ws.client(clients[i].id);
+    if (client == nullptr) continue;
+
+    if (clients[i].binary) {
+      if (binaryLength > 0) client->binary(telemetryBinaryBuffer, binaryLength);
+    } else {
+      if (jsonLength > 0) client->text(telemetryBuffer, jsonLength);
+    }
+  }
+}
+
+// Home Assistant: retained discovery configs once per connection, then one
+// JSON state message per group when values changed (ess/<group>/state)
+enum HaGroupId : uint8_t { HA_BATTERY, HA_INVERTER, HA_GRID, HA_CONTROL, HA_GROUP_COUNT };
+static const char* const haGroups[HA_GROUP_COUNT] = { "battery", "inverter", "grid", "control" };
+
+enum HaEntityId : uint8_t {
+  HA_BATTERY_SOC, HA_BATTERY_VOLTAGE, HA_BATTERY_CURRENT, HA_BATTERY_POWER,
+  HA_BATTERY_TEMPERATURE, HA_BATTERY_SOH,
+  HA_MP_DC_VOLTAGE, HA_MP_DC_CURRENT, HA_MP_AC_VOLTAGE, HA_MP_AC_FREQUENCY,
+  HA_MP_INVERTER_POWER, HA_MP_MAINS_POWER, HA_MP_ESS_POWER, HA_MP_TEMPERATURE,
+  HA_GRID_POWER, HA_GRID_CONSUMPTION, HA_GRID_FEED_IN,
+  HA_FEEDIN_ENABLED, HA_FEEDIN_TARGET, HA_FEEDIN_MAX, HA_ESS_STRATEGY,
+  HA_ENTITY_COUNT
+};
+
+// Order must match HaEntityId. Power dead bands keep the filtered values from
+// triggering a message every second.
+static const HaEntity haEntities[HA_ENTITY_COUNT] = {
+  {"soc", TELEMETRY_INT, 0, 0, HA_BATTERY, "sensor", "Battery SOC", "%", "battery", "measurement"},
+  {"voltage", TELEMETRY_FLOAT, 2, 0.05f, HA_BATTERY, "sensor", "Battery voltage", "V", "voltage", "measurement"},
+  {"current", TELEMETRY_FLOAT, 1, 0.5f, HA_BATTERY, "sensor", "Battery current", "A", "current", "measurement"},
+  {"power", TELEMETRY_FLOAT, 0, 20, HA_BATTERY, "sensor", "Battery power", "W", "power", "measurement"},
+  {"temperature", TELEMETRY_FLOAT, 1, 0.5f, HA_BATTERY, "sensor", "Battery temperature", "°C", "temperature", "measurement"},
+  {"soh", TELEMETRY_INT, 0, 0, HA_BATTERY, "sensor", "Battery SOH", "%", nullptr, "measurement"},
+  {"dc_voltage", TELEMETRY_FLOAT, 2, 0.05f, HA_INVERTER, "sensor", "Inverter DC voltage", "V", "voltage", "measurement"},
+  {"dc_current", TELEMETRY_FLOAT, 1, 0.5f, HA_INVERTER, "sensor", "Inverter DC current", "A", "current", "measurement"},
+  {"ac_voltage", TELEMETRY_FLOAT, 1, 1, HA_INVERTER, "sensor", "Mains voltage", "V", "voltage", "measurement"},
+  {"ac_frequency", TELEMETRY_FLOAT, 2, 0.05f, HA_INVERTER, "sensor", "Mains frequency", "Hz", "frequency", "measurement"},
+  {"inverter_power", TELEMETRY_FLOAT, 0, 20, HA_INVERTER, "sensor", "Inverter power", "W", "power", "measurement"},
+  {"mains_power", TELEMETRY_FLOAT, 0, 20, HA_INVERTER, "sensor", "Inverter mains power", "W", "power", "measurement"},
+  {"ess_power", TELEMETRY_FLOAT, 0, 20, HA_INVERTER, "sensor", "ESS setpoint", "W", "power", "measurement"},
+  {"temperature", TELEMETRY_FLOAT, 1, 0.5f, HA_INVERTER, "sensor", "Inverter temperature", "°C", "temperature", "measurement"},
+  {"power", TELEMETRY_FLOAT, 0, 20, HA_GRID, "sensor", "Grid power", "W", "power", "measurement"},
+  {"consumption", TELEMETRY_FLOAT, 3, 0.01f, HA_GRID, "sensor", "Grid consumption", "kWh", "energy", "total_increasing"},
+  {"feed_in", TELEMETRY_FLOAT, 3, 0.01f, HA_GRID, "sensor", "Grid feed-in", "kWh", "energy", "total_increasing"},
+  {"feedin_enabled", TELEMETRY_BOOL, 0, 0, HA_CONTROL, "binary_sensor", "Feed-in control", nullptr, nullptr, nullptr},
+  {"feedin_target", TELEMETRY_FLOAT, 0, 0, HA_CONTROL, "sensor", "Feed-in target", "W", "power", nullptr},
+  {"feedin_max", TELEMETRY_FLOAT, 0, 0, HA_CONTROL, "sensor", "Feed-in maximum", "W", "power", nullptr},
+  {"strategy", TELEMETRY_TEXT, 0, 0, HA_CONTROL, "sensor", "ESS strategy", nullptr, nullptr, nullptr},
+};
+
+HaDiscovery haDiscovery(haEntities, HA_ENTITY_COUNT, "ess", haGroups, HA_GROUP_COUNT);
+static char haNodeId[24];
+static const HaDevice haDevice = {
+  haNodeId, "Victron ESS", "MultiPlus-II ESS controller", "build " __DATE__, MQTT_STATUS_TOPIC
+};
+static char haTopic[HA_TOPIC_SIZE];
+static char haPayload[HA_CONFIG_SIZE];
+static volatile bool haResendState = false;
+
+// MQTT task, right after every (re)connect
+void publishHomeAssistantDiscovery() {
+  char topic[HA_TOPIC_SIZE];
+  char payload[HA_CONFIG_SIZE];
+  for (uint8_t i = 0; i < haDiscovery.getEntityCount(); i++) {
+    if (haDiscovery.serializeConfig(haDevice, i, topic, sizeof(topic), payload, sizeof(payload)) > 0) {
+      mqttClient.publish(topic, payload, true);
+    } else {
+      Serial.printf("Home Assistant config %u does not fit\n", i);
+    }
+  }
+  haResendState = true;
+}
+
+void publishHomeAssistantState() {
+  PylontechBatteryState battery = pylontechCAN.getBattery();
+  const MultiplusData& multiplus = systemData.multiplus;
+
+  haDiscovery.setInt(HA_BATTERY_SOC, battery.soc);
+  haDiscovery.setFloat(HA_BATTERY_VOLTAGE, battery.voltage);
+  haDiscovery.setFloat(HA_BATTERY_CURRENT, battery.current);
+  haDiscovery.setFloat(HA_BATTERY_POWER, battery.power);
+  haDiscovery.setFloat(HA_BATTERY_TEMPERATURE, battery.temperature);
+  haDiscovery.setInt(HA_BATTERY_SOH, battery.soh);
+
+  haDiscovery.setFloat(HA_MP_DC_VOLTAGE, multiplus.dcVoltage);
+  haDiscovery.setFloat(HA_MP_DC_CURRENT, multiplus.dcCurrent);
+  haDiscovery.setFloat(HA_MP_AC_VOLTAGE, multiplus.uMainsRMS);
+  haDiscovery.setFloat(HA_MP_AC_FREQUENCY, multiplus.acFrequency);
+  haDiscovery.setFloat(HA_MP_INVERTER_POWER, multiplus.pinverterFiltered);
+  haDiscovery.setFloat(HA_MP_MAINS_POWER, multiplus.pmainsFiltered);
+  haDiscovery.setFloat(HA_MP_ESS_POWER, multiplus.esspower);
+  haDiscovery.setFloat(HA_MP_TEMPERATURE, multiplus.temp);
+
+  haDiscovery.setFloat(HA_GRID_POWER, systemData.electricMeter.power);
+  haDiscovery.setFloat(HA_GRID_CONSUMPTION, systemData.electricMeter.consumption);
+  haDiscovery.setFloat(HA_GRID_FEED_IN, systemData.electricMeter.feedIn);
+
+  haDiscovery.setBool(HA_FEEDIN_ENABLED, feedInControlEnabled);
+  haDiscovery.setFloat(HA_FEEDIN_TARGET, targetFeedInPower);
+  haDiscovery.setFloat(HA_FEEDIN_MAX, maxFeedInPower);
+  haDiscovery.setText(HA_ESS_STRATEGY, systemData.essControl.essStrategy);
+
+  if (haResendState) {
+    haResendState = false;
+    haDiscovery.invalidate();
+  }
+  uint8_t due = haDiscovery.takeDueGroups(millis());
+  for (uint8_t group = 0; group < HA_GROUP_COUNT; group++) {
+    if (!(due & (1u << group))) continue;
+    if (haDiscovery.serializeState(group, haTopic, sizeof(haTopic), haPayload, sizeof(haPayload)) > 0) {
+      mqttClient.publish(haTopic, haPayload);
+    }
+  }
+}
+
+// MQTT commands, dispatched from mqttClient.loop(). Values are parsed and
+// range checked by the router before a handler sees them.
+bool onFeedInEnabled(const MqttRoute& route, const char* topic, MqttValue value) {
+  feedInControlEnabled = value.b;
+  applyFeedInSettings();
+  return true;
+}
+
+// While the impulse meter is the decisive source the loop cannot see feed-in
+// and runs with target 0 instead, see EssControlInput::meterImportOnly
+bool onFeedInTarget(const MqttRoute& route, const char* topic, MqttValue value) {
+  targetFeedInPower = value.f > maxFeedInPower ? maxFeedInPower : value.f;
+  applyFeedInSettings();
+  return true;
+}
+
+bool onFeedInMax(const MqttRoute& route, const char* topic, MqttValue value) {
+  maxFeedInPower = value.f;
+  if (targetFeedInPower > maxFeedInPower) targetFeedInPower = maxFeedInPower;
+  applyFeedInSettings();
+  return true;
+}
+
+// Direct setpoint, only while the feed-in control loop does not own it
+bool onEssSetpoint(const MqttRoute& route, const char* topic, MqttValue value) {
+  if (feedInControlEnabled) return false;
+  return veBusHandler.sendEssPowerCommand((int16_t)value.i);
+}
+
+bool onSwitchState(const MqttRoute& route, const char* topic, MqttValue value) {
+  return veBusHandler.setSwitchState((VeBusSwitchState)value.i);
+}
+
+bool onCurrentLimit(const MqttRoute& route, const char* topic, MqttValue value) {
+  return veBusHandler.sendCurrentLimitCommand((uint8_t)value.i);
+}
+
+bool onChargeOnly(const MqttRoute& route, const char* topic, MqttValue value) {
+  return veBusHandler.setSwitchState(value.b ? VEBUS_SWITCH_CHARGER_ONLY : VEBUS_SWITCH_ON);
+}
+
+static const MqttEnumName switchStateNames[] = {
+  {"charger_only", VEBUS_SWITCH_CHARGER_ONLY},
+  {"inverter_only", VEBUS_SWITCH_INVERTER_ONLY},
+  {"on", VEBUS_SWITCH_ON},
+  {"off", VEBUS_SWITCH_OFF},
+};
+
+static const MqttRoute mqttRoutes[] = {
+  {"ess/feedin/enabled", MQTT_VALUE_BOOL, 0, 0, nullptr, 0, onFeedInEnabled},
+  {"ess/feedin/target", MQTT_VALUE_FLOAT, 0, 10000, nullptr, 0, onFeedInTarget},
+  {"ess/feedin/max", MQTT_VALUE_FLOAT, 100, 10000, nullptr, 0, onFeedInMax},
+  {"ess/set/setpoint", MQTT_VALUE_INT, -5000, 5000, nullptr, 0, onEssSetpoint},
+  {"ess/set/switch", MQTT_VALUE_ENUM, 0, 0, switchStateNames, 4, onSwitchState},
+  {"ess/set/current_limit", MQTT_VALUE_INT, 1, 50, nullptr, 0, onCurrentLimit},
+  {"ess/set/charge_only", MQTT_VALUE_BOOL, 0, 0, nullptr, 0, onChargeOnly},
+};
+
+MqttRouter mqttRouter(mqttRoutes, sizeof(mqttRoutes) / sizeof(mqttRoutes[0]));
+
+void onMqttMessage(const char* topic, const char* payload) {
+  MqttRouteResult result = mqttRouter.dispatch(topic, payload);
+  if (result != MQTT_ROUTE_OK) {
+    Serial.printf("MQTT command %s '%s': %s\n", topic, payload, MqttRouter::resultName(result));
+  }
 }
 
 void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
   if (type == WS_EVT_CONNECT) {
     Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
-    // Send debug message when client connects
-    char connectMsg[64];
-    snprintf(connectMsg, sizeof(connectMsg), "WebSocket client #%u connected", client->id());
-    publishDebugMessage(connectMsg, "success");
-    sendFullStatusToClient(client);
+    LOG_SUCCESS(LOG_MODULE_WEB, "WebSocket client #%u connected", client->id());
+    addTelemetryClient(client->id());
   } else if (type == WS_EVT_DISCONNECT) {
-    Serial.printf("WebSocket client #%u disconnected\n", client->id());
-    char disconnectMsg[64];
-    snprintf(disconnectMsg, sizeof(disconnectMsg), "WebSocket client #%u disconnected", client->id());
-    publishDebugMessage(disconnectMsg, "warning");
+    removeTelemetryClient(client->id());
+    streamServer.removeClient(client->id());
+    LOG_WARNING(LOG_MODULE_WEB, "WebSocket client #%u disconnected", client->id());
+  } else if (type == WS_EVT_DATA) {
+    // Telemetry format switch: {"telemetry":"binary"} or {"telemetry":"json"}
+    // High-rate stream: {"stream":{"signals":["ac_power",...],"rate":50}}, {"stream":{}} stops
+    AwsFrameInfo* info = (AwsFrameInfo*)arg;
+    if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+      JsonDocument doc;
+      if (deserializeJson(doc, data, len)) {
+        return;
+      }
+      if (doc["telemetry"].is<const char*>()) {
+        setTelemetryFormat(client->id(), strcmp(doc["telemetry"], "binary") == 0);
+      }
+      if (doc["stream"].is<JsonObject>()) {
+        uint8_t signals = 0;
+        for (JsonVariant name : doc["stream"]["signals"].as<JsonArray>()) {
+          int signal = streamSignalFromName(name | "");
+          if (signal >= 0) {
+            signals |= 1 << signal;
+          }
+        }
+        uint16_t rate = doc["stream"]["rate"] | STREAM_MAX_RATE_HZ;
+        if (!streamServer.subscribe(client->id(), signals, rate)) {
+          LOG_WARNING(LOG_MODULE_WEB, "Signal stream: all stream slots in use");
+        }
+      }
+    }
   }
 }
 
 // Main processing functions
 void updateStatusLED() {
   // Update LED based on current power flow
-  if (systemData.battery.power > 100) {
+  int32_t batteryPower = pylontechCAN.getBattery().power;
+  if (batteryPower > 100) {
     // Positive power = charging
-    statusLED.updatePowerFlow(systemData.battery.power);
-  } else if (systemData.battery.power < -100) {
+    statusLED.updatePowerFlow(batteryPower);
+  } else if (batteryPower < -100) {
     // Negative power = discharging
-    statusLED.updatePowerFlow(systemData.battery.power);
+    statusLED.updatePowerFlow(batteryPower);
   } else {
     // Low power = idle
     statusLED.updatePowerFlow(0);
@@ -275,15 +596,20 @@ void setupOTA() {
     }
     // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
     Serial.println("Start updating " + type);
+    eventLog.logEvent(EVENT_OTA_START, 0);
+    eventLog.saveState();
   });
   ArduinoOTA.onEnd([]() {
     Serial.println("\nEnd");
+    eventLog.logEvent(EVENT_OTA_DONE, 0);
+    eventLog.saveState();
   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
     Serial.printf("Progress: %u%%\r", (progress * 100) / total);
   });
   ArduinoOTA.onError([](ota_error_t error) {
     Serial.printf("Error[%u]: ", error);
+    eventLog.logEvent(EVENT_OTA_FAILED, error);
     if (error == OTA_AUTH_ERROR) {
       Serial.println("Auth Failed");
     } else if (error == OTA_BEGIN_ERROR) {
@@ -334,6 +660,8 @@ void setupOTA() {
     if(!index){
       Serial.printf("Update Start: %s\n", filename.c_str());
       statusLED.setBootMode();
+      eventLog.logEvent(EVENT_OTA_START, 1);
+      eventLog.saveState();
       if(!Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000)){
         Update.printError(Serial);
       }
@@ -347,9 +675,12 @@ void setupOTA() {
       if(Update.end(true)){
         Serial.printf("Update Success: %uB\n", index+len);
         statusLED.setWiFiConnected();
+        eventLog.logEvent(EVENT_OTA_DONE, 1);
+        eventLog.saveState();
       } else {
         Update.printError(Serial);
         statusLED.setErrorMode();
+        eventLog.logEvent(EVENT_OTA_FAILED, 1);
       }
     }
   });
@@ -381,7 +712,8 @@ void setupWebServer() {
     }
     if (request->hasParam("target", true)) {
       targetFeedInPower = request->getParam("target", true)->value().toFloat();
-      // Clamp to reasonable limits
+      // Clamp to reasonable limits. The control loop uses 0 instead while the
+      // impulse meter, which cannot see feed-in, is the decisive meter.
       if (targetFeedInPower < 0) targetFeedInPower = 0;
       if (targetFeedInPower > maxFeedInPower) targetFeedInPower = maxFeedInPower;
     }
@@ -391,6 +723,7 @@ void setupWebServer() {
       if (maxFeedInPower < 100) maxFeedInPower = 100;
       if (maxFeedInPower > 10000) maxFeedInPower = 10000;
     }
+    applyFeedInSettings();
     
     // Send response with current settings (memory-efficient)
     char jsonResponse[128];
@@ -432,13 +765,17 @@ void setupWebServer() {
   
   // MQTT status endpoint (with configuration data)
   webServer.on("/api/mqtt", HTTP_GET, [](AsyncWebServerRequest *request){
-    char response[256];
+    MqttOutboxStats outboxStats = mqttClient.getOutboxStats();
+    char response[384];
     snprintf(response, sizeof(response), 
-             "{\"connected\":%s,\"server\":\"%s\",\"port\":%d,\"username\":\"%s\",\"password\":\"\",\"lastMessage\":\"N/A\"}", 
+             "{\"connected\":%s,\"server\":\"%s\",\"port\":%d,\"username\":\"%s\",\"password\":\"\",\"lastMessage\":\"N/A\","
+             "\"connects\":%lu,\"queued\":%lu,\"replaced\":%lu,\"dropped\":%lu}", 
              mqttClient.isConnected() ? "true" : "false",
              strlen(mqttClient.mqttServer) > 0 ? mqttClient.mqttServer : "",
              mqttClient.mqttPort > 0 ? mqttClient.mqttPort : 1883,
-             strlen(mqttClient.mqttUsername) > 0 ? mqttClient.mqttUsername : "");
+             strlen(mqttClient.mqttUsername) > 0 ? mqttClient.mqttUsername : "",
+             (unsigned long)mqttClient.getConnectCount(), (unsigned long)outboxStats.queued,
+             (unsigned long)outboxStats.replaced, (unsigned long)outboxStats.dropped);
     
     request->send(200, "application/json", response);
     
@@ -477,6 +814,7 @@ void setupWebServer() {
       static const char html_end[] PROGMEM = "</p><p><em>Note: SPIFFS not available, using fallback HTML</em></p></body></html>";
       
       // Build response with minimal string operations
+      PylontechBatteryState battery = pylontechCAN.getBattery();
       String response;
       response.reserve(512); // Pre-allocate to reduce fragmentation
       response += FPSTR(html_start);
@@ -484,9 +822,9 @@ void setupWebServer() {
       response += FPSTR(html_ip);
       response += WiFi.localIP().toString();
       response += FPSTR(html_battery);
-      response += systemData.battery.soc;
+      response += battery.soc;
       response += FPSTR(html_power);
-      response += systemData.battery.power;
+      response += battery.power;
       response += FPSTR(html_can);
       response += pylontechCAN.isBatteryOnline() ? "Online" : "Offline";
       response += FPSTR(html_end);
@@ -500,6 +838,7 @@ void setupWebServer() {
   // Setup WebSocket
   ws.onEvent(onWsEvent);
   webServer.addHandler(&ws);
+  streamServer.begin(&ws);
   
   // Start the web server
   webServer.begin();
@@ -509,18 +848,10 @@ void setupWebServer() {
   Serial.println(WiFi.localIP());
   
   // Setup MQTT
-  auto onMqttMessage = [](const char* topic, const char* payload) {
-    if (strcmp(topic, "ess/feedin/enabled") == 0) {
-      feedInControlEnabled = (strcmp(payload, "true") == 0 || strcmp(payload, "1") == 0);
-    } else if (strcmp(topic, "ess/feedin/target") == 0) {
-      targetFeedInPower = atof(payload);
-    } else if (strcmp(topic, "ess/feedin/max") == 0) {
-      maxFeedInPower = atof(payload);
-    }
-  };
-  
   mqttClient.setCallback(onMqttMessage);
-  // MQTT will auto-connect with saved credentials
+  mqttClient.setConnectCallback(publishHomeAssistantDiscovery);
+  // Connects in its own task with the saved credentials
+  mqttClient.begin();
 }
 
 void onTimer() {
@@ -531,13 +862,16 @@ void setup() {
   Serial.begin(115200);
   Serial.println("\nVictron ESS Controller Starting...");
   
-  // Initialize system data with default values
-  systemData.battery.voltage = 0.0;
-  systemData.battery.current = 0.0;
-  systemData.battery.power = 0;
-  systemData.battery.soc = 0;
-  systemData.battery.temperature = 0.0;
+  // Debug messages are formatted and sent from the log task, never from the caller
+  debugLog.setSink(LOG_SINK_WEBSOCKET, sendLogToWebSocket, LOG_LEVEL_DEBUG,
+                   DEBUG_LOG_WEBSOCKET_RATE, DEBUG_LOG_WEBSOCKET_BURST);
+  debugLog.setSink(LOG_SINK_MQTT, sendLogToMqtt, LOG_LEVEL_INFO, DEBUG_LOG_MQTT_RATE, DEBUG_LOG_MQTT_BURST);
+  debugLog.begin();
+  
+  // Home Assistant node id from the MAC, stable across firmware updates
+  snprintf(haNodeId, sizeof(haNodeId), "victron_ess_%06lx", (unsigned long)((ESP.getEfuseMac() >> 24) & 0xFFFFFF));
   
+  // Initialize system data with default values
   systemData.multiplus.dcVoltage = 0.0;
   systemData.multiplus.dcCurrent = 0.0;
   systemData.multiplus.temp = 0.0;
@@ -558,22 +892,47 @@ void setup() {
     loadConfigFromSPIFFS();
   }
   
+  // Energy counters and event log from flash, before anything is logged
+  eventLog.begin();
+  
   // Setup WiFi connection
   setupWiFiConnection();
   
   // Setup OTA updates
   setupOTA();
   
+  // Signal history for /api/history
+  historyRecorder.begin();
+  
   // Setup web server
   setupWebServer();
   
   // Initialize VE.Bus communication (separate task)
+  veBusHandler.setSignalStream(streamServer.getRing());
   if (!veBusHandler.begin()) {
     Serial.println("VE.Bus initialization failed");
     statusLED.setErrorMode();
   } else {
     Serial.println("VE.Bus communication started");
-    veBusHandler.enableDebugMode(true); // Enable debug output
+  }
+  
+  // ESS setpoint control loop, runs on the VE.Bus sync frames
+  applyFeedInSettings();
+  if (!essController.begin(&veBusHandler)) {
+    Serial.println("ESS control loop initialization failed");
+    statusLED.setErrorMode();
+  } else {
+    Serial.println("ESS control loop started");
+  }
+  
+  // SML smart meter on the IR interface, feeds the control loop (optional)
+  if (smlMeter.begin(&Serial1, &essController)) {
+    Serial.println("SML meter reader started");
+  }
+  
+  // Optical impulse meter, used by the control loop while no SML meter delivers (optional)
+  if (impulseMeter.begin(&essController)) {
+    Serial.println("Impulse meter reader started");
   }
   
   // Initialize Pylontech CAN communication (separate task)
@@ -598,13 +957,10 @@ void setup() {
   Serial.println("OTA Update: http://" + WiFi.localIP().toString() + "/update");
   Serial.println("VE.Bus Task: " + String(veBusHandler.isTaskRunning() ? "Running" : "Stopped"));
   Serial.println("CAN Task: " + String(pylontechCAN.isTaskRunning() ? "Running" : "Stopped"));
+  Serial.println("ESS Control Task: " + String(essController.isTaskRunning() ? "Running" : "Stopped"));
   Serial.println("==============================================");
   
-  // Send test debug message to verify WebSocket connection
-  publishDebugMessage("System startup complete - Debug console active", "success");
-  
-  // Send another test message immediately
-  publishDebugMessage("WebSocket connection test - this should appear in debug console", "info");
+  LOG_SUCCESS(LOG_MODULE_SYSTEM, "System startup complete - Debug console active");
 }
 
 void loop() {
@@ -615,7 +971,7 @@ void loop() {
   if (wifiProvisioning.isConnected()) {
     ArduinoOTA.handle();
     
-    // Handle MQTT
+    // Received MQTT commands; connecting and sending happen in the MQTT task
     mqttClient.loop();
     
     unsigned long currentTime = millis();
@@ -626,6 +982,12 @@ void loop() {
       processTimerEvents();
     }
     
+    // Snapshot for newly connected WebSocket clients
+    sendPendingSnapshots();
+    
+    // High-rate signal stream to subscribed clients
+    streamServer.loop();
+    
     // Update status LED
     if (currentTime - lastLedUpdate >= LED_UPDATE_INTERVAL) {
       lastLedUpdate = currentTime;
@@ -637,135 +999,38 @@ void loop() {
     if (currentTime - lastStatusUpdate >= STATUS_UPDATE_INTERVAL) {
       lastStatusUpdate = currentTime;
       
-      // Send test debug message every 5 seconds to verify WebSocket connection
-      static unsigned long lastDebugTest = 0;
-      if (currentTime - lastDebugTest >= 2000) {  // Every 2 seconds
-        lastDebugTest = currentTime;
-        char testMsg[64];
-        snprintf(testMsg, sizeof(testMsg), "WebSocket test - VE.Bus Task: %s", 
-                 veBusHandler.isTaskRunning() ? "Running" : "Stopped");
-        publishDebugMessage(testMsg, "info");
-      }
-      
-      // Send VE.Bus debug info via MQTT
-      if (mqttClient.isConnected()) {
-        auto veBusStats = veBusHandler.getStatistics();
-        char debugMsg[256];
-        snprintf(debugMsg, sizeof(debugMsg), 
-                 "VE.Bus Status: framesSent=%u, framesReceived=%u, isRunning=%d, taskRunning=%d", 
-                 veBusStats.framesSent, veBusStats.framesReceived, 
-                 veBusHandler.isTaskRunning(), veBusHandler.isTaskRunning());
-        mqttClient.publishDebug(debugMsg);
-      }
-      
-      // Send WebSocket update to all connected clients - comprehensive data
-      if (ws.count() > 0) {
-        JsonDocument wsDoc;
-        String wsJson;
-        wsJson.reserve(1024); // Larger buffer for all data
-        
-        // Battery data
-        wsDoc["battery_soc"] = systemData.battery.soc;
-        wsDoc["battery_voltage"] = systemData.battery.voltage;
-        wsDoc["battery_current"] = systemData.battery.current;
-        wsDoc["battery_power"] = systemData.battery.power;
-        wsDoc["battery_temperature"] = systemData.battery.temperature;
-        wsDoc["battery_soh"] = systemData.battery.soh;
-        wsDoc["battery_chargeVoltage"] = systemData.battery.chargeVoltage;
-        wsDoc["battery_chargeCurrentLimit"] = systemData.battery.chargeCurrentLimit;
-        wsDoc["battery_dischargeCurrentLimit"] = systemData.battery.dischargeCurrentLimit;
-        wsDoc["battery_manufacturer"] = systemData.battery.manufacturer;
-        serializeJson(wsDoc, wsJson);
-        ws.textAll(wsJson);
-        wsDoc.clear();
-
-        // MultiPlus data
-        wsDoc["multiplusDcVoltage"] = systemData.multiplus.dcVoltage;
-        wsDoc["multiplusDcCurrent"] = systemData.multiplus.dcCurrent;
-        wsDoc["multiplusUMainsRMS"] = systemData.multiplus.uMainsRMS;
-        wsDoc["multiplusAcFrequency"] = systemData.multiplus.acFrequency;
-        wsDoc["multiplusPinverterFiltered"] = systemData.multiplus.pinverterFiltered;
-        wsDoc["multiplusPmainsFiltered"] = systemData.multiplus.pmainsFiltered;
-        wsDoc["multiplusPowerFactor"] = systemData.multiplus.powerFactor;
-        wsDoc["multiplusTemp"] = systemData.multiplus.temp;
-        wsDoc["multiplusStatus80"] = systemData.multiplus.status80;
-        wsDoc["masterMultiLED_ActualInputCurrentLimit"] = systemData.multiplus.masterMultiLED_ActualInputCurrentLimit;
-        wsDoc["multiplusESSpower"] = systemData.multiplus.esspower;
-        serializeJson(wsDoc, wsJson);
-        ws.textAll(wsJson);
-        wsDoc.clear();
-
-        // VE.Bus data
+      // VE.Bus state for the debug console, only while the module is at debug level
+      if (debugLog.isEnabled(LOG_LEVEL_DEBUG, LOG_MODULE_VEBUS)) {
         auto veBusStats = veBusHandler.getStatistics();
-        wsDoc["veBus_isOnline"] = veBusHandler.isTaskRunning();
-        wsDoc["veBus_communicationQuality"] = veBusHandler.getCommunicationQuality();
-        wsDoc["veBus_framesSent"] = veBusStats.framesSent;
-        wsDoc["veBus_framesReceived"] = veBusStats.framesReceived;
-        wsDoc["veBus_checksumErrors"] = veBusStats.checksumErrors;
-        wsDoc["veBus_timeoutErrors"] = veBusStats.timeoutErrors;
-        serializeJson(wsDoc, wsJson);
-        ws.textAll(wsJson);
-        wsDoc.clear();
-
-        // ESS Control data
-        wsDoc["switchMode"] = systemData.essControl.switchMode;
-        wsDoc["essPowerStrategy"] = systemData.essControl.essStrategy;
-        wsDoc["secondsInMinStrategy"] = systemData.essControl.secondsInMinStrategy;
-        wsDoc["secondsInMaxStrategy"] = systemData.essControl.secondsInMaxStrategy;
-        wsDoc["bmsPowerAverage"] = systemData.battery.power;
-
-        // Feed-in control
-        wsDoc["feedInControl_enabled"] = feedInControlEnabled;
-        wsDoc["feedInControl_current"] = systemData.multiplus.esspower;
-        wsDoc["feedInControl_target"] = targetFeedInPower;
-        wsDoc["feedInControl_max"] = maxFeedInPower;
-
-        // Status LED
-        wsDoc["statusLED_mode"] = 3; // Normal operation
-
-        // MQTT status
-        wsDoc["mqtt"]["connected"] = mqttClient.isConnected();
-        wsDoc["mqtt"]["server"] = mqttClient.mqttServer;
-        wsDoc["mqtt"]["port"] = mqttClient.mqttPort;
-        
-        serializeJson(wsDoc, wsJson);
-        ws.textAll(wsJson);
-        wsDoc.clear();
+        LOG_DEBUG(LOG_MODULE_VEBUS, "VE.Bus Status: framesSent=%u, framesReceived=%u, taskRunning=%d",
+                  veBusStats.framesSent, veBusStats.framesReceived, veBusHandler.isTaskRunning());
       }
       
-      // Publish to MQTT (string-free version)
-      char buffer[32];
-      snprintf(buffer, sizeof(buffer), "%d", systemData.battery.soc);
-      mqttClient.publish("ess/battery/soc", buffer);
-      
-      snprintf(buffer, sizeof(buffer), "%.2f", systemData.battery.voltage);
-      mqttClient.publish("ess/battery/voltage", buffer);
-      
-      snprintf(buffer, sizeof(buffer), "%.1f", systemData.battery.power);
-      mqttClient.publish("ess/battery/power", buffer);
+      // 1 s samples for /api/history
+      historyRecorder.sample();
       
-      snprintf(buffer, sizeof(buffer), "%.1f", systemData.multiplus.esspower);
-      mqttClient.publish("ess/multiplus/power", buffer);
+      // Energy counters and min/max trackers, periodically written to flash
+      eventLog.loop();
       
-      mqttClient.publish("ess/feedin/enabled", feedInControlEnabled ? "true" : "false");
-      
-      snprintf(buffer, sizeof(buffer), "%.1f", targetFeedInPower);
-      mqttClient.publish("ess/feedin/target", buffer);
+      // Changed fields to all connected clients
+      if (ws.count() > 0) {
+        sendTelemetryUpdate();
+      }
       
-      snprintf(buffer, sizeof(buffer), "%.1f", maxFeedInPower);
-      mqttClient.publish("ess/feedin/max", buffer);
+      // Home Assistant state, only groups that changed
+      if (mqttClient.isConnected()) {
+        publishHomeAssistantState();
+      }
       
       // Log current status
-      Serial.printf("Battery: %.1fV, %.1fA, %dW, SOC:%d%% | ", 
-                    systemData.battery.voltage, 
-                    systemData.battery.current,
-                    systemData.battery.power,
-                    systemData.battery.soc);
-      Serial.printf("CAN: %s, VE.Bus: %s, MQTT: %s | ",
-                    pylontechCAN.isBatteryOnline() ? "Online" : "Offline",
-                    veBusHandler.isTaskRunning() ? "Running" : "Stopped",
-                    mqttClient.isConnected() ? "Connected" : "Disconnected");
-      Serial.printf("WiFi: %s\r\n", WiFi.isConnected() ? "Connected" : "Disconnected");
+      if (debugLog.isEnabled(LOG_LEVEL_DEBUG, LOG_MODULE_SYSTEM)) {
+        PylontechBatteryState battery = pylontechCAN.getBattery();
+        LOG_DEBUG(LOG_MODULE_SYSTEM, "Battery: %d mV, %d mA, %d W, SOC %d%%",
+                  (int32_t)(battery.voltage * 1000), (int32_t)(battery.current * 1000), battery.power, battery.soc);
+        LOG_DEBUG(LOG_MODULE_SYSTEM, "CAN online: %d, VE.Bus running: %d, MQTT connected: %d, WiFi connected: %d",
+                  pylontechCAN.isBatteryOnline(), veBusHandler.isTaskRunning(), mqttClient.isConnected(),
+                  WiFi.isConnected());
+      }
     }
     
     // Clean up WebSocket connections
@@ -779,20 +1044,23 @@ void loop() {
   delay(1);
 }
 
-// Global debug function for MQTT and WebSocket publishing
-void publishDebugMessage(const String& message, const String& level) {
-  // Send to MQTT if connected
-  if (mqttClient.isConnected()) {
-    mqttClient.publishDebug(message.c_str());
+// Debug log sinks, called from the log task
+void sendLogToWebSocket(const LogRecord& record, const char* text) {
+  if (ws.count() == 0) {
+    return;
   }
-
-  // Send to WebSocket for real-time web interface debugging
   JsonDocument doc;
-  doc["debug"]["level"] = level;
-  doc["debug"]["message"] = message;
-  doc["debug"]["timestamp"] = millis();
-
-  String wsJson;
-  serializeJson(doc, wsJson);
-  ws.textAll(wsJson);
-}
\ No newline at end of file
+  doc["debug"]["level"] = logLevelName(record.level);
+  doc["debug"]["message"] = text;
+  doc["debug"]["timestamp"] = record.timeMs;
+
+  char json[LOG_TEXT_MAX + 96];
+  size_t length = serializeJson(doc, json, sizeof(json));
+  ws.textAll(json, length);
+}
+
+void sendLogToMqtt(const LogRecord& record, const char* text) {
+  if (mqttClient.isConnected()) {
+    mqttClient.publishDebug(text);
+  }
+}
@@ -1,5 +1,6 @@
 #include "mqtt_minimal.h"
 #include <string.h>
+#include <esp_system.h>
 
 MQTTMinimal* mqttInstance = nullptr;
 
@@ -9,16 +10,56 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
     }
 }
 
-MQTTMinimal::MQTTMinimal() : client(wifiClient), lastReconnect(0), mqttPort(1883) {
+MQTTMinimal::MQTTMinimal() : mqttPort(1883), client(wifiClient), mutex(nullptr), inbox(nullptr), taskHandle(nullptr),
+                             connected(false), configChanged(false), connectCount(0), port(1883), failures(0), nextAttempt(0) {
     mqttInstance = this;
     client.setCallback(mqttCallback);
+    client.setBufferSize(MQTT_BUFFER_SIZE);
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
     strcpy(mqttServer, "192.168.30.1"); // Default
     mqttUsername[0] = '\0';
     mqttPassword[0] = '\0';
-    payloadBuffer[0] = '\0';
+    clientId[0] = '\0';
+    server[0] = '\0';
+    username[0] = '\0';
+    password[0] = '\0';
+}
+
+void MQTTMinimal::begin() {
+    if (mutex == nullptr) {
+        mutex = xSemaphoreCreateMutex();
+        inbox = xQueueCreate(MQTT_INBOX_DEPTH, sizeof(InboundMessage));
+        if (mutex == nullptr || inbox == nullptr) {
+            Serial.println("MQTT: Failed to create mutex or queue");
+            return;
+        }
+    }
+    configChanged = true;
+
+    if (taskHandle == nullptr) {
+        // Unique per device, two controllers on one broker would kick each other out
+        snprintf(clientId, sizeof(clientId), "ESP32ESS-%06lx", (unsigned long)((ESP.getEfuseMac() >> 24) & 0xFFFFFF));
+
+        BaseType_t result = xTaskCreatePinnedToCore(
+            taskWrapper,
+            "MQTT",
+            MQTT_TASK_STACK_SIZE,
+            this,
+            MQTT_TASK_PRIORITY,
+            &taskHandle,
+            MQTT_TASK_CORE
+        );
+        if (result != pdPASS) {
+            Serial.println("MQTT: Failed to create task");
+            taskHandle = nullptr;
+        }
+    } else {
+        xTaskNotifyGive(taskHandle);
+    }
 }
 
 void MQTTMinimal::begin(const char* server, int port, const char* username, const char* password) {
+    if (mutex != nullptr) xSemaphoreTake(mutex, portMAX_DELAY);
     strncpy(mqttServer, server, sizeof(mqttServer) - 1);
     mqttServer[sizeof(mqttServer) - 1] = '\0';
     
@@ -29,34 +70,42 @@ void MQTTMinimal::begin(const char* server, int port, const char* username, cons
     
     strncpy(mqttPassword, password, sizeof(mqttPassword) - 1);
     mqttPassword[sizeof(mqttPassword) - 1] = '\0';
+    if (mutex != nullptr) xSemaphoreGive(mutex);
     
-    client.setServer(server, port);
+    begin();
 }
 
 void MQTTMinimal::loop() {
-    if (!client.connected()) {
-        if (millis() - lastReconnect > 5000) {
-            connect();
-            lastReconnect = millis();
+    if (inbox == nullptr) return;
+
+    InboundMessage message;
+    while (xQueueReceive(inbox, &message, 0) == pdTRUE) {
+        if (messageCallback) {
+            messageCallback(message.topic, message.payload);
         }
-    } else {
-        client.loop();
     }
 }
 
-bool MQTTMinimal::isConnected() {
-    return client.connected();
-}
+void MQTTMinimal::publish(const char* topic, const char* value, bool retained) {
+    if (taskHandle == nullptr) return;
 
-void MQTTMinimal::publish(const char* topic, const char* value) {
-    if (isConnected()) {
-        client.publish(topic, value);
+    if (xTaskGetCurrentTaskHandle() == taskHandle) {
+        // Connect callback, the outbox would drop most of a burst
+        if (client.connected()) {
+            client.publish(topic, value, retained);
+        }
+        return;
     }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    outbox.push(topic, value, retained);
+    xSemaphoreGive(mutex);
+    xTaskNotifyGive(taskHandle);
 }
 
 void MQTTMinimal::publishDebug(const char* message) {
     if (isConnected()) {
-        client.publish("esp32victron/debug/vebus", message);
+        publish("esp32victron/debug/vebus", message);
     }
 }
 
@@ -64,30 +113,124 @@ void MQTTMinimal::setCallback(std::function<void(const char* topic, const char*
     messageCallback = callback;
 }
 
-void MQTTMinimal::connect() {
-    if (WiFi.status() != WL_CONNECTED || strlen(mqttServer) == 0) return;
-    
-    const char* clientId = "ESP32ESS";
-    bool connected = false;
+void MQTTMinimal::setConnectCallback(std::function<void()> callback) {
+    connectCallback = callback;
+}
+
+MqttOutboxStats MQTTMinimal::getOutboxStats() {
+    MqttOutboxStats stats = {};
+    if (mutex == nullptr) return stats;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    stats = outbox.getStats();
+    xSemaphoreGive(mutex);
+    return stats;
+}
+
+void MQTTMinimal::taskWrapper(void* parameter) {
+    MQTTMinimal* mqtt = static_cast<MQTTMinimal*>(parameter);
+    mqtt->mqttTask();
+}
+
+void MQTTMinimal::mqttTask() {
+    for (;;) {
+        if (configChanged) {
+            applyConfig();
+        }
+
+        if (!client.connected()) {
+            if (connected) {
+                connected = false;
+                failures = 0;
+                nextAttempt = millis() + mqttBackoffMs(0, esp_random());
+                Serial.println("MQTT: Connection lost");
+            }
+
+            if (WiFi.status() == WL_CONNECTED && strlen(server) > 0 && (int32_t)(millis() - nextAttempt) >= 0) {
+                if (connect()) {
+                    failures = 0;
+                    connected = true;
+                    connectCount++;
+                } else {
+                    if (failures < 255) failures++;
+                    uint32_t delayMs = mqttBackoffMs(failures, esp_random());
+                    nextAttempt = millis() + delayMs;
+                    Serial.printf("MQTT: Connect to %s:%d failed (state %d), retry in %lu ms\n",
+                                  server, port, client.state(), (unsigned long)delayMs);
+                }
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        client.loop();
+        sendQueued();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_TASK_POLL_MS));
+    }
+}
+
+void MQTTMinimal::applyConfig() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    configChanged = false;
+    strncpy(server, mqttServer, sizeof(server));
+    port = mqttPort;
+    strncpy(username, mqttUsername, sizeof(username));
+    strncpy(password, mqttPassword, sizeof(password));
+    xSemaphoreGive(mutex);
+
+    if (client.connected()) {
+        client.disconnect();
+    }
+    connected = false;
+    client.setServer(server, port);
+    failures = 0;
+    nextAttempt = millis();
+}
+
+bool MQTTMinimal::connect() {
+    bool ok = false;
     
-    if (strlen(mqttUsername) > 0) {
-        connected = client.connect(clientId, mqttUsername, mqttPassword);
+    // The broker publishes "offline" for us when the connection is lost
+    if (strlen(username) > 0) {
+        ok = client.connect(clientId, username, password, MQTT_STATUS_TOPIC, 0, true, "offline");
     } else {
-        connected = client.connect(clientId);
+        ok = client.connect(clientId, MQTT_STATUS_TOPIC, 0, true, "offline");
     }
-    
-    if (connected) {
-        client.subscribe("ess/feedin/+");
+    if (!ok) return false;
+
+    Serial.printf("MQTT: Connected to %s:%d as %s\n", server, port, clientId);
+    client.publish(MQTT_STATUS_TOPIC, "online", true);
+    client.subscribe("ess/feedin/+", MQTT_COMMAND_QOS);
+    client.subscribe("ess/set/+", MQTT_COMMAND_QOS);
+    if (connectCallback) {
+        connectCallback();
     }
+    return true;
 }
 
-void MQTTMinimal::onMessage(char* topic, byte* payload, unsigned int length) {
-    if (messageCallback) {
-        // Null-terminate payload in buffer
-        if (length < sizeof(payloadBuffer)) {
-            memcpy(payloadBuffer, payload, length);
-            payloadBuffer[length] = '\0';
-            messageCallback(topic, payloadBuffer);
+void MQTTMinimal::sendQueued() {
+    for (;;) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool available = outbox.pop(sending);
+        xSemaphoreGive(mutex);
+        if (!available) return;
+
+        // A failed write means the connection is gone, the next round reconnects
+        if (!client.publish(sending.topic, (const uint8_t*)sending.payload, sending.length, sending.retained)) {
+            return;
         }
     }
 }
+
+void MQTTMinimal::onMessage(char* topic, byte* payload, unsigned int length) {
+    // MQTT task; the callback runs in loop()
+    InboundMessage message;
+    if (length >= sizeof(message.payload) || strlen(topic) >= sizeof(message.topic)) return;
+
+    strcpy(message.topic, topic);
+    memcpy(message.payload, payload, length);
+    message.payload[length] = '\0';
+    if (xQueueSend(inbox, &message, 0) != pdTRUE) {
+        Serial.println("MQTT: Inbox full, message dropped");
+    }
+}
@@ -1,19 +1,53 @@
 #pragma once
 
+/*
+ * MQTT client running in its own task.
+ *
+ * Connecting, reading and writing happen only in the MQTT task, so a broker
+ * that is down never stalls the Arduino loop. publish() puts the message into
+ * a bounded outbox (MqttOutbox, latest payload per topic) and wakes the task.
+ * Received messages are handed to the message callback from loop(), in the
+ * Arduino loop like before. Reconnects back off exponentially with jitter.
+ */
+
 #include <WiFi.h>
 #include <PubSubClient.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include "mqtt_outbox.h"
+
+#define MQTT_STATUS_TOPIC "ess/status"   // Retained "online" as birth, "offline" as last will
+#define MQTT_BUFFER_SIZE 768             // Largest outbox message plus MQTT header
+#define MQTT_COMMAND_QOS 1               // Commands (ess/feedin/+, ess/set/+) are acknowledged, 0 to turn off
+#define MQTT_INBOX_DEPTH 4
+#define MQTT_INBOX_TOPIC_MAX 48
+#define MQTT_INBOX_PAYLOAD_MAX 64
+#define MQTT_SOCKET_TIMEOUT_S 5
+#define MQTT_TASK_STACK_SIZE 6144
+#define MQTT_TASK_PRIORITY 1
+#define MQTT_TASK_CORE 0
+#define MQTT_TASK_POLL_MS 50             // Keep alive and incoming messages without outgoing ones
 
 class MQTTMinimal {
 public:
     MQTTMinimal();
     
+    // Starts the MQTT task with mqttServer etc.; with arguments also after a configuration change
+    void begin();
     void begin(const char* server, int port, const char* username = "", const char* password = "");
+    // Arduino loop: delivers received messages to the callback, never blocks
     void loop();
-    bool isConnected();
-    void publish(const char* topic, const char* value);
+    bool isConnected() { return connected; }
+    // Any task; only the latest payload per topic waits in the outbox
+    void publish(const char* topic, const char* value, bool retained = false);
     void publishDebug(const char* message);
     void setCallback(std::function<void(const char* topic, const char* payload)> callback);
+    // Runs in the MQTT task after every connect; publish() from there is sent right away
+    void setConnectCallback(std::function<void()> callback);
     void onMessage(char* topic, byte* payload, unsigned int length);
+    MqttOutboxStats getOutboxStats();
+    uint32_t getConnectCount() const { return connectCount; }
     
     char mqttServer[64];
     int mqttPort;
@@ -21,11 +55,37 @@ public:
     char mqttPassword[32];
     
 private:
+    struct InboundMessage {
+        char topic[MQTT_INBOX_TOPIC_MAX];
+        char payload[MQTT_INBOX_PAYLOAD_MAX];
+    };
+
     WiFiClient wifiClient;
     PubSubClient client;
     std::function<void(const char* topic, const char* payload)> messageCallback;
-    unsigned long lastReconnect;
-    char payloadBuffer[128];
+    std::function<void()> connectCallback;
+
+    SemaphoreHandle_t mutex;            // Outbox and configuration
+    QueueHandle_t inbox;
+    TaskHandle_t taskHandle;
+    MqttOutbox outbox;
+    MqttMessage sending;                // Message taken from the outbox, MQTT task only
+    volatile bool connected;
+    volatile bool configChanged;
+    uint32_t connectCount;
+
+    // MQTT task copies of the configuration, PubSubClient keeps the server pointer
+    char clientId[24];
+    char server[64];
+    int port;
+    char username[32];
+    char password[32];
+    uint8_t failures;
+    uint32_t nextAttempt;
     
-    void connect();
+    static void taskWrapper(void* parameter);
+    void mqttTask();
+    void applyConfig();
+    bool connect();
+    void sendQueued();
 };
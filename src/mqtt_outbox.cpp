@@ -0,0 +1,79 @@
+/*
+ * MQTT Outbox Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "mqtt_outbox.h"
+#include <string.h>
+
+MqttOutbox::MqttOutbox() {
+    head = 0;
+    count = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+MqttOutboxResult MqttOutbox::push(const char* topic, const char* payload, bool retained) {
+    size_t topicLength = strlen(topic);
+    size_t length = strlen(payload);
+    if (topicLength >= MQTT_TOPIC_MAX || length >= MQTT_PAYLOAD_MAX) {
+        stats.rejected++;
+        return MQTT_OUTBOX_REJECTED;
+    }
+
+    MqttOutboxResult result = MQTT_OUTBOX_QUEUED;
+    MqttMessage* slot = nullptr;
+    for (uint8_t i = 0; i < count; i++) {
+        MqttMessage& queued = slots[(head + i) % MQTT_OUTBOX_SLOTS];
+        if (strcmp(queued.topic, topic) == 0) {
+            slot = &queued;
+            result = MQTT_OUTBOX_REPLACED;
+            stats.replaced++;
+            break;
+        }
+    }
+
+    if (slot == nullptr) {
+        if (count == MQTT_OUTBOX_SLOTS) {
+            head = (head + 1) % MQTT_OUTBOX_SLOTS;
+            count--;
+            result = MQTT_OUTBOX_DROPPED_OLDEST;
+            stats.dropped++;
+        }
+        slot = &slots[(head + count) % MQTT_OUTBOX_SLOTS];
+        count++;
+        memcpy(slot->topic, topic, topicLength + 1);
+    }
+
+    memcpy(slot->payload, payload, length + 1);
+    slot->length = (uint16_t)length;
+    slot->retained = retained;
+    stats.queued++;
+    return result;
+}
+
+bool MqttOutbox::pop(MqttMessage& message) {
+    if (count == 0) return false;
+
+    const MqttMessage& slot = slots[head];
+    memcpy(message.topic, slot.topic, strlen(slot.topic) + 1);
+    memcpy(message.payload, slot.payload, slot.length + 1);
+    message.length = slot.length;
+    message.retained = slot.retained;
+    head = (head + 1) % MQTT_OUTBOX_SLOTS;
+    count--;
+    return true;
+}
+
+uint32_t mqttBackoffMs(uint8_t failures, uint32_t random) {
+    uint32_t delay = MQTT_BACKOFF_MIN_MS;
+    for (uint8_t i = 0; i < failures && delay < MQTT_BACKOFF_MAX_MS; i++) {
+        delay *= 2;
+    }
+    if (delay > MQTT_BACKOFF_MAX_MS) delay = MQTT_BACKOFF_MAX_MS;
+
+    // 50-100 % of the delay
+    uint32_t half = delay / 2;
+    return half + random % (half + 1);
+}
@@ -0,0 +1,75 @@
+/*
+ * MQTT Outbox
+ *
+ * Bounded FIFO of messages waiting for the MQTT task. A message for a topic
+ * that is already queued replaces the queued payload in place, so a slow or
+ * absent broker never sees stale values, only the latest per topic. When the
+ * queue is full of other topics, the oldest message is dropped.
+ *
+ * Also the reconnect backoff: the delay doubles with every failed attempt
+ * up to MQTT_BACKOFF_MAX_MS, randomized to 50-100 % so that devices do not
+ * reconnect in lock step after a broker restart.
+ *
+ * No locking and no hardware dependencies, can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MQTT_OUTBOX_SLOTS 8
+#define MQTT_TOPIC_MAX 96               // Incl. terminator
+#define MQTT_PAYLOAD_MAX 448            // Home Assistant configs are up to ~420 B
+#define MQTT_BACKOFF_MIN_MS 1000
+#define MQTT_BACKOFF_MAX_MS 60000
+
+struct MqttMessage {
+    char topic[MQTT_TOPIC_MAX];
+    char payload[MQTT_PAYLOAD_MAX];     // Zero terminated
+    uint16_t length;
+    bool retained;
+};
+
+struct MqttOutboxStats {
+    uint32_t queued;
+    uint32_t replaced;                  // Newer payload for a queued topic
+    uint32_t dropped;                   // Oldest message pushed out by a full queue
+    uint32_t rejected;                  // Topic or payload too long
+};
+
+enum MqttOutboxResult : uint8_t {
+    MQTT_OUTBOX_QUEUED,
+    MQTT_OUTBOX_REPLACED,
+    MQTT_OUTBOX_DROPPED_OLDEST,
+    MQTT_OUTBOX_REJECTED
+};
+
+class MqttOutbox {
+private:
+    MqttMessage slots[MQTT_OUTBOX_SLOTS];
+    uint8_t head;                       // Oldest message
+    uint8_t count;
+    MqttOutboxStats stats;
+
+public:
+    MqttOutbox();
+
+    MqttOutboxResult push(const char* topic, const char* payload, bool retained);
+
+    // Oldest message; false if empty
+    bool pop(MqttMessage& message);
+
+    void clear() { head = 0; count = 0; }
+    uint8_t size() const { return count; }
+    const MqttOutboxStats& getStats() const { return stats; }
+};
+
+// Delay before the next connect after `failures` failed attempts; random is any 32 bit value
+uint32_t mqttBackoffMs(uint8_t failures, uint32_t random);
+
+#endif // MQTT_OUTBOX_H
@@ -0,0 +1,148 @@
+/*
+ * MQTT Command Router Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "mqtt_router.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// Payload without surrounding whitespace equals word, ignoring case
+static bool equalsWord(const char* start, const char* end, const char* word) {
+    while (start < end && *word != '\0') {
+        if (lower(*start++) != lower(*word++)) return false;
+    }
+    return start == end && *word == '\0';
+}
+
+MqttRouter::MqttRouter(const MqttRoute* table, uint8_t count) {
+    routes = table;
+    routeCount = count;
+    memset(results, 0, sizeof(results));
+}
+
+bool MqttRouter::topicMatches(const char* filter, const char* topic) {
+    for (;;) {
+        if (*filter == '#') {
+            return true;                // Also matches the parent level itself
+        }
+        if (*filter == '+') {
+            while (*topic != '\0' && *topic != '/') topic++;
+            filter++;
+        } else {
+            while (*filter != '\0' && *filter != '/' && *filter == *topic) {
+                filter++;
+                topic++;
+            }
+            if ((*filter != '\0' && *filter != '/') || (*topic != '\0' && *topic != '/')) {
+                return false;           // Level differs
+            }
+        }
+
+        if (*filter == '\0' || *topic == '\0') {
+            // "a/#" matches "a"
+            return *filter == *topic || (filter[0] == '/' && filter[1] == '#' && filter[2] == '\0');
+        }
+        if (*filter != *topic) return false;
+        filter++;
+        topic++;
+    }
+}
+
+MqttRouteResult MqttRouter::parseValue(const MqttRoute& route, const char* payload, MqttValue& value) {
+    const char* start = payload;
+    while (isSpace(*start)) start++;
+    const char* end = start + strlen(start);
+    while (end > start && isSpace(end[-1])) end--;
+    if (start == end) return MQTT_ROUTE_INVALID;
+
+    char* parsed;
+    switch (route.type) {
+        case MQTT_VALUE_BOOL:
+            if (equalsWord(start, end, "1") || equalsWord(start, end, "true") || equalsWord(start, end, "on")) {
+                value.b = true;
+                return MQTT_ROUTE_OK;
+            }
+            if (equalsWord(start, end, "0") || equalsWord(start, end, "false") || equalsWord(start, end, "off")) {
+                value.b = false;
+                return MQTT_ROUTE_OK;
+            }
+            return MQTT_ROUTE_INVALID;
+
+        case MQTT_VALUE_INT: {
+            long number = strtol(start, &parsed, 10);
+            if (parsed != end) return MQTT_ROUTE_INVALID;
+            if (number < route.min || number > route.max) return MQTT_ROUTE_OUT_OF_RANGE;
+            value.i = (int32_t)number;
+            return MQTT_ROUTE_OK;
+        }
+
+        case MQTT_VALUE_FLOAT: {
+            float number = strtof(start, &parsed);
+            if (parsed != end || isnan(number) || isinf(number)) return MQTT_ROUTE_INVALID;
+            if (number < route.min || number > route.max) return MQTT_ROUTE_OUT_OF_RANGE;
+            value.f = number;
+            return MQTT_ROUTE_OK;
+        }
+
+        case MQTT_VALUE_ENUM: {
+            for (uint8_t i = 0; i < route.nameCount; i++) {
+                if (equalsWord(start, end, route.names[i].name)) {
+                    value.i = route.names[i].value;
+                    return MQTT_ROUTE_OK;
+                }
+            }
+            long number = strtol(start, &parsed, 10);
+            if (parsed != end) return MQTT_ROUTE_INVALID;
+            for (uint8_t i = 0; i < route.nameCount; i++) {
+                if (route.names[i].value == number) {
+                    value.i = (int32_t)number;
+                    return MQTT_ROUTE_OK;
+                }
+            }
+            return MQTT_ROUTE_OUT_OF_RANGE;
+        }
+    }
+    return MQTT_ROUTE_INVALID;
+}
+
+MqttRouteResult MqttRouter::dispatch(const char* topic, const char* payload) {
+    MqttRouteResult result = MQTT_ROUTE_NO_ROUTE;
+
+    for (uint8_t i = 0; i < routeCount; i++) {
+        const MqttRoute& route = routes[i];
+        if (!topicMatches(route.filter, topic)) continue;
+
+        MqttValue value;
+        result = parseValue(route, payload, value);
+        if (result == MQTT_ROUTE_OK && !route.handler(route, topic, value)) {
+            result = MQTT_ROUTE_REJECTED;
+        }
+        break;
+    }
+
+    results[result]++;
+    return result;
+}
+
+const char* MqttRouter::resultName(MqttRouteResult result) {
+    switch (result) {
+        case MQTT_ROUTE_OK: return "ok";
+        case MQTT_ROUTE_NO_ROUTE: return "no route";
+        case MQTT_ROUTE_INVALID: return "invalid value";
+        case MQTT_ROUTE_OUT_OF_RANGE: return "out of range";
+        case MQTT_ROUTE_REJECTED: return "rejected";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * MQTT Command Router
+ *
+ * Dispatches inbound MQTT messages through a static route table:
+ *
+ *   static const MqttRoute routes[] = {
+ *     {"ess/set/setpoint", MQTT_VALUE_INT, -5000, 5000, nullptr, 0, onSetpoint},
+ *     ...
+ *   };
+ *
+ * Each route has a topic filter (MQTT syntax, "+" matches one level, "#" the
+ * rest), a value type and a range. The payload is parsed and checked before
+ * the handler is called, so handlers only get valid values. Routes are tried
+ * in table order, the first match wins.
+ *
+ * Payloads: BOOL 1/0, true/false, on/off (any case); INT and FLOAT decimal
+ * numbers, surrounding whitespace allowed; ENUM one of the names (any case)
+ * or its number.
+ *
+ * Nothing is allocated, the payload is parsed in place. No hardware
+ * dependencies, can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef MQTT_ROUTER_H
+#define MQTT_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum MqttValueType : uint8_t {
+    MQTT_VALUE_BOOL,
+    MQTT_VALUE_INT,
+    MQTT_VALUE_FLOAT,
+    MQTT_VALUE_ENUM
+};
+
+enum MqttRouteResult : uint8_t {
+    MQTT_ROUTE_OK,
+    MQTT_ROUTE_NO_ROUTE,
+    MQTT_ROUTE_INVALID,                 // Payload does not parse
+    MQTT_ROUTE_OUT_OF_RANGE,
+    MQTT_ROUTE_REJECTED,                // Handler refused, e.g. not possible in the current mode
+    MQTT_ROUTE_RESULT_COUNT
+};
+
+struct MqttEnumName {
+    const char* name;
+    int32_t value;
+};
+
+union MqttValue {
+    bool b;
+    int32_t i;                          // INT and ENUM
+    float f;
+};
+
+struct MqttRoute;
+
+// Returns false if the command can not be carried out now
+typedef bool (*MqttRouteHandler)(const MqttRoute& route, const char* topic, MqttValue value);
+
+struct MqttRoute {
+    const char* filter;
+    MqttValueType type;
+    float min;                          // INT and FLOAT, inclusive
+    float max;
+    const MqttEnumName* names;          // ENUM
+    uint8_t nameCount;
+    MqttRouteHandler handler;
+};
+
+class MqttRouter {
+private:
+    const MqttRoute* routes;
+    uint8_t routeCount;
+    uint32_t results[MQTT_ROUTE_RESULT_COUNT];
+
+public:
+    MqttRouter(const MqttRoute* table, uint8_t count);
+
+    MqttRouteResult dispatch(const char* topic, const char* payload);
+
+    uint32_t getCount(MqttRouteResult result) const { return result < MQTT_ROUTE_RESULT_COUNT ? results[result] : 0; }
+
+    static bool topicMatches(const char* filter, const char* topic);
+    static MqttRouteResult parseValue(const MqttRoute& route, const char* payload, MqttValue& value);
+    static const char* resultName(MqttRouteResult result);
+};
+
+#endif // MQTT_ROUTER_H
@@ -0,0 +1,577 @@
+/*
+ * Host Microbenchmarks
+ *
+ * Entry point of the native environment (pio run -e native). It times the
+ * protocol and control hot paths on the build machine:
+ *
+ *   .pio/build/native/program [filter]
+ *
+ * Each benchmark doubles its iteration count until one run takes at least
+ * BENCH_MIN_TIME_MS and prints the time per iteration, like Google Benchmark.
+ * The reports after them run once and print sizes and rates instead of times;
+ * a report whose check fails makes the program exit with 1.
+ * Only benchmarks and reports whose name contains the filter run.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "hal.h"
+
+#if HAL_POSIX
+
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "system_data.h"
+#include "debug_log.h"
+#include "perf_monitor.h"
+#include "vebus_frame_decoder.h"
+#include "vebus_frame_writer.h"
+#include "vebus_command_queue.h"
+#include "vebus_messages.h"
+#include "vebus_handler.h"
+#include "pylontech_decoder.h"
+#include "sml_parser.h"
+#include "ess_control.h"
+#include "log_ring.h"
+#include "perf_histogram.h"
+#include "history_store.h"
+#include "telemetry_fields.h"
+
+#define BENCH_MIN_TIME_MS 200
+#define BENCH_MAX_ITERATIONS (1UL << 30)
+
+// Globals the library expects from the application (main.cpp on the target)
+SystemData systemData;
+DebugLog debugLog;
+PerfMonitor perfMonitor;
+
+// Unit tests (pio test -e native) link the library with their own main()
+#ifndef PIO_UNIT_TESTING
+
+// Results go here so the compiler cannot drop the work
+static volatile uint32_t benchSink;
+
+// Failed checks of the reports, the exit code
+static uint32_t benchFailures;
+
+// Every heap allocation of the program, for the reports that claim there are none
+static std::atomic<uint32_t> benchAllocations(0);
+
+void* operator new(size_t size) {
+    benchAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* pointer = malloc(size > 0 ? size : 1);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+typedef void (*BenchFunction)(uint32_t iterations);
+
+struct Benchmark {
+    const char* name;
+    BenchFunction function;
+};
+
+// The ESS setpoint frame the way VeBusHandler::sendEssPowerCommand() queues it
+static size_t encodeEssPower(uint8_t* wire, int16_t power, uint8_t frameNumber) {
+    VeBusEssPowerCommand setpoint;
+    setpoint.targetPower = power;
+    VeBusCommandDescriptor command = setpoint.toCommand();
+    VeBusMk3Writer writer(wire, VEBUS_MK3_TEMPLATE_ESS_POWER, frameNumber);
+    writer.put(command.data, command.length);
+    return writer.finish();
+}
+
+// Reference: the encoding VeBusMk3Writer replaced, kept as it was in
+// VeBusHandler::sendFrameMk3Correct() (txBuffer, stuffing pass, checksum pass)
+static int legacyCommandReplaceFAtoFF(uint8_t* outbuf, const uint8_t* inbuf, int inlength) {
+    int j = 0;
+
+    // Starting from the beginning, replace 0xFA..FF with double-byte character
+    for (int i = 0; i < inlength; i++) {
+        uint8_t c = inbuf[i];
+        if (c >= 0xFA) {
+            outbuf[j++] = VEBUS_MK3_STUFF_BYTE;
+            outbuf[j++] = 0x70 | (c & 0x0F);
+        } else {
+            outbuf[j++] = c;    // No replacement
+        }
+    }
+    return j;   // New length of output frame
+}
+
+static int legacyAppendChecksum(uint8_t* buf, int inlength) {
+    int j = 0;
+
+    // Calculate checksum starting from 3rd byte
+    uint8_t cs = 1;
+    for (int i = 2; i < inlength; i++) {
+        cs -= buf[i];
+    }
+    j = inlength;
+    if (cs >= 0xFB) {
+        // EXCEPTION: Only replace starting from 0xFB
+        buf[j++] = VEBUS_MK3_STUFF_BYTE;
+        buf[j++] = (cs - 0xFA);
+    } else {
+        buf[j++] = cs;
+    }
+    buf[j++] = VEBUS_MK3_END_FRAME;  // Append End Of Frame symbol
+    return j;   // New length of output frame
+}
+
+static size_t legacyEncodeEssPower(uint8_t* finalBuffer, int16_t power, uint8_t frameNumber) {
+    VeBusEssPowerCommand setpoint;
+    setpoint.targetPower = power;
+    VeBusCommandDescriptor command = setpoint.toCommand();
+
+    uint8_t txBuffer[64];
+    int txLength = 0;
+    txBuffer[txLength++] = VEBUS_MK3_HEADER1;
+    txBuffer[txLength++] = VEBUS_MK3_HEADER2;
+    txBuffer[txLength++] = VEBUS_MK3_DATA_FRAME;
+    txBuffer[txLength++] = frameNumber;
+    txBuffer[txLength++] = 0x00;        // Our own ID high byte
+    txBuffer[txLength++] = 0xE6;        // Our own ID low byte
+    txBuffer[txLength++] = command.command;
+    txBuffer[txLength++] = 0x02;        // Flags (RAM var, no EEPROM)
+    for (int i = 0; i < command.length && txLength < (int)sizeof(txBuffer) - 3; i++) {
+        txBuffer[txLength++] = command.data[i];
+    }
+
+    // Apply byte stuffing to the entire frame after header
+    uint8_t stuffedBuffer[128];
+    int stuffedLength = legacyCommandReplaceFAtoFF(stuffedBuffer, &txBuffer[4], txLength - 4);
+
+    int finalLength = 0;
+    for (int i = 0; i < 4; i++) {
+        finalBuffer[finalLength++] = txBuffer[i];
+    }
+    for (int i = 0; i < stuffedLength; i++) {
+        finalBuffer[finalLength++] = stuffedBuffer[i];
+    }
+    return (size_t)legacyAppendChecksum(finalBuffer, finalLength);
+}
+
+// Setpoints of -2048..2047 W: -6..-1 W and every 256th one stuff a data byte
+static void benchVeBusEncode(uint32_t iterations) {
+    uint8_t wire[VEBUS_MK3_FRAME_SIZE(VEBUS_COMMAND_MAX_DATA)];
+    for (uint32_t i = 0; i < iterations; i++) {
+        benchSink = (uint32_t)encodeEssPower(wire, (int16_t)(i & 0x0FFF) - 2048, (uint8_t)(i & 0x7F));
+    }
+}
+
+static void benchVeBusEncodeLegacy(uint32_t iterations) {
+    uint8_t wire[128];
+    for (uint32_t i = 0; i < iterations; i++) {
+        benchSink = (uint32_t)legacyEncodeEssPower(wire, (int16_t)(i & 0x0FFF) - 2048, (uint8_t)(i & 0x7F));
+    }
+}
+
+static void benchVeBusDecode(uint32_t iterations) {
+    // A burst of differently stuffed frames, decoded as one UART read each
+    uint8_t stream[8 * VEBUS_MK3_FRAME_SIZE(VEBUS_COMMAND_MAX_DATA)];
+    size_t streamLength = 0;
+    for (uint8_t n = 0; n < 8; n++) {
+        VeBusEssPowerCommand setpoint;
+        setpoint.targetPower = (int16_t)((0xF8 + n) | ((n * 37) << 8));
+        VeBusCommandDescriptor command = setpoint.toCommand();
+        VeBusMk3Writer writer(stream + streamLength, VEBUS_MK3_TEMPLATE_ESS_POWER, n);
+        writer.put(command.data, command.length);
+        streamLength += writer.finish();
+    }
+
+    VeBusFrameDecoder decoder;
+    VeBusFrameView frame;
+    uint32_t frames = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        const uint8_t* data = stream;
+        size_t remaining = streamLength;
+        while (remaining > 0) {
+            size_t taken = decoder.push(data, remaining);
+            data += taken;
+            remaining -= taken;
+            while (decoder.next(frame) != VEBUS_DECODE_NEED_MORE) {
+                frames++;
+            }
+        }
+    }
+    benchSink = frames;
+}
+
+static void benchPylontechCycle(uint32_t iterations) {
+    static const struct {
+        uint32_t id;
+        uint8_t length;
+        uint8_t data[8];
+    } cycle[] = {
+        { PYLONTECH_LIMITS_ID, 8, { 0x14, 0x02, 0xE8, 0x03, 0xE8, 0x03, 0xC2, 0x01 } },
+        { PYLONTECH_SOC_ID, 4, { 0x4B, 0x00, 0x64, 0x00 } },
+        { PYLONTECH_MEASUREMENTS_ID, 6, { 0x1A, 0x13, 0x9C, 0xFF, 0xD2, 0x00 } },
+        { PYLONTECH_ALARMS_ID, 7, { 0x00, 0x00, 0x00, 0x00, 0x02, 0x50, 0x4E } },
+        { PYLONTECH_REQUEST_ID, 1, { 0xC0 } },
+        { PYLONTECH_MANUFACTURER_ID, 8, { 'P', 'Y', 'L', 'O', 'N', ' ', ' ', ' ' } },
+    };
+    PylontechDecoder decoder;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (size_t f = 0; f < sizeof(cycle) / sizeof(cycle[0]); f++) {
+            decoder.decode(cycle[f].id, false, false, cycle[f].data, cycle[f].length, i | 1);
+        }
+        benchSink = decoder.takeUpdated();
+    }
+}
+
+static void benchSmlTelegram(uint32_t iterations) {
+    // eHZ telegram with 1.8.0, 2.8.0, 16.7.0 and the phase powers (test/test_sml_parser)
+    static const uint8_t telegram[] = {
+        0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01, 0x76, 0x05, 0x00, 0x42,
+        0x31, 0x01, 0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x01, 0x01, 0x76, 0x01,
+        0x01, 0x05, 0x00, 0x00, 0x42, 0x31, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48,
+        0x00, 0x00, 0x7A, 0xC5, 0x1B, 0x01, 0x01, 0x63, 0x12, 0x34, 0x00, 0x76,
+        0x05, 0x00, 0x42, 0x32, 0x01, 0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x07,
+        0x01, 0x77, 0x01, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48, 0x00, 0x00, 0x7A,
+        0xC5, 0x1B, 0x01, 0x72, 0x62, 0x01, 0x65, 0x01, 0x02, 0x03, 0x04, 0x79,
+        0x77, 0x07, 0x81, 0x81, 0xC7, 0x82, 0x03, 0xFF, 0x01, 0x01, 0x01, 0x01,
+        0x04, 0x45, 0x4D, 0x48, 0x01, 0x77, 0x07, 0x01, 0x00, 0x00, 0x00, 0x09,
+        0xFF, 0x01, 0x01, 0x01, 0x01, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48, 0x00,
+        0x00, 0x7A, 0xC5, 0x1B, 0x01, 0x77, 0x07, 0x01, 0x00, 0x01, 0x08, 0x00,
+        0xFF, 0x05, 0x00, 0x01, 0x01, 0x82, 0x72, 0x62, 0x01, 0x65, 0x01, 0x02,
+        0x03, 0x04, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x07,
+        0x5B, 0xCD, 0x15, 0x01, 0x77, 0x07, 0x01, 0x00, 0x02, 0x08, 0x00, 0xFF,
+        0x01, 0x01, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0xB2, 0x6E, 0x01, 0x77, 0x07, 0x01, 0x00, 0x01, 0x08, 0x01, 0xFF,
+        0x01, 0x01, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x30, 0x39, 0x01, 0x77, 0x07, 0x01, 0x00, 0x10, 0x07, 0x00, 0xFF,
+        0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0xFF, 0xFF, 0xFB, 0x2E, 0x01,
+        0x77, 0x07, 0x01, 0x00, 0x24, 0x07, 0x00, 0xFF, 0x01, 0x01, 0x62, 0x1B,
+        0x52, 0x00, 0x55, 0x00, 0x00, 0x00, 0x64, 0x01, 0x77, 0x07, 0x01, 0x00,
+        0x38, 0x07, 0x00, 0xFF, 0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0xFF,
+        0xFF, 0xFA, 0x24, 0x01, 0x77, 0x07, 0x01, 0x00, 0x4C, 0x07, 0x00, 0xFF,
+        0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0x00, 0x00, 0x00, 0xA6, 0x01,
+        0x01, 0x01, 0x63, 0x56, 0x78, 0x00, 0x76, 0x05, 0x00, 0x42, 0x33, 0x01,
+        0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x02, 0x01, 0x71, 0x01, 0x63, 0x9A,
+        0xBC, 0x00, 0x00, 0x00, 0x1B, 0x1B, 0x1B, 0x1B, 0x1A, 0x02, 0x21, 0x0F
+    };
+    static SmlParser parser;
+    SmlParseEvent event;
+    for (uint32_t i = 0; i < iterations; i++) {
+        parser.push(telegram, sizeof(telegram), event);
+    }
+    benchSink = parser.getTelegrams();
+}
+
+static void benchEssControlStep(uint32_t iterations) {
+    EssControlParams params = { 0, 2400, 80, 10 };
+    EssControlInput input = { 0, true, true, true, 52.0f, 50.0f, 50.0f, 0, false };
+    for (uint32_t i = 0; i < iterations; i++) {
+        input.meterPower = (int32_t)(i % 4001) - 2000;
+        EssControlOutput output = essControlStep(params, input);
+        input.lastSetpoint = output.setpoint;
+    }
+    benchSink = (uint32_t)input.lastSetpoint;
+}
+
+static void benchLogRing(uint32_t iterations) {
+    static LogRing ring;
+    LogRecord record = {};
+    record.format = "Sent MK3 frame #%d command 0x%02X";
+    for (uint32_t i = 0; i < iterations; i++) {
+        record.args[0] = (int32_t)i;
+        ring.push(record);
+        ring.pop(record);
+    }
+    benchSink = (uint32_t)record.args[0];
+}
+
+static void benchPerfHistogram(uint32_t iterations) {
+    static PerfHistogram histogram;
+    for (uint32_t i = 0; i < iterations; i++) {
+        histogram.record(i & 0xFFFF);
+    }
+    benchSink = histogram.getCount();
+}
+
+static uint32_t benchRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// One second of the six history signals: a slow battery and a noisy household
+static void historySample(uint32_t t, uint32_t& state, int32_t values[HISTORY_SIGNAL_COUNT]) {
+    int32_t noise = (int32_t)(benchRandom(state) % 601) - 300;
+    int32_t load = 400 + (int32_t)((t / 1800) % 5) * 150;
+    values[HISTORY_METER_POWER] = load + noise;
+    values[HISTORY_BATTERY_POWER] = -(load + noise / 4);
+    values[HISTORY_BATTERY_SOC] = 20 + (int32_t)((t / 600) % 70);
+    values[HISTORY_INVERTER_POWER] = load + noise / 2;
+    values[HISTORY_ESS_SETPOINT] = load;
+    values[HISTORY_DC_VOLTAGE] = 5000 + (int32_t)((t / 120) % 300);
+}
+
+static void benchHistoryRecord(uint32_t iterations) {
+    static HistoryStore store;
+    static uint32_t time = 0;
+    uint32_t state = 1;
+    int32_t values[HISTORY_SIGNAL_COUNT];
+    for (uint32_t i = 0; i < iterations; i++) {
+        historySample(time, state, values);
+        store.record(time++, values);
+    }
+    benchSink = time;
+}
+
+// One second of telemetry: BMS and Multiplus values with measurement noise
+// around a load that steps every few minutes, VE.Bus counters that always move
+static void telemetrySample(uint32_t t, uint32_t& state, TelemetryPublisher& telemetry) {
+    static SystemData data;
+    static PylontechBatteryState battery;
+    float load = 400.0f + (float)((t / 180) % 5) * 300.0f;
+    float noise = (float)((int32_t)(benchRandom(state) % 201) - 100) / 100.0f;
+
+    battery.soc = (int16_t)(80 - (t / 900) % 60);
+    battery.soh = 98;
+    battery.voltage = 52.30f - load / 20000.0f + noise * 0.03f;
+    battery.current = -load / battery.voltage + noise * 0.2f;
+    battery.power = (int32_t)lroundf(battery.voltage * battery.current);
+    battery.temperature = 21.0f + (float)((t / 1200) % 4) * 0.5f;
+    battery.chargeVoltage = 53.2f;
+    battery.chargeCurrentLimit = 74.0f;
+    battery.dischargeCurrentLimit = 100.0f;
+    strcpy(battery.manufacturer, "PYLON");
+
+    MultiplusData& multiplus = data.multiplus;
+    multiplus.dcVoltage = battery.voltage + 0.05f + noise * 0.02f;
+    multiplus.dcCurrent = battery.current * 0.98f;
+    multiplus.uMainsRMS = 231.0f + noise * 0.8f;
+    multiplus.acFrequency = 50.0f + noise * 0.02f;
+    multiplus.pinverterFiltered = -(int)load + (int)(noise * 15);
+    multiplus.pmainsFiltered = (int)(noise * 40);
+    multiplus.powerFactor = 0.98f + noise * 0.005f;
+    multiplus.temp = 35.0f + (float)((t / 600) % 6) * 0.5f;
+    multiplus.esspower = (int16_t)(-load);
+    strcpy(data.essControl.essStrategy, "normal");
+    data.essControl.secondsInMaxStrategy = t / 60 * 60;
+
+    sampleSystemTelemetry(telemetry, data, battery);
+    telemetry.setBool(TM_VEBUS_ONLINE, true);
+    telemetry.setFloat(TM_VEBUS_QUALITY, 1.0f);
+    telemetry.setInt(TM_VEBUS_FRAMES_SENT, (int32_t)(t * 12));
+    telemetry.setInt(TM_VEBUS_FRAMES_RECEIVED, (int32_t)(t * 150));
+    telemetry.setBool(TM_FEEDIN_ENABLED, true);
+    telemetry.setFloat(TM_FEEDIN_TARGET, 0.0f);
+    telemetry.setFloat(TM_FEEDIN_MAX, 800.0f);
+    telemetry.setInt(TM_STATUS_LED_MODE, 3);
+    telemetry.setBool(TM_MQTT_CONNECTED, true);
+    telemetry.setText(TM_MQTT_SERVER, "192.168.1.10");
+    telemetry.setInt(TM_MQTT_PORT, 1883);
+}
+
+// sendTelemetryUpdate() for one JSON and one binary client
+static void benchTelemetryDelta(uint32_t iterations) {
+    static TelemetryPublisher telemetry(telemetryFields, TM_FIELD_COUNT);
+    static char json[2048];
+    static uint8_t binary[512];
+    static uint32_t time = 0;
+    uint32_t state = 1;
+    for (uint32_t i = 0; i < iterations; i++) {
+        telemetrySample(time++, state, telemetry);
+        uint64_t changes = telemetry.takeChanges();
+        uint64_t unsent = changes;
+        benchSink = telemetry.serializeJson(json, sizeof(json), unsent);
+        benchSink = telemetry.serializeBinary(binary, sizeof(binary), changes);
+    }
+}
+
+static const Benchmark benchmarks[] = {
+    { "vebus_encode_ess_power", benchVeBusEncode },
+    { "vebus_encode_ess_power_legacy", benchVeBusEncodeLegacy },
+    { "vebus_decode_8_frames", benchVeBusDecode },
+    { "pylontech_decode_cycle", benchPylontechCycle },
+    { "sml_parse_telegram", benchSmlTelegram },
+    { "ess_control_step", benchEssControlStep },
+    { "log_ring_push_pop", benchLogRing },
+    { "perf_histogram_record", benchPerfHistogram },
+    { "history_record_6_signals", benchHistoryRecord },
+    { "telemetry_delta_cycle", benchTelemetryDelta },
+};
+
+typedef void (*ReportFunction)(void);
+
+struct Report {
+    const char* name;
+    ReportFunction function;
+};
+
+// RAM of the history store and what a day of samples costs per tier
+static void reportHistoryFootprint() {
+    static HistoryStore store;
+    uint32_t state = 1;
+    int32_t values[HISTORY_SIGNAL_COUNT];
+    for (uint32_t t = 0; t < 24 * 3600; t++) {
+        historySample(t, state, values);
+        store.record(t, values);
+    }
+
+    printf("sizeof(HistoryStore) %u B, %u B per signal, %u B per block\n", (unsigned)sizeof(HistoryStore),
+           (unsigned)(sizeof(HistoryStore) / HISTORY_SIGNAL_COUNT), (unsigned)sizeof(HistoryBlock));
+    printf("%-16s %6s %10s %10s %12s\n", "signal", "tier", "B/record", "B/hour", "retained h");
+    const uint8_t signals[] = { HISTORY_BATTERY_SOC, HISTORY_METER_POWER };
+    for (uint8_t signal : signals) {
+        for (uint8_t tier = 0; tier < HISTORY_TIER_COUNT; tier++) {
+            HistoryUsage usage = store.getUsage(signal, tier);
+            double perRecord = usage.records > 0 ? (double)usage.bytes / usage.records : 0;
+            uint32_t period = historyTierPeriod(tier);
+            double retained = perRecord > 0 ? usage.capacity / perRecord * period / 3600 : 0;
+            printf("%-16s %5us %10.2f %10.0f %12.1f\n", historySignalName(signal), (unsigned)period,
+                   perRecord, perRecord * 3600 / period, retained);
+        }
+    }
+}
+
+// What a WebSocket client receives per second, changed fields vs the full
+// snapshot every second, and the heap use of a cycle (it should have none)
+static void reportTelemetryDelta() {
+    static TelemetryPublisher telemetry(telemetryFields, TM_FIELD_COUNT);
+    static char json[2048];
+    static uint8_t binary[512];
+    const uint32_t seconds = 3600;
+    uint64_t deltaJson = 0, deltaBinary = 0, fullJson = 0, fullBinary = 0, fields = 0;
+    uint32_t state = 1;
+
+    uint32_t allocations = benchAllocations.load();
+    for (uint32_t t = 0; t < seconds; t++) {
+        telemetrySample(t, state, telemetry);
+        uint64_t changes = telemetry.takeChanges();
+        fields += __builtin_popcountll(changes);
+        uint64_t unsent = changes;
+        deltaJson += telemetry.serializeJson(json, sizeof(json), unsent);
+        deltaBinary += telemetry.serializeBinary(binary, sizeof(binary), changes);
+        unsent = telemetry.allFields();
+        fullJson += telemetry.serializeJson(json, sizeof(json), unsent);
+        fullBinary += telemetry.serializeBinary(binary, sizeof(binary), telemetry.allFields());
+    }
+    allocations = benchAllocations.load() - allocations;
+
+    printf("%u fields, %.1f changed per second over %u s\n", (unsigned)TM_FIELD_COUNT,
+           (double)fields / seconds, (unsigned)seconds);
+    printf("%-8s %12s %12s\n", "format", "full B/s", "delta B/s");
+    printf("%-8s %12.0f %12.0f\n", "json", (double)fullJson / seconds, (double)deltaJson / seconds);
+    printf("%-8s %12.0f %12.0f\n", "binary", (double)fullBinary / seconds, (double)deltaBinary / seconds);
+    printf("heap allocations per cycle %.2f\n", (double)allocations / seconds);
+}
+
+// Every setpoint with every frame number through both encoders: the wire
+// bytes must be identical; a difference fails the run
+static void reportVeBusEncodeReference() {
+    static uint8_t wire[32768][VEBUS_MK3_FRAME_SIZE(VEBUS_COMMAND_MAX_DATA)];
+    static uint8_t reference[32768][128];
+    static size_t wireLength[32768];
+    static size_t referenceLength[32768];
+    uint32_t frames = 0, stuffed = 0, escapedChecksum = 0, mismatches = 0;
+    double writerNs = 0, legacyNs = 0;
+
+    for (uint8_t frameNumber = 0; frameNumber < 0x80; frameNumber++) {
+        for (uint32_t half = 0; half < 2; half++) {
+            // One half of the int16 range at a time, timed as a batch per encoder
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < 32768; i++) {
+                int16_t power = (int16_t)(half * 32768 + i);
+                wireLength[i] = encodeEssPower(wire[i], power, frameNumber);
+            }
+            auto middle = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < 32768; i++) {
+                int16_t power = (int16_t)(half * 32768 + i);
+                referenceLength[i] = legacyEncodeEssPower(reference[i], power, frameNumber);
+            }
+            auto end = std::chrono::steady_clock::now();
+            writerNs += std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count();
+            legacyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count();
+
+            for (uint32_t i = 0; i < 32768; i++) {
+                size_t length = referenceLength[i];
+                if (wireLength[i] != length || memcmp(wire[i], reference[i], length) != 0) {
+                    if (mismatches++ == 0) {
+                        printf("MISMATCH power %d frame %u\n", (int16_t)(half * 32768 + i), frameNumber);
+                    }
+                    continue;
+                }
+                frames++;
+                uint16_t bits = (uint16_t)(half * 32768 + i);
+                uint32_t stuffedBytes = ((bits & 0xFF) >= VEBUS_MK3_STUFF_BYTE) + ((bits >> 8) >= VEBUS_MK3_STUFF_BYTE);
+                if (stuffedBytes > 0) stuffed++;
+                // Header, 3 data bytes, checksum and EOF plus one byte per escape
+                if (length > 13 + stuffedBytes) escapedChecksum++;
+            }
+        }
+    }
+
+    printf("%u frames byte-identical, %u with stuffed data, %u with escaped checksum\n",
+           (unsigned)frames, (unsigned)stuffed, (unsigned)escapedChecksum);
+    printf("%-10s %9.1f ns per frame\n", "writer", writerNs / (frames + mismatches));
+    printf("%-10s %9.1f ns per frame\n", "legacy", legacyNs / (frames + mismatches));
+    if (mismatches > 0) {
+        printf("FAILED: %u frames differ\n", (unsigned)mismatches);
+        benchFailures++;
+    }
+}
+
+static const Report reports[] = {
+    { "vebus_encode_reference", reportVeBusEncodeReference },
+    { "history_store_footprint", reportHistoryFootprint },
+    { "telemetry_delta_vs_full", reportTelemetryDelta },
+};
+
+static double runNs(BenchFunction function, uint32_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    function(iterations);
+    auto end = std::chrono::steady_clock::now();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+
+    printf("%-28s %12s %12s\n", "Benchmark", "Time", "Iterations");
+    for (const Benchmark& benchmark : benchmarks) {
+        if (strstr(benchmark.name, filter) == nullptr) {
+            continue;
+        }
+        uint32_t iterations = 1;
+        double ns = runNs(benchmark.function, iterations);
+        while (ns < BENCH_MIN_TIME_MS * 1e6 && iterations < BENCH_MAX_ITERATIONS) {
+            iterations *= 2;
+            ns = runNs(benchmark.function, iterations);
+        }
+        printf("%-28s %9.1f ns %12u\n", benchmark.name, ns / iterations, iterations);
+    }
+
+    for (const Report& report : reports) {
+        if (strstr(report.name, filter) == nullptr) {
+            continue;
+        }
+        printf("\n%s\n", report.name);
+        report.function();
+    }
+    return benchFailures > 0 ? 1 : 0;
+}
+
+#endif // PIO_UNIT_TESTING
+
+#endif // HAL_POSIX
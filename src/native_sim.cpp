@@ -0,0 +1,204 @@
+/*
+ * Closed Loop VE.Bus Simulation
+ *
+ * Entry point of the native-sim environment. It runs VeBusHandler against
+ * VeBusSimulator for a while and reports how the ESS setpoints fared:
+ *
+ *   .pio/build/native-sim/program [--seconds 10] [--period-ms 0] [--slot-us 2000] [--pty]
+ *
+ * By default a producer task sends a new setpoint on every sync
+ * notification, like EssController. --period-ms sends at a fixed rate
+ * instead. --pty connects the handler through a pseudo terminal and
+ * VeBusUartPosix instead of the in-process VeBusSimulatorUart.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "hal.h"
+
+#if HAL_POSIX
+
+#include <atomic>
+#include <pty.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include "system_data.h"
+#include "debug_log.h"
+#include "perf_monitor.h"
+#include "vebus_handler.h"
+#include "vebus_uart_posix.h"
+#include "vebus_simulator.h"
+
+#define SIM_DEFAULT_SECONDS 10
+#define SIM_SETPOINT_RANGE 2000     // Setpoints sweep -1000..999 W, unique within the simulator history
+
+// Globals the library expects from the application (main.cpp on the target)
+SystemData systemData;
+DebugLog debugLog;
+PerfMonitor perfMonitor;
+VeBusHandler veBusHandler;
+
+// Unit tests (pio test -e native-sim) link the library with their own main()
+#ifndef PIO_UNIT_TESTING
+
+static VeBusSimulator simulator;
+static std::atomic<bool> producing(true);
+static uint32_t setpointsSubmitted = 0;
+
+static void produceSetpoints(uint32_t periodMs) {
+    if (periodMs == 0) {
+        veBusHandler.setSyncListener(halTaskCurrent());
+    }
+    uint32_t count = 0;
+    while (producing) {
+        if (periodMs == 0) {
+            if (halTaskNotifyTake(100) == 0) {
+                continue;
+            }
+        } else {
+            halDelayMs(periodMs);
+        }
+        int16_t power = (int16_t)(count++ % SIM_SETPOINT_RANGE) - SIM_SETPOINT_RANGE / 2;
+        simulator.noteSetpoint(power);
+        if (veBusHandler.sendEssPowerCommand(power)) {
+            setpointsSubmitted++;
+        }
+    }
+    veBusHandler.setSyncListener(nullptr);
+}
+
+static double percent(uint32_t part, uint32_t whole) {
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+static void printDistribution(const char* name, const PerfHistogram& histogram) {
+    printf("%-26s n=%u min=%u p50=%u p90=%u p99=%u max=%u us\n", name, histogram.getCount(),
+           histogram.getMin(), histogram.percentile(50), histogram.percentile(90),
+           histogram.percentile(99), histogram.getMax());
+}
+
+int main(int argc, char** argv) {
+    uint32_t seconds = SIM_DEFAULT_SECONDS;
+    uint32_t periodMs = 0;
+    bool usePty = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--period-ms") == 0 && i + 1 < argc) {
+            periodMs = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--slot-us") == 0 && i + 1 < argc) {
+            simulator.setSlotWindow((uint32_t)atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--pty") == 0) {
+            usePty = true;
+        } else {
+            printf("Usage: %s [--seconds N] [--period-ms N] [--slot-us N] [--pty]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    debugLog.setModuleLevel(LOG_MODULE_VEBUS, LOG_LEVEL_WARNING);
+    debugLog.begin();
+
+    VeBusSimulatorUart simulatedUart(simulator);
+    VeBusUartPosix ptyUart;
+    std::thread ptyReader;
+    std::atomic<bool> reading(true);
+    int master = -1;
+
+    if (usePty) {
+        int slave;
+        char name[64];
+        if (openpty(&master, &slave, name, nullptr, nullptr) != 0) {
+            perror("openpty");
+            return 1;
+        }
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        close(slave);
+
+        simulator.begin([master](const uint8_t* data, size_t length) {
+            if (write(master, data, length) < 0) {
+                perror("pty write");
+            }
+        });
+        ptyReader = std::thread([master, &reading]() {
+            uint8_t chunk[256];
+            while (reading) {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                if (poll(&pfd, 1, 10) > 0) {
+                    ssize_t count = read(master, chunk, sizeof(chunk));
+                    if (count > 0) simulator.receive(chunk, (size_t)count);
+                }
+            }
+        });
+        if (!ptyUart.open(name, VEBUS_BAUD_RATE, []() { veBusHandler.onUartReceive(); }) ||
+            !veBusHandler.begin(&ptyUart)) {
+            return 1;
+        }
+    } else {
+        simulatedUart.setReceiveHandler([]() { veBusHandler.onUartReceive(); });
+        simulator.begin([&simulatedUart](const uint8_t* data, size_t length) {
+            simulatedUart.deliver(data, length);
+        });
+        if (!veBusHandler.begin(&simulatedUart)) {
+            return 1;
+        }
+    }
+
+    printf("Simulating %u s, %s, setpoints %s\n", seconds, usePty ? "pseudo terminal" : "in-process UART",
+           periodMs == 0 ? "on every sync frame" : "at a fixed period");
+    std::thread producer(produceSetpoints, periodMs);
+    halDelayMs(seconds * 1000);
+
+    producing = false;
+    producer.join();
+    halDelayMs(100);    // Last acknowledgments
+    VeBusSimulatorStats sim = simulator.getStats();
+    VeBusStatistics handler = veBusHandler.getStatistics();
+    PerfHistogram ackLatency = simulator.getAckLatency();
+    PerfHistogram slotOffset = simulator.getSlotOffset();
+
+    veBusHandler.end();
+    simulator.end();
+    reading = false;
+    if (ptyReader.joinable()) {
+        ptyReader.join();
+        ptyUart.end();
+        close(master);
+    }
+
+    printf("\nSimulator\n");
+    printf("%-26s %u\n", "sync frames", sim.syncFrames);
+    printf("%-26s %u (%u checksum errors, %u other)\n", "host frames", sim.hostFrames,
+           sim.checksumErrors, sim.otherCommands);
+    printf("%-26s %u\n", "ESS writes", sim.essCommands);
+    printf("%-26s %u (%.2f %%)\n", "acknowledged", sim.essAcknowledged, percent(sim.essAcknowledged, sim.essCommands));
+    printf("%-26s %u (%.2f %%)\n", "slot misses", sim.slotMisses, percent(sim.slotMisses, sim.essCommands));
+    printf("%-26s %u (%.2f %%)\n", "frame number misses", sim.numberMisses, percent(sim.numberMisses, sim.essCommands));
+    printDistribution("setpoint to ack latency", ackLatency);
+    printDistribution("sync to host frame offset", slotOffset);
+
+    printf("\nHandler\n");
+    printf("%-26s %u\n", "setpoints submitted", setpointsSubmitted);
+    printf("%-26s %u (%.2f %% of submitted)\n", "setpoints acknowledged", handler.setpointsAcknowledged,
+           percent(handler.setpointsAcknowledged, setpointsSubmitted));
+    printf("%-26s %u\n", "setpoints coalesced", handler.commandsCoalesced);
+    printf("%-26s %u sent, %u timeouts, %u retransmissions\n", "frames", handler.framesSent,
+           handler.timeoutErrors, handler.retransmissions);
+    printf("%-26s %u\n", "slots missed", handler.slotsMissed);
+    printf("%-26s %u us (max %u us)\n", "tx offset after sync", handler.lastTxOffsetUs, handler.maxTxOffsetUs);
+    printf("%-26s %u us (max %u us)\n", "queue to wire latency", handler.setpointLatencyUs, handler.maxSetpointLatencyUs);
+    return 0;
+}
+
+#endif // PIO_UNIT_TESTING
+
+#endif // HAL_POSIX
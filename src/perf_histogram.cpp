@@ -0,0 +1,40 @@
+/*
+ * Performance Histogram Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "perf_histogram.h"
+
+void PerfHistogram::clear() {
+    for (uint16_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = 0;
+    }
+    count = 0;
+    minCycles = UINT32_MAX;
+    maxCycles = 0;
+    sumCycles = 0;
+}
+
+uint32_t PerfHistogram::percentile(uint8_t percent) const {
+    if (count == 0 || resetRequested) {
+        return 0;
+    }
+    if (percent > 100) percent = 100;
+    uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    if (rank == 0) {
+        return minCycles;
+    }
+    uint32_t seen = 0;
+    for (uint16_t i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint32_t high = bucketHigh(i);
+            if (high > maxCycles) high = maxCycles;
+            if (high < minCycles) high = minCycles;
+            return high;
+        }
+    }
+    return maxCycles;
+}
@@ -0,0 +1,97 @@
+/*
+ * Performance Histogram
+ *
+ * Duration statistics of one instrumented code site in CPU cycles (or any
+ * other unit, the ESS controller records microseconds): count, min, max, sum
+ * and a log-linear histogram. Each power of two is split into
+ * PERF_HISTOGRAM_SUB_BUCKETS buckets, so a percentile is off by at most 25 %
+ * over the whole range from a few cycles to seconds; plain log2 buckets
+ * would be off by up to 100 %.
+ *
+ * record() is a few instructions, never allocates and takes no lock; every
+ * site is recorded by one task. Readers copy the histogram without a lock
+ * and may see a record in progress, which is fine for statistics. reset()
+ * from another task only sets a flag, the recording task clears the
+ * histogram with its next record().
+ *
+ * No hardware dependencies, can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PERF_HISTOGRAM_H
+#define PERF_HISTOGRAM_H
+
+#include <stdint.h>
+
+#define PERF_HISTOGRAM_SUB_BITS 2
+#define PERF_HISTOGRAM_SUB_BUCKETS (1 << PERF_HISTOGRAM_SUB_BITS)
+// Values below PERF_HISTOGRAM_SUB_BUCKETS have a bucket each, then 4 per power of two up to 2^32
+#define PERF_HISTOGRAM_BUCKETS ((32 - PERF_HISTOGRAM_SUB_BITS + 1) * PERF_HISTOGRAM_SUB_BUCKETS)
+
+class PerfHistogram {
+private:
+    uint32_t buckets[PERF_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t sumCycles;
+    volatile bool resetRequested;
+
+    void clear();
+
+public:
+    PerfHistogram() : resetRequested(false) { clear(); }
+
+    static uint8_t bucketOf(uint32_t cycles) {
+        if (cycles < PERF_HISTOGRAM_SUB_BUCKETS) {
+            return (uint8_t)cycles;
+        }
+        uint8_t octave = 31 - __builtin_clz(cycles);        // >= PERF_HISTOGRAM_SUB_BITS
+        uint8_t shift = octave - PERF_HISTOGRAM_SUB_BITS;
+        uint8_t sub = (cycles >> shift) & (PERF_HISTOGRAM_SUB_BUCKETS - 1);
+        return (uint8_t)((shift + 1) * PERF_HISTOGRAM_SUB_BUCKETS + sub);
+    }
+
+    // Smallest value of a bucket
+    static uint32_t bucketLow(uint8_t bucket) {
+        if (bucket < PERF_HISTOGRAM_SUB_BUCKETS) {
+            return bucket;
+        }
+        uint8_t shift = bucket / PERF_HISTOGRAM_SUB_BUCKETS - 1;
+        uint8_t sub = bucket % PERF_HISTOGRAM_SUB_BUCKETS;
+        return (uint32_t)(PERF_HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    }
+
+    // Largest value of a bucket
+    static uint32_t bucketHigh(uint8_t bucket) {
+        return bucket + 1 < PERF_HISTOGRAM_BUCKETS ? bucketLow(bucket + 1) - 1 : UINT32_MAX;
+    }
+
+    void record(uint32_t cycles) {
+        if (resetRequested) {
+            clear();
+            resetRequested = false;
+        }
+        buckets[bucketOf(cycles)]++;
+        count++;
+        sumCycles += cycles;
+        if (cycles < minCycles) minCycles = cycles;
+        if (cycles > maxCycles) maxCycles = cycles;
+    }
+
+    // Any task; takes effect with the next record()
+    void reset() { resetRequested = true; }
+
+    // Upper bound of the bucket holding the percentile (0..100), clamped to min/max
+    uint32_t percentile(uint8_t percent) const;
+
+    uint32_t getCount() const { return resetRequested ? 0 : count; }
+    uint32_t getMin() const { return count > 0 && !resetRequested ? minCycles : 0; }
+    uint32_t getMax() const { return resetRequested ? 0 : maxCycles; }
+    uint32_t getMean() const { return count > 0 && !resetRequested ? (uint32_t)(sumCycles / count) : 0; }
+    uint32_t getBucket(uint8_t bucket) const { return buckets[bucket]; }
+};
+
+#endif // PERF_HISTOGRAM_H
@@ -0,0 +1,85 @@
+/*
+ * Performance Monitor Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "perf_monitor.h"
+
+static const char* const siteNames[PERF_SITE_COUNT] = {
+    "vebus_receive_frame",
+    "vebus_process_frame",
+    "vebus_send_frame",
+    "can_decode",
+    "can_publish",
+    "ws_telemetry",
+    "api_request",
+};
+
+void PerfMonitor::reset() {
+    for (uint8_t i = 0; i < PERF_SITE_COUNT; i++) {
+        sites[i].reset();
+    }
+}
+
+static uint32_t cyclesToNs(uint32_t cycles, uint32_t mhz) {
+    return (uint32_t)((uint64_t)cycles * 1000 / mhz);
+}
+
+void PerfMonitor::toJson(JsonObject target) {
+    uint32_t mhz = halCpuMhz();
+    target["cpu_mhz"] = mhz;
+    target["enabled"] = PERF_MONITOR_ENABLED != 0;
+
+    JsonObject siteObjects = target["sites"].to<JsonObject>();
+    for (uint8_t i = 0; i < PERF_SITE_COUNT; i++) {
+        const PerfHistogram& histogram = sites[i];
+        JsonObject site = siteObjects[siteNames[i]].to<JsonObject>();
+        site["count"] = histogram.getCount();
+        site["min_ns"] = cyclesToNs(histogram.getMin(), mhz);
+        site["mean_ns"] = cyclesToNs(histogram.getMean(), mhz);
+        site["p50_ns"] = cyclesToNs(histogram.percentile(50), mhz);
+        site["p99_ns"] = cyclesToNs(histogram.percentile(99), mhz);
+        site["max_ns"] = cyclesToNs(histogram.getMax(), mhz);
+    }
+
+    JsonArray tasks = target["tasks"].to<JsonArray>();
+#if HAL_POSIX
+    // Host threads have no stack watermark or run time counter
+    (void)tasks;
+    target["run_time_stats"] = false;
+#else
+#if configUSE_TRACE_FACILITY
+    static TaskStatus_t status[PERF_MAX_TASKS];     // Only from the web server task
+    uint32_t totalRunTime = 0;
+    UBaseType_t taskCount = uxTaskGetSystemState(status, PERF_MAX_TASKS, &totalRunTime);
+    for (UBaseType_t i = 0; i < taskCount; i++) {
+        JsonObject task = tasks.add<JsonObject>();
+        task["name"] = status[i].pcTaskName;
+        task["priority"] = status[i].uxCurrentPriority;
+        task["stack_free"] = status[i].usStackHighWaterMark;    // Bytes on the ESP32, lowest ever
+#if configTASKLIST_INCLUDE_COREID
+        if (status[i].xCoreID == tskNO_AFFINITY) {
+            task["core"] = nullptr;
+        } else {
+            task["core"] = status[i].xCoreID;
+        }
+#endif
+#if configGENERATE_RUN_TIME_STATS
+        task["run_time"] = status[i].ulRunTimeCounter;
+        if (totalRunTime > 0) {
+            // Both cores count into the total
+            task["cpu_percent"] = (float)((uint64_t)status[i].ulRunTimeCounter * 1000 / totalRunTime) / 10.0f;
+        }
+#endif
+    }
+#else
+    // Without the trace facility only the calling task is known
+    JsonObject task = tasks.add<JsonObject>();
+    task["name"] = pcTaskGetName(nullptr);
+    task["stack_free"] = uxTaskGetStackHighWaterMark(nullptr);
+#endif
+    target["run_time_stats"] = configGENERATE_RUN_TIME_STATS != 0;
+#endif
+}
@@ -0,0 +1,84 @@
+/*
+ * Performance Monitor
+ *
+ * Cycle counter timing of the hot paths, served by GET /api/perf. A site is
+ * timed with a scope object:
+ *
+ *   void VeBusHandler::processReceivedFrame(...) {
+ *       PerfScope perf(PERF_VEBUS_PROCESS_FRAME);
+ *       ...
+ *
+ * which reads the CPU cycle counter (CCOUNT) at both ends and records the
+ * difference in the site's PerfHistogram, about 20 cycles in total. The
+ * counter is per core, all timed tasks are pinned to a core. On the host
+ * (hal.h) the "cycles" are nanoseconds. With PERF_MONITOR_ENABLED 0 the
+ * scope is empty and compiles away.
+ *
+ * Also reports the FreeRTOS tasks: stack high water mark and, when the
+ * FreeRTOS run time statistics are configured in, the CPU time per task.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PERF_MONITOR_H
+#define PERF_MONITOR_H
+
+#include <ArduinoJson.h>
+#include "hal.h"
+#include "perf_histogram.h"
+
+#ifndef PERF_MONITOR_ENABLED
+#define PERF_MONITOR_ENABLED 1
+#endif
+
+#define PERF_MAX_TASKS 24
+
+// Order must match the names in perf_monitor.cpp
+enum PerfSiteId : uint8_t {
+    PERF_VEBUS_RECEIVE_FRAME,           // VeBusHandler::receiveFrame(), one decoded frame or none
+    PERF_VEBUS_PROCESS_FRAME,           // VeBusHandler::processReceivedFrame()
+    PERF_VEBUS_SEND_FRAME,              // VeBusHandler::sendFrameMk3(), encoding and UART FIFO write
+    PERF_CAN_DECODE,                    // PylontechDecoder::decode() of one frame
+    PERF_CAN_PUBLISH,                   // Snapshot of one BMS cycle
+    PERF_WS_TELEMETRY,                  // sendTelemetryUpdate() in loop(), JSON/binary build and send
+    PERF_API_REQUEST,                   // ExternalAPI handlers
+    PERF_SITE_COUNT
+};
+
+class PerfMonitor {
+private:
+    PerfHistogram sites[PERF_SITE_COUNT];
+
+public:
+    static inline uint32_t cycles() { return halCycleCount(); }
+
+    void record(PerfSiteId site, uint32_t cycleCount) { sites[site].record(cycleCount); }
+
+    // Takes effect with the next record of each site
+    void reset();
+
+    // {"cpu_mhz":240,"sites":{"vebus_process_frame":{"count":..,"min_ns":..,...}},"tasks":[...]}
+    void toJson(JsonObject target);
+};
+
+extern PerfMonitor perfMonitor;
+
+class PerfScope {
+#if PERF_MONITOR_ENABLED
+private:
+    PerfSiteId site;
+    uint32_t start;
+
+public:
+    explicit PerfScope(PerfSiteId id) : site(id), start(PerfMonitor::cycles()) {}
+    ~PerfScope() { perfMonitor.record(site, PerfMonitor::cycles() - start); }
+#else
+public:
+    explicit PerfScope(PerfSiteId) {}
+#endif
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+};
+
+#endif // PERF_MONITOR_H
@@ -4,12 +4,25 @@
 #include <Arduino.h>
 #include <driver/twai.h>
 #include "system_data.h"
+#include "pylontech_decoder.h"
+#include "seqlock.h"
 
 /**
  * Pylontech CAN Bus Communication Handler
  * 
  * Handles communication with Pylontech batteries via CAN bus
  * Runs in separate FreeRTOS task for non-blocking operation
+ *
+ * The TWAI acceptance filter only lets the BMS ID range (0x350-0x35F)
+ * through, other traffic on the bus never reaches the RX queue. The task
+ * sleeps in twai_receive() until a frame arrives, then keeps decoding until
+ * the bus has been quiet for CAN_BURST_GAP_MS: that is one BMS broadcast
+ * cycle. Only then the decoded state is published as one snapshot through a
+ * SeqLock, so getBattery() never returns the voltage of one cycle with the
+ * current of the previous one, and readers never block the CAN task. Each
+ * snapshot carries the receive time of every frame kind for staleness checks.
+ * Once per CAN_STATUS_INTERVAL_MS (or when idle) the task reads the TWAI
+ * alerts and status for the error counters and recovers from bus-off.
  */
 
 // LilyGO T-CAN485 Board CAN pin definitions
@@ -21,14 +34,27 @@
 #define CAN_RX_PIN GPIO_NUM_26
 #endif
 #define CAN_BITRATE TWAI_TIMING_CONFIG_500KBITS()
+#define CAN_RX_QUEUE_LEN 32                 // A full BMS burst is 6 frames per battery
+#define CAN_STATUS_INTERVAL_MS 1000
+#define CAN_BURST_GAP_MS 20                 // Quiet time that ends a BMS broadcast cycle
+#define CAN_BURST_MAX_FRAMES 64             // Publish at the latest after this many frames
+#define CAN_BATTERY_TIMEOUT_MS 5000         // Battery data older than this is offline
+#define CAN_ALERTS (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_RX_QUEUE_FULL | \
+                    TWAI_ALERT_ARB_LOST | TWAI_ALERT_BUS_ERROR | TWAI_ALERT_ERR_PASS)
 
-// Pylontech CAN IDs
-#define PYLONTECH_BATTERY_VOLTAGE_ID    0x359
-#define PYLONTECH_BATTERY_CURRENT_ID    0x35A
-#define PYLONTECH_BATTERY_SOC_ID        0x35B
-#define PYLONTECH_BATTERY_TEMP_ID       0x35C
-#define PYLONTECH_BATTERY_LIMITS_ID     0x35D
-#define PYLONTECH_BATTERY_STATUS_ID     0x35E
+struct PylontechCanStats {
+    uint32_t framesReceived;
+    uint32_t cycles;                        // Snapshots published
+    uint32_t busOff;                        // Bus-off events, each followed by a recovery
+    uint32_t rxQueueFull;                   // Alerts; frames lost are in rxMissed
+    uint32_t rxMissed;                      // From twai_get_status_info()
+    uint32_t rxOverruns;
+    uint32_t arbitrationLost;
+    uint32_t busErrors;
+    uint32_t errorPassive;
+    twai_state_t state;
+    PylontechDecoderStats decoder;
+};
 
 class PylontechCAN {
 private:
@@ -41,23 +67,18 @@ private:
     twai_timing_config_t t_config;
     twai_filter_config_t f_config;
     
+    PylontechDecoder decoder;
+    SeqLock<PylontechBatteryState> battery; // Written by the CAN task only
+    PylontechCanStats stats;
+    portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+    
     // Task management
     static void canTaskWrapper(void* parameter);
     void canTask();
     
     // Message processing
-    void processCanMessage(const twai_message_t& message);
-    void processBatteryVoltage(const twai_message_t& message);
-    void processBatteryCurrent(const twai_message_t& message);
-    void processBatterySOC(const twai_message_t& message);
-    void processBatteryTemperature(const twai_message_t& message);
-    void processBatteryLimits(const twai_message_t& message);
-    void processBatteryStatus(const twai_message_t& message);
-    
-    // Helper functions
-    uint16_t bytesToUint16(uint8_t high, uint8_t low);
-    int16_t bytesToInt16(uint8_t high, uint8_t low);
-    uint32_t bytesToUint32(uint8_t byte3, uint8_t byte2, uint8_t byte1, uint8_t byte0);
+    void publishBatteryState(uint8_t updated);
+    void checkBusStatus();
     
 public:
     PylontechCAN();
@@ -68,10 +89,12 @@ public:
     void end();
     bool isTaskRunning() const { return isRunning; }
     
+    // Consistent copy of the last complete BMS cycle, from any task
+    PylontechBatteryState getBattery() const { return battery.read(); }
+    
     // Statistics
-    uint32_t messagesReceived = 0;
-    uint32_t messagesErrors = 0;
     unsigned long lastMessageTime = 0;
+    PylontechCanStats getStats();
     
     // Status
     bool isBatteryOnline() const;
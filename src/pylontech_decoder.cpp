@@ -0,0 +1,111 @@
+/*
+ * Pylontech CAN Decoder Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pylontech_decoder.h"
+#include <string.h>
+
+static inline uint16_t getLe16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static inline int16_t getLe16Signed(const uint8_t* data) {
+    return (int16_t)getLe16(data);
+}
+
+// Sorted by ID
+const PylontechDecoder::Route PylontechDecoder::routes[] = {
+    {PYLONTECH_LIMITS_ID, PYLONTECH_FRAME_LIMITS, 6, &PylontechDecoder::decodeLimits},
+    {PYLONTECH_SOC_ID, PYLONTECH_FRAME_SOC, 4, &PylontechDecoder::decodeSoc},
+    {PYLONTECH_MEASUREMENTS_ID, PYLONTECH_FRAME_MEASUREMENTS, 6, &PylontechDecoder::decodeMeasurements},
+    {PYLONTECH_ALARMS_ID, PYLONTECH_FRAME_ALARMS, 4, &PylontechDecoder::decodeAlarms},
+    {PYLONTECH_REQUEST_ID, PYLONTECH_FRAME_REQUEST, 1, &PylontechDecoder::decodeRequest},
+    {PYLONTECH_MANUFACTURER_ID, PYLONTECH_FRAME_MANUFACTURER, 1, &PylontechDecoder::decodeManufacturer},
+};
+
+PylontechDecoder::PylontechDecoder() {
+    memset(&state, 0, sizeof(state));
+    memset(&stats, 0, sizeof(stats));
+    state.soc = -1;
+    state.soh = -1;
+}
+
+bool PylontechDecoder::decode(uint32_t id, bool extended, bool remote, const uint8_t* data, uint8_t length, uint32_t nowMs) {
+    stats.frames++;
+    if (extended || remote) {
+        stats.ignored++;
+        return false;
+    }
+    if (length > 8) length = 8;
+
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]) && routes[i].id <= id; i++) {
+        if (routes[i].id != id) continue;
+
+        if (length < routes[i].minLength) {
+            stats.tooShort++;
+            return false;
+        }
+        (this->*routes[i].decode)(data, length);
+        state.updated |= PYLONTECH_UPDATED(routes[i].frame);
+        state.received[routes[i].frame] = nowMs;
+        stats.decoded++;
+        return true;
+    }
+
+    stats.ignored++;
+    return false;
+}
+
+uint8_t PylontechDecoder::takeUpdated() {
+    uint8_t updated = state.updated;
+    state.updated = 0;
+    return updated;
+}
+
+void PylontechDecoder::decodeLimits(const uint8_t* data, uint8_t length) {
+    state.chargeVoltage = getLe16(&data[0]) / 10.0f;
+    state.chargeCurrentLimit = getLe16Signed(&data[2]) / 10.0f;
+    state.dischargeCurrentLimit = getLe16Signed(&data[4]) / 10.0f;
+    if (length >= 8) {
+        state.dischargeVoltage = getLe16(&data[6]) / 10.0f;
+    }
+}
+
+void PylontechDecoder::decodeSoc(const uint8_t* data, uint8_t /* length */) {
+    state.soc = (int16_t)getLe16(&data[0]);
+    state.soh = (int16_t)getLe16(&data[2]);
+}
+
+void PylontechDecoder::decodeMeasurements(const uint8_t* data, uint8_t /* length */) {
+    state.voltage = getLe16Signed(&data[0]) / 100.0f;
+    state.current = getLe16Signed(&data[2]) / 10.0f;
+    state.power = (int32_t)(state.voltage * state.current);
+    state.temperature = getLe16Signed(&data[4]) / 10.0f;
+}
+
+void PylontechDecoder::decodeAlarms(const uint8_t* data, uint8_t length) {
+    state.protectionFlags1 = data[0];
+    state.protectionFlags2 = data[1];
+    state.warningFlags1 = data[2];
+    state.warningFlags2 = data[3];
+    if (length >= 5) {
+        state.modules = data[4];
+    }
+}
+
+void PylontechDecoder::decodeRequest(const uint8_t* data, uint8_t /* length */) {
+    state.requestFlags = data[0];
+}
+
+void PylontechDecoder::decodeManufacturer(const uint8_t* data, uint8_t length) {
+    // Padded with spaces or zeros
+    uint8_t end = length;
+    while (end > 0 && (data[end - 1] == ' ' || data[end - 1] == '\0')) end--;
+    for (uint8_t i = 0; i < end; i++) {
+        state.manufacturer[i] = (data[i] >= 0x20 && data[i] < 0x7F) ? (char)data[i] : '?';
+    }
+    state.manufacturer[end] = '\0';
+}
@@ -0,0 +1,126 @@
+/*
+ * Pylontech CAN Decoder
+ *
+ * Decodes the frames a Pylontech BMS sends about once per second
+ * (500 kbit/s, 11 bit IDs, little endian values):
+ *
+ *   0x351  charge voltage 0.1 V, charge / discharge current limit 0.1 A,
+ *          discharge voltage 0.1 V
+ *   0x355  SOC %, SOH %
+ *   0x356  voltage 0.01 V, current 0.1 A, temperature 0.1 °C
+ *   0x359  protection flags (2 bytes), warning flags (2 bytes), module count
+ *   0x35C  request flags (charge / discharge enable, force charge)
+ *   0x35E  manufacturer, 8 ASCII characters
+ *
+ * Frames are dispatched through a table sorted by ID; frames that are too
+ * short, extended or remote frames and other IDs are only counted. All IDs
+ * lie in 0x350-0x35F, the range PYLONTECH_FILTER_* lets through the TWAI
+ * acceptance filter.
+ *
+ * No hardware dependencies, can be tested on the host with recorded traces.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PYLONTECH_DECODER_H
+#define PYLONTECH_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PYLONTECH_LIMITS_ID         0x351
+#define PYLONTECH_SOC_ID            0x355
+#define PYLONTECH_MEASUREMENTS_ID   0x356
+#define PYLONTECH_ALARMS_ID         0x359
+#define PYLONTECH_REQUEST_ID        0x35C
+#define PYLONTECH_MANUFACTURER_ID   0x35E
+
+// Single filter, standard frame: ID in bits 31..21, mask bits set = don't care
+#define PYLONTECH_FILTER_CODE       (0x350UL << 21)
+#define PYLONTECH_FILTER_MASK       ((0x00FUL << 21) | 0x1FFFFFUL)
+
+enum PylontechFrame : uint8_t {
+    PYLONTECH_FRAME_LIMITS,
+    PYLONTECH_FRAME_SOC,
+    PYLONTECH_FRAME_MEASUREMENTS,
+    PYLONTECH_FRAME_ALARMS,
+    PYLONTECH_FRAME_REQUEST,
+    PYLONTECH_FRAME_MANUFACTURER,
+    PYLONTECH_FRAME_COUNT
+};
+
+// Bit of a frame in PylontechBatteryState::updated
+#define PYLONTECH_UPDATED(frame) (1u << (frame))
+
+struct PylontechBatteryState {
+    float chargeVoltage;
+    float chargeCurrentLimit;
+    float dischargeCurrentLimit;
+    float dischargeVoltage;
+    int16_t soc;
+    int16_t soh;
+    float voltage;
+    float current;
+    int32_t power;                      // W, from voltage and current of the same frame
+    float temperature;
+    uint8_t protectionFlags1;
+    uint8_t protectionFlags2;
+    uint8_t warningFlags1;
+    uint8_t warningFlags2;
+    uint8_t modules;
+    uint8_t requestFlags;
+    char manufacturer[9];
+    uint8_t updated;                    // PYLONTECH_UPDATED() bits since the last takeUpdated(),
+                                        // in a PylontechCAN snapshot the frames of that cycle
+    uint32_t received[PYLONTECH_FRAME_COUNT];   // Time of the last frame of each kind, 0 = never
+
+    // Age of a frame kind in the time base given to decode(), UINT32_MAX if never received
+    uint32_t age(PylontechFrame frame, uint32_t nowMs) const {
+        return received[frame] == 0 ? UINT32_MAX : nowMs - received[frame];
+    }
+};
+
+struct PylontechDecoderStats {
+    uint32_t frames;
+    uint32_t decoded;
+    uint32_t ignored;                   // Other IDs, extended or remote frames
+    uint32_t tooShort;
+};
+
+class PylontechDecoder {
+private:
+    struct Route {
+        uint32_t id;
+        PylontechFrame frame;
+        uint8_t minLength;
+        void (PylontechDecoder::*decode)(const uint8_t* data, uint8_t length);
+    };
+    static const Route routes[];
+
+    PylontechBatteryState state;
+    PylontechDecoderStats stats;
+
+    void decodeLimits(const uint8_t* data, uint8_t length);
+    void decodeSoc(const uint8_t* data, uint8_t length);
+    void decodeMeasurements(const uint8_t* data, uint8_t length);
+    void decodeAlarms(const uint8_t* data, uint8_t length);
+    void decodeRequest(const uint8_t* data, uint8_t length);
+    void decodeManufacturer(const uint8_t* data, uint8_t length);
+
+public:
+    PylontechDecoder();
+
+    // False if the frame was not decoded. nowMs stamps PylontechBatteryState::received
+    // and must not be 0, e.g. millis() | 1.
+    bool decode(uint32_t id, bool extended, bool remote, const uint8_t* data, uint8_t length, uint32_t nowMs);
+
+    const PylontechBatteryState& getState() const { return state; }
+
+    // Update bits since the last call, cleared
+    uint8_t takeUpdated();
+
+    const PylontechDecoderStats& getStats() const { return stats; }
+};
+
+#endif // PYLONTECH_DECODER_H
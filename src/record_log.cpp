@@ -0,0 +1,398 @@
+/*
+ * Record Log Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "record_log.h"
+#include <string.h>
+
+#define RECORD_LOG_CHUNK 64             // Stack buffer for CRC checks and copies
+
+// CRC-32 (IEEE 802.3), nibble table
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+static inline void putLe32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t getLe32(const uint8_t* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+RecordLog::RecordLog(LogFlash* logFlash) {
+    flash = logFlash;
+    segmentSize = 0;
+    segmentCount = 0;
+    nextSequence = 1;
+    head = -1;
+    headOffset = 0;
+    mounted = false;
+    buffered = 0;
+    memset(sequences, 0, sizeof(sequences));
+    memset(erased, 0, sizeof(erased));
+    memset(keys, 0, sizeof(keys));
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool RecordLog::readHeader(uint8_t segment, uint32_t& sequence) {
+    uint8_t header[RECORD_LOG_SEGMENT_HEADER];
+    if (!flash->read(address(segment, 0), header, sizeof(header))) return false;
+    if (getLe32(&header[0]) != RECORD_LOG_MAGIC) return false;
+    if (getLe32(&header[12]) != crc32Update(0, header, 12)) return false;
+    sequence = getLe32(&header[4]);
+    return sequence != 0;
+}
+
+// True for a complete record; end is set when the rest of the segment is unwritten
+bool RecordLog::checkRecord(uint8_t segment, uint32_t offset, LogRecordInfo& info, bool& end) {
+    uint8_t header[RECORD_LOG_RECORD_HEADER];
+    end = false;
+
+    if (offset + RECORD_LOG_RECORD_HEADER > segmentSize) {
+        end = true;
+        return false;
+    }
+    if (!flash->read(address(segment, offset), header, sizeof(header))) return false;
+
+    bool blank = true;
+    for (uint8_t i = 0; i < sizeof(header); i++) {
+        blank &= header[i] == 0xFF;
+    }
+    if (blank) {
+        end = true;
+        return false;
+    }
+
+    info.length = header[0] | (header[1] << 8);
+    info.type = header[2];
+    if (header[3] != (uint8_t)~info.type) return false;
+    if (info.length > RECORD_LOG_MAX_PAYLOAD || offset + recordSize(info.length) > segmentSize) return false;
+
+    uint32_t crc = crc32Update(0, header, 4);
+    uint8_t chunk[RECORD_LOG_CHUNK];
+    for (uint16_t done = 0; done < info.length; ) {
+        uint16_t part = (uint32_t)(info.length - done) > sizeof(chunk) ? sizeof(chunk) : info.length - done;
+        if (!flash->read(address(segment, offset + RECORD_LOG_RECORD_HEADER + done), chunk, part)) return false;
+        crc = crc32Update(crc, chunk, part);
+        done += part;
+    }
+    return crc == getLe32(&header[4]);
+}
+
+bool RecordLog::isErased(uint8_t segment, uint32_t offset) {
+    uint8_t chunk[RECORD_LOG_CHUNK];
+    while (offset < segmentSize) {
+        uint32_t part = segmentSize - offset > sizeof(chunk) ? sizeof(chunk) : segmentSize - offset;
+        if (!flash->read(address(segment, offset), chunk, part)) return false;
+        for (uint32_t i = 0; i < part; i++) {
+            if (chunk[i] != 0xFF) return false;
+        }
+        offset += part;
+    }
+    return true;
+}
+
+// Segment with the lowest sequence number not below atLeast, -1 if none
+int RecordLog::findSequence(uint32_t atLeast) const {
+    int found = -1;
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        if (sequences[i] >= atLeast && sequences[i] != 0 && (found < 0 || sequences[i] < sequences[found])) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+uint8_t RecordLog::usedSegments() const {
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        if (sequences[i] != 0) used++;
+    }
+    return used;
+}
+
+void RecordLog::indexRecord(uint8_t type, uint32_t sequence, uint32_t offset, uint16_t length) {
+    if (type >= RECORD_LOG_KEYS) return;
+    keys[type].valid = true;
+    keys[type].sequence = sequence;
+    keys[type].offset = offset;
+    keys[type].length = length;
+}
+
+bool RecordLog::mount() {
+    mounted = false;
+    head = -1;
+    headOffset = 0;
+    buffered = 0;
+    nextSequence = 1;
+    memset(keys, 0, sizeof(keys));
+    memset(&stats, 0, sizeof(stats));
+
+    segmentSize = flash->getSectorSize();
+    uint32_t count = segmentSize >= 512 ? flash->getSize() / segmentSize : 0;
+    segmentCount = count > RECORD_LOG_MAX_SEGMENTS ? RECORD_LOG_MAX_SEGMENTS : (uint8_t)count;
+    if (segmentCount < 2) return false;
+
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        uint32_t sequence;
+        sequences[i] = readHeader(i, sequence) ? sequence : 0;
+        erased[i] = false;
+        if (sequences[i] >= nextSequence) nextSequence = sequences[i] + 1;
+    }
+
+    // Walk the segments oldest first, later records of a key replace earlier ones
+    int segment;
+    for (uint32_t sequence = 1; (segment = findSequence(sequence)) >= 0; sequence = sequences[segment] + 1) {
+        uint32_t offset = RECORD_LOG_SEGMENT_HEADER;
+        LogRecordInfo info;
+        bool end;
+        while (checkRecord(segment, offset, info, end)) {
+            indexRecord(info.type, sequences[segment], offset, info.length);
+            stats.records++;
+            offset += recordSize(info.length);
+        }
+
+        bool clean = end && isErased(segment, offset);
+        if (!clean) stats.tornRecords++;
+        head = segment;
+        // Nothing more is written behind a torn record, the next append opens a new segment
+        headOffset = clean ? offset : segmentSize;
+    }
+
+    if (usedSegments() == segmentCount) {
+        // Power was lost during compaction, before the oldest segment was erased
+        int oldest = findSequence(1);
+        bool live = false;
+        for (uint8_t k = 0; k < RECORD_LOG_KEYS; k++) {
+            live |= keys[k].valid && keys[k].sequence == sequences[oldest];
+        }
+        if (live) {
+            // Copies are incomplete and the head holds nothing else: drop it and start over,
+            // the next segment change repeats the compaction
+            if (!erase(head)) return false;
+            return mount();
+        }
+        if (!erase(oldest)) return false;
+    }
+
+    mounted = true;
+    return true;
+}
+
+bool RecordLog::erase(uint8_t segment) {
+    static const uint8_t invalid[RECORD_LOG_SEGMENT_HEADER] = { 0 };
+
+    sequences[segment] = 0;
+    erased[segment] = false;
+    // A half-erased sector may keep its old header; clear it first so the stale records stay invisible
+    if (!flash->write(address(segment, 0), invalid, sizeof(invalid))) return false;
+    if (!flash->eraseSector(address(segment, 0))) return false;
+    erased[segment] = true;
+    stats.erases++;
+    return true;
+}
+
+bool RecordLog::openSegment() {
+    // Round robin from the current head spreads the erases over all segments
+    int start = head < 0 ? 0 : (head + 1) % segmentCount;
+    int segment = -1;
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        uint8_t candidate = (start + i) % segmentCount;
+        if (sequences[candidate] == 0) {
+            segment = candidate;
+            break;
+        }
+    }
+    if (segment < 0) return false;
+    if (!erased[segment] && !erase(segment)) return false;
+
+    uint8_t header[RECORD_LOG_SEGMENT_HEADER];
+    putLe32(&header[0], RECORD_LOG_MAGIC);
+    putLe32(&header[4], nextSequence);
+    putLe32(&header[8], 0xFFFFFFFFUL);
+    putLe32(&header[12], crc32Update(0, header, 12));
+    erased[segment] = false;
+    if (!flash->write(address(segment, 0), header, sizeof(header))) return false;
+
+    sequences[segment] = nextSequence++;
+    head = segment;
+    headOffset = RECORD_LOG_SEGMENT_HEADER;
+
+    // Keep one segment free for the next change
+    if (usedSegments() == segmentCount) {
+        int oldest = findSequence(1);
+        if (!compact(oldest)) return false;
+        if (!erase(oldest)) return false;
+    }
+    return true;
+}
+
+// Copy the records of a segment that are still the latest of their key to the head
+bool RecordLog::compact(uint8_t segment) {
+    uint8_t chunk[RECORD_LOG_CHUNK];
+
+    for (uint8_t k = 0; k < RECORD_LOG_KEYS; k++) {
+        KeyEntry& key = keys[k];
+        if (!key.valid || key.sequence != sequences[segment]) continue;
+
+        uint32_t size = recordSize(key.length);
+        if (headOffset + size > segmentSize) {
+            key.valid = false;      // Cannot happen with RECORD_LOG_MAX_PAYLOAD and 4 kB segments
+            continue;
+        }
+        for (uint32_t done = 0; done < size; ) {
+            uint32_t part = size - done > sizeof(chunk) ? sizeof(chunk) : size - done;
+            if (!flash->read(address(segment, key.offset + done), chunk, part) ||
+                !flash->write(address(head, headOffset + done), chunk, part)) {
+                headOffset = segmentSize;
+                return false;
+            }
+            done += part;
+        }
+        key.sequence = sequences[head];
+        key.offset = headOffset;
+        headOffset += size;
+        stats.compactedRecords++;
+    }
+    return true;
+}
+
+void RecordLog::encodeHeader(uint8_t* out, uint8_t type, const void* payload, uint16_t length) const {
+    out[0] = (uint8_t)length;
+    out[1] = (uint8_t)(length >> 8);
+    out[2] = type;
+    out[3] = (uint8_t)~type;
+    putLe32(&out[4], crc32Update(crc32Update(0, out, 4), (const uint8_t*)payload, length));
+}
+
+bool RecordLog::append(uint8_t type, const void* payload, uint16_t length) {
+    if (!mounted || length > RECORD_LOG_MAX_PAYLOAD) return false;
+
+    uint32_t size = recordSize(length);
+    if (head < 0 || headOffset + buffered + size > segmentSize) {
+        if (!flush() || !openSegment()) return false;
+    }
+    if (buffered + size > RECORD_LOG_BUFFER_SIZE && !flush()) return false;
+
+    uint32_t offset = headOffset + buffered;
+    if (size > RECORD_LOG_BUFFER_SIZE) {
+        // Larger than the buffer: header and payload straight to the flash
+        uint8_t header[RECORD_LOG_RECORD_HEADER];
+        uint8_t padding[3] = { 0xFF, 0xFF, 0xFF };
+        uint32_t padded = size - RECORD_LOG_RECORD_HEADER;
+        encodeHeader(header, type, payload, length);
+        if (!flash->write(address(head, offset), header, sizeof(header)) ||
+            !flash->write(address(head, offset + RECORD_LOG_RECORD_HEADER), payload, length) ||
+            (padded > length && !flash->write(address(head, offset + RECORD_LOG_RECORD_HEADER + length), padding, padded - length))) {
+            headOffset = segmentSize;
+            return false;
+        }
+        headOffset += size;
+        stats.flushes++;
+    } else {
+        uint8_t* out = &buffer[buffered];
+        encodeHeader(out, type, payload, length);
+        memcpy(&out[RECORD_LOG_RECORD_HEADER], payload, length);
+        memset(&out[RECORD_LOG_RECORD_HEADER + length], 0xFF, size - RECORD_LOG_RECORD_HEADER - length);
+        buffered += size;
+    }
+
+    indexRecord(type, sequences[head], offset, length);
+    stats.records++;
+    return true;
+}
+
+bool RecordLog::flush() {
+    if (buffered == 0) return true;
+
+    bool ok = flash->write(address(head, headOffset), buffer, buffered);
+    // After a failed write the rest of the segment is not trusted
+    headOffset = ok ? headOffset + buffered : segmentSize;
+    buffered = 0;
+    stats.flushes++;
+    return ok;
+}
+
+bool RecordLog::readLatest(uint8_t type, void* payload, uint16_t size, uint16_t& length) {
+    if (!mounted || type >= RECORD_LOG_KEYS || !keys[type].valid) return false;
+    if (!flush()) return false;
+
+    const KeyEntry& key = keys[type];
+    int segment = findSequence(key.sequence);
+    if (segment < 0 || sequences[segment] != key.sequence || key.length > size) return false;
+
+    length = key.length;
+    return flash->read(address(segment, key.offset + RECORD_LOG_RECORD_HEADER), payload, key.length);
+}
+
+void RecordLog::rewind(LogCursor& cursor) const {
+    int oldest = findSequence(1);
+    cursor.sequence = oldest >= 0 ? sequences[oldest] : 1;
+    cursor.offset = RECORD_LOG_SEGMENT_HEADER;
+}
+
+bool RecordLog::next(LogCursor& cursor, LogRecordInfo& info, void* payload, uint16_t size) {
+    if (!mounted) return false;
+
+    int segment;
+    while ((segment = findSequence(cursor.sequence)) >= 0) {
+        if (sequences[segment] != cursor.sequence) {
+            // Our segment was reused in the meantime, continue with the next one
+            cursor.sequence = sequences[segment];
+            cursor.offset = RECORD_LOG_SEGMENT_HEADER;
+        }
+
+        bool end;
+        if (checkRecord(segment, cursor.offset, info, end)) {
+            uint16_t part = info.length < size ? info.length : size;
+            if (part > 0 && !flash->read(address(segment, cursor.offset + RECORD_LOG_RECORD_HEADER), payload, part)) {
+                return false;
+            }
+            cursor.offset += recordSize(info.length);
+            return true;
+        }
+        if (segment == head && end) {
+            return false;           // Stay here, later records of the head are read on the next call
+        }
+
+        cursor.sequence++;
+        cursor.offset = RECORD_LOG_SEGMENT_HEADER;
+    }
+    return false;
+}
+
+bool RecordLog::format() {
+    if (segmentCount == 0) {
+        segmentSize = flash->getSectorSize();
+        uint32_t count = segmentSize >= 512 ? flash->getSize() / segmentSize : 0;
+        segmentCount = count > RECORD_LOG_MAX_SEGMENTS ? RECORD_LOG_MAX_SEGMENTS : (uint8_t)count;
+    }
+    for (uint8_t i = 0; i < segmentCount; i++) {
+        if (!erase(i)) return false;
+    }
+    return mount();
+}
+
+RecordLogStats RecordLog::getStats() const {
+    RecordLogStats result = stats;
+    result.segments = segmentCount;
+    result.usedSegments = usedSegments();
+    result.headOffset = headOffset + buffered;
+    return result;
+}
@@ -0,0 +1,149 @@
+/*
+ * Record Log
+ *
+ * Append-only log of small CRC-protected records on raw NOR flash, used for
+ * the energy counters and the event log (EventLog). The flash area is split
+ * into segments of one erase sector each. Records are appended to the head
+ * segment; when it is full the next free segment becomes the head. There is
+ * always one free segment: when the last one is taken, the records of the
+ * oldest segment that are still the latest of their key are copied to the
+ * new head and the oldest segment is erased (compaction). Other records,
+ * like events, age out with their segment.
+ *
+ * Segment: header (magic, sequence, CRC), then records up to the sector end.
+ * Record:  u16 payload length, u8 type, u8 ~type, u32 CRC32 over the first
+ *          4 bytes and the payload, payload padded to 4 bytes with 0xFF.
+ *
+ * Records go through a small RAM buffer and reach the flash in one write on
+ * flush(), so frequent small events do not each cost a write. Flash is only
+ * erased when a segment is reused.
+ *
+ * Power loss: an interrupted write leaves a record with a bad CRC (or junk
+ * behind the last record) in the head segment. mount() stops the head at the
+ * last good record and continues in a new segment. An interrupted compaction
+ * shows as no free segment while the oldest one still holds live keys; the
+ * new head only holds partial copies, so it is erased and the compaction
+ * runs again. Before a segment is erased its header is cleared, so an
+ * interrupted erase or header write leaves a segment that counts as free.
+ *
+ * The flash is accessed through LogFlash, so the log runs on the host against
+ * a simulated flash.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RECORD_LOG_MAGIC 0x474F4C45UL   // "ELOG"
+#define RECORD_LOG_SEGMENT_HEADER 16
+#define RECORD_LOG_RECORD_HEADER 8
+#define RECORD_LOG_MAX_SEGMENTS 32
+#define RECORD_LOG_MAX_PAYLOAD 1000     // All keyed records fit into one 4 kB segment
+#define RECORD_LOG_KEYS 4               // Types below this are keyed: the latest record is kept
+#define RECORD_LOG_BUFFER_SIZE 512      // Records collected before a flash write
+
+// NOR flash: erase sets a sector to 0xFF, write can only clear bits
+class LogFlash {
+public:
+    virtual ~LogFlash() {}
+
+    virtual uint32_t getSize() const = 0;
+    virtual uint32_t getSectorSize() const = 0;
+
+    virtual bool read(uint32_t address, void* data, size_t length) = 0;
+    virtual bool write(uint32_t address, const void* data, size_t length) = 0;
+    virtual bool eraseSector(uint32_t address) = 0;
+};
+
+struct LogRecordInfo {
+    uint8_t type;
+    uint16_t length;                    // Payload bytes
+};
+
+// Reading position; start with RecordLog::rewind()
+struct LogCursor {
+    uint32_t sequence;                  // Segment being read, to notice when it was reused
+    uint32_t offset;
+};
+
+struct RecordLogStats {
+    uint8_t segments;
+    uint8_t usedSegments;
+    uint32_t records;                   // Found on mount plus appended since
+    uint32_t erases;                    // Since mount
+    uint32_t flushes;
+    uint32_t compactedRecords;
+    uint32_t tornRecords;               // Interrupted writes found on mount
+    uint32_t headOffset;
+};
+
+class RecordLog {
+private:
+    struct KeyEntry {
+        bool valid;
+        uint32_t sequence;              // Segment holding the latest record of this key
+        uint32_t offset;
+        uint16_t length;
+    };
+
+    LogFlash* flash;
+    uint32_t segmentSize;
+    uint8_t segmentCount;
+    uint32_t sequences[RECORD_LOG_MAX_SEGMENTS];    // 0 = free
+    bool erased[RECORD_LOG_MAX_SEGMENTS];           // Known to be erased since mount
+    uint32_t nextSequence;
+    int head;                           // Segment being written, -1 = none yet
+    uint32_t headOffset;                // Written to flash so far
+    bool mounted;
+
+    uint8_t buffer[RECORD_LOG_BUFFER_SIZE];
+    uint16_t buffered;
+
+    KeyEntry keys[RECORD_LOG_KEYS];
+    RecordLogStats stats;
+
+    uint32_t address(uint8_t segment, uint32_t offset) const { return (uint32_t)segment * segmentSize + offset; }
+    static uint32_t recordSize(uint16_t length) { return RECORD_LOG_RECORD_HEADER + ((length + 3u) & ~3u); }
+
+    bool readHeader(uint8_t segment, uint32_t& sequence);
+    bool checkRecord(uint8_t segment, uint32_t offset, LogRecordInfo& info, bool& end);
+    bool isErased(uint8_t segment, uint32_t offset);
+    int findSequence(uint32_t atLeast) const;
+    uint8_t usedSegments() const;
+    void encodeHeader(uint8_t* out, uint8_t type, const void* payload, uint16_t length) const;
+    bool openSegment();
+    bool compact(uint8_t segment);
+    bool erase(uint8_t segment);
+    void indexRecord(uint8_t type, uint32_t sequence, uint32_t offset, uint16_t length);
+
+public:
+    explicit RecordLog(LogFlash* logFlash);
+
+    // Scan the flash and continue after the last good record; false if the flash is unusable
+    bool mount();
+    bool isMounted() const { return mounted; }
+
+    // Buffered; false if the record is too large or the flash failed
+    bool append(uint8_t type, const void* payload, uint16_t length);
+    bool flush();
+    uint16_t getBuffered() const { return buffered; }
+
+    // Latest record of a keyed type (flushes first); false if there is none
+    bool readLatest(uint8_t type, void* payload, uint16_t size, uint16_t& length);
+
+    // All flushed records, oldest first
+    void rewind(LogCursor& cursor) const;
+    bool next(LogCursor& cursor, LogRecordInfo& info, void* payload, uint16_t size);
+
+    // Erase everything
+    bool format();
+
+    RecordLogStats getStats() const;
+};
+
+#endif // RECORD_LOG_H
@@ -0,0 +1,84 @@
+/*
+ * Sequence Lock
+ *
+ * Publishes a snapshot of a plain data structure from one writer to any
+ * number of readers without blocking. The writer bumps the sequence counter
+ * to an odd value, copies the data and bumps it to the next even value.
+ * Readers copy the data and retry if the counter was odd or changed while
+ * they were copying, so they always get a consistent snapshot and never
+ * hold up the writer.
+ *
+ * Only one writer may be active at a time; concurrent writers need their own
+ * lock. A writer can be preempted in the middle of a write by a reader of
+ * higher priority on the same core (e.g. setSwitchState() from loop() and
+ * the ESS control task on core 1). Spinning would then never let the writer
+ * finish, so read() sleeps a tick between attempts after
+ * SEQLOCK_SPIN_LIMIT failed copies.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "hal.h"
+
+#define SEQLOCK_SPIN_LIMIT 16   // Failed copies before read() starts to sleep
+
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock data must be trivially copyable");
+
+private:
+    std::atomic<uint32_t> sequence;
+    T data;
+
+public:
+    SeqLock() : sequence(0), data() {}
+
+    // Writer side - callers must serialize writes
+    void write(const T& value) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy((void*)&data, (const void*)&value, sizeof(T));
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Single read attempt, fails if a write was in progress
+    bool tryRead(T& value) const {
+        uint32_t seq = sequence.load(std::memory_order_acquire);
+        if (seq & 1) {
+            return false;
+        }
+        memcpy((void*)&value, (const void*)&data, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence.load(std::memory_order_relaxed) == seq;
+    }
+
+    // Wait-free for the writer, readers retry until they get a clean copy.
+    // Not from an ISR or a critical section, it may sleep.
+    T read() const {
+        T value;
+        uint32_t attempts = 0;
+        while (!tryRead(value)) {
+            if (++attempts >= SEQLOCK_SPIN_LIMIT) {
+                // A preempted writer of lower priority runs meanwhile
+                halDelayMs(1);
+            }
+        }
+        return value;
+    }
+
+    // Number of completed writes, changes whenever a new snapshot is published
+    uint32_t generation() const {
+        return sequence.load(std::memory_order_acquire) >> 1;
+    }
+};
+
+#endif // SEQLOCK_H
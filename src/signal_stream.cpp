@@ -0,0 +1,168 @@
+/*
+ * Signal Stream Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "signal_stream.h"
+#include <string.h>
+
+static const char* const signalNames[STREAM_SIGNAL_COUNT] = {
+    "ac_power", "dc_current", "dc_voltage", "ess_setpoint", "meter_power"
+};
+
+const char* streamSignalName(uint8_t signal) {
+    return signal < STREAM_SIGNAL_COUNT ? signalNames[signal] : "";
+}
+
+int streamSignalFromName(const char* name) {
+    for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+        if (strcmp(name, signalNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+void StreamSampleRing::push(const StreamSample& sample) {
+    uint32_t sequence = head.load(std::memory_order_relaxed);
+
+    // Readers of the slot we are about to overwrite see the claim and retry elsewhere
+    claimed.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slots[sequence % STREAM_RING_SIZE] = sample;
+    head.store(sequence + 1, std::memory_order_release);
+}
+
+bool StreamSampleRing::read(uint32_t sequence, StreamSample& sample) const {
+    if ((int32_t)(sequence - head.load(std::memory_order_acquire)) >= 0) {
+        return false;
+    }
+    sample = slots[sequence % STREAM_RING_SIZE];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return claimed.load(std::memory_order_relaxed) - sequence <= STREAM_RING_SIZE;
+}
+
+StreamBatcher::StreamBatcher() {
+    signalMask = 0;
+    decimation = 0;
+    batchSamples = 0;
+    skip = 0;
+    nextSequence = 0;
+    building.length = 0;
+    buildingCount = 0;
+    buildingStartMs = 0;
+    queueHead = 0;
+    queueCount = 0;
+    droppedBatches = 0;
+    lostSamples = 0;
+}
+
+void StreamBatcher::subscribe(uint8_t signals, uint16_t rateHz, uint32_t ringHead) {
+    unsubscribe();
+    signals &= STREAM_ALL_SIGNALS;
+    if (signals == 0 || rateHz == 0) {
+        decimation = 0;
+        return;
+    }
+
+    signalMask = signals;
+    decimation = rateHz >= STREAM_MAX_RATE_HZ ? 1 : STREAM_MAX_RATE_HZ / rateHz;
+    uint16_t samples = (uint32_t)STREAM_BATCH_MS * (STREAM_MAX_RATE_HZ / decimation) / 1000;
+    batchSamples = samples < 1 ? 1 : samples > STREAM_BATCH_MAX_SAMPLES ? STREAM_BATCH_MAX_SAMPLES : samples;
+
+    skip = 0;
+    nextSequence = ringHead;
+    queueHead = 0;
+    droppedBatches = 0;
+    lostSamples = 0;
+}
+
+void StreamBatcher::collect(const StreamSampleRing& ring) {
+    if (signalMask == 0) return;
+
+    uint32_t head = ring.getHead();
+    if (head - nextSequence > STREAM_RING_SIZE) {
+        // We were not called for too long, the oldest samples are gone
+        lostSamples += head - nextSequence - STREAM_RING_SIZE;
+        nextSequence = head - STREAM_RING_SIZE;
+    }
+
+    while (nextSequence != head) {
+        StreamSample sample;
+        if (!ring.read(nextSequence, sample)) {
+            lostSamples++;
+        } else if (skip == 0) {
+            addSample(sample);
+            skip = decimation - 1;
+        } else {
+            skip--;
+        }
+        nextSequence++;
+    }
+}
+
+void StreamBatcher::addSample(const StreamSample& sample) {
+    // The offset field is 16 bits; after a pause in the sync frames start over
+    if (buildingCount > 0 && sample.timeMs - buildingStartMs > UINT16_MAX) {
+        finishBatch();
+    }
+
+    uint8_t* out;
+    if (buildingCount == 0) {
+        buildingStartMs = sample.timeMs;
+        building.length = STREAM_BATCH_HEADER;
+    }
+    out = &building.data[building.length];
+
+    uint16_t offset = (uint16_t)(sample.timeMs - buildingStartMs);
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+    for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+        if (!(signalMask & (1 << i))) continue;
+        uint16_t value = (uint16_t)sample.values[i];
+        *out++ = (uint8_t)value;
+        *out++ = (uint8_t)(value >> 8);
+    }
+    building.length = out - building.data;
+    buildingCount++;
+
+    if (buildingCount >= batchSamples) {
+        finishBatch();
+    }
+}
+
+void StreamBatcher::finishBatch() {
+    if (buildingCount == 0) return;
+
+    building.data[0] = STREAM_FRAME_BATCH;
+    building.data[1] = signalMask;
+    building.data[2] = buildingCount;
+    building.data[3] = 0;
+    building.data[4] = (uint8_t)buildingStartMs;
+    building.data[5] = (uint8_t)(buildingStartMs >> 8);
+    building.data[6] = (uint8_t)(buildingStartMs >> 16);
+    building.data[7] = (uint8_t)(buildingStartMs >> 24);
+    buildingCount = 0;
+
+    if (queueCount == STREAM_CLIENT_BATCHES) {
+        // Client is behind: replace the oldest batch, the next one reports the gap
+        uint16_t gap = queue[queueHead].data[3] + 1;
+        queueHead = (queueHead + 1) % STREAM_CLIENT_BATCHES;
+        queueCount--;
+        droppedBatches++;
+
+        uint8_t* next = queueCount > 0 ? &queue[queueHead].data[3] : &building.data[3];
+        gap += *next;
+        *next = gap > 255 ? 255 : (uint8_t)gap;
+    }
+
+    queue[(queueHead + queueCount) % STREAM_CLIENT_BATCHES] = building;
+    queueCount++;
+}
+
+void StreamBatcher::pop() {
+    if (queueCount > 0) {
+        queueHead = (queueHead + 1) % STREAM_CLIENT_BATCHES;
+        queueCount--;
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Signal Stream
+ *
+ * High-rate samples of a few control loop signals for diagnostics, one per
+ * VE.Bus sync frame (50 Hz). The VE.Bus task writes them into a
+ * StreamSampleRing; for every subscribed WebSocket client a StreamBatcher
+ * picks the signals it asked for, thins them out to its rate and packs
+ * them into binary batches.
+ *
+ * A batcher holds at most STREAM_CLIENT_BATCHES finished batches. While the
+ * client's socket cannot take more, new batches replace the oldest ones, so
+ * a slow client loses data instead of growing the heap.
+ *
+ * Batch frame (little endian):
+ *   u8  STREAM_FRAME_BATCH
+ *   u8  signal mask (bit = StreamSignal)
+ *   u8  number of samples
+ *   u8  batches dropped before this one (saturating)
+ *   u32 time of the first sample in ms
+ *   per sample: u16 ms after the first sample, i16 per signal in the mask
+ *
+ * No hardware dependencies, batching and backpressure can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SIGNAL_STREAM_H
+#define SIGNAL_STREAM_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#define STREAM_RING_SIZE 64             // 1.28 s of samples at 50 Hz
+#define STREAM_MAX_RATE_HZ 50           // One sample per sync frame
+#define STREAM_BATCH_MS 200             // A batch covers about this much time
+#define STREAM_BATCH_MAX_SAMPLES 10     // STREAM_BATCH_MS at STREAM_MAX_RATE_HZ
+#define STREAM_CLIENT_BATCHES 4         // Batches held back per client
+
+#define STREAM_FRAME_BATCH 0x02         // First byte of a batch, 0x01 is telemetry
+#define STREAM_BATCH_HEADER 8
+
+enum StreamSignal : uint8_t {
+    STREAM_AC_POWER = 0,                // W, inverter AC power
+    STREAM_DC_CURRENT,                  // dA, as reported by the Multiplus
+    STREAM_DC_VOLTAGE,                  // cV
+    STREAM_ESS_SETPOINT,                // W, last setpoint sent to the Multiplus
+    STREAM_METER_POWER,                 // W, grid meter, positive = import
+    STREAM_SIGNAL_COUNT
+};
+
+#define STREAM_ALL_SIGNALS ((1 << STREAM_SIGNAL_COUNT) - 1)
+#define STREAM_BATCH_MAX_BYTES (STREAM_BATCH_HEADER + STREAM_BATCH_MAX_SAMPLES * (2 + 2 * STREAM_SIGNAL_COUNT))
+
+// Names used by clients to subscribe, e.g. "ac_power"
+const char* streamSignalName(uint8_t signal);
+int streamSignalFromName(const char* name);     // -1 if unknown
+
+// Rounded and saturated to the i16 sent in batches
+inline int16_t streamValue(float value) {
+    value = value < 0 ? value - 0.5f : value + 0.5f;
+    return value >= 32767.0f ? 32767 : value <= -32768.0f ? -32768 : (int16_t)value;
+}
+
+struct StreamSample {
+    uint32_t timeMs;
+    int16_t values[STREAM_SIGNAL_COUNT];
+};
+
+// One writer, any number of readers that each keep their own position
+class StreamSampleRing {
+private:
+    StreamSample slots[STREAM_RING_SIZE];
+    std::atomic<uint32_t> head;         // Samples written so far
+    std::atomic<uint32_t> claimed;      // Samples written or being written
+
+public:
+    StreamSampleRing() : head(0), claimed(0) {}
+
+    void push(const StreamSample& sample);
+
+    uint32_t getHead() const { return head.load(std::memory_order_acquire); }
+
+    // Sample number sequence; false if it is not written yet or already overwritten
+    bool read(uint32_t sequence, StreamSample& sample) const;
+};
+
+struct StreamBatch {
+    uint8_t data[STREAM_BATCH_MAX_BYTES];
+    uint16_t length;
+};
+
+class StreamBatcher {
+private:
+    uint8_t signalMask;                 // 0 = not subscribed
+    uint8_t decimation;                 // Keep every n-th sample
+    uint8_t batchSamples;               // Samples per batch at this rate
+    uint8_t skip;                       // Samples to skip before the next one is kept
+    uint32_t nextSequence;              // Next ring sample to look at
+
+    StreamBatch building;
+    uint8_t buildingCount;
+    uint32_t buildingStartMs;
+
+    StreamBatch queue[STREAM_CLIENT_BATCHES];
+    uint8_t queueHead;
+    uint8_t queueCount;
+
+    uint32_t droppedBatches;            // Replaced while the client was busy
+    uint32_t lostSamples;               // Overwritten in the ring before we read them
+
+    void addSample(const StreamSample& sample);
+    void finishBatch();
+
+public:
+    StreamBatcher();
+
+    // Start at the current ring position; rate is rounded to 50 Hz / n.
+    // An empty mask or rate 0 unsubscribes.
+    void subscribe(uint8_t signals, uint16_t rateHz, uint32_t ringHead);
+    void unsubscribe() { signalMask = 0; queueCount = 0; buildingCount = 0; }
+    bool isSubscribed() const { return signalMask != 0; }
+
+    // Take the new samples from the ring into batches
+    void collect(const StreamSampleRing& ring);
+
+    // Oldest finished batch, nullptr if none; pop() after it was sent
+    const StreamBatch* front() const { return queueCount > 0 ? &queue[queueHead] : nullptr; }
+    void pop();
+
+    uint8_t getSignalMask() const { return signalMask; }
+    uint16_t getRateHz() const { return decimation > 0 ? STREAM_MAX_RATE_HZ / decimation : 0; }
+    uint8_t getQueuedBatches() const { return queueCount; }
+    uint32_t getDroppedBatches() const { return droppedBatches; }
+    uint32_t getLostSamples() const { return lostSamples; }
+};
+
+#endif // SIGNAL_STREAM_H
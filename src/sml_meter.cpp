@@ -0,0 +1,142 @@
+/*
+ * SML Smart Meter Reader Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sml_meter.h"
+#include "system_data.h"
+
+SmlMeter::SmlMeter() {
+    serial = nullptr;
+    essController = nullptr;
+    taskHandle = nullptr;
+    isRunning = false;
+}
+
+SmlMeter::~SmlMeter() {
+    end();
+}
+
+bool SmlMeter::begin(HardwareSerial* hardwareSerial, EssController* ess, int rxPin) {
+    if (rxPin < 0) {
+        Serial.println("SML: No receiver pin configured (SML_RX_PIN), meter reader disabled");
+        return false;
+    }
+
+    serial = hardwareSerial;
+    essController = ess;
+    parser.reset();
+
+    serial->begin(SML_BAUD_RATE, SERIAL_8N1, rxPin, -1);
+    serial->setRxTimeout(SML_RX_TIMEOUT_SYMBOLS);
+    serial->onReceive([this]() { onUartReceive(); });
+
+    isRunning = true;   // Before the task starts, it preempts setup() on this core
+    BaseType_t result = xTaskCreatePinnedToCore(
+        taskWrapper,
+        "SmlMeter",
+        SML_TASK_STACK_SIZE,
+        this,
+        SML_TASK_PRIORITY,
+        &taskHandle,
+        SML_TASK_CORE
+    );
+
+    if (result != pdPASS) {
+        Serial.println("SML: Failed to create task");
+        isRunning = false;
+        taskHandle = nullptr;
+        serial->end();
+        serial = nullptr;
+        return false;
+    }
+
+    Serial.printf("SML: Meter reader on UART%d RX:IO%d at %d baud\n", SML_SERIAL_PORT, rxPin, SML_BAUD_RATE);
+    return true;
+}
+
+void SmlMeter::end() {
+    isRunning = false;
+
+    if (taskHandle != nullptr) {
+        vTaskDelete(taskHandle);
+        taskHandle = nullptr;
+    }
+    if (serial != nullptr) {
+        serial->end();
+        serial = nullptr;
+    }
+}
+
+void SmlMeter::taskWrapper(void* parameter) {
+    SmlMeter* meter = static_cast<SmlMeter*>(parameter);
+    meter->readerTask();
+}
+
+void SmlMeter::onUartReceive() {
+    // Runs in the UART event task - only notify
+    if (taskHandle != nullptr) {
+        xTaskNotifyGive(taskHandle);
+    }
+}
+
+void SmlMeter::readerTask() {
+    uint8_t chunk[SML_READ_CHUNK];
+
+    while (isRunning) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SML_TASK_IDLE_TIMEOUT_MS));
+
+        size_t length;
+        while ((length = serial->read(chunk, sizeof(chunk))) > 0) {
+            size_t offset = 0;
+            while (offset < length) {
+                SmlParseEvent event;
+                offset += parser.push(&chunk[offset], length - offset, event);
+
+                if (event == SML_EVENT_TELEGRAM) {
+                    publishReadings(parser.getReadings());
+                } else if (event == SML_EVENT_CRC_ERROR) {
+                    systemData.electricMeter.crcWrong++;
+                }
+            }
+        }
+    }
+
+    vTaskDelete(nullptr);
+}
+
+void SmlMeter::publishReadings(const SmlReadings& readings) {
+    ElectricMeterData& meter = systemData.electricMeter;
+
+    if (readings.fields & SML_FIELD_CONSUMPTION) meter.consumption = readings.consumption;
+    if (readings.fields & SML_FIELD_FEED_IN) meter.feedIn = readings.feedIn;
+    if (readings.fields & SML_FIELD_POWER_L1) meter.powerL1 = readings.powerL1;
+    if (readings.fields & SML_FIELD_POWER_L2) meter.powerL2 = readings.powerL2;
+    if (readings.fields & SML_FIELD_POWER_L3) meter.powerL3 = readings.powerL3;
+    if (readings.fields & SML_FIELD_RUNTIME) meter.runtime = readings.runtime;
+    if (readings.fields & SML_FIELD_MANUFACTURER) {
+        strncpy(meter.deviceID, readings.manufacturer, sizeof(meter.deviceID) - 1);
+        meter.deviceID[sizeof(meter.deviceID) - 1] = '\0';
+    }
+    if (readings.fields & SML_FIELD_STATUS) {
+        memset(meter.status180, 0, sizeof(meter.status180));
+        memcpy(meter.status180, readings.status, readings.statusLength);
+    }
+
+    systemData.powerMeter.smlTelegrams++;
+    systemData.powerMeter.smlLastTelegramTime = millis();
+
+    if (readings.fields & SML_FIELD_POWER) {
+        meter.power = readings.power;
+        systemData.powerMeter.decisiveMeterPower = (int)readings.power;
+        systemData.powerMeter.newDigitalMeterPower = true;
+        systemData.powerMeter.newMeterValue = true;
+
+        // Straight to the control loop, the meter delay limits how fast we can react
+        if (essController != nullptr) {
+            essController->publishMeterPower((int32_t)readings.power);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * SML Smart Meter Reader
+ *
+ * Reads the optical (IR) interface of an SML electricity meter on a UART
+ * and decodes the telegrams while they arrive. The task is woken by the
+ * UART as soon as the line goes idle after a burst, so a telegram is
+ * available a few milliseconds after its last byte. Decoded values go to
+ * systemData.electricMeter, the total power also to the ESS control loop.
+ *
+ * The receiver pin is set with the SML_RX_PIN build flag; without it the
+ * reader stays disabled.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SML_METER_H
+#define SML_METER_H
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "sml_parser.h"
+#include "ess_controller.h"
+
+#ifndef SML_RX_PIN
+#define SML_RX_PIN -1           // IR receiver input, -1 = no meter connected
+#endif
+
+#define SML_SERIAL_PORT 1
+#define SML_BAUD_RATE 9600
+#define SML_RX_TIMEOUT_SYMBOLS 2        // UART event after 2 symbols of line idle
+#define SML_READ_CHUNK 64
+#define SML_TASK_STACK_SIZE 3072
+#define SML_TASK_PRIORITY 2
+#define SML_TASK_CORE 1
+#define SML_TASK_IDLE_TIMEOUT_MS 1000
+
+class SmlMeter {
+private:
+    HardwareSerial* serial;
+    EssController* essController;
+    TaskHandle_t taskHandle;
+    bool isRunning;
+    SmlParser parser;
+
+    static void taskWrapper(void* parameter);
+    void readerTask();
+    void onUartReceive();
+    void publishReadings(const SmlReadings& readings);
+
+public:
+    SmlMeter();
+    ~SmlMeter();
+
+    bool begin(HardwareSerial* hardwareSerial, EssController* ess, int rxPin = SML_RX_PIN);
+    void end();
+    bool isTaskRunning() const { return isRunning; }
+
+    uint32_t getTelegrams() const { return parser.getTelegrams(); }
+    uint32_t getCrcErrors() const { return parser.getCrcErrors(); }
+    uint32_t getFormatErrors() const { return parser.getFormatErrors(); }
+};
+
+#endif // SML_METER_H
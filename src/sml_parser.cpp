@@ -0,0 +1,443 @@
+/*
+ * SML Smart Meter Stream Parser Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sml_parser.h"
+#include <string.h>
+
+#define SML_ESCAPE 0x1B
+#define SML_ESCAPE_START 0x01
+#define SML_ESCAPE_END 0x1A
+
+#define SML_TYPE_OCTET_STRING 0
+#define SML_TYPE_INTEGER 5
+#define SML_TYPE_UNSIGNED 6
+#define SML_TYPE_LIST 7
+
+// Elements of an SML_ListEntry (list of 7)
+#define SML_ENTRY_SIZE 7
+#define SML_ENTRY_OBJ_NAME 0
+#define SML_ENTRY_STATUS 1
+#define SML_ENTRY_VAL_TIME 2
+#define SML_ENTRY_SCALER 4
+#define SML_ENTRY_VALUE 5
+#define SML_TIME_SEC_INDEX 1    // valTime is a choice: list of tag and value
+
+struct SmlObis {
+    uint8_t code[6];
+    uint16_t field;
+};
+
+static const SmlObis SML_OBIS_CODES[] = {
+    { { 0x01, 0x00, 0x01, 0x08, 0x00, 0xFF }, SML_FIELD_CONSUMPTION },
+    { { 0x01, 0x00, 0x02, 0x08, 0x00, 0xFF }, SML_FIELD_FEED_IN },
+    { { 0x01, 0x00, 0x10, 0x07, 0x00, 0xFF }, SML_FIELD_POWER },
+    { { 0x01, 0x00, 0x24, 0x07, 0x00, 0xFF }, SML_FIELD_POWER_L1 },
+    { { 0x01, 0x00, 0x38, 0x07, 0x00, 0xFF }, SML_FIELD_POWER_L2 },
+    { { 0x01, 0x00, 0x4C, 0x07, 0x00, 0xFF }, SML_FIELD_POWER_L3 },
+    { { 0x81, 0x81, 0xC7, 0x82, 0x03, 0xFF }, SML_FIELD_MANUFACTURER },
+};
+
+static const uint8_t SML_START[4] = { SML_ESCAPE_START, SML_ESCAPE_START, SML_ESCAPE_START, SML_ESCAPE_START };
+
+// CRC16/X.25 (reflected 0x1021), kept in flash
+static const uint16_t SML_CRC_TABLE[256] = {
+    0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+    0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+    0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+    0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+    0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+    0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+    0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+    0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+    0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+    0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+    0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+    0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+    0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+    0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+    0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+    0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+    0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+    0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+    0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+    0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+    0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+    0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+    0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+    0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+    0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+    0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+    0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+    0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+    0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+    0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+    0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+    0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78,
+};
+
+uint16_t SmlParser::crc16(uint16_t crc, uint8_t byte) {
+    return (crc >> 8) ^ SML_CRC_TABLE[(crc ^ byte) & 0xFF];
+}
+
+SmlParser::SmlParser() {
+    memset(&readings, 0, sizeof(readings));
+    reset();
+}
+
+void SmlParser::reset() {
+    frameState = FRAME_HUNT;
+    match = 0;
+    telegrams = 0;
+    crcErrors = 0;
+    formatErrors = 0;
+}
+
+void SmlParser::startTelegram() {
+    frameState = FRAME_DATA;
+    match = 0;
+
+    // The CRC covers the start sequence
+    crc = 0xFFFF;
+    for (uint8_t i = 0; i < 4; i++) {
+        crc = crc16(crc, SML_ESCAPE);
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        crc = crc16(crc, SML_START[i]);
+    }
+
+    tlvState = TLV_TYPE;
+    depth = 0;
+    failed = false;
+    capture = CAPTURE_NONE;
+    entryDepth = 0;
+    field = 0;
+    memset(&pending, 0, sizeof(pending));
+}
+
+SmlParseEvent SmlParser::endTelegram() {
+    frameState = FRAME_HUNT;
+    match = 0;
+
+    // Transmitted low byte first
+    uint16_t received = escape[2] | (escape[3] << 8);
+    if ((crc ^ 0xFFFF) != received) {
+        crcErrors++;
+        return SML_EVENT_CRC_ERROR;
+    }
+    if (failed || depth != 0) {
+        formatErrors++;
+        return SML_EVENT_FORMAT_ERROR;
+    }
+
+    readings = pending;
+    telegrams++;
+    return SML_EVENT_TELEGRAM;
+}
+
+void SmlParser::fail() {
+    failed = true;
+}
+
+SmlParseEvent SmlParser::feed(uint8_t byte) {
+    switch (frameState) {
+        case FRAME_HUNT:
+            // 1B1B1B1B 01010101
+            if (match < 4 ? byte == SML_ESCAPE : byte == SML_ESCAPE_START) {
+                if (++match == 8) {
+                    startTelegram();
+                }
+            } else {
+                // A fifth 0x1B keeps the last four as a possible escape
+                match = (byte != SML_ESCAPE) ? 0 : (match == 4) ? 4 : 1;
+            }
+            return SML_EVENT_NONE;
+
+        case FRAME_DATA:
+            crc = crc16(crc, byte);
+            if (byte == SML_ESCAPE) {
+                if (++match == 4) {
+                    frameState = FRAME_ESCAPE;
+                    match = 0;
+                }
+                return SML_EVENT_NONE;
+            }
+            // Fewer than four 0x1B are plain data
+            for (; match > 0; match--) {
+                dataByte(SML_ESCAPE);
+            }
+            dataByte(byte);
+            return SML_EVENT_NONE;
+
+        case FRAME_ESCAPE:
+            escape[match++] = byte;
+            if (escape[0] != SML_ESCAPE_END || match <= 2) {
+                crc = crc16(crc, byte);     // Only the CRC itself is not covered
+            }
+            if (match == 1 && escape[0] != SML_ESCAPE && escape[0] != SML_ESCAPE_START &&
+                escape[0] != SML_ESCAPE_END) {
+                formatErrors++;
+                frameState = FRAME_HUNT;
+                match = 0;
+                return SML_EVENT_FORMAT_ERROR;
+            }
+            if (match < 4) {
+                return SML_EVENT_NONE;
+            }
+
+            if (escape[0] == SML_ESCAPE_END) {
+                return endTelegram();
+            }
+            if (memcmp(escape, SML_START, 4) == 0) {
+                // Restart without end sequence: the previous telegram is lost
+                formatErrors++;
+                startTelegram();
+                return SML_EVENT_FORMAT_ERROR;
+            }
+            if (escape[0] == SML_ESCAPE && escape[1] == SML_ESCAPE &&
+                escape[2] == SML_ESCAPE && escape[3] == SML_ESCAPE) {
+                // Escaped 1B1B1B1B in the data
+                for (uint8_t i = 0; i < 4; i++) {
+                    dataByte(SML_ESCAPE);
+                }
+                frameState = FRAME_DATA;
+                match = 0;
+                return SML_EVENT_NONE;
+            }
+            formatErrors++;
+            frameState = FRAME_HUNT;
+            match = 0;
+            return SML_EVENT_FORMAT_ERROR;
+    }
+    return SML_EVENT_NONE;
+}
+
+size_t SmlParser::push(const uint8_t* data, size_t length, SmlParseEvent& event) {
+    event = SML_EVENT_NONE;
+    for (size_t i = 0; i < length; i++) {
+        event = feed(data[i]);
+        if (event != SML_EVENT_NONE) {
+            return i + 1;
+        }
+    }
+    return length;
+}
+
+void SmlParser::dataByte(uint8_t byte) {
+    if (failed) {
+        return;
+    }
+
+    switch (tlvState) {
+        case TLV_TYPE:
+            if (byte == 0x00) {
+                // End of message marker inside a message, padding outside
+                if (depth > 0) {
+                    tlvType = SML_TYPE_OCTET_STRING;
+                    tlvLength = 0;
+                    startElement();
+                    completeElement();
+                }
+                return;
+            }
+            tlvType = (byte >> 4) & 0x07;
+            tlvLength = byte & 0x0F;
+            tlvBytes = 1;
+            if (byte & 0x80) {
+                tlvState = TLV_LENGTH;
+                return;
+            }
+            break;
+
+        case TLV_LENGTH:
+            tlvLength = (tlvLength << 4) | (byte & 0x0F);
+            if (++tlvBytes > 3) {
+                fail();
+                return;
+            }
+            if (byte & 0x80) {
+                return;
+            }
+            break;
+
+        case TLV_VALUE:
+            valueByte(byte);
+            if (++valueIndex == tlvLength) {
+                tlvState = TLV_TYPE;
+                completeElement();
+            }
+            return;
+    }
+
+    // Type-length complete
+    tlvState = TLV_TYPE;
+    if (tlvType == SML_TYPE_LIST) {
+        if (tlvLength > 0xFF || depth >= SML_MAX_DEPTH) {
+            fail();
+            return;
+        }
+        startElement();
+        if (tlvLength == 0) {
+            completeElement();
+            return;
+        }
+        stack[depth].size = tlvLength;
+        stack[depth].remaining = tlvLength;
+        depth++;
+        if (tlvLength == SML_ENTRY_SIZE) {
+            // Possibly an OBIS list entry, decided by its object name
+            entryDepth = depth;
+            field = 0;
+            scaler = 0;
+        }
+        return;
+    }
+
+    // Value length includes the type-length bytes
+    if (tlvLength < tlvBytes) {
+        fail();
+        return;
+    }
+    tlvLength -= tlvBytes;
+    startElement();
+    if (tlvLength == 0) {
+        completeElement();
+    } else {
+        valueIndex = 0;
+        tlvState = TLV_VALUE;
+    }
+}
+
+void SmlParser::startElement() {
+    elementIndex = depth > 0 ? stack[depth - 1].size - stack[depth - 1].remaining : 0;
+    capture = CAPTURE_NONE;
+    value = 0;
+
+    if (entryDepth == 0) {
+        return;
+    }
+    bool integer = tlvType == SML_TYPE_INTEGER || tlvType == SML_TYPE_UNSIGNED;
+
+    if (depth == entryDepth) {
+        entryElement = elementIndex;
+        if (elementIndex == SML_ENTRY_OBJ_NAME) {
+            if (tlvType == SML_TYPE_OCTET_STRING && tlvLength == sizeof(obis)) {
+                capture = CAPTURE_OBIS;
+            }
+        } else if (field == 0) {
+            return;
+        } else if (elementIndex == SML_ENTRY_STATUS) {
+            if (field == SML_FIELD_CONSUMPTION && tlvType != SML_TYPE_LIST) {
+                capture = CAPTURE_STATUS;
+            }
+        } else if (elementIndex == SML_ENTRY_SCALER || elementIndex == SML_ENTRY_VALUE) {
+            if (integer && tlvLength <= 8) {
+                capture = CAPTURE_INTEGER;
+            } else if (elementIndex == SML_ENTRY_VALUE && field == SML_FIELD_MANUFACTURER &&
+                       tlvType == SML_TYPE_OCTET_STRING) {
+                capture = CAPTURE_TEXT;
+            }
+        }
+    } else if (depth == entryDepth + 1 && entryElement == SML_ENTRY_VAL_TIME &&
+               elementIndex == SML_TIME_SEC_INDEX && field == SML_FIELD_CONSUMPTION) {
+        if (integer && tlvLength <= 4) {
+            capture = CAPTURE_INTEGER;
+        }
+    }
+}
+
+void SmlParser::valueByte(uint8_t byte) {
+    switch (capture) {
+        case CAPTURE_NONE:
+            break;
+        case CAPTURE_OBIS:
+            obis[valueIndex] = byte;
+            break;
+        case CAPTURE_INTEGER:
+            if (valueIndex == 0 && tlvType == SML_TYPE_INTEGER) {
+                value = (int8_t)byte;   // Sign extension
+            } else {
+                value = (int64_t)(((uint64_t)value << 8) | byte);
+            }
+            break;
+        case CAPTURE_STATUS:
+            if (valueIndex < SML_STATUS_MAX_BYTES) {
+                pending.status[valueIndex] = byte;
+                pending.statusLength = valueIndex + 1;
+            }
+            break;
+        case CAPTURE_TEXT:
+            if (valueIndex < SML_MANUFACTURER_MAX) {
+                pending.manufacturer[valueIndex] = byte;
+            }
+            break;
+    }
+}
+
+void SmlParser::storeValue() {
+    double scaled = (double)value;
+    for (int8_t i = scaler; i > 0; i--) {
+        scaled *= 10;
+    }
+    for (int8_t i = scaler; i < 0; i++) {
+        scaled /= 10;
+    }
+
+    switch (field) {
+        case SML_FIELD_CONSUMPTION: pending.consumption = scaled / 1000; break;  // Wh -> kWh
+        case SML_FIELD_FEED_IN:     pending.feedIn = scaled / 1000; break;
+        case SML_FIELD_POWER:       pending.power = scaled; break;
+        case SML_FIELD_POWER_L1:    pending.powerL1 = scaled; break;
+        case SML_FIELD_POWER_L2:    pending.powerL2 = scaled; break;
+        case SML_FIELD_POWER_L3:    pending.powerL3 = scaled; break;
+        default: return;
+    }
+    pending.fields |= field;
+}
+
+void SmlParser::completeElement() {
+    switch (capture) {
+        case CAPTURE_NONE:
+            break;
+        case CAPTURE_OBIS:
+            for (size_t i = 0; i < sizeof(SML_OBIS_CODES) / sizeof(SML_OBIS_CODES[0]); i++) {
+                if (memcmp(obis, SML_OBIS_CODES[i].code, sizeof(obis)) == 0) {
+                    field = SML_OBIS_CODES[i].field;
+                    break;
+                }
+            }
+            break;
+        case CAPTURE_INTEGER:
+            if (depth > entryDepth) {
+                pending.runtime = (uint32_t)value;
+                pending.fields |= SML_FIELD_RUNTIME;
+            } else if (elementIndex == SML_ENTRY_SCALER) {
+                scaler = (int8_t)value;
+            } else {
+                storeValue();
+            }
+            break;
+        case CAPTURE_STATUS:
+            pending.fields |= SML_FIELD_STATUS;
+            break;
+        case CAPTURE_TEXT:
+            pending.fields |= SML_FIELD_MANUFACTURER;
+            break;
+    }
+    capture = CAPTURE_NONE;
+
+    // Count the element in its list and close every list that is now complete
+    while (depth > 0) {
+        if (--stack[depth - 1].remaining > 0) {
+            return;
+        }
+        if (depth == entryDepth) {
+            entryDepth = 0;
+            field = 0;
+        }
+        depth--;
+    }
+}
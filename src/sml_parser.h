@@ -0,0 +1,153 @@
+/*
+ * SML Smart Meter Stream Parser
+ *
+ * Incremental parser for SML (Smart Message Language) telegrams as sent by
+ * the optical interface of German electricity meters:
+ *   1B1B1B1B 01010101 <SML messages> 00.. 1B1B1B1B 1A <pad> <CRC16>
+ *
+ * Bytes are consumed as they arrive: the escape layer strips the framing
+ * and runs the CRC16 (X.25) over the raw stream, the TLV layer walks the
+ * message lists with a small stack and only keeps the OBIS entries we use.
+ * The telegram itself is never stored; the decoded values become visible
+ * in getReadings() when the CRC at the end of the telegram matched.
+ *
+ * No hardware dependencies, captured meter streams can be replayed on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SML_PARSER_H
+#define SML_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SML_MAX_DEPTH 12                // Nesting of SML lists, real telegrams use about 7
+#define SML_STATUS_MAX_BYTES 6          // Same as MAX_METER_STATUS_BYTES
+#define SML_MANUFACTURER_MAX 9
+
+// Bits of SmlReadings::fields
+#define SML_FIELD_CONSUMPTION 0x0001    // 1.8.0
+#define SML_FIELD_FEED_IN 0x0002        // 2.8.0
+#define SML_FIELD_POWER 0x0004          // 16.7.0
+#define SML_FIELD_POWER_L1 0x0008       // 36.7.0
+#define SML_FIELD_POWER_L2 0x0010       // 56.7.0
+#define SML_FIELD_POWER_L3 0x0020       // 76.7.0
+#define SML_FIELD_MANUFACTURER 0x0040   // 129-129:199.130.3
+#define SML_FIELD_STATUS 0x0080         // Status word of 1.8.0
+#define SML_FIELD_RUNTIME 0x0100        // Seconds index of 1.8.0
+
+enum SmlParseEvent {
+    SML_EVENT_NONE = 0,
+    SML_EVENT_TELEGRAM,         // Telegram complete and CRC correct, readings updated
+    SML_EVENT_CRC_ERROR,        // Telegram complete but CRC wrong, readings unchanged
+    SML_EVENT_FORMAT_ERROR      // Unexpected escape sequence or nesting, waiting for next start
+};
+
+struct SmlReadings {
+    uint16_t fields;                    // SML_FIELD_* present in the last telegram
+    double consumption;                 // kWh
+    double feedIn;                      // kWh
+    double power;                       // W, positive = import
+    double powerL1;
+    double powerL2;
+    double powerL3;
+    uint32_t runtime;                   // s
+    char manufacturer[SML_MANUFACTURER_MAX + 1];
+    uint8_t status[SML_STATUS_MAX_BYTES];
+    uint8_t statusLength;
+};
+
+class SmlParser {
+private:
+    enum FrameState : uint8_t {
+        FRAME_HUNT,             // Looking for the start sequence
+        FRAME_DATA,             // Inside a telegram
+        FRAME_ESCAPE            // Four 0x1B seen, collecting the escape command
+    };
+
+    enum TlvState : uint8_t {
+        TLV_TYPE,               // Next byte is a type-length field
+        TLV_LENGTH,             // Continuation byte of a multi-byte type-length
+        TLV_VALUE               // Reading the value bytes
+    };
+
+    // What the bytes of the current value are kept for
+    enum Capture : uint8_t {
+        CAPTURE_NONE,
+        CAPTURE_OBIS,           // Object name of a list entry
+        CAPTURE_INTEGER,        // Scaler, value or seconds index
+        CAPTURE_STATUS,         // Status word of 1.8.0
+        CAPTURE_TEXT            // Manufacturer ID
+    };
+
+    // List on the TLV stack
+    struct ListFrame {
+        uint8_t size;
+        uint8_t remaining;
+    };
+
+    // Framing
+    FrameState frameState;
+    uint8_t match;              // Matched bytes of the start sequence / escape run
+    uint8_t escape[4];          // Escape command after 1B1B1B1B
+    uint16_t crc;
+
+    // TLV walker
+    TlvState tlvState;
+    uint8_t tlvType;
+    uint16_t tlvLength;         // Value bytes (lists: elements)
+    uint8_t tlvBytes;           // Bytes of the type-length field
+    uint16_t valueIndex;
+    uint8_t elementIndex;       // Index of the current element in its parent list
+    Capture capture;
+    ListFrame stack[SML_MAX_DEPTH];
+    uint8_t depth;
+    bool failed;                // Structure broken, ignore the rest of the telegram
+
+    // OBIS list entry being decoded
+    uint8_t entryDepth;         // Stack depth of the current 7 element list entry, 0 = none
+    uint8_t entryElement;       // Entry element the walker is in (2 = valTime)
+    uint8_t obis[6];
+    uint16_t field;             // SML_FIELD_* the entry holds, 0 = not of interest
+    int8_t scaler;
+    int64_t value;
+
+    SmlReadings pending;        // Filled while the telegram streams in
+    SmlReadings readings;       // Last telegram with a good CRC
+
+    uint32_t telegrams;
+    uint32_t crcErrors;
+    uint32_t formatErrors;
+
+    void startTelegram();
+    SmlParseEvent endTelegram();
+    void dataByte(uint8_t byte);
+    void startElement();
+    void valueByte(uint8_t byte);
+    void completeElement();
+    void storeValue();
+    void fail();
+
+public:
+    SmlParser();
+
+    void reset();
+
+    // Feed one byte, returns an event when a telegram ended
+    SmlParseEvent feed(uint8_t byte);
+
+    // Feed bytes until the first event; returns the number of bytes consumed
+    size_t push(const uint8_t* data, size_t length, SmlParseEvent& event);
+
+    const SmlReadings& getReadings() const { return readings; }
+    uint32_t getTelegrams() const { return telegrams; }
+    uint32_t getCrcErrors() const { return crcErrors; }
+    uint32_t getFormatErrors() const { return formatErrors; }
+
+    // CRC16/X.25 as used by SML, exposed for tests and tools
+    static uint16_t crc16(uint16_t crc, uint8_t byte);
+};
+
+#endif // SML_PARSER_H
@@ -0,0 +1,91 @@
+/*
+ * Signal Stream Server Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "stream_server.h"
+
+SignalStreamServer::SignalStreamServer() {
+    ws = nullptr;
+    for (uint8_t i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        clients[i].id = 0;
+        clients[i].pending = false;
+        clients[i].signals = 0;
+        clients[i].rateHz = 0;
+    }
+}
+
+bool SignalStreamServer::subscribe(uint32_t clientId, uint8_t signals, uint16_t rateHz) {
+    bool stop = signals == 0 || rateHz == 0;
+    bool found = false;
+
+    portENTER_CRITICAL(&clientsLock);
+    Client* slot = nullptr;
+    for (uint8_t i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        if (clients[i].id == clientId) {
+            slot = &clients[i];
+            break;
+        }
+        if (clients[i].id == 0 && slot == nullptr && !stop) {
+            slot = &clients[i];
+        }
+    }
+    if (slot != nullptr) {
+        slot->id = stop ? 0 : clientId;
+        slot->signals = stop ? 0 : signals;
+        slot->rateHz = stop ? 0 : rateHz;
+        slot->pending = true;
+        found = true;
+    }
+    portEXIT_CRITICAL(&clientsLock);
+
+    return found || stop;
+}
+
+void SignalStreamServer::removeClient(uint32_t clientId) {
+    portENTER_CRITICAL(&clientsLock);
+    for (uint8_t i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        if (clients[i].id == clientId) {
+            clients[i].id = 0;
+            clients[i].signals = 0;
+            clients[i].rateHz = 0;
+            clients[i].pending = true;
+        }
+    }
+    portEXIT_CRITICAL(&clientsLock);
+}
+
+void SignalStreamServer::loop() {
+    if (ws == nullptr) return;
+
+    for (uint8_t i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        Client& slot = clients[i];
+
+        portENTER_CRITICAL(&clientsLock);
+        uint32_t id = slot.id;
+        bool pending = slot.pending;
+        uint8_t signals = slot.signals;
+        uint16_t rateHz = slot.rateHz;
+        slot.pending = false;
+        portEXIT_CRITICAL(&clientsLock);
+
+        if (pending) {
+            slot.batcher.subscribe(signals, rateHz, ring.getHead());
+        }
+        if (!slot.batcher.isSubscribed()) continue;
+
+        slot.batcher.collect(ring);
+
+        AsyncWebSocketClient* client = ws->client(id);
+        if (client == nullptr) continue;
+
+        // Backpressure: leave batches with the batcher while the socket queue is full
+        const StreamBatch* batch;
+        while ((batch = slot.batcher.front()) != nullptr && !client->queueIsFull()) {
+            client->binary(batch->data, batch->length);
+            slot.batcher.pop();
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Signal Stream Server
+ *
+ * Sends the 50 Hz signal stream (signal_stream.h) to WebSocket clients that
+ * subscribed with
+ *   {"stream":{"signals":["ac_power","meter_power"],"rate":50}}
+ * and stops with {"stream":{}} (no signals) or rate 0. Batches go out from loop() only
+ * while the client's message queue has room; otherwise the batcher keeps the
+ * newest STREAM_CLIENT_BATCHES and drops older ones.
+ *
+ * Subscriptions arrive in the async TCP task and are handed over to loop()
+ * through a small locked table; batchers are only touched from loop().
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "signal_stream.h"
+
+#define STREAM_MAX_CLIENTS 2            // Each batcher holds about 0.6 kB
+
+class SignalStreamServer {
+private:
+    struct Client {
+        uint32_t id;                    // WebSocket client, 0 = slot free
+        bool pending;                   // Subscription changed, loop() applies it
+        uint8_t signals;
+        uint16_t rateHz;
+        StreamBatcher batcher;
+    };
+
+    AsyncWebSocket* ws;
+    StreamSampleRing ring;
+    Client clients[STREAM_MAX_CLIENTS];
+    portMUX_TYPE clientsLock = portMUX_INITIALIZER_UNLOCKED;
+
+public:
+    SignalStreamServer();
+
+    void begin(AsyncWebSocket* webSocket) { ws = webSocket; }
+
+    // Producer side, one sample per sync frame
+    StreamSampleRing* getRing() { return &ring; }
+
+    // From the WebSocket event handler; false if all stream slots are taken
+    bool subscribe(uint32_t clientId, uint8_t signals, uint16_t rateHz);
+    void removeClient(uint32_t clientId);
+
+    // From loop(): batch new samples and send what the clients can take
+    void loop();
+};
+
+#endif // STREAM_SERVER_H
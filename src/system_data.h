@@ -11,39 +11,21 @@
 #ifndef SYSTEM_DATA_H
 #define SYSTEM_DATA_H
 
-#include <Arduino.h>
 #include <stdint.h>
 
 // Maximum sizes and constants - DRASTICALLY REDUCED FOR ESP32
 #define MAX_METER_STATUS_BYTES 6
-#define SML_LENGTH_MAX 400
 // LOGFILE_ALL_SIZE and LOGFILE_FEW_SIZE removed - no more logging buffers!
 #define CPS 10000                               // Cycles per second for timer
 #define DEFAULT_SHELLY_SWITCHING_INTERVAL 450  // Default Shelly switching interval
 
-// Battery Management System (BMS) Data Structure
+// Battery min/max trackers; the live BMS values are the snapshot from
+// pylontechCAN.getBattery(), published once per BMS broadcast cycle
 struct BatteryData {
-    int16_t soc = -1;                           // Battery level 0-100% (negative = invalid)
     int16_t socMin = 32767;                    // Used to log minimum battery level
     int16_t socMax = -32768;                   // Used to log maximum battery level
     uint32_t socMinTime = 0;                    // Time when minimum SOC occurred
     uint32_t socMaxTime = 0;                    // Time when maximum SOC occurred
-    int16_t soh = -1;                           // Battery health 0-100% (negative = invalid)
-    float chargeVoltage = -1;                   // Maximum charge voltage
-    float chargeCurrentLimit = -1;              // Maximum charge current limit
-    float dischargeCurrentLimit = -1;           // Maximum discharge current limit
-    float dischargeVoltage = -1;                // Minimum discharge voltage
-    float voltage = -1;                         // Current battery voltage
-    float current = -1;                         // Current battery current
-    int power = -1;                             // Current battery power
-    float temperature = -1;                     // Battery temperature
-    char manufacturer[9] = {0};                 // Battery manufacturer string
-    int8_t nrPacksInParallel = -1;             // Number of battery packs in parallel
-    uint8_t protectionFlags1 = 0;              // Protection flags byte 1
-    uint8_t protectionFlags2 = 0;              // Protection flags byte 2
-    uint8_t warningFlags1 = 0;                 // Warning flags byte 1
-    uint8_t warningFlags2 = 0;                 // Warning flags byte 2
-    uint8_t requestFlags = 0;                  // Request flags
 };
 
 // Electric Meter Data Structure
@@ -153,16 +135,11 @@ struct PowerMeterData {
     bool newMeterValue = false;                 // New meter value available flag
     int infoDssCntSinceLastMeterPower = 0;      // Info-DSS message counter
     
-    // SML processing buffers
-    char sBuf[1024];                            // Circular SML buffer
-    char sBuf2[SML_LENGTH_MAX];                 // Linear SML buffer
-    uint16_t smlp = 0;                          // SML buffer pointer
-    uint16_t smlCnt = 0;                        // SML stream length counter
-    uint16_t smlLength = 0;                     // Detected SML stream length
+    // SML telegrams are decoded while streaming in (SmlParser), no buffers here
+    uint32_t smlTelegrams = 0;                  // Telegrams with correct CRC
+    uint32_t smlLastTelegramTime = 0;           // millis() of the last telegram
     
-    // Power trend analysis
-    int powerTrendRingbuf[5*60];                // 5 minute power trend buffer (reduced from 15*60 to 5*60)
-    int powerTrendPtr = 0;                      // Power trend buffer pointer
+    // Power trend analysis (history of the meter power is kept by HistoryRecorder)
     float powerTrendConsumption = 0;            // Power trend consumption
     float powerTrendFeedIn = 0;                 // Power trend feed-in
 };
@@ -232,7 +209,7 @@ struct TimerData {
     bool oneMinuteOver = false;                 // Main loop one minute flag
 };
 
-// Power Calculation and Ring Buffer Data Structure
+// Power Calculation Data Structure
 struct PowerCalculationData {
     int electricMeterStatusDifferent = 0;       // Status difference counter
     int electricMeterSignPositive = 0;          // Positive sign counter
@@ -240,32 +217,19 @@ struct PowerCalculationData {
     int electricMeterCurrentSign = 0;           // Current sign decision
     int16_t estTargetPower = 0;                 // ESS target power
     int essPowerStrategy = 5;                   // Power strategy
-    int16_t estTargetPowerRingBuf[10] = {0};    // Target power ring buffer (reduced from 45 to 10)
-    int ptrPowerRingBuf = 0;                    // Power ring buffer pointer
-    int16_t pACinRingBuf[16] = {0};             // AC input ring buffer (reduced from 32 to 16)
-    int ptr_pACinRingBuf = 0;                   // AC input buffer pointer
-    int16_t pInverterRingBuf[16] = {0};         // Inverter ring buffer (reduced from 32 to 16)
-    int ptr_pInverterRingBuf = 0;               // Inverter buffer pointer
     int16_t powerACin = 0;                      // Power on AC input
-    int16_t powerChargerRingBuf[50] = {0};      // Charger power buffer (reduced from 400 to 50)
-    int ptr_powerChargerRingBuf = 0;            // Charger buffer pointer
-    int16_t powerControlDeviationRingBuf[50] = {0}; // Control deviation buffer (reduced from 400 to 50)
-    int ptr_powerControlDeviationRingBuf = 0;   // Control deviation pointer
-    int16_t powerMeterRingBuf[50] = {0};        // Meter power buffer (reduced from 400 to 50)
-    int ptr_powerMeterRingBuf = 0;              // Meter buffer pointer
     float beta = 0.001;                         // Cable resistance averaging factor
 };
 
 // Optical Meter Measurement Data
 struct OpticalMeterData {
-    volatile bool IRpinDisplay = LOW;           // IR pin display state
-    volatile int highCnt = 1000;                // High pulse counter
-    volatile int totalCnt = 4000000;            // Total measurement counter
-    volatile int highCycles = 0;                // High pulse cycles
-    volatile int highCyclesPrevious = 0;        // Previous high pulse cycles
-    volatile int totalCycles = 0;               // Total measurement cycles
-    volatile bool meterHighPulse = false;       // Current pulse state
-    volatile bool isrNewMeterPulse = false;     // New pulse flag
+    // Pulses are timestamped in the GPIO interrupt (ImpulseMeter), no sampling here
+    uint32_t pulses = 0;                        // Accepted impulses
+    uint32_t pulsesRejected = 0;                // Impulses closer than the debounce interval
+    uint32_t pulsesDropped = 0;                 // Impulses lost to a full queue
+    uint32_t pulseIntervalUs = 0;               // Interval between the last two impulses
+    uint32_t pulseAgeMs = 0;                    // Time since the last impulse
+    bool powerBounded = false;                  // Power is capped by the overdue next impulse
     volatile int shelly1PMcnt = 0;              // Shelly 1PM counter
     volatile int shelly1PMpulsewidth = 100;     // Shelly 1PM pulse width
 };
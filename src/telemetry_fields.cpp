@@ -0,0 +1,97 @@
+/*
+ * Telemetry Fields Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "telemetry_fields.h"
+
+const TelemetryField telemetryFields[TM_FIELD_COUNT] = {
+    {"battery_soc", TELEMETRY_INT, 0, 0},
+    {"battery_voltage", TELEMETRY_FLOAT, 2, 0.05f},
+    {"battery_current", TELEMETRY_FLOAT, 1, 0.1f},
+    {"battery_power", TELEMETRY_INT, 0, 0},
+    {"battery_temperature", TELEMETRY_FLOAT, 1, 0.5f},
+    {"battery_soh", TELEMETRY_INT, 0, 0},
+    {"battery_chargeVoltage", TELEMETRY_FLOAT, 1, 0.05f},
+    {"battery_chargeCurrentLimit", TELEMETRY_FLOAT, 1, 0.5f},
+    {"battery_dischargeCurrentLimit", TELEMETRY_FLOAT, 1, 0.5f},
+    {"battery_manufacturer", TELEMETRY_TEXT, 0, 0},
+    {"battery_protectionFlags1", TELEMETRY_INT, 0, 0},
+    {"battery_protectionFlags2", TELEMETRY_INT, 0, 0},
+    {"battery_warningFlags1", TELEMETRY_INT, 0, 0},
+    {"battery_warningFlags2", TELEMETRY_INT, 0, 0},
+    {"battery_requestFlags", TELEMETRY_INT, 0, 0},
+    {"multiplusDcVoltage", TELEMETRY_FLOAT, 2, 0.05f},
+    {"multiplusDcCurrent", TELEMETRY_FLOAT, 1, 0.2f},
+    {"multiplusUMainsRMS", TELEMETRY_FLOAT, 1, 0.5f},
+    {"multiplusAcFrequency", TELEMETRY_FLOAT, 2, 0.02f},
+    {"multiplusPinverterFiltered", TELEMETRY_INT, 0, 0},
+    {"multiplusPmainsFiltered", TELEMETRY_INT, 0, 0},
+    {"multiplusPowerFactor", TELEMETRY_FLOAT, 2, 0.01f},
+    {"multiplusTemp", TELEMETRY_FLOAT, 1, 0.5f},
+    {"multiplusStatus80", TELEMETRY_INT, 0, 0},
+    {"masterMultiLED_ActualInputCurrentLimit", TELEMETRY_FLOAT, 1, 0.1f},
+    {"multiplusESSpower", TELEMETRY_INT, 0, 0},
+    {"veBus_isOnline", TELEMETRY_BOOL, 0, 0},
+    {"veBus_communicationQuality", TELEMETRY_FLOAT, 2, 0.01f},
+    {"veBus_framesSent", TELEMETRY_INT, 0, 0},
+    {"veBus_framesReceived", TELEMETRY_INT, 0, 0},
+    {"veBus_checksumErrors", TELEMETRY_INT, 0, 0},
+    {"veBus_timeoutErrors", TELEMETRY_INT, 0, 0},
+    {"switchMode", TELEMETRY_INT, 0, 0},
+    {"essPowerStrategy", TELEMETRY_TEXT, 0, 0},
+    {"secondsInMinStrategy", TELEMETRY_INT, 0, 0},
+    {"secondsInMaxStrategy", TELEMETRY_INT, 0, 0},
+    {"bmsPowerAverage", TELEMETRY_INT, 0, 0},
+    {"feedInControl_enabled", TELEMETRY_BOOL, 0, 0},
+    {"feedInControl_current", TELEMETRY_INT, 0, 0},
+    {"feedInControl_target", TELEMETRY_FLOAT, 0, 0},
+    {"feedInControl_max", TELEMETRY_FLOAT, 0, 0},
+    {"statusLED_mode", TELEMETRY_INT, 0, 0},
+    {"mqtt_connected", TELEMETRY_BOOL, 0, 0},
+    {"mqtt_server", TELEMETRY_TEXT, 0, 0},
+    {"mqtt_port", TELEMETRY_INT, 0, 0},
+};
+
+void sampleSystemTelemetry(TelemetryPublisher& telemetry, const SystemData& data,
+                           const PylontechBatteryState& battery) {
+    const MultiplusData& multiplus = data.multiplus;
+
+    telemetry.setInt(TM_BATTERY_SOC, battery.soc);
+    telemetry.setFloat(TM_BATTERY_VOLTAGE, battery.voltage);
+    telemetry.setFloat(TM_BATTERY_CURRENT, battery.current);
+    telemetry.setInt(TM_BATTERY_POWER, battery.power);
+    telemetry.setFloat(TM_BATTERY_TEMPERATURE, battery.temperature);
+    telemetry.setInt(TM_BATTERY_SOH, battery.soh);
+    telemetry.setFloat(TM_BATTERY_CHARGE_VOLTAGE, battery.chargeVoltage);
+    telemetry.setFloat(TM_BATTERY_CCL, battery.chargeCurrentLimit);
+    telemetry.setFloat(TM_BATTERY_DCL, battery.dischargeCurrentLimit);
+    telemetry.setText(TM_BATTERY_MANUFACTURER, battery.manufacturer);
+    telemetry.setInt(TM_BATTERY_PROTECTION1, battery.protectionFlags1);
+    telemetry.setInt(TM_BATTERY_PROTECTION2, battery.protectionFlags2);
+    telemetry.setInt(TM_BATTERY_WARNING1, battery.warningFlags1);
+    telemetry.setInt(TM_BATTERY_WARNING2, battery.warningFlags2);
+    telemetry.setInt(TM_BATTERY_REQUEST, battery.requestFlags);
+
+    telemetry.setFloat(TM_MP_DC_VOLTAGE, multiplus.dcVoltage);
+    telemetry.setFloat(TM_MP_DC_CURRENT, multiplus.dcCurrent);
+    telemetry.setFloat(TM_MP_MAINS_VOLTAGE, multiplus.uMainsRMS);
+    telemetry.setFloat(TM_MP_AC_FREQUENCY, multiplus.acFrequency);
+    telemetry.setInt(TM_MP_PINVERTER, multiplus.pinverterFiltered);
+    telemetry.setInt(TM_MP_PMAINS, multiplus.pmainsFiltered);
+    telemetry.setFloat(TM_MP_POWER_FACTOR, multiplus.powerFactor);
+    telemetry.setFloat(TM_MP_TEMP, multiplus.temp);
+    telemetry.setInt(TM_MP_STATUS80, multiplus.status80);
+    telemetry.setFloat(TM_MP_INPUT_CURRENT_LIMIT, multiplus.masterMultiLED_ActualInputCurrentLimit);
+    telemetry.setInt(TM_MP_ESS_POWER, multiplus.esspower);
+
+    telemetry.setInt(TM_SWITCH_MODE, data.essControl.switchMode);
+    telemetry.setText(TM_ESS_STRATEGY, data.essControl.essStrategy);
+    telemetry.setInt(TM_SECONDS_MIN_STRATEGY, data.essControl.secondsInMinStrategy);
+    telemetry.setInt(TM_SECONDS_MAX_STRATEGY, data.essControl.secondsInMaxStrategy);
+    telemetry.setInt(TM_BMS_POWER_AVERAGE, battery.power); // Placeholder
+
+    telemetry.setInt(TM_FEEDIN_CURRENT, multiplus.esspower);
+}
@@ -0,0 +1,49 @@
+/*
+ * Telemetry Fields
+ *
+ * The field table of the WebSocket telemetry and the part of the sampling
+ * that comes from SystemData and the BMS snapshot. The live state of the
+ * VE.Bus handler, feed-in control and MQTT client is set in main.cpp.
+ *
+ * No hardware dependencies, the frames the web UI gets can be tested on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TELEMETRY_FIELDS_H
+#define TELEMETRY_FIELDS_H
+
+#include <stdint.h>
+#include "telemetry_publisher.h"
+#include "system_data.h"
+#include "pylontech_decoder.h"
+
+// The web UI merges the fields it receives, so after a full snapshot on
+// connect only changed fields are sent
+enum TelemetryFieldId : uint8_t {
+    TM_BATTERY_SOC, TM_BATTERY_VOLTAGE, TM_BATTERY_CURRENT, TM_BATTERY_POWER,
+    TM_BATTERY_TEMPERATURE, TM_BATTERY_SOH, TM_BATTERY_CHARGE_VOLTAGE,
+    TM_BATTERY_CCL, TM_BATTERY_DCL, TM_BATTERY_MANUFACTURER,
+    TM_BATTERY_PROTECTION1, TM_BATTERY_PROTECTION2, TM_BATTERY_WARNING1,
+    TM_BATTERY_WARNING2, TM_BATTERY_REQUEST,
+    TM_MP_DC_VOLTAGE, TM_MP_DC_CURRENT, TM_MP_MAINS_VOLTAGE, TM_MP_AC_FREQUENCY,
+    TM_MP_PINVERTER, TM_MP_PMAINS, TM_MP_POWER_FACTOR, TM_MP_TEMP, TM_MP_STATUS80,
+    TM_MP_INPUT_CURRENT_LIMIT, TM_MP_ESS_POWER,
+    TM_VEBUS_ONLINE, TM_VEBUS_QUALITY, TM_VEBUS_FRAMES_SENT, TM_VEBUS_FRAMES_RECEIVED,
+    TM_VEBUS_CHECKSUM_ERRORS, TM_VEBUS_TIMEOUT_ERRORS,
+    TM_SWITCH_MODE, TM_ESS_STRATEGY, TM_SECONDS_MIN_STRATEGY, TM_SECONDS_MAX_STRATEGY,
+    TM_BMS_POWER_AVERAGE,
+    TM_FEEDIN_ENABLED, TM_FEEDIN_CURRENT, TM_FEEDIN_TARGET, TM_FEEDIN_MAX,
+    TM_STATUS_LED_MODE, TM_MQTT_CONNECTED, TM_MQTT_SERVER, TM_MQTT_PORT,
+    TM_FIELD_COUNT
+};
+
+// Order matches TelemetryFieldId
+extern const TelemetryField telemetryFields[TM_FIELD_COUNT];
+
+// Battery, Multiplus and ESS control fields
+void sampleSystemTelemetry(TelemetryPublisher& telemetry, const SystemData& data,
+                           const PylontechBatteryState& battery);
+
+#endif // TELEMETRY_FIELDS_H
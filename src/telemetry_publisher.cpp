@@ -0,0 +1,252 @@
+/*
+ * Telemetry Publisher Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "telemetry_publisher.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+TelemetryPublisher::TelemetryPublisher(const TelemetryField* fieldTable, uint8_t count) {
+    fields = fieldTable;
+    fieldCount = count > TELEMETRY_MAX_FIELDS ? TELEMETRY_MAX_FIELDS : count;
+    memset(current, 0, sizeof(current));
+    memset(sent, 0, sizeof(sent));
+    sentMask = 0;
+
+    // FNV-1a over the table, clients notice a firmware with other fields
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        for (const char* c = fields[i].key; *c != '\0'; c++) {
+            hash = (hash ^ (uint8_t)*c) * 16777619UL;
+        }
+        hash = (hash ^ fields[i].type) * 16777619UL;
+        hash = (hash ^ fields[i].decimals) * 16777619UL;
+    }
+    schemaId = (uint16_t)(hash ^ (hash >> 16));
+}
+
+void TelemetryPublisher::setInt(uint8_t index, int32_t value) {
+    if (index < fieldCount) current[index].i = value;
+}
+
+void TelemetryPublisher::setFloat(uint8_t index, float value) {
+    if (index < fieldCount) current[index].f = value;
+}
+
+void TelemetryPublisher::setBool(uint8_t index, bool value) {
+    if (index < fieldCount) current[index].b = value;
+}
+
+void TelemetryPublisher::setText(uint8_t index, const char* value) {
+    if (index < fieldCount) {
+        strncpy(current[index].text, value != nullptr ? value : "", TELEMETRY_TEXT_MAX - 1);
+        current[index].text[TELEMETRY_TEXT_MAX - 1] = '\0';
+    }
+}
+
+bool TelemetryPublisher::hasChanged(uint8_t index) const {
+    if (!(sentMask & (1ULL << index))) {
+        return true;
+    }
+
+    const Value& now = current[index];
+    const Value& last = sent[index];
+    switch (fields[index].type) {
+        case TELEMETRY_INT:
+            return now.i != last.i;
+        case TELEMETRY_FLOAT:
+            if (isnan(now.f) || isnan(last.f)) {
+                return isnan(now.f) != isnan(last.f);
+            }
+            if (fields[index].deadband > 0) {
+                return fabsf(now.f - last.f) >= fields[index].deadband;
+            }
+            return now.f != last.f;
+        case TELEMETRY_BOOL:
+            return now.b != last.b;
+        case TELEMETRY_TEXT:
+            return strcmp(now.text, last.text) != 0;
+    }
+    return false;
+}
+
+// Appends ,"key":value at offset (no comma for the first field). Returns the
+// new offset, or 0 if it does not fit with room left for the closing brace.
+size_t TelemetryPublisher::writeField(char* buffer, size_t size, size_t offset, uint8_t index) const {
+    const TelemetryField& field = fields[index];
+    const Value& value = current[index];
+    size_t limit = size - 1;        // Keep one byte for '}'
+    int written;
+
+    if (offset > 1) {
+        if (offset + 1 >= limit) return 0;
+        buffer[offset++] = ',';
+    }
+
+    written = snprintf(&buffer[offset], limit - offset, "\"%s\":", field.key);
+    if (written < 0 || offset + written >= limit) return 0;
+    offset += written;
+
+    switch (field.type) {
+        case TELEMETRY_INT:
+            written = snprintf(&buffer[offset], limit - offset, "%ld", (long)value.i);
+            break;
+        case TELEMETRY_FLOAT:
+            if (isnan(value.f) || isinf(value.f)) {
+                written = snprintf(&buffer[offset], limit - offset, "null");
+            } else {
+                written = snprintf(&buffer[offset], limit - offset, "%.*f", field.decimals, (double)value.f);
+            }
+            break;
+        case TELEMETRY_BOOL:
+            written = snprintf(&buffer[offset], limit - offset, "%s", value.b ? "true" : "false");
+            break;
+        case TELEMETRY_TEXT: {
+            if (offset + 1 >= limit) return 0;
+            buffer[offset++] = '"';
+            for (const char* c = value.text; *c != '\0'; c++) {
+                uint8_t ch = (uint8_t)*c;
+                if (ch == '"' || ch == '\\') {
+                    if (offset + 2 >= limit) return 0;
+                    buffer[offset++] = '\\';
+                    buffer[offset++] = (char)ch;
+                } else if (ch < 0x20) {
+                    if (offset + 6 >= limit) return 0;
+                    offset += snprintf(&buffer[offset], limit - offset, "\\u%04x", ch);
+                } else {
+                    if (offset + 1 >= limit) return 0;
+                    buffer[offset++] = (char)ch;
+                }
+            }
+            written = snprintf(&buffer[offset], limit - offset, "\"");
+            break;
+        }
+    }
+    if (written < 0 || offset + written >= limit) return 0;
+    return offset + written;
+}
+
+uint64_t TelemetryPublisher::takeChanges() {
+    uint64_t changes = 0;
+
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        if (hasChanged(i)) {
+            changes |= 1ULL << i;
+            sent[i] = current[i];
+        }
+    }
+    sentMask |= changes;
+    return changes;
+}
+
+size_t TelemetryPublisher::serializeJson(char* buffer, size_t size, uint64_t& fieldMask) const {
+    if (size < 3) return 0;
+
+    size_t offset = 1;
+    buffer[0] = '{';
+
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        if (!(fieldMask & (1ULL << i))) continue;
+
+        size_t next = writeField(buffer, size, offset, i);
+        if (next == 0) continue;    // Does not fit, bit stays set for the caller
+        offset = next;
+        fieldMask &= ~(1ULL << i);
+    }
+
+    if (offset == 1) return 0;
+    buffer[offset++] = '}';
+    buffer[offset] = '\0';
+    return offset;
+}
+
+int32_t TelemetryPublisher::scaleFloat(float value, uint8_t decimals) {
+    if (isnan(value)) return TELEMETRY_NO_VALUE;
+
+    double scaled = value;
+    for (uint8_t i = 0; i < decimals; i++) {
+        scaled *= 10;
+    }
+    scaled = scaled < 0 ? scaled - 0.5 : scaled + 0.5;
+    if (scaled >= 2147483647.0) return INT32_MAX;
+    if (scaled <= -2147483647.0) return -INT32_MAX;
+    return (int32_t)scaled;
+}
+
+static inline uint8_t* putLe(uint8_t* out, uint64_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        *out++ = (uint8_t)(value >> (8 * i));
+    }
+    return out;
+}
+
+size_t TelemetryPublisher::serializeBinary(uint8_t* buffer, size_t size, uint64_t fieldMask) const {
+    fieldMask &= allFields();
+
+    // Length first, the frame is written completely or not at all
+    size_t length = TELEMETRY_FRAME_HEADER;
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        if (!(fieldMask & (1ULL << i))) continue;
+        switch (fields[i].type) {
+            case TELEMETRY_INT:
+            case TELEMETRY_FLOAT: length += 4; break;
+            case TELEMETRY_BOOL: length += 1; break;
+            case TELEMETRY_TEXT: length += 1 + strlen(current[i].text); break;
+        }
+    }
+    if (length > size) return 0;
+
+    uint8_t* out = buffer;
+    *out++ = TELEMETRY_FRAME_VALUES;
+    out = putLe(out, schemaId, 2);
+    out = putLe(out, fieldMask, 8);
+
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        if (!(fieldMask & (1ULL << i))) continue;
+
+        const Value& value = current[i];
+        switch (fields[i].type) {
+            case TELEMETRY_INT:
+                out = putLe(out, (uint32_t)value.i, 4);
+                break;
+            case TELEMETRY_FLOAT:
+                out = putLe(out, (uint32_t)scaleFloat(value.f, fields[i].decimals), 4);
+                break;
+            case TELEMETRY_BOOL:
+                *out++ = value.b ? 1 : 0;
+                break;
+            case TELEMETRY_TEXT: {
+                uint8_t textLength = (uint8_t)strlen(value.text);
+                *out++ = textLength;
+                memcpy(out, value.text, textLength);
+                out += textLength;
+                break;
+            }
+        }
+    }
+    return out - buffer;
+}
+
+size_t TelemetryPublisher::serializeSchema(char* buffer, size_t size) const {
+    static const char typeNames[] = { 'i', 'f', 'b', 't' };
+
+    int written = snprintf(buffer, size, "{\"schema\":{\"id\":%u,\"fields\":[", schemaId);
+    if (written < 0 || (size_t)written >= size) return 0;
+    size_t offset = written;
+
+    for (uint8_t i = 0; i < fieldCount; i++) {
+        written = snprintf(&buffer[offset], size - offset, "%s[\"%s\",\"%c\",%u]",
+                           i > 0 ? "," : "", fields[i].key, typeNames[fields[i].type],
+                           fields[i].type == TELEMETRY_FLOAT ? fields[i].decimals : 0);
+        if (written < 0 || offset + written >= size) return 0;
+        offset += written;
+    }
+
+    written = snprintf(&buffer[offset], size - offset, "]}}");
+    if (written < 0 || offset + written >= size) return 0;
+    return offset + written;
+}
@@ -0,0 +1,116 @@
+/*
+ * Telemetry Publisher
+ *
+ * Keeps the last value sent per field and reports the fields that changed.
+ * Float fields have a dead band, smaller changes are not reported. The
+ * changed (or all) fields can be written in two formats:
+ *
+ * JSON: a flat object, e.g. {"battery_soc":57,"multiplusDcVoltage":52.31}
+ *
+ * Binary (little endian), described by the schema message sent before it:
+ *   u8  TELEMETRY_FRAME_VALUES
+ *   u16 schema id
+ *   u64 mask of the fields in this frame
+ *   per field in the mask, by ascending id:
+ *     INT, FLOAT   i32, floats scaled by 10^decimals (INT32_MIN = no value)
+ *     BOOL         u8
+ *     TEXT         u8 length + bytes
+ *
+ * The field table is given by the caller (static const TelemetryField[]),
+ * values are set by index. Serialization goes into a caller supplied
+ * buffer, nothing is allocated after construction.
+ *
+ * No hardware dependencies, can be benchmarked on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TELEMETRY_PUBLISHER_H
+#define TELEMETRY_PUBLISHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEMETRY_MAX_FIELDS 64         // Limited by the 64 bit field masks
+#define TELEMETRY_TEXT_MAX 33           // Longest text value incl. terminator
+
+#define TELEMETRY_FRAME_VALUES 0x01     // First byte of a binary frame
+#define TELEMETRY_FRAME_HEADER 11       // Type, schema id, field mask
+#define TELEMETRY_NO_VALUE INT32_MIN    // NaN float in a binary frame
+
+enum TelemetryType : uint8_t {
+    TELEMETRY_INT,
+    TELEMETRY_FLOAT,
+    TELEMETRY_BOOL,
+    TELEMETRY_TEXT
+};
+
+struct TelemetryField {
+    const char* key;
+    TelemetryType type;
+    uint8_t decimals;           // Float digits after the point
+    float deadband;             // Float changes below this are not sent
+};
+
+class TelemetryPublisher {
+private:
+    struct Value {
+        union {
+            int32_t i;
+            float f;
+            bool b;
+        };
+        char text[TELEMETRY_TEXT_MAX];
+    };
+
+    const TelemetryField* fields;
+    uint8_t fieldCount;
+    Value current[TELEMETRY_MAX_FIELDS];
+    Value sent[TELEMETRY_MAX_FIELDS];
+    uint64_t sentMask;          // Fields that have a value in sent[]
+
+    uint16_t schemaId;
+
+    bool hasChanged(uint8_t index) const;
+    size_t writeField(char* buffer, size_t size, size_t offset, uint8_t index) const;
+
+public:
+    TelemetryPublisher(const TelemetryField* fieldTable, uint8_t count);
+
+    void setInt(uint8_t index, int32_t value);
+    void setFloat(uint8_t index, float value);
+    void setBool(uint8_t index, bool value);
+    void setText(uint8_t index, const char* value);
+
+    // Mask of the fields that changed since they were last taken; marks them sent
+    uint64_t takeChanges();
+
+    // The given fields count as changed again on the next takeChanges()
+    void invalidate(uint64_t fieldMask = ~0ULL) { sentMask &= ~fieldMask; }
+
+    uint64_t allFields() const {
+        return fieldCount >= 64 ? ~0ULL : (1ULL << fieldCount) - 1;
+    }
+
+    // Fields of fieldMask as JSON object. Returns the length, 0 if none was
+    // written. Written fields are cleared from fieldMask, the bits left over
+    // did not fit.
+    size_t serializeJson(char* buffer, size_t size, uint64_t& fieldMask) const;
+
+    // Fields of fieldMask as binary frame. Returns the length, 0 if the
+    // buffer is too small.
+    size_t serializeBinary(uint8_t* buffer, size_t size, uint64_t fieldMask) const;
+
+    // Schema message for binary clients:
+    // {"schema":{"id":<id>,"fields":[["battery_soc","i",0],...]}}
+    size_t serializeSchema(char* buffer, size_t size) const;
+
+    uint8_t getFieldCount() const { return fieldCount; }
+    uint16_t getSchemaId() const { return schemaId; }
+
+    // Float to the integer sent in binary frames
+    static int32_t scaleFloat(float value, uint8_t decimals);
+};
+
+#endif // TELEMETRY_PUBLISHER_H
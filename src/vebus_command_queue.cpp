@@ -0,0 +1,112 @@
+/*
+ * VE.Bus Command Queue Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_command_queue.h"
+
+VeBusCommandQueue::VeBusCommandQueue() {
+    lanes[VEBUS_PRIORITY_SETPOINT].items = setpointItems;
+    lanes[VEBUS_PRIORITY_SETPOINT].capacity = 1;
+    lanes[VEBUS_PRIORITY_CONTROL].items = controlItems;
+    lanes[VEBUS_PRIORITY_CONTROL].capacity = VEBUS_CONTROL_QUEUE_SIZE;
+    lanes[VEBUS_PRIORITY_DIAGNOSTIC].items = diagnosticItems;
+    lanes[VEBUS_PRIORITY_DIAGNOSTIC].capacity = VEBUS_DIAGNOSTIC_QUEUE_SIZE;
+    clear();
+    resetStatistics();
+}
+
+void VeBusCommandQueue::clear() {
+    for (uint8_t i = 0; i < VEBUS_PRIORITY_COUNT; i++) {
+        lanes[i].head = 0;
+        lanes[i].count = 0;
+    }
+}
+
+void VeBusCommandQueue::pushBack(Lane& lane, const VeBusCommandDescriptor& command) {
+    uint8_t tail = (lane.head + lane.count) % lane.capacity;
+    lane.items[tail] = command;
+    lane.count++;
+}
+
+void VeBusCommandQueue::pushFront(Lane& lane, const VeBusCommandDescriptor& command) {
+    lane.head = (lane.head + lane.capacity - 1) % lane.capacity;
+    lane.items[lane.head] = command;
+    lane.count++;
+}
+
+bool VeBusCommandQueue::push(const VeBusCommandDescriptor& command, VeBusCommandPriority priority) {
+    Lane& lane = lanes[priority];
+
+    if (priority == VEBUS_PRIORITY_SETPOINT && lane.count > 0) {
+        // Last writer wins - the queued setpoint is outdated
+        lane.items[lane.head] = command;
+        coalesced++;
+        return true;
+    }
+
+    if (lane.count >= lane.capacity) {
+        dropped++;
+        return false;
+    }
+
+    pushBack(lane, command);
+    return true;
+}
+
+bool VeBusCommandQueue::pushRetry(const VeBusCommandDescriptor& command, VeBusCommandPriority priority) {
+    Lane& lane = lanes[priority];
+
+    if (priority == VEBUS_PRIORITY_SETPOINT && lane.count > 0) {
+        // A newer setpoint is already waiting, the old one must not go out again
+        coalesced++;
+        return false;
+    }
+
+    if (lane.count >= lane.capacity) {
+        dropped++;
+        return false;
+    }
+
+    pushFront(lane, command);
+    return true;
+}
+
+bool VeBusCommandQueue::pop(VeBusCommandDescriptor& command, VeBusCommandPriority* priority,
+                            VeBusCommandPriority first) {
+    for (uint8_t i = first; i < VEBUS_PRIORITY_COUNT; i++) {
+        Lane& lane = lanes[i];
+        if (lane.count == 0) {
+            continue;
+        }
+
+        command = lane.items[lane.head];
+        lane.head = (lane.head + 1) % lane.capacity;
+        lane.count--;
+
+        if (priority != nullptr) {
+            *priority = (VeBusCommandPriority)i;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool VeBusCommandQueue::isEmpty(VeBusCommandPriority first) const {
+    for (uint8_t i = first; i < VEBUS_PRIORITY_COUNT; i++) {
+        if (lanes[i].count > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t VeBusCommandQueue::size() const {
+    uint8_t total = 0;
+    for (uint8_t i = 0; i < VEBUS_PRIORITY_COUNT; i++) {
+        total += lanes[i].count;
+    }
+    return total;
+}
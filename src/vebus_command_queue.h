@@ -0,0 +1,103 @@
+/*
+ * VE.Bus Command Queue
+ *
+ * Commands waiting for a transmit slot, kept as compact descriptors and
+ * ordered by priority class:
+ *   1. ESS setpoint - single entry, a newer setpoint replaces a queued one
+ *      (last writer wins), so only the newest 0x37 value goes on the wire
+ *   2. Control commands (switch state, current limit, configuration)
+ *   3. Diagnostics (status/version/error requests)
+ *
+ * The queue does no locking; VeBusHandler guards it with a critical section.
+ * It has no hardware dependencies and can be exercised on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_COMMAND_QUEUE_H
+#define VEBUS_COMMAND_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vebus_request_table.h"
+
+#define VEBUS_COMMAND_MAX_DATA 8        // Largest payload we send (voltage range: 5 bytes)
+#define VEBUS_CONTROL_QUEUE_SIZE 4
+#define VEBUS_DIAGNOSTIC_QUEUE_SIZE 8
+
+// Descriptor flags
+#define VEBUS_COMMAND_FLAG_MK3 0x01             // Send as MK3 frame
+#define VEBUS_COMMAND_FLAG_WAIT_RESPONSE 0x02   // Retry if not acknowledged (ESS setpoints only)
+
+enum VeBusCommandPriority : uint8_t {
+    VEBUS_PRIORITY_SETPOINT = 0,
+    VEBUS_PRIORITY_CONTROL,
+    VEBUS_PRIORITY_DIAGNOSTIC,
+    VEBUS_PRIORITY_COUNT
+};
+
+struct VeBusCommandDescriptor {
+    uint8_t command;
+    uint8_t address;
+    uint8_t length;
+    uint8_t flags;
+    uint8_t retryCount;
+    uint8_t data[VEBUS_COMMAND_MAX_DATA];
+    VeBusRequestHandle request;     // Valid if a pending request waits for the response
+    uint32_t queuedUs;              // Time the command was queued (micros)
+
+    VeBusCommandDescriptor() : command(0), address(0), length(0), flags(0), retryCount(0), data(), queuedUs(0) {}
+
+    bool waitForResponse() const { return (flags & VEBUS_COMMAND_FLAG_WAIT_RESPONSE) != 0; }
+};
+
+class VeBusCommandQueue {
+private:
+    // Ring buffer of one priority class
+    struct Lane {
+        VeBusCommandDescriptor* items;
+        uint8_t capacity;
+        uint8_t head;
+        uint8_t count;
+    };
+
+    VeBusCommandDescriptor setpointItems[1];
+    VeBusCommandDescriptor controlItems[VEBUS_CONTROL_QUEUE_SIZE];
+    VeBusCommandDescriptor diagnosticItems[VEBUS_DIAGNOSTIC_QUEUE_SIZE];
+    Lane lanes[VEBUS_PRIORITY_COUNT];
+
+    uint32_t coalesced;
+    uint32_t dropped;
+
+    static void pushBack(Lane& lane, const VeBusCommandDescriptor& command);
+    static void pushFront(Lane& lane, const VeBusCommandDescriptor& command);
+
+public:
+    VeBusCommandQueue();
+
+    void clear();
+
+    // Queue a new command. A setpoint replaces a queued setpoint; other
+    // classes fail (and count as dropped) when full. Never blocks.
+    bool push(const VeBusCommandDescriptor& command, VeBusCommandPriority priority);
+
+    // Put a command back in front of its class for a retry. A setpoint is
+    // only retried if no newer setpoint was queued meanwhile.
+    bool pushRetry(const VeBusCommandDescriptor& command, VeBusCommandPriority priority);
+
+    // Take the next command, highest priority class first. Classes above
+    // first are skipped, e.g. setpoints while one waits for its acknowledgment.
+    bool pop(VeBusCommandDescriptor& command, VeBusCommandPriority* priority = nullptr,
+             VeBusCommandPriority first = VEBUS_PRIORITY_SETPOINT);
+
+    bool isEmpty(VeBusCommandPriority first = VEBUS_PRIORITY_SETPOINT) const;
+    uint8_t size() const;
+    uint8_t size(VeBusCommandPriority priority) const { return lanes[priority].count; }
+
+    uint32_t getCoalesced() const { return coalesced; }
+    uint32_t getDropped() const { return dropped; }
+    void resetStatistics() { coalesced = 0; dropped = 0; }
+};
+
+#endif // VEBUS_COMMAND_QUEUE_H
@@ -0,0 +1,163 @@
+/*
+ * VE.Bus Streaming Frame Decoder Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_frame_decoder.h"
+#include <string.h>
+
+VeBusFrameDecoder::VeBusFrameDecoder() {
+    reset();
+}
+
+void VeBusFrameDecoder::reset() {
+    rawPos = 0;
+    rawEnd = 0;
+    frameEmitted = false;
+    startFrame();
+}
+
+void VeBusFrameDecoder::startFrame() {
+    outPos = 0;
+    rawIndex = 0;
+    checksum = 0;
+    state = STATE_FRAME;
+}
+
+void VeBusFrameDecoder::abortFrame() {
+    // Pending raw bytes belong to the aborted frame as well
+    reset();
+}
+
+uint8_t* VeBusFrameDecoder::rxSpace(size_t& capacity) {
+    capacity = VEBUS_DECODER_BUFFER_SIZE - rawEnd;
+    return &buffer[rawEnd];
+}
+
+void VeBusFrameDecoder::commit(size_t length) {
+    size_t capacity = VEBUS_DECODER_BUFFER_SIZE - rawEnd;
+    rawEnd += (length < capacity) ? length : capacity;
+}
+
+size_t VeBusFrameDecoder::push(const uint8_t* data, size_t length) {
+    size_t capacity;
+    uint8_t* space = rxSpace(capacity);
+    size_t n = (length < capacity) ? length : capacity;
+    memcpy(space, data, n);
+    commit(n);
+    return n;
+}
+
+void VeBusFrameDecoder::store(uint8_t value) {
+    // outPos never overtakes rawPos, as destuffing only shrinks the frame
+    buffer[outPos++] = value;
+}
+
+VeBusDecodeResult VeBusFrameDecoder::next(VeBusFrameView& view) {
+    if (frameEmitted) {
+        // Move the not yet decoded bytes of the next frame to the front
+        uint16_t remaining = rawEnd - rawPos;
+        if (remaining > 0 && rawPos > 0) {
+            memmove(buffer, &buffer[rawPos], remaining);
+        }
+        rawPos = 0;
+        rawEnd = remaining;
+        frameEmitted = false;
+        startFrame();
+    }
+
+    while (rawPos < rawEnd) {
+        uint8_t byte = buffer[rawPos++];
+
+        if (byte == VEBUS_EOF_BYTE) {
+            if (state == STATE_DISCARD) {
+                frameEmitted = true;    // Resynchronized, start over with the next byte
+                return VEBUS_DECODE_OVERFLOW;
+            }
+            if (state == STATE_STUFFED) {
+                store(VEBUS_STUFF_BYTE);    // 0xFA is allowed as plain checksum value
+            }
+            checksum += byte;
+            return finishFrame(view);
+        }
+
+        if (state == STATE_DISCARD) {
+            continue;
+        }
+
+        if (outPos >= rawPos) {
+            // Cannot happen while destuffing in place, but never write ahead of the reader
+            state = STATE_DISCARD;
+            continue;
+        }
+
+        // Checksum runs over all raw bytes from index 2, except the 0x55 marker of sync frames
+        if (rawIndex >= 2 && !(rawIndex == 4 && outPos == 4 && buffer[2] == VEBUS_FRAME_TYPE_SYNC)) {
+            checksum += byte;
+        }
+        if (rawIndex < 0xFF) {
+            rawIndex++;
+        }
+
+        if (outPos < VEBUS_DECODER_HEADER_SIZE) {
+            store(byte);    // Header bytes are never stuffed (0xFD/0xFE frame type)
+            continue;
+        }
+
+        if (state == STATE_STUFFED) {
+            state = STATE_FRAME;
+            if (byte >= 0x70) {
+                store(byte + 0x80);     // 0x7A..0x7F -> 0xFA..0xFF
+            } else {
+                store(byte + VEBUS_STUFF_BYTE);     // Escaped checksum 0xFB..0xFF
+            }
+        } else if (byte == VEBUS_STUFF_BYTE) {
+            state = STATE_STUFFED;
+        } else {
+            store(byte);
+        }
+    }
+
+    // All raw bytes consumed - reclaim the space freed by destuffing
+    rawPos = outPos;
+    rawEnd = outPos;
+
+    if (state != STATE_DISCARD && outPos >= VEBUS_DECODER_BUFFER_SIZE) {
+        state = STATE_DISCARD;
+    }
+    if (state == STATE_DISCARD) {
+        // Keep nothing of an oversized frame
+        outPos = 0;
+        rawPos = 0;
+        rawEnd = 0;
+    }
+
+    return VEBUS_DECODE_NEED_MORE;
+}
+
+VeBusDecodeResult VeBusFrameDecoder::finishFrame(VeBusFrameView& view) {
+    frameEmitted = true;
+
+    // Header plus at least the checksum byte
+    if (outPos < VEBUS_DECODER_HEADER_SIZE + 1 || checksum != 0) {
+        return VEBUS_DECODE_CHECKSUM_ERROR;
+    }
+
+    view.sourceAddress = ((uint16_t)buffer[0] << 8) | buffer[1];
+    view.frameType = buffer[2];
+    view.frameNumber = buffer[3];
+    view.payload = &buffer[VEBUS_DECODER_HEADER_SIZE];
+    view.payloadLength = outPos - VEBUS_DECODER_HEADER_SIZE - 1;
+    view.checksum = buffer[outPos - 1];
+
+    // Same field mapping as before: address, command, data...
+    const uint8_t* p = view.payload;
+    view.address = view.payloadLength > 0 ? p[0] : 0;
+    view.command = view.payloadLength > 1 ? p[1] : 0;
+    view.data = view.payloadLength > 2 ? &p[2] : p;
+    view.length = view.payloadLength > 3 ? view.payloadLength - 3 : 0;
+
+    return VEBUS_DECODE_FRAME;
+}
@@ -0,0 +1,102 @@
+/*
+ * VE.Bus Streaming Frame Decoder
+ *
+ * Single-pass decoder for MK3 framed VE.Bus traffic:
+ *   header (address, FD/FE, frame number) -> destuffing -> running checksum -> 0xFF
+ *
+ * Raw bytes are read from the UART straight into the decoder buffer
+ * (rxSpace()/commit()) and destuffed in place, so a received frame is never
+ * copied. A decoded frame is returned as a VeBusFrameView pointing into that
+ * buffer; the view stays valid until the next call to next().
+ *
+ * The decoder has no hardware dependencies and can be fed from a captured
+ * byte stream on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_FRAME_DECODER_H
+#define VEBUS_FRAME_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEBUS_DECODER_BUFFER_SIZE 128
+#define VEBUS_DECODER_HEADER_SIZE 4     // address(2), frame type, frame number
+#define VEBUS_FRAME_TYPE_SYNC 0xFD
+#define VEBUS_FRAME_TYPE_DATA 0xFE
+#define VEBUS_STUFF_BYTE 0xFA
+#define VEBUS_EOF_BYTE 0xFF
+
+enum VeBusDecodeResult {
+    VEBUS_DECODE_NEED_MORE = 0,     // All committed bytes consumed, frame not complete yet
+    VEBUS_DECODE_FRAME,             // A valid frame is available in the view
+    VEBUS_DECODE_CHECKSUM_ERROR,    // Frame ended but checksum did not match
+    VEBUS_DECODE_OVERFLOW           // Frame too long for the buffer, dropped until next 0xFF
+};
+
+// Lightweight view of a decoded frame. Points into the decoder buffer.
+struct VeBusFrameView {
+    uint16_t sourceAddress;     // 0x8383 = Multiplus, 0x98F7 = MK3 interface
+    uint8_t frameType;          // 0xFD = sync frame, 0xFE = data frame
+    uint8_t frameNumber;        // Frame counter 0..127
+    const uint8_t* payload;     // Destuffed bytes after the header (without checksum)
+    uint8_t payloadLength;
+    uint8_t checksum;           // Destuffed checksum byte
+
+    // Field mapping used by the message structures (address, command, data)
+    uint8_t address;
+    uint8_t command;
+    const uint8_t* data;
+    uint8_t length;
+
+    bool isSyncFrame() const { return frameType == VEBUS_FRAME_TYPE_SYNC; }
+};
+
+class VeBusFrameDecoder {
+private:
+    enum State : uint8_t {
+        STATE_FRAME,        // Decoding header or payload
+        STATE_STUFFED,      // Previous byte was 0xFA
+        STATE_DISCARD       // Dropping bytes until the next end of frame
+    };
+
+    uint8_t buffer[VEBUS_DECODER_BUFFER_SIZE];
+    uint16_t outPos;        // End of destuffed frame data
+    uint16_t rawPos;        // Next raw byte to decode
+    uint16_t rawEnd;        // End of committed raw bytes
+    uint8_t rawIndex;       // Raw byte index inside the current frame
+    uint8_t checksum;       // Running sum over raw bytes from index 2
+    State state;
+    bool frameEmitted;
+
+    void startFrame();
+    void store(uint8_t value);
+    VeBusDecodeResult finishFrame(VeBusFrameView& view);
+
+public:
+    VeBusFrameDecoder();
+
+    void reset();
+
+    // Free space for raw bytes. Read from the UART directly into it and
+    // commit() the number of bytes written.
+    uint8_t* rxSpace(size_t& capacity);
+    void commit(size_t length);
+
+    // Convenience for callers that already hold the bytes (e.g. captures).
+    // Returns the number of bytes taken, call next() after every push.
+    size_t push(const uint8_t* data, size_t length);
+
+    // Decode committed bytes up to the next frame end
+    VeBusDecodeResult next(VeBusFrameView& view);
+
+    // True while a frame is partially received
+    bool isInFrame() const { return rawIndex > 0 || state == STATE_DISCARD; }
+
+    // Drop a partially received frame (e.g. after an RX timeout)
+    void abortFrame();
+};
+
+#endif // VEBUS_FRAME_DECODER_H
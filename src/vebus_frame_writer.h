@@ -0,0 +1,124 @@
+/*
+ * VE.Bus MK3 Frame Writer
+ *
+ * Builds the wire image of an MK3 data frame in a single pass:
+ *   98 F7 FE <frame nr> 00 E6 <command> 02 <data...> <checksum> FF
+ *
+ * The fixed part of each command we send is a compile-time template that
+ * carries the precomputed checksum sum of its bytes. Sending a frame copies
+ * the template, patches the frame number, stuffs the variable data bytes
+ * directly into the output and keeps the checksum running, so there are no
+ * intermediate buffers and no second pass over the frame.
+ *
+ * The output is identical to byte replacement followed by the checksum
+ * calculation described in docs/README.md. No hardware dependencies.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_FRAME_WRITER_H
+#define VEBUS_FRAME_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "vebus_frame_decoder.h"
+
+#define VEBUS_MK3_TEMPLATE_SIZE 8           // Header, our ID, command and flags
+#define VEBUS_MK3_TEMPLATE_MAX_DATA 4       // Fixed data bytes a template can carry
+#define VEBUS_MK3_OWN_ID_HIGH 0x00          // Repeated by the Multiplus in its acknowledgments
+#define VEBUS_MK3_OWN_ID_LOW 0xE6
+#define VEBUS_MK3_FLAGS_RAMVAR 0x02         // RAM variable, no EEPROM storage
+
+// Worst case wire size: every variable byte stuffed, escaped checksum, EOF
+#define VEBUS_MK3_FRAME_SIZE(dataLength) \
+    (VEBUS_MK3_TEMPLATE_SIZE + VEBUS_MK3_TEMPLATE_MAX_DATA + 2 * (dataLength) + 3)
+
+struct VeBusMk3Template {
+    uint8_t bytes[VEBUS_MK3_TEMPLATE_SIZE + VEBUS_MK3_TEMPLATE_MAX_DATA];
+    uint8_t length;     // Used bytes
+    uint8_t sum;        // Sum of bytes[2..length) with frame number 0
+};
+
+// Fixed data bytes must be below 0xFA, they are not stuffed
+constexpr VeBusMk3Template vebusMk3Template(uint8_t command, uint8_t dataLength = 0,
+                                            uint8_t d0 = 0, uint8_t d1 = 0,
+                                            uint8_t d2 = 0, uint8_t d3 = 0) {
+    return { { 0x98, 0xF7, VEBUS_FRAME_TYPE_DATA, 0x00,
+               VEBUS_MK3_OWN_ID_HIGH, VEBUS_MK3_OWN_ID_LOW, command, VEBUS_MK3_FLAGS_RAMVAR,
+               d0, d1, d2, d3 },
+             (uint8_t)(VEBUS_MK3_TEMPLATE_SIZE + dataLength),
+             (uint8_t)(VEBUS_FRAME_TYPE_DATA + VEBUS_MK3_OWN_ID_HIGH + VEBUS_MK3_OWN_ID_LOW +
+                       command + VEBUS_MK3_FLAGS_RAMVAR + d0 + d1 + d2 + d3) };
+}
+
+constexpr bool vebusMk3TemplateIsPlain(const VeBusMk3Template& frameTemplate,
+                                       uint8_t index = VEBUS_DECODER_HEADER_SIZE) {
+    return index >= frameTemplate.length ||
+           (frameTemplate.bytes[index] < VEBUS_STUFF_BYTE && vebusMk3TemplateIsPlain(frameTemplate, index + 1));
+}
+
+// The fixed command set
+constexpr VeBusMk3Template VEBUS_MK3_TEMPLATE_SWITCH = vebusMk3Template(0x05);
+constexpr VeBusMk3Template VEBUS_MK3_TEMPLATE_RAM_READ = vebusMk3Template(0x30);
+constexpr VeBusMk3Template VEBUS_MK3_TEMPLATE_ESS_POWER = vebusMk3Template(0x37);
+constexpr VeBusMk3Template VEBUS_MK3_TEMPLATE_CURRENT_LIMIT = vebusMk3Template(0x41);
+
+// Periodic status request: RAM read of battery voltage (0x04) and AC power (0x0E)
+constexpr VeBusMk3Template VEBUS_MK3_TEMPLATE_STATUS_REQUEST = vebusMk3Template(0x30, 4, 0x04, 0x0E, 0x00, 0x00);
+
+static_assert(vebusMk3TemplateIsPlain(VEBUS_MK3_TEMPLATE_SWITCH), "MK3 template needs stuffing");
+static_assert(vebusMk3TemplateIsPlain(VEBUS_MK3_TEMPLATE_RAM_READ), "MK3 template needs stuffing");
+static_assert(vebusMk3TemplateIsPlain(VEBUS_MK3_TEMPLATE_ESS_POWER), "MK3 template needs stuffing");
+static_assert(vebusMk3TemplateIsPlain(VEBUS_MK3_TEMPLATE_CURRENT_LIMIT), "MK3 template needs stuffing");
+static_assert(vebusMk3TemplateIsPlain(VEBUS_MK3_TEMPLATE_STATUS_REQUEST), "MK3 template needs stuffing");
+
+class VeBusMk3Writer {
+private:
+    uint8_t* out;
+    size_t length;
+    uint8_t sum;        // Running sum of the wire bytes from index 2
+
+public:
+    // The buffer must hold VEBUS_MK3_FRAME_SIZE() of the data that follows
+    VeBusMk3Writer(uint8_t* buffer, const VeBusMk3Template& frameTemplate, uint8_t frameNumber)
+        : out(buffer), length(frameTemplate.length), sum(frameTemplate.sum + frameNumber) {
+        memcpy(out, frameTemplate.bytes, frameTemplate.length);
+        out[3] = frameNumber;   // Header is not stuffed, numbers wrap at 127
+    }
+
+    void put(uint8_t value) {
+        if (value >= VEBUS_STUFF_BYTE) {
+            uint8_t escaped = 0x70 | (value & 0x0F);
+            out[length++] = VEBUS_STUFF_BYTE;
+            out[length++] = escaped;
+            sum += VEBUS_STUFF_BYTE + escaped;
+        } else {
+            out[length++] = value;
+            sum += value;
+        }
+    }
+
+    void put(const uint8_t* data, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            put(data[i]);
+        }
+    }
+
+    // Append checksum and EOF, returns the wire length
+    size_t finish() {
+        uint8_t checksum = 1 - sum;
+        if (checksum > VEBUS_STUFF_BYTE) {
+            // 0xFA itself is allowed as checksum, only 0xFB..0xFF are escaped
+            out[length++] = VEBUS_STUFF_BYTE;
+            out[length++] = checksum - VEBUS_STUFF_BYTE;
+        } else {
+            out[length++] = checksum;
+        }
+        out[length++] = VEBUS_EOF_BYTE;
+        return length;
+    }
+};
+
+#endif // VEBUS_FRAME_WRITER_H
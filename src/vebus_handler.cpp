@@ -7,23 +7,23 @@
 
 #include "vebus_handler.h"
 #include "system_data.h"
-
-// External debug function declaration
-extern void publishDebugMessage(const String& message, const String& level);
+#include "debug_log.h"
+#include "perf_monitor.h"
+#include <algorithm>
+#include <string.h>
 
 // Global instance
 // VeBusHandler veBusHandler; // Removed - defined in main.cpp
 
 VeBusHandler::VeBusHandler() {
-    serial = nullptr;
+    uart = nullptr;
     taskHandle = nullptr;
-    commandQueue = nullptr;
-    mutex = nullptr;
+    syncListener = nullptr;
+    signalStream = nullptr;
     lastCommandId = 0;
     isRunning = false;
-    debugMode = true;  // Enable debug mode by default
-    rxBufferPos = 0;
     lastRxTime = 0;
+    pendingPriority = VEBUS_PRIORITY_CONTROL;
     waitingForResponse = false;
     responseTimeout = 0;
 }
@@ -32,83 +32,51 @@ VeBusHandler::~VeBusHandler() {
     end();
 }
 
+#if HAL_ESP32
 bool VeBusHandler::begin(int rxPin, int txPin, long baudRate) {
-    Serial.println("VeBus: Starting initialization...");
-    
-    // Enable debug mode for troubleshooting
-    debugMode = true;
-    
-    if (debugMode) publishDebugMessage("VeBus: Starting initialization...", "info");
+    LOG_INFO(LOG_MODULE_VEBUS, "Starting initialization...");
     
-    // Initialize hardware serial for RS485
-    serial = &Serial2;
-    serial->begin(baudRate, SERIAL_8N1, rxPin, txPin);
-    Serial.printf("VeBus: Serial initialized on pins RX:%d TX:%d\n", rxPin, txPin);
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: Serial initialized on pins RX:%d TX:%d", rxPin, txPin);
-        publishDebugMessage(msg, "info");
+    // Initialize hardware serial for RS485 - the UART switches DE/SE itself
+    if (!uartEsp32.begin(&Serial2, VEBUS_SERIAL_PORT, baudRate, rxPin, txPin, VEBUS_DE_PIN, VEBUS_SE_PIN,
+                         VEBUS_RX_TIMEOUT_SYMBOLS, [this]() { onUartReceive(); })) {
+        LOG_ERROR(LOG_MODULE_VEBUS, "RS485 half duplex UART setup failed");
+        return false;
     }
+    LOG_INFO(LOG_MODULE_VEBUS, "Serial initialized on pins RX:%d TX:%d", rxPin, txPin);
     
-    // Configure RS485 half-duplex mode - try to enable it
-    pinMode(VEBUS_DE_PIN, OUTPUT);  // Driver Enable
-    pinMode(VEBUS_SE_PIN, OUTPUT);  // Send Enable
-    digitalWrite(VEBUS_DE_PIN, LOW);  // Start in receive mode
-    digitalWrite(VEBUS_SE_PIN, LOW);  // Start in receive mode
-    Serial.printf("VeBus: RS485 pins configured - DE:%d SE:%d\n", VEBUS_DE_PIN, VEBUS_SE_PIN);
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: RS485 pins configured - DE:%d SE:%d", VEBUS_DE_PIN, VEBUS_SE_PIN);
-        publishDebugMessage(msg, "info");
+    if (!begin(&uartEsp32)) {
+        uartEsp32.end();
+        return false;
     }
     
-    // Try to set RS485 mode if available
-    #ifdef UART_MODE_RS485_HALF_DUPLEX
-    serial->setMode(UART_MODE_RS485_HALF_DUPLEX);
-    Serial.println("VeBus: UART_MODE_RS485_HALF_DUPLEX enabled");
-    #else
-    Serial.println("VeBus: UART_MODE_RS485_HALF_DUPLEX not available");
-    #endif
-    
+    LOG_INFO(LOG_MODULE_VEBUS, "MK3 Communication handler initialized at %d baud (RX:IO%d, TX:IO%d)",
+                 (int32_t)baudRate, rxPin, txPin);
+    return true;
+}
+#endif
+
+bool VeBusHandler::begin(VeBusUart* transport) {
     // Create mutex for thread-safe access
-    mutex = xSemaphoreCreateMutex();
-    if (mutex == nullptr) {
-        Serial.println("VeBus: Failed to create mutex");
+    if (!mutex.create()) {
+        LOG_ERROR(LOG_MODULE_VEBUS, "Failed to create mutex");
         return false;
     }
     
-    // Create command queue
-    commandQueue = xQueueCreate(VEBUS_QUEUE_SIZE, sizeof(VeBusCommandItem));
-    if (commandQueue == nullptr) {
-        Serial.println("VeBus: Failed to create command queue");
-        vSemaphoreDelete(mutex);
-        return false;
-    }
+    commands.clear();
+    uart = transport;
+    stats.reset();
+    decoder.reset();
+    isRunning = true;   // Before the task starts, it preempts setup() on this core
     
     // Create communication task
-    BaseType_t result = xTaskCreatePinnedToCore(
-        taskWrapper,
-        "VeBusTask",
-        VEBUS_TASK_STACK_SIZE,
-        this,
-        VEBUS_TASK_PRIORITY,
-        &taskHandle,
-        VEBUS_TASK_CORE
-    );
-    
-    if (result != pdPASS) {
-        Serial.println("VeBus: Failed to create task");
-        vQueueDelete(commandQueue);
-        vSemaphoreDelete(mutex);
+    if (!halTaskCreate(taskWrapper, "VeBusTask", VEBUS_TASK_STACK_SIZE, this,
+                       VEBUS_TASK_PRIORITY, VEBUS_TASK_CORE, &taskHandle)) {
+        LOG_ERROR(LOG_MODULE_VEBUS, "Failed to create task");
+        mutex.destroy();
+        uart = nullptr;
+        isRunning = false;
         return false;
     }
-    
-    isRunning = true;
-    stats.reset();
-    resetRxBuffer();
-    
-    Serial.printf("VeBus: MK3 Communication handler initialized at %ld baud (RX:IO%d, TX:IO%d, DE:IO%d, SE:IO%d)\n", 
-                 baudRate, rxPin, txPin, VEBUS_DE_PIN, VEBUS_SE_PIN);
     return true;
 }
 
@@ -117,25 +85,23 @@ void VeBusHandler::end() {
     
     // Wait for task to finish
     if (taskHandle != nullptr) {
-        vTaskDelete(taskHandle);
+        halTaskDelete(taskHandle);
         taskHandle = nullptr;
     }
     
     // Clean up resources
-    if (commandQueue != nullptr) {
-        vQueueDelete(commandQueue);
-        commandQueue = nullptr;
-    }
+    commandLock.enter();
+    commands.clear();
+    commandLock.exit();
     
-    if (mutex != nullptr) {
-        vSemaphoreDelete(mutex);
-        mutex = nullptr;
-    }
+    mutex.destroy();
     
-    if (serial != nullptr) {
-        serial->end();
-        serial = nullptr;
+#if HAL_ESP32
+    if (uart == &uartEsp32) {
+        uartEsp32.end();
     }
+#endif
+    uart = nullptr;
 }
 
 void VeBusHandler::taskWrapper(void* parameter) {
@@ -143,287 +109,232 @@ void VeBusHandler::taskWrapper(void* parameter) {
     handler->communicationTask();
 }
 
-void VeBusHandler::communicationTask() {
-    VeBusFrame receivedFrame;
-    VeBusCommandItem commandItem;
-    TickType_t lastWakeTime = xTaskGetTickCount();
-    
-    // Send initial debug message
-    Serial.println("VeBus: TASK STARTED - communicationTask is running!");
-    Serial.println("VeBus: About to send WebSocket debug message");
-    if (debugMode) {
-        publishDebugMessage("VeBus: TASK STARTED - communicationTask is running!", "info");
-        Serial.println("VeBus: WebSocket debug message sent");
+void VeBusHandler::onUartReceive() {
+    // Runs in the UART event task - only notify, the frame is handled in our task
+    if (taskHandle != nullptr) {
+        halTaskNotify(taskHandle);
     }
+}
+
+void VeBusHandler::communicationTask() {
+    VeBusFrameView receivedFrame;
+    
+    LOG_INFO(LOG_MODULE_VEBUS, "communicationTask started");
     
     while (isRunning) {
+        // Sleep until the UART reports received bytes or the idle timeout expires,
+        // while transmitting only until the TX done event is due
+        uint32_t waitMs = uart->isTransmitting() ? VEBUS_TASK_TX_POLL_MS : VEBUS_TASK_IDLE_TIMEOUT_MS;
+        halTaskNotifyTake(waitMs);
+        
+        // TX done: the UART has already switched the transceiver back to receive
+        uart->poll();
+        
         // Debug: Show that task loop is running
         static uint32_t loopCounter = 0;
-        if (++loopCounter % 100 == 0) {  // Every 100 iterations (1 second at 100Hz)
-            Serial.printf("VeBus: Task loop running (iteration %u)\n", loopCounter);
+        if (++loopCounter % 100 == 0) {  // Every 100 iterations
+            LOG_DEBUG(LOG_MODULE_VEBUS, "Task loop running (iteration %u)", loopCounter);
         }
         
         // Send heartbeat debug message every 10 seconds
         static uint32_t lastHeartbeat = 0;
-        if (millis() - lastHeartbeat > 10000 && debugMode) {
-            char msg[64];
-            snprintf(msg, sizeof(msg), "VeBus: communicationTask heartbeat (framesSent: %u)", stats.framesSent);
-            publishDebugMessage(msg, "info");
+        if (halMillis() - lastHeartbeat > 10000) {
+            lastHeartbeat = halMillis();
+            LOG_INFO(LOG_MODULE_VEBUS, "communicationTask heartbeat (framesSent: %u)", stats.framesSent);
         }
-        // Process incoming frames
-        if (receiveFrame(receivedFrame)) {
+        
+        // Process all incoming frames, this also feeds the sync frame detection
+        while (receiveFrame(receivedFrame)) {
             processReceivedFrame(receivedFrame);
             stats.framesReceived++;
         }
         
-        // Process command queue
-        if (xQueueReceive(commandQueue, &commandItem, 0) == pdTRUE) {
-            if (sendFrame(commandItem.frame)) {
-                stats.framesSent++;
-                
-                if (commandItem.waitForResponse) {
-                    pendingCommand = commandItem;
-                    waitingForResponse = true;
-                    responseTimeout = millis() + VEBUS_TIMEOUT_MS;
-                }
-            } else {
-                stats.framesDropped++;
-                
-                // Retry if possible
-                if (commandItem.retryCount < VEBUS_MAX_RETRY_COUNT) {
-                    commandItem.retryCount++;
-                    xQueueSendToBack(commandQueue, &commandItem, 0);
-                    stats.retransmissions++;
-                }
-            }
-        }
+        // Transmit in the slot right after the sync frame
+        processTransmitSlot();
         
         // Handle timeouts
-        if (waitingForResponse && millis() > responseTimeout) {
+        if (waitingForResponse && (int32_t)(halMillis() - responseTimeout) >= 0) {
             handleTimeout();
         }
-        
-        // Send periodic status request to generate some frame traffic
-        static uint32_t lastStatusRequest = 0;
-        static uint8_t frameNumber = 0;
-        
-        // Debug: Check timing condition
-        uint32_t currentMillis = millis();
-        uint32_t timeDiff = currentMillis - lastStatusRequest;
-        if (timeDiff % 1000 == 0 && timeDiff > 0) {  // Log every second
-            Serial.printf("VeBus: Time check - current: %lu, last: %lu, diff: %lu\n", 
-                         currentMillis, lastStatusRequest, timeDiff);
-        }
-        
-        if (millis() - lastStatusRequest > 2000) { // Every 2 seconds (faster for testing)
-            Serial.println("VeBus: PERIODIC REQUEST - About to send status frame");
-            Serial.printf("VeBus: Current millis: %lu, lastStatusRequest: %lu\n", millis(), lastStatusRequest);
-            if (debugMode) {
-                publishDebugMessage("VeBus: PERIODIC REQUEST - About to send status frame", "info");
-            }
-            VeBusFrame statusFrame;
-            statusFrame.isMk3Frame = true;
-            statusFrame.frameNumber = frameNumber++;
-            statusFrame.command = 0x30;  // Read RAM command
-            statusFrame.length = 4;      // 4 bytes of data
-            statusFrame.data[0] = 0x04;  // Battery voltage
-            statusFrame.data[1] = 0x0E;  // AC Power
-            statusFrame.data[2] = 0x00;  // Padding
-            statusFrame.data[3] = 0x00;  // Padding
-            
-            // Calculate MK3 checksum
-            statusFrame.calculateChecksum();
-            
-            // Send directly instead of queuing to ensure it gets sent
-            Serial.println("VeBus: CALLING sendFrame function");
-            Serial.printf("VeBus: Frame data - command: 0x%02X, length: %d\n", statusFrame.command, statusFrame.length);
-            if (sendFrame(statusFrame)) {
-                stats.framesSent++;  // Increment counter immediately
-                lastStatusRequest = millis();
-                Serial.printf("VeBus: ✓ Sent periodic MK3 status request #%d (framesSent: %u)\n", 
-                             frameNumber - 1, stats.framesSent);
-                if (debugMode) {
-                    char msg[128];
-                    snprintf(msg, sizeof(msg), "VeBus: ✓ Sent periodic MK3 status request #%d (framesSent: %u)", 
-                             frameNumber - 1, stats.framesSent);
-                    publishDebugMessage(msg, "success");
-                }
-            } else {
-                Serial.println("VeBus: ✗ Failed to send periodic status request");
-                if (debugMode) {
-                    char msg[128];
-                    snprintf(msg, sizeof(msg), "VeBus: ✗ Failed to send periodic status request #%d", frameNumber - 1);
-                    publishDebugMessage(msg, "error");
-                }
-            }
-        } else {
-            // Debug: Show when condition is not met
-            if (millis() % 5000 == 0) {  // Log every 5 seconds
-                Serial.printf("VeBus: Waiting for periodic request - current: %lu, last: %lu, remaining: %lu ms\n",
-                             millis(), lastStatusRequest, 2000 - (millis() - lastStatusRequest));
-            }
-        }
+        expireRequests();
         
         // Update device online status
-        if (deviceState.isStale()) {
-            if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (deviceState.isOnline && deviceState.isStale()) {
+            if (mutex.lock()) {
                 deviceState.isOnline = false;
-                xSemaphoreGive(mutex);
+                publishDeviceState();
+                mutex.unlock();
             }
         }
-        
-        // Task timing - run at 100Hz
-        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(10));
     }
     
     // Task cleanup - this should never be reached in normal operation
-    Serial.println("VeBus: communicationTask ending");
-    if (debugMode) publishDebugMessage("VeBus: communicationTask ending", "warning");
-    vTaskDelete(nullptr);
+    LOG_WARNING(LOG_MODULE_VEBUS, "communicationTask ending");
+    halTaskDelete(nullptr);
 }
 
-bool VeBusHandler::receiveFrame(VeBusFrame& frame) {
-    while (serial->available()) {
-        uint8_t byte = serial->read();
-        lastRxTime = millis();
+void VeBusHandler::processTransmitSlot() {
+    static uint32_t lastStatusRequest = 0;
+    
+    // The previous frame is still going out
+    if (uart->isTransmitting()) {
+        return;
+    }
+    
+    bool statusRequestDue = halMillis() - lastStatusRequest > 2000;  // Every 2 seconds
+    
+    // One write at a time waits for its acknowledgment, a newer setpoint
+    // must not take over pendingCommand before that
+    VeBusCommandPriority first = waitingForResponse ? VEBUS_PRIORITY_CONTROL : VEBUS_PRIORITY_SETPOINT;
+    commandLock.enter();
+    bool commandPending = !commands.isEmpty(first);
+    commandLock.exit();
+    if (!statusRequestDue && !commandPending) {
+        return;
+    }
+    
+    // Only one frame per sync frame, carrying the sync frame number + 1
+    uint8_t frameNumber;
+    if (!slotScheduler.acquireSlot(halMicros(), frameNumber)) {
+        return;
+    }
+    
+    // Queued commands have priority over the periodic status request,
+    // the queue hands them out by priority class
+    VeBusCommandDescriptor command;
+    VeBusCommandPriority priority;
+    bool commandTaken = false;
+    while (commandPending && !commandTaken) {
+        commandLock.enter();
+        commandPending = commands.pop(command, &priority, first);
+        commandLock.exit();
+        commandTaken = commandPending;
         
-        // Look for MK3 header or MK2 sync byte
-        if (rxBufferPos == 0) {
-            if (byte == VEBUS_MK3_HEADER1) {
-                // Start of MK3 frame
-                rxBuffer[rxBufferPos++] = byte;
-                continue;
-            } else if (byte == VEBUS_SYNC_BYTE) {
-                // Start of MK2 frame
-                rxBuffer[rxBufferPos++] = byte;
-                continue;
-            } else {
-                // Not a valid frame start
-                continue;
-            }
+        if (commandTaken && command.request.isValid()) {
+            // Cancelled or expired while queued - the slot goes to the next command
+            requestLock.enter();
+            commandTaken = requests.markSent(command.request, frameNumber, halMillis());
+            requestLock.exit();
         }
+    }
+    
+    if (commandTaken) {
+        VeBusFrame frame;
+        buildFrame(command, frame);
+        frame.frameNumber = frameNumber;
         
-        // Store byte in buffer
-        if (rxBufferPos < VEBUS_FRAME_SIZE) {
-            rxBuffer[rxBufferPos++] = byte;
+        if (sendFrame(frame)) {
+            stats.framesSent++;
+            
+            if (priority == VEBUS_PRIORITY_SETPOINT) {
+                stats.setpointLatencyUs = halMicros() - command.queuedUs;
+                if (stats.setpointLatencyUs > stats.maxSetpointLatencyUs) {
+                    stats.maxSetpointLatencyUs = stats.setpointLatencyUs;
+                }
+            }
+            
+            if (command.waitForResponse()) {
+                pendingCommand = command;
+                pendingPriority = priority;
+                waitingForResponse = true;
+                responseTimeout = halMillis() + VEBUS_ACK_TIMEOUT_MS;
+            }
         } else {
-            // Buffer overflow - reset
-            resetRxBuffer();
             stats.framesDropped++;
-            continue;
-        }
-        
-        // Check if frame is complete
-        if (isFrameComplete()) {
-            bool frameValid = false;
             
-            if (rxBuffer[0] == VEBUS_MK3_HEADER1 && rxBuffer[1] == VEBUS_MK3_HEADER2) {
-                // MK3 Frame
-                frameValid = parseMk3Frame(frame);
-            } else if (rxBuffer[0] == VEBUS_SYNC_BYTE) {
-                // MK2 Frame
-                frameValid = parseMk2Frame(frame);
+            // Marked sent above so a cancelled request never goes out; it did not
+            if (command.request.isValid()) {
+                requestLock.enter();
+                requests.markUnsent(command.request);
+                requestLock.exit();
             }
             
-            resetRxBuffer();
-            
-            if (frameValid) {
-                return true;
-            } else {
-                stats.checksumErrors++;
-                if (debugMode) {
-                    Serial.println("VeBus: Frame parsing/checksum error");
+            // Retry if possible
+            if (command.retryCount < VEBUS_MAX_RETRY_COUNT) {
+                command.retryCount++;
+                commandLock.enter();
+                bool requeued = commands.pushRetry(command, priority);
+                commandLock.exit();
+                if (requeued) {
+                    stats.retransmissions++;
                 }
             }
         }
+        return;
     }
     
-    // Check for incomplete frame timeout
-    if (rxBufferPos > 0 && (millis() - lastRxTime) > 100) {
-        resetRxBuffer();
-        stats.framesDropped++;
+    if (!statusRequestDue) {
+        return;  // Only cancelled requests were queued
     }
     
-    return false;
-}
-
-bool VeBusHandler::parseMk2Frame(VeBusFrame& frame) {
-    if (rxBufferPos < 5) return false;  // Minimum MK2 frame size
-    
-    frame.isMk3Frame = false;
-    frame.sync = rxBuffer[0];
-    frame.address = rxBuffer[1];
-    frame.command = rxBuffer[2];
-    frame.length = rxBuffer[3];
-    
-    uint8_t expectedLength = 4 + frame.length + 1;  // Header + data + checksum
-    if (rxBufferPos < expectedLength) return false;
-    
-    uint8_t dataLength = min(frame.length, (uint8_t)VEBUS_MK3_MAX_DATA_SIZE);
-    memcpy(frame.data, &rxBuffer[4], dataLength);
-    frame.checksum = rxBuffer[4 + dataLength];
-    
-    return frame.isChecksumValid();
+    // Send periodic status request to generate some frame traffic
+    LOG_DEBUG(LOG_MODULE_VEBUS, "Periodic request - about to send status frame");
+    if (sendFrameMk3(VEBUS_MK3_TEMPLATE_STATUS_REQUEST, frameNumber, nullptr, 0)) {
+        stats.framesSent++;
+        lastStatusRequest = halMillis();
+        LOG_DEBUG(LOG_MODULE_VEBUS, "✓ Sent periodic MK3 status request #%d (framesSent: %u)",
+                  frameNumber, stats.framesSent);
+    } else {
+        LOG_ERROR(LOG_MODULE_VEBUS, "✗ Failed to send periodic status request #%d", frameNumber);
+    }
 }
 
-bool VeBusHandler::parseMk3Frame(VeBusFrame& frame) {
-    if (rxBufferPos < 8) return false;  // Minimum MK3 frame size
-    
-    frame.isMk3Frame = true;
-    
-    // Check for end of frame
-    if (rxBuffer[rxBufferPos - 1] != VEBUS_MK3_END_FRAME) return false;
-    
-    // Extract frame number
-    frame.frameNumber = rxBuffer[3];
-    
-    // Destuff the frame data
-    uint8_t destuffedData[VEBUS_FRAME_SIZE];
-    int destuffedLength = 0;
-    
-    // Skip MK3 header (4 bytes) and start destuffing
-    for (int i = 4; i < rxBufferPos - 1; i++) {  // -1 to skip end frame
-        uint8_t byte = rxBuffer[i];
+bool VeBusHandler::receiveFrame(VeBusFrameView& frame) {
+    PerfScope perf(PERF_VEBUS_RECEIVE_FRAME);
+    while (true) {
+        VeBusDecodeResult result = decoder.next(frame);
         
-        if (byte == VEBUS_MK3_STUFF_BYTE && i < rxBufferPos - 2) {
-            // Next byte contains stuffed data
-            i++;
-            uint8_t nextByte = rxBuffer[i];
-            if (nextByte >= 0x70 && nextByte <= 0x7F) {
-                // Unstuff: 0x70-0x7F -> 0xFA-0xFF
-                byte = 0xFA + (nextByte & 0x0F);
-            } else {
-                byte = nextByte + 0x80;
-            }
+        if (result == VEBUS_DECODE_FRAME) {
+            // Track sync frames for the transmit slot scheduler
+            uint8_t marker = frame.payloadLength > 0 ? frame.payload[0] : 0;
+            slotScheduler.onFrame(frame.frameType, frame.frameNumber, marker, halMicros());
+            return true;
+        }
+        
+        if (result == VEBUS_DECODE_CHECKSUM_ERROR) {
+            stats.checksumErrors++;
+            LOG_DEBUG(LOG_MODULE_VEBUS, "Frame parsing/checksum error");
+            continue;
+        }
+        
+        if (result == VEBUS_DECODE_OVERFLOW) {
+            stats.framesDropped++;
+            continue;
         }
         
-        if (destuffedLength < VEBUS_FRAME_SIZE) {
-            destuffedData[destuffedLength++] = byte;
+        // Decoder needs more bytes - read them straight into its buffer
+        size_t available = uart->available();
+        if (available == 0) {
+            break;
+        }
+        size_t capacity;
+        uint8_t* space = decoder.rxSpace(capacity);
+        size_t count = uart->read(space, std::min(available, capacity));
+        if (count == 0) {
+            break;
         }
+        decoder.commit(count);
+        lastRxTime = halMillis();
     }
     
-    if (destuffedLength < 4) return false;  // Need at least address + command + flags + data
-    
-    // Parse MK3 frame structure
-    frame.address = destuffedData[0];
-    frame.command = destuffedData[1];
-    frame.length = destuffedLength - 4;  // Subtract address, command, flags, checksum
-    
-    // Copy data
-    uint8_t dataLength = min(frame.length, (uint8_t)VEBUS_MK3_MAX_DATA_SIZE);
-    memcpy(frame.data, &destuffedData[2], dataLength);
-    
-    // Checksum is the last byte before end frame
-    frame.checksum = destuffedData[destuffedLength - 1];
+    if (decoder.isInFrame()) {
+        // Another device is transmitting, the slot after the sync frame is taken
+        slotScheduler.onBusBusy();
+        
+        // Check for incomplete frame timeout
+        if ((halMillis() - lastRxTime) > 100) {
+            decoder.abortFrame();
+            stats.framesDropped++;
+        }
+    }
     
-    return frame.isChecksumValid();
+    return false;
 }
 
 bool VeBusHandler::sendFrame(const VeBusFrame& frame) {
-    Serial.println("VeBus: sendFrame called");
-    if (debugMode) publishDebugMessage("VeBus: sendFrame called", "debug");
+    LOG_DEBUG(LOG_MODULE_VEBUS, "sendFrame called");
     
-    if (serial == nullptr || !serial) {
+    if (uart == nullptr) {
         return false;
     }
     
@@ -432,184 +343,126 @@ bool VeBusHandler::sendFrame(const VeBusFrame& frame) {
         return sendFrameMk3Correct(frame);
     } else {
         // MK2 Protocol sending (legacy)
-        // RS485: Switch to transmit mode
-        digitalWrite(VEBUS_DE_PIN, HIGH);
-        digitalWrite(VEBUS_SE_PIN, HIGH);
-        delayMicroseconds(50);
+        uint8_t txBuffer[VEBUS_MK3_MAX_DATA_SIZE + 5];
+        int txLength = 0;
         
-        serial->write(frame.sync);
-        serial->write(frame.address);
-        serial->write(frame.command);
-        serial->write(frame.length);
+        txBuffer[txLength++] = frame.sync;
+        txBuffer[txLength++] = frame.address;
+        txBuffer[txLength++] = frame.command;
+        txBuffer[txLength++] = frame.length;
         
         for (int i = 0; i < frame.length && i < VEBUS_MK3_MAX_DATA_SIZE; i++) {
-            serial->write(frame.data[i]);
+            txBuffer[txLength++] = frame.data[i];
         }
         
-        serial->write(frame.checksum);
-        serial->flush();
+        txBuffer[txLength++] = frame.checksum;
         
-        // RS485: Switch back to receive mode
-        delayMicroseconds(50);
-        digitalWrite(VEBUS_DE_PIN, LOW);
-        digitalWrite(VEBUS_SE_PIN, LOW);
+        // Returns as soon as the frame is in the TX FIFO, RTS switches the transceiver
+        bool success = uart->transmit(txBuffer, txLength);
         
-        if (debugMode) {
-            Serial.printf("VeBus: Sent MK2 frame type 0x%02X, length %d\n", frame.command, frame.length);
-        }
-        return true;
+        LOG_DEBUG(LOG_MODULE_VEBUS, "Sent MK2 frame type 0x%02X, length %d", frame.command, frame.length);
+        return success;
+    }
+}
+
+// Templates of the fixed command set, other commands get theirs built at runtime
+static VeBusMk3Template mk3TemplateFor(uint8_t command) {
+    switch (command) {
+        case VEBUS_CMD_SET_SWITCH:        return VEBUS_MK3_TEMPLATE_SWITCH;
+        case 0x30:  /* Read RAM */        return VEBUS_MK3_TEMPLATE_RAM_READ;
+        case VEBUS_CMD_SET_ESS_POWER:     return VEBUS_MK3_TEMPLATE_ESS_POWER;
+        case VEBUS_CMD_SET_INPUT_CURRENT: return VEBUS_MK3_TEMPLATE_CURRENT_LIMIT;
+        default:                          return vebusMk3Template(command);
     }
 }
 
 bool VeBusHandler::sendFrameMk3Correct(const VeBusFrame& frame) {
-    Serial.println("VeBus: sendFrameMk3Correct called");
-    if (debugMode) publishDebugMessage("VeBus: sendFrameMk3Correct called", "debug");
-    
-    // Check if serial is available
-    if (!serial) {
-        Serial.println("VeBus: ERROR - Serial interface not initialized!");
-        if (debugMode) publishDebugMessage("VeBus: ERROR - Serial interface not initialized!", "error");
+    // Commands come from descriptors, their payload never exceeds VEBUS_COMMAND_MAX_DATA
+    size_t length = frame.length < VEBUS_COMMAND_MAX_DATA ? frame.length : VEBUS_COMMAND_MAX_DATA;
+    return sendFrameMk3(mk3TemplateFor(frame.command), frame.frameNumber, frame.data, length);
+}
+
+bool VeBusHandler::sendFrameMk3(const VeBusMk3Template& frameTemplate, uint8_t frameNumber,
+                                const uint8_t* data, size_t length) {
+    PerfScope perf(PERF_VEBUS_SEND_FRAME);
+    if (uart == nullptr) {
+        LOG_ERROR(LOG_MODULE_VEBUS, "ERROR - Serial interface not initialized!");
         return false;
     }
     
-    // Use the correct MK3 format from reference implementation
-    uint8_t txBuffer[64];  // Buffer for command assembly
-    int txLength = 0;
-    
-    // Build MK3 frame according to reference implementation
-    txBuffer[txLength++] = VEBUS_MK3_HEADER1;     // 0x98
-    txBuffer[txLength++] = VEBUS_MK3_HEADER2;     // 0xF7
-    txBuffer[txLength++] = VEBUS_MK3_DATA_FRAME;  // 0xFE
-    txBuffer[txLength++] = frame.frameNumber;    // Frame number
-    
-    // Our own ID
-    txBuffer[txLength++] = 0x00;  // Our own ID high byte
-    txBuffer[txLength++] = 0xE6;  // Our own ID low byte
-    
-    // Command and flags
-    txBuffer[txLength++] = frame.command;  // Command
-    txBuffer[txLength++] = 0x02;           // Flags (RAM var, no EEPROM)
-    
-    // Add data from frame
-    for (int i = 0; i < frame.length && txLength < sizeof(txBuffer) - 3; i++) {
-        txBuffer[txLength++] = frame.data[i];
-    }
-    
-    Serial.printf("VeBus: Built frame with %d bytes before stuffing\n", txLength);
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: Built frame with %d bytes before stuffing", txLength);
-        publishDebugMessage(msg, "debug");
-    }
-    
-    // Apply byte stuffing to the entire frame after header
-    uint8_t stuffedBuffer[128];
-    int stuffedLength = commandReplaceFAtoFF(stuffedBuffer, &txBuffer[4], txLength - 4);
-    
-    // Rebuild frame with stuffed data
-    uint8_t finalBuffer[128];
-    int finalLength = 0;
-    
-    // Copy header (first 4 bytes, no stuffing)
-    for (int i = 0; i < 4; i++) {
-        finalBuffer[finalLength++] = txBuffer[i];
-    }
-    
-    // Copy stuffed data
-    for (int i = 0; i < stuffedLength; i++) {
-        finalBuffer[finalLength++] = stuffedBuffer[i];
-    }
+    // Stuffing and checksum in one pass over the variable bytes
+    uint8_t wire[VEBUS_MK3_FRAME_SIZE(VEBUS_COMMAND_MAX_DATA)];
+    VeBusMk3Writer writer(wire, frameTemplate, frameNumber);
+    writer.put(data, length);
+    size_t wireLength = writer.finish();
     
-    // Calculate and append checksum
-    finalLength = appendChecksum(finalBuffer, finalLength);
-    
-    Serial.printf("VeBus: Final frame length: %d bytes\n", finalLength);
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: Final frame length: %d bytes", finalLength);
-        publishDebugMessage(msg, "debug");
-    }
-    
-    // RS485: Switch to transmit mode
-    digitalWrite(VEBUS_DE_PIN, HIGH);
-    digitalWrite(VEBUS_SE_PIN, HIGH);
-    delayMicroseconds(50);  // Small delay for transceiver switching
-    if (debugMode) publishDebugMessage("VeBus: RS485 switched to TX mode", "debug");
-    
-    Serial.printf("VeBus: RS485 pins set - DE:%d SE:%d\n", digitalRead(VEBUS_DE_PIN), digitalRead(VEBUS_SE_PIN));
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: RS485 pins state - DE:%d SE:%d", digitalRead(VEBUS_DE_PIN), digitalRead(VEBUS_SE_PIN));
-        publishDebugMessage(msg, "debug");
-    }
-    
-    // Send the frame
-    size_t bytesSent = serial->write(finalBuffer, finalLength);
-    serial->flush();
-    
-    // RS485: Switch back to receive mode
-    delayMicroseconds(50);  // Allow last byte to be sent
-    digitalWrite(VEBUS_DE_PIN, LOW);
-    digitalWrite(VEBUS_SE_PIN, LOW);
-    if (debugMode) publishDebugMessage("VeBus: RS485 switched to RX mode", "debug");
-    
-    Serial.printf("VeBus: Sent %d bytes via serial\n", bytesSent);
-    if (debugMode) {
-        char msg[128];
-        snprintf(msg, sizeof(msg), "VeBus: Sent %d bytes via serial (MK3 frame type 0x%02X)", 
-                 bytesSent, frame.command);
-        publishDebugMessage(msg, "success");
-    }
+    // Returns as soon as the frame is in the TX FIFO,
+    // the UART drives DE/SE via RTS for exactly the frame time
+    bool success = uart->transmit(wire, wireLength);
     
-    bool success = (bytesSent == finalLength);
-    Serial.printf("VeBus: sendFrame result: %s (%d/%d bytes)\n", success ? "SUCCESS" : "FAILED", bytesSent, finalLength);
-    if (debugMode) {
-        char msg[64];
-        snprintf(msg, sizeof(msg), "VeBus: Frame send result: %s (%d/%d)", success ? "SUCCESS" : "FAILED", bytesSent, finalLength);
-        publishDebugMessage(msg, success ? "success" : "error");
+    if (success) {
+        LOG_DEBUG(LOG_MODULE_VEBUS, "Sent MK3 frame #%d command 0x%02X, %u bytes",
+                  frameNumber, frameTemplate.bytes[6], (int32_t)wireLength);
+    } else {
+        LOG_ERROR(LOG_MODULE_VEBUS, "Sending MK3 frame #%d command 0x%02X failed", frameNumber, frameTemplate.bytes[6]);
     }
     
     return success;
 }
 
-int VeBusHandler::commandReplaceFAtoFF(uint8_t *outbuf, const uint8_t *inbuf, int inlength) {
-    int j = 0;
-    
-    // Starting from the beginning, replace 0xFA..FF with double-byte character
-    for (int i = 0; i < inlength; i++) {
-        uint8_t c = inbuf[i];
-        if (c >= 0xFA) {
-            outbuf[j++] = VEBUS_MK3_STUFF_BYTE;
-            outbuf[j++] = 0x70 | (c & 0x0F);
-        } else {
-            outbuf[j++] = c;    // No replacement
-        }
+// Responses that confirm a write, by command. Only the ESS setpoint is a
+// write we know the answer of; other commands are not waited for.
+static bool isAcknowledgment(const VeBusCommandDescriptor& command, uint8_t response) {
+    switch (command.command) {
+        case VEBUS_CMD_SET_ESS_POWER:
+            return response == VEBUS_MK3_WRITE_RAMVAR_OK || response == VEBUS_MK3_WRITE_SETTING_OK;
+        default:
+            return false;
     }
-    return j;   // New length of output frame
 }
 
-int VeBusHandler::appendChecksum(uint8_t *buf, int inlength) {
-    int j = 0;
-    
-    // Calculate checksum starting from 3rd byte
-    uint8_t cs = 1;
-    for (int i = 2; i < inlength; i++) {
-        cs -= buf[i];
+void VeBusHandler::processReceivedFrame(const VeBusFrameView& frame) {
+    PerfScope perf(PERF_VEBUS_PROCESS_FRAME);
+    if (frame.isSyncFrame()) {
+        // Sync frames only show that the device is alive, they carry no data for us
+        if (mutex.lock()) {
+            deviceState.updateTimestamp();
+            publishDeviceState();
+            
+            // One sample per sync period for the diagnostics stream
+            StreamSampleRing* stream = signalStream;
+            if (stream != nullptr) {
+                StreamSample sample;
+                sample.timeMs = halMillis();
+                sample.values[STREAM_AC_POWER] = deviceState.acInfo.acPower;
+                sample.values[STREAM_DC_CURRENT] = streamValue(deviceState.dcInfo.dcCurrent * 10);
+                sample.values[STREAM_DC_VOLTAGE] = streamValue(deviceState.dcInfo.dcVoltage * 100);
+                sample.values[STREAM_ESS_SETPOINT] = systemData.multiplus.esspower;
+                sample.values[STREAM_METER_POWER] = streamValue(systemData.powerMeter.decisiveMeterPower);
+                stream->push(sample);
+            }
+            mutex.unlock();
+        }
+        
+        // Start of a sync period - let the ESS control loop run
+        HalTaskHandle listener = syncListener;
+        if (listener != nullptr) {
+            halTaskNotify(listener);
+        }
+        return;
     }
-    j = inlength;
-    if (cs >= 0xFB) {
-        // EXCEPTION: Only replace starting from 0xFB
-        buf[j++] = VEBUS_MK3_STUFF_BYTE;
-        buf[j++] = (cs - 0xFA);
-    } else {
-        buf[j++] = cs;
+    
+    // MK3 replies to our own frames repeat our ID: 00 E6 <response>
+    if (frame.payloadLength >= 3 && frame.payload[0] == VEBUS_MK3_OWN_ID_HIGH &&
+        frame.payload[1] == VEBUS_MK3_OWN_ID_LOW) {
+        if (waitingForResponse && isAcknowledgment(pendingCommand, frame.payload[2])) {
+            waitingForResponse = false;
+            stats.setpointsAcknowledged++;
+            LOG_DEBUG(LOG_MODULE_VEBUS, "ESS power command acknowledged in frame #%d", frame.frameNumber);
+        }
     }
-    buf[j++] = VEBUS_MK3_END_FRAME;  // Append End Of Frame symbol
-    return j;   // New length of output frame
-}
-
-void VeBusHandler::processReceivedFrame(const VeBusFrame& frame) {
-    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+    
+    if (mutex.lock()) {
         deviceState.updateTimestamp();
         
         switch (frame.command) {
@@ -625,90 +478,216 @@ void VeBusHandler::processReceivedFrame(const VeBusFrame& frame) {
                 deviceState.ledStatus.fromFrame(frame);
                 break;
                 
-            case VEBUS_CMD_SET_ESS_POWER: // ESS Power Response
-                if (waitingForResponse && pendingCommand.frame.command == VEBUS_CMD_SET_ESS_POWER) {
-                    waitingForResponse = false;
-                    if (debugMode) {
-                        Serial.println("VeBus: ESS power command acknowledged");
-                    }
-                }
+            case VEBUS_CMD_GET_VERSION:
+                deviceState.versionInfo.fromFrame(frame);
+                deviceState.versionTime = halMillis();
+                break;
+                
+            case VEBUS_CMD_GET_DEVICE_STATUS:
+                deviceState.statusInfo.fromFrame(frame);
+                deviceState.statusTime = halMillis();
+                break;
+                
+            case VEBUS_CMD_GET_ERROR_INFO:
+                deviceState.errorInfo.fromFrame(frame);
+                deviceState.errorTime = halMillis();
+                break;
+                
+            case VEBUS_CMD_GET_WARNING_INFO:
+                deviceState.warningInfo.fromFrame(frame);
+                deviceState.warningTime = halMillis();
                 break;
                 
             default:
-                if (debugMode) {
-                    Serial.printf("VeBus: Unknown frame type 0x%02X\n", frame.command);
-                }
+                // Frames of other devices on the bus (e.g. 0xE4 broadcasts) - not of interest
                 break;
         }
         
-        xSemaphoreGive(mutex);
+        publishDeviceState();
+        mutex.unlock();
     }
     
+    // Complete waiting requests after the snapshot is published
+    dispatchResponse(frame);
+    
     // Update legacy variables for compatibility
     updateLegacyVariables();
 }
 
-void VeBusHandler::handleTimeout() {
-    waitingForResponse = false;
-    stats.timeoutErrors++;
+void VeBusHandler::dispatchResponse(const VeBusFrameView& frame) {
+    VeBusResponseCallback callback = nullptr;
+    void* context = nullptr;
+    VeBusResponse response;
+    
+    requestLock.enter();
+    bool matched = requests.complete(frame.command, frame.frameNumber, frame.data, frame.length,
+                                     halMillis(), callback, context, response);
+    requestLock.exit();
     
-    if (debugMode) {
-        Serial.println("VeBus: Command timeout");
+    if (matched && callback != nullptr) {
+        callback(&response, context);
     }
+}
+
+void VeBusHandler::expireRequests() {
+    VeBusResponseCallback callback;
+    void* context;
+    bool more = true;
     
-    // Retry pending command if possible
-    if (pendingCommand.retryCount < VEBUS_MAX_RETRY_COUNT) {
-        pendingCommand.retryCount++;
-        pendingCommand.timestamp = millis();
+    while (more) {
+        requestLock.enter();
+        more = requests.expire(halMillis(), callback, context);
+        requestLock.exit();
         
-        if (xQueueSendToBack(commandQueue, &pendingCommand, 0) == pdTRUE) {
-            stats.retransmissions++;
+        if (callback != nullptr) {
+            stats.timeoutErrors++;
+            callback(nullptr, context);
         }
     }
 }
 
-bool VeBusHandler::isFrameComplete() {
-    if (rxBufferPos < 4) {
-        return false; // Need at least header
+VeBusRequestHandle VeBusHandler::submitRequest(uint8_t command, const uint8_t* data, uint8_t length,
+                                               VeBusResponseCallback callback, void* context) {
+    VeBusRequestHandle handle;
+    if (!isInitialized()) {
+        return handle;
+    }
+    
+    requestLock.enter();
+    handle = requests.add(command, halMillis(), callback, context);
+    requestLock.exit();
+    
+    if (!handle.isValid()) {
+        LOG_WARNING(LOG_MODULE_VEBUS, "Request table full, dropping request 0x%02X", command);
+        return handle;
     }
     
-    // Check for MK3 frame (starts with 0x98 0xF7)
-    if (rxBuffer[0] == VEBUS_MK3_HEADER1 && rxBuffer[1] == VEBUS_MK3_HEADER2) {
-        // MK3 frame ends with 0xFF
-        return (rxBufferPos > 0 && rxBuffer[rxBufferPos - 1] == VEBUS_MK3_END_FRAME);
+    VeBusCommandDescriptor descriptor;
+    descriptor.command = command;
+    descriptor.length = std::min(length, (uint8_t)VEBUS_COMMAND_MAX_DATA);
+    if (data != nullptr && descriptor.length > 0) {
+        memcpy(descriptor.data, data, descriptor.length);
     }
+    descriptor.request = handle;
     
-    // MK2 frame (starts with 0xFF)
-    if (rxBuffer[0] == VEBUS_SYNC_BYTE) {
-        uint8_t expectedLength = 4 + rxBuffer[3] + 1; // Header + data + checksum
-        return rxBufferPos >= expectedLength;
+    if (!queueCommand(descriptor, VEBUS_PRIORITY_DIAGNOSTIC)) {
+        cancelRequest(handle);
+        return VeBusRequestHandle();
     }
     
-    return false; // Invalid frame type
+    return handle;
+}
+
+VeBusRequestState VeBusHandler::pollRequest(const VeBusRequestHandle& handle, VeBusResponse* response) {
+    requestLock.enter();
+    VeBusRequestState state = requests.poll(handle, response);
+    requestLock.exit();
+    return state;
 }
 
-void VeBusHandler::resetRxBuffer() {
-    rxBufferPos = 0;
-    memset(rxBuffer, 0, sizeof(rxBuffer));
+void VeBusHandler::cancelRequest(const VeBusRequestHandle& handle) {
+    requestLock.enter();
+    requests.cancel(handle);
+    requestLock.exit();
 }
 
-VeBusDeviceState VeBusHandler::getDeviceState() {
-    VeBusDeviceState state;
+bool VeBusHandler::isRequestPending(uint8_t command) {
+    requestLock.enter();
+    bool pending = requests.isPending(command);
+    requestLock.exit();
+    return pending;
+}
+
+bool VeBusHandler::waitForRequest(const VeBusRequestHandle& handle) {
+    if (!handle.isValid()) {
+        return false;
+    }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        state = deviceState;
-        xSemaphoreGive(mutex);
+    // The VE.Bus task delivers the response, waiting for it there would never end
+    if (halTaskCurrent() == taskHandle) {
+        cancelRequest(handle);
+        return false;
     }
     
-    return state;
+    while (true) {
+        VeBusRequestState state = pollRequest(handle);
+        if (state == VEBUS_REQUEST_COMPLETED) {
+            return true;
+        }
+        if (state != VEBUS_REQUEST_QUEUED && state != VEBUS_REQUEST_SENT) {
+            return false;  // Timed out
+        }
+        halDelayMs(5);
+    }
+}
+
+void VeBusHandler::handleTimeout() {
+    waitingForResponse = false;
+    stats.timeoutErrors++;
+    
+    LOG_WARNING(LOG_MODULE_VEBUS, "Command timeout");
+    
+    // Retry pending command if possible - a newer setpoint supersedes it
+    if (pendingCommand.retryCount < VEBUS_MAX_RETRY_COUNT) {
+        pendingCommand.retryCount++;
+        
+        commandLock.enter();
+        bool requeued = commands.pushRetry(pendingCommand, pendingPriority);
+        commandLock.exit();
+        if (requeued) {
+            stats.retransmissions++;
+        }
+    }
+}
+
+void VeBusHandler::publishDeviceState() {
+    // Called with mutex held, so there is only ever one writer
+    stateSnapshot.write(deviceState);
+}
+
+VeBusDeviceState VeBusHandler::getDeviceState() const {
+    return stateSnapshot.read();
 }
 
 VeBusStatistics VeBusHandler::getStatistics() {
-    return stats; // Statistics are updated atomically
+    VeBusStatistics result = stats; // Statistics are updated atomically
+    result.syncFrames = slotScheduler.getSyncFrames();
+    result.slotsMissed = slotScheduler.getSlotsMissed();
+    result.lastTxOffsetUs = slotScheduler.getLastTxOffset();
+    result.maxTxOffsetUs = slotScheduler.getMaxTxOffset();
+    commandLock.enter();
+    result.commandsCoalesced = commands.getCoalesced();
+    result.commandsDropped = commands.getDropped();
+    commandLock.exit();
+    return result;
 }
 
 void VeBusHandler::resetStatistics() {
     stats.reset();
+    slotScheduler.resetStatistics();
+    commandLock.enter();
+    commands.resetStatistics();
+    commandLock.exit();
+}
+
+bool VeBusHandler::queueCommand(const VeBusCommandDescriptor& command, VeBusCommandPriority priority) {
+    VeBusCommandDescriptor queued = command;
+    queued.queuedUs = halMicros();
+    
+    // Never waits for queue space - callers may be the async web server
+    commandLock.enter();
+    bool success = commands.push(queued, priority);
+    commandLock.exit();
+    return success;
+}
+
+void VeBusHandler::buildFrame(const VeBusCommandDescriptor& command, VeBusFrame& frame) {
+    frame.address = command.address;
+    frame.command = command.command;
+    frame.length = command.length;
+    memcpy(frame.data, command.data, command.length);
+    frame.isMk3Frame = (command.flags & VEBUS_COMMAND_FLAG_MK3) != 0;
+    frame.calculateChecksum();
 }
 
 bool VeBusHandler::sendEssPowerCommand(int16_t targetPower) {
@@ -716,12 +695,10 @@ bool VeBusHandler::sendEssPowerCommand(int16_t targetPower) {
     cmd.targetPower = targetPower;
     cmd.commandId = ++lastCommandId;
     
-    VeBusCommandItem item;
-    item.frame = cmd.toFrame();
-    item.waitForResponse = true;
-    item.timestamp = millis();
-    
-    return xQueueSendToBack(commandQueue, &item, pdMS_TO_TICKS(100)) == pdTRUE;
+    // Only the newest setpoint is kept, an older queued one is replaced
+    VeBusCommandDescriptor command = cmd.toCommand();
+    command.flags |= VEBUS_COMMAND_FLAG_WAIT_RESPONSE;
+    return queueCommand(command, VEBUS_PRIORITY_SETPOINT);
 }
 
 bool VeBusHandler::sendCurrentLimitCommand(uint8_t currentLimit) {
@@ -729,12 +706,8 @@ bool VeBusHandler::sendCurrentLimitCommand(uint8_t currentLimit) {
     cmd.currentLimit = currentLimit;
     cmd.commandId = ++lastCommandId;
     
-    VeBusCommandItem item;
-    item.frame = cmd.toFrame();
-    item.waitForResponse = true;
-    item.timestamp = millis();
-    
-    return xQueueSendToBack(commandQueue, &item, pdMS_TO_TICKS(100)) == pdTRUE;
+    VeBusCommandDescriptor command = cmd.toCommand();
+    return queueCommand(command, VEBUS_PRIORITY_CONTROL);
 }
 
 bool VeBusHandler::sendSwitchCommand(uint8_t switchState) {
@@ -742,29 +715,38 @@ bool VeBusHandler::sendSwitchCommand(uint8_t switchState) {
     cmd.switchState = switchState;
     cmd.commandId = ++lastCommandId;
     
-    VeBusCommandItem item;
-    item.frame = cmd.toFrame();
-    item.waitForResponse = true;
-    item.timestamp = millis();
-    
-    return xQueueSendToBack(commandQueue, &item, pdMS_TO_TICKS(100)) == pdTRUE;
+    VeBusCommandDescriptor command = cmd.toCommand();
+    return queueCommand(command, VEBUS_PRIORITY_CONTROL);
 }
 
-bool VeBusHandler::sendCustomCommand(const VeBusFrame& frame, bool waitForResponse) {
-    VeBusCommandItem item;
-    item.frame = frame;
-    item.waitForResponse = waitForResponse;
-    item.timestamp = millis();
+bool VeBusHandler::sendCustomCommand(const VeBusFrame& frame) {
+    if (frame.length > VEBUS_COMMAND_MAX_DATA) {
+        LOG_WARNING(LOG_MODULE_VEBUS, "Custom command 0x%02X too long (%d bytes)", frame.command, frame.length);
+        return false;
+    }
+    
+    VeBusCommandDescriptor command;
+    command.command = frame.command;
+    command.address = frame.address;
+    command.length = frame.length;
+    memcpy(command.data, frame.data, frame.length);
+    if (frame.isMk3Frame) {
+        command.flags |= VEBUS_COMMAND_FLAG_MK3;
+    }
     
-    return xQueueSendToBack(commandQueue, &item, pdMS_TO_TICKS(100)) == pdTRUE;
+    // ESS power frames keep last-writer-wins semantics on this path too
+    VeBusCommandPriority priority = frame.command == VEBUS_CMD_SET_ESS_POWER ?
+                                    VEBUS_PRIORITY_SETPOINT : VEBUS_PRIORITY_CONTROL;
+    return queueCommand(command, priority);
 }
 
 bool VeBusHandler::isDeviceOnline() const {
-    return deviceState.isOnline && !deviceState.isStale();
+    VeBusDeviceState state = getDeviceState();
+    return state.isOnline && !state.isStale();
 }
 
 uint32_t VeBusHandler::getLastCommunicationTime() const {
-    return deviceState.lastUpdateTime;
+    return getDeviceState().lastUpdateTime;
 }
 
 float VeBusHandler::getCommunicationQuality() const {
@@ -830,169 +812,48 @@ void VeBusHandler::updateLegacyVariables() {
 
 // New MK2 Protocol API Functions for External Control
 bool VeBusHandler::requestVersionInfo(VeBusVersionInfo& info) {
-    if (!isInitialized()) {
+    const uint8_t data[] = { 0x00 };  // Request all version info
+    if (!waitForRequest(submitRequest(VEBUS_CMD_GET_VERSION, data, sizeof(data)))) {
         return false;
     }
-    
-    VeBusFrame frame;
-    frame.command = VEBUS_CMD_GET_VERSION;
-    frame.length = 1;
-    frame.data[0] = 0x00; // Request all version info
-    
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    if (success) {
-        // Wait for response with timeout
-        TickType_t startTime = xTaskGetTickCount();
-        while ((xTaskGetTickCount() - startTime) < pdMS_TO_TICKS(responseTimeout)) {
-            VeBusFrame response;
-            if (receiveFrame(response) && response.command == VEBUS_CMD_GET_VERSION) {
-                info.productId = response.data[0];
-                info.firmwareVersion = response.data[1];
-                info.protocolVersion = response.data[2];
-                xSemaphoreGive(mutex);
-                return true;
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    }
-    xSemaphoreGive(mutex);
-    return false;
+    info = getDeviceState().versionInfo;
+    return true;
 }
 
 bool VeBusHandler::requestDeviceStatus(VeBusDeviceStatusInfo& status) {
-    if (!isInitialized()) {
+    const uint8_t data[] = { 0x00 };
+    if (!waitForRequest(submitRequest(VEBUS_CMD_GET_DEVICE_STATUS, data, sizeof(data)))) {
         return false;
     }
-    
-    VeBusFrame frame;
-    frame.command = VEBUS_CMD_GET_DEVICE_STATUS;
-    frame.length = 1;
-    frame.data[0] = 0x00;
-    
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    if (success) {
-        TickType_t startTime = xTaskGetTickCount();
-        while ((xTaskGetTickCount() - startTime) < pdMS_TO_TICKS(responseTimeout)) {
-            VeBusFrame response;
-            if (receiveFrame(response) && response.command == VEBUS_CMD_GET_DEVICE_STATUS) {
-                status.state = response.data[0];
-                status.mode = response.data[1];
-                status.alarm = response.data[2];
-                status.warnings = response.data[3];
-                xSemaphoreGive(mutex);
-                return true;
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    }
-    xSemaphoreGive(mutex);
-    return false;
+    status = getDeviceState().statusInfo;
+    return true;
 }
 
 bool VeBusHandler::requestErrorInfo(VeBusErrorInfo& error) {
-    if (!isInitialized()) {
+    const uint8_t data[] = { 0x00 };
+    if (!waitForRequest(submitRequest(VEBUS_CMD_GET_ERROR_INFO, data, sizeof(data)))) {
         return false;
     }
-    
-    VeBusFrame frame;
-    frame.command = VEBUS_CMD_GET_ERROR_INFO;
-    frame.length = 1;
-    frame.data[0] = 0x00;
-    
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    if (success) {
-        TickType_t startTime = xTaskGetTickCount();
-        while ((xTaskGetTickCount() - startTime) < pdMS_TO_TICKS(responseTimeout)) {
-            VeBusFrame response;
-            if (receiveFrame(response) && response.command == VEBUS_CMD_GET_ERROR_INFO) {
-                error.errorCode = response.data[0];
-                error.errorSubCode = response.data[1];
-                error.errorCounter = (uint32_t(response.data[2]) << 24) | 
-                                   (uint32_t(response.data[3]) << 16) |
-                                   (uint32_t(response.data[4]) << 8) | 
-                                   uint32_t(response.data[5]);
-                error.timestamp = (uint32_t(response.data[6]) << 24) |
-                                 (uint32_t(response.data[7]) << 16) |
-                                 (uint32_t(response.data[8]) << 8) |
-                                 uint32_t(response.data[9]);
-                xSemaphoreGive(mutex);
-                return true;
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    }
-    xSemaphoreGive(mutex);
-    return false;
+    error = getDeviceState().errorInfo;
+    return true;
 }
 
 bool VeBusHandler::requestWarningInfo(VeBusWarningInfo& warning) {
-    if (!isInitialized()) {
+    const uint8_t data[] = { 0x00 };
+    if (!waitForRequest(submitRequest(VEBUS_CMD_GET_WARNING_INFO, data, sizeof(data)))) {
         return false;
     }
-    
-    VeBusFrame frame;
-    frame.command = VEBUS_CMD_GET_WARNING_INFO;
-    frame.length = 1;
-    frame.data[0] = 0x00;
-    
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    if (success) {
-        TickType_t startTime = xTaskGetTickCount();
-        while ((xTaskGetTickCount() - startTime) < pdMS_TO_TICKS(responseTimeout)) {
-            VeBusFrame response;
-            if (receiveFrame(response) && response.command == VEBUS_CMD_GET_WARNING_INFO) {
-                warning.warningFlags = (uint16_t(response.data[0]) << 8) | uint16_t(response.data[1]);
-                warning.batteryVoltageWarning = response.data[2];
-                warning.temperatureWarning = response.data[3];
-                warning.overloadWarning = response.data[4];
-                warning.dcRippleWarning = response.data[5];
-                xSemaphoreGive(mutex);
-                return true;
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    }
-    xSemaphoreGive(mutex);
-    return false;
+    warning = getDeviceState().warningInfo;
+    return true;
 }
 
 bool VeBusHandler::requestLedStatus(VeBusLedStatus& ledStatus) {
-    if (!isInitialized()) {
+    const uint8_t data[] = { 0x00 };
+    if (!waitForRequest(submitRequest(VEBUS_CMD_GET_LED_STATUS, data, sizeof(data)))) {
         return false;
     }
-    
-    VeBusFrame frame;
-    frame.command = VEBUS_CMD_GET_LED_STATUS;
-    frame.length = 1;
-    frame.data[0] = 0x00;
-    
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    if (success) {
-        TickType_t startTime = xTaskGetTickCount();
-        while ((xTaskGetTickCount() - startTime) < pdMS_TO_TICKS(responseTimeout)) {
-            VeBusFrame response;
-            if (receiveFrame(response) && response.command == VEBUS_CMD_GET_LED_STATUS) {
-                ledStatus.mainLed = response.data[0];
-                ledStatus.absorbLed = response.data[1];
-                ledStatus.bulkLed = response.data[2];
-                ledStatus.floatLed = response.data[3];
-                ledStatus.invertLed = response.data[4];
-                ledStatus.overloadLed = response.data[5];
-                ledStatus.lowBatteryLed = response.data[6];
-                ledStatus.temperatureLed = response.data[7];
-                xSemaphoreGive(mutex);
-                return true;
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    }
-    xSemaphoreGive(mutex);
-    return false;
+    ledStatus = getDeviceState().ledStatus;
+    return true;
 }
 
 bool VeBusHandler::setSwitchState(VeBusSwitchState state) {
@@ -1006,14 +867,13 @@ bool VeBusHandler::setSwitchState(VeBusSwitchState state) {
     frame.data[0] = 0x00; // Device address
     frame.data[1] = (uint8_t)state;
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
+    // Sent by the VE.Bus task in the next free slot
+    bool success = sendCustomCommand(frame);
+    if (success && mutex.lock()) {
         // Update device state
         deviceState.switchState = (uint8_t)state;
-        stats.framesSent++;
+        publishDeviceState();
+        mutex.unlock();
     }
     
     return success;
@@ -1030,14 +890,12 @@ bool VeBusHandler::resetDevice() {
     frame.data[0] = 0x00; // Device address
     frame.data[1] = 0x01; // Reset command
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
-        stats.framesSent++;
+    bool success = sendCustomCommand(frame);
+    if (success && mutex.lock()) {
         // Clear device state after reset
-        memset(&deviceState, 0, sizeof(deviceState));
+        deviceState = VeBusDeviceState();
+        publishDeviceState();
+        mutex.unlock();
     }
     
     return success;
@@ -1054,15 +912,7 @@ bool VeBusHandler::clearErrors() {
     frame.data[0] = 0x00; // Device address
     frame.data[1] = 0x01; // Clear command
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
-        stats.framesSent++;
-    }
-    
-    return success;
+    return sendCustomCommand(frame);
 }
 
 bool VeBusHandler::enableAutoRestart(bool enable) {
@@ -1076,15 +926,7 @@ bool VeBusHandler::enableAutoRestart(bool enable) {
     frame.data[0] = 0x00; // Device address
     frame.data[1] = enable ? 0x01 : 0x00;
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
-        stats.framesSent++;
-    }
-    
-    return success;
+    return sendCustomCommand(frame);
 }
 
 bool VeBusHandler::setVoltageRange(float minVoltage, float maxVoltage) {
@@ -1106,15 +948,7 @@ bool VeBusHandler::setVoltageRange(float minVoltage, float maxVoltage) {
     frame.data[3] = maxV >> 8;
     frame.data[4] = maxV & 0xFF;
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
-        stats.framesSent++;
-    }
-    
-    return success;
+    return sendCustomCommand(frame);
 }
 
 bool VeBusHandler::setFrequencyRange(float minFreq, float maxFreq) {
@@ -1136,13 +970,5 @@ bool VeBusHandler::setFrequencyRange(float minFreq, float maxFreq) {
     frame.data[3] = maxF >> 8;
     frame.data[4] = maxF & 0xFF;
     
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    bool success = sendFrame(frame);
-    xSemaphoreGive(mutex);
-    
-    if (success) {
-        stats.framesSent++;
-    }
-    
-    return success;
+    return sendCustomCommand(frame);
 }
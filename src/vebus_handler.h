@@ -11,13 +11,19 @@
 #ifndef VEBUS_HANDLER_H
 #define VEBUS_HANDLER_H
 
-#include <Arduino.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/queue.h>
-#include <freertos/semphr.h>
-#include <HardwareSerial.h>
+#include "hal.h"
 #include "vebus_messages.h"
+#include "vebus_frame_decoder.h"
+#include "vebus_slot_scheduler.h"
+#include "seqlock.h"
+#include "vebus_request_table.h"
+#include "vebus_command_queue.h"
+#include "vebus_uart.h"
+#if HAL_ESP32
+#include "vebus_uart_esp32.h"
+#endif
+#include "vebus_frame_writer.h"
+#include "signal_stream.h"
 
 // VE.Bus Communication Configuration
 #define VEBUS_SERIAL_PORT 2
@@ -26,10 +32,12 @@
 #define VEBUS_TX_PIN 22         // RS485_TX = IO22
 #define VEBUS_DE_PIN 17         // RS485_EN = IO17 (Driver Enable)
 #define VEBUS_SE_PIN 19         // RS485_SE = IO19 (Send Enable)
-#define VEBUS_QUEUE_SIZE 10
 #define VEBUS_TASK_STACK_SIZE 4096
 #define VEBUS_TASK_PRIORITY 2
 #define VEBUS_TASK_CORE 1
+#define VEBUS_TASK_IDLE_TIMEOUT_MS 10  // Task wakes at least this often without UART events
+#define VEBUS_TASK_TX_POLL_MS 1        // Wake interval while a frame is being transmitted
+#define VEBUS_RX_TIMEOUT_SYMBOLS 1     // UART RX event after 1 symbol of bus idle (end of frame)
 
 // MK3 Protocol Constants
 #define VEBUS_MK3_HEADER1 0x98
@@ -39,20 +47,6 @@
 #define VEBUS_MK3_STUFF_BYTE 0xFA
 #define VEBUS_BROADCAST_ADDRESS 0x00
 
-// Command Queue Item
-struct VeBusCommandItem {
-    VeBusFrame frame;
-    uint8_t retryCount;
-    uint32_t timestamp;
-    bool waitForResponse;
-    
-    VeBusCommandItem() {
-        retryCount = 0;
-        timestamp = 0;
-        waitForResponse = false;
-    }
-};
-
 // VE.Bus Statistics
 struct VeBusStatistics {
     uint32_t framesSent = 0;
@@ -61,6 +55,15 @@ struct VeBusStatistics {
     uint32_t checksumErrors = 0;
     uint32_t timeoutErrors = 0;
     uint32_t retransmissions = 0;
+    uint32_t syncFrames = 0;        // Sync frames seen on the bus
+    uint32_t slotsMissed = 0;       // Pending frames that missed their transmit window
+    uint32_t lastTxOffsetUs = 0;    // Transmit offset after the last sync frame
+    uint32_t maxTxOffsetUs = 0;     // Worst transmit offset after a sync frame
+    uint32_t commandsCoalesced = 0; // Setpoints replaced by a newer one before sending
+    uint32_t commandsDropped = 0;   // Commands rejected because their class was full
+    uint32_t setpointLatencyUs = 0; // Queue-to-wire time of the last ESS setpoint
+    uint32_t maxSetpointLatencyUs = 0;
+    uint32_t setpointsAcknowledged = 0; // ESS setpoints confirmed by the Multiplus (00 E6 87)
     uint32_t lastResetTime = 0;
     
     void reset() {
@@ -70,64 +73,102 @@ struct VeBusStatistics {
         checksumErrors = 0;
         timeoutErrors = 0;
         retransmissions = 0;
-        lastResetTime = millis();
+        syncFrames = 0;
+        slotsMissed = 0;
+        lastTxOffsetUs = 0;
+        maxTxOffsetUs = 0;
+        commandsCoalesced = 0;
+        commandsDropped = 0;
+        setpointLatencyUs = 0;
+        maxSetpointLatencyUs = 0;
+        setpointsAcknowledged = 0;
+        lastResetTime = halMillis();
     }
 };
 
 class VeBusHandler {
 private:
-    // Hardware and FreeRTOS objects
-    HardwareSerial* serial;
-    TaskHandle_t taskHandle;
-    QueueHandle_t commandQueue;
-    SemaphoreHandle_t mutex;  // Renamed from stateMutex for consistency
-    
-    // Communication state
+    // Hardware and task objects
+#if HAL_ESP32
+    VeBusUartEsp32 uartEsp32;
+#endif
+    VeBusUart* uart;        // nullptr until begin() succeeded
+    HalTaskHandle taskHandle;
+    HalTaskHandle syncListener;  // Notified on every sync frame
+    StreamSampleRing* signalStream;  // Gets one sample per sync frame
+    HalMutex mutex;  // Serializes writers of deviceState
+    
+    // Communication state - deviceState is the working copy of the writers,
+    // readers only ever see the snapshot published through stateSnapshot
     VeBusDeviceState deviceState;
+    SeqLock<VeBusDeviceState> stateSnapshot;
     VeBusStatistics stats;  // Renamed from statistics for consistency
     uint8_t lastCommandId;
     bool isRunning;
-    bool debugMode;
     
-    // Frame buffers
-    uint8_t rxBuffer[VEBUS_FRAME_SIZE];
-    uint8_t rxBufferPos;
+    // Receive path: UART bytes are decoded in place, frames are handed out as views
+    VeBusFrameDecoder decoder;
     uint32_t lastRxTime;
     
-    // Pending command tracking
-    VeBusCommandItem pendingCommand;
+    // Transmit slots locked to the Multiplus sync frame
+    VeBusSlotScheduler slotScheduler;
+    
+    // Requests waiting for a response, shared with the caller tasks
+    VeBusRequestTable requests;
+    HalSpinLock requestLock;
+    
+    // Commands waiting for a transmit slot, shared with the caller tasks
+    VeBusCommandQueue commands;
+    HalSpinLock commandLock;
+    
+    // The one write waiting for its acknowledgment (00 E6 87), newer
+    // setpoints are held back until it is acknowledged or timed out
+    VeBusCommandDescriptor pendingCommand;
+    VeBusCommandPriority pendingPriority;
     bool waitingForResponse;
     uint32_t responseTimeout;
     
     // Private methods
     static void taskWrapper(void* parameter);
     void communicationTask();
-    bool receiveFrame(VeBusFrame& frame);
-    bool parseMk2Frame(VeBusFrame& frame);
-    bool parseMk3Frame(VeBusFrame& frame);
+    void processTransmitSlot();
+    bool receiveFrame(VeBusFrameView& frame);
     bool sendFrame(const VeBusFrame& frame);
     bool sendFrameMk3Correct(const VeBusFrame& frame);
-    int commandReplaceFAtoFF(uint8_t *outbuf, const uint8_t *inbuf, int inlength);
-    int appendChecksum(uint8_t *buf, int inlength);
-    void processReceivedFrame(const VeBusFrame& frame);
+    bool sendFrameMk3(const VeBusMk3Template& frameTemplate, uint8_t frameNumber,
+                      const uint8_t* data, size_t length);
+    void processReceivedFrame(const VeBusFrameView& frame);
+    void publishDeviceState();
+    bool queueCommand(const VeBusCommandDescriptor& command, VeBusCommandPriority priority);
+    void buildFrame(const VeBusCommandDescriptor& command, VeBusFrame& frame);
+    void dispatchResponse(const VeBusFrameView& frame);
+    void expireRequests();
+    bool waitForRequest(const VeBusRequestHandle& handle);
     void handleTimeout();
     void updateStatistics();
-    bool isFrameComplete();
-    void resetRxBuffer();
     
 public:
     VeBusHandler();
     ~VeBusHandler();
     
     // Initialization and control
+#if HAL_ESP32
     bool begin(int rxPin = VEBUS_RX_PIN, int txPin = VEBUS_TX_PIN, 
                long baudRate = VEBUS_BAUD_RATE);
+#endif
+    // Runs on any transport, e.g. VeBusUartPosix or a fake on the host.
+    // The transport must call onUartReceive() when bytes arrived.
+    bool begin(VeBusUart* transport);
     void end();
-    bool isInitialized() const { return serial != nullptr; }
+    
+    // Any task - wakes the VE.Bus task to read the UART
+    void onUartReceive();
+    bool isInitialized() const { return uart != nullptr; }
     bool isTaskRunning() const { return isRunning; }
     
-    // Device state access (thread-safe)
-    VeBusDeviceState getDeviceState();
+    // Device state access (thread-safe, never blocks)
+    VeBusDeviceState getDeviceState() const;
+    uint32_t getDeviceStateGeneration() const { return stateSnapshot.generation(); }
     VeBusStatistics getStatistics();
     void resetStatistics();
     
@@ -135,15 +176,32 @@ public:
     bool sendEssPowerCommand(int16_t targetPower);
     bool sendCurrentLimitCommand(uint8_t currentLimit);
     bool sendSwitchCommand(uint8_t switchState);
-    bool sendCustomCommand(const VeBusFrame& frame, bool waitForResponse = false);
+    // Queued and sent without waiting for an answer; use submitRequest()
+    // for commands that are answered
+    bool sendCustomCommand(const VeBusFrame& frame);
+    
+    // Asynchronous requests - the frame is sent by the VE.Bus task and the
+    // response is delivered to the callback (VE.Bus task context) or kept
+    // for pollRequest(). Never blocks; returns an invalid handle if full.
+    VeBusRequestHandle submitRequest(uint8_t command, const uint8_t* data = nullptr, uint8_t length = 0,
+                                     VeBusResponseCallback callback = nullptr, void* context = nullptr);
+    VeBusRequestState pollRequest(const VeBusRequestHandle& handle, VeBusResponse* response = nullptr);
+    void cancelRequest(const VeBusRequestHandle& handle);
+    bool isRequestPending(uint8_t command);
     
     // Status and diagnostics
     bool isDeviceOnline() const;
     uint32_t getLastCommunicationTime() const;
     float getCommunicationQuality() const; // Returns 0.0-1.0
-    void enableDebugMode(bool enable) { debugMode = enable; }
+    void setTxSlotWindow(uint32_t windowUs) { slotScheduler.setWindow(windowUs); }
+    uint32_t getTxSlotWindow() const { return slotScheduler.getWindow(); }
+    void setSyncListener(HalTaskHandle task) { syncListener = task; }
+    void setSignalStream(StreamSampleRing* stream) { signalStream = stream; }
     
     // New MK2 Protocol API Functions for External Control
+    // The request*() functions wait for the response (up to VEBUS_REQUEST_TIMEOUT_MS)
+    // and must not be called from async callbacks; use submitRequest() there.
+    // The setters only queue the frame.
     bool requestVersionInfo(VeBusVersionInfo& info);
     bool requestDeviceStatus(VeBusDeviceStatusInfo& status);
     bool requestErrorInfo(VeBusErrorInfo& error);
@@ -172,7 +230,6 @@ public:
     void updateLegacyVariables();
     
     // Compatibility functions for legacy code
-    void sendMessageToRemote(byte* message, int length) { sendCustomCommand(*((VeBusFrame*)message), false); }
     void sendEssPowerCommand(int power) { sendEssPowerCommand((int16_t)power); }
     void sendCurrentLimitCommand(int limit) { sendCurrentLimitCommand((uint8_t)limit); }
 };
@@ -11,19 +11,28 @@
 #ifndef VEBUS_MESSAGES_H
 #define VEBUS_MESSAGES_H
 
-#include <Arduino.h>
 #include <stdint.h>
+#include <string.h>
+#include "hal.h"
+#include "vebus_frame_decoder.h"
+#include "vebus_command_queue.h"
 
 // VE.Bus Constants
 #define VEBUS_FRAME_SIZE 128  // Increased for MK3 protocol with stuffing
 #define VEBUS_SYNC_BYTE 0xFF
 #define VEBUS_MAX_RETRY_COUNT 3
 #define VEBUS_TIMEOUT_MS 1000
+#define VEBUS_ACK_TIMEOUT_MS 100        // Write acknowledgment, normally within the same sync period
 
 // MK3 Protocol Frame Structure
 #define VEBUS_MK3_HEADER_SIZE 4
 #define VEBUS_MK3_MAX_DATA_SIZE 120
 
+// CommandWriteViaID (0x37): RAM ID of the ESS power value, responses
+#define VEBUS_ESS_POWER_RAM_ID 0x83
+#define VEBUS_MK3_WRITE_RAMVAR_OK 0x87
+#define VEBUS_MK3_WRITE_SETTING_OK 0x88
+
 // VE.Bus Frame Types
 enum VeBusFrameType {
     VEBUS_FRAME_SYNC = 0x00,
@@ -85,6 +94,14 @@ struct VeBusVersionInfo {
     uint8_t productId;
     uint8_t firmwareVersion;
     uint8_t protocolVersion;
+    
+    void fromFrame(const VeBusFrameView& frame) {
+        if (frame.command == 0x01 && frame.length >= 3) {
+            productId = frame.data[0];
+            firmwareVersion = frame.data[1];
+            protocolVersion = frame.data[2];
+        }
+    }
 };
 
 // MK2 Protocol Device Status Structure
@@ -93,6 +110,15 @@ struct VeBusDeviceStatusInfo {
     uint8_t mode;           // Operating mode
     uint8_t alarm;          // Alarm status
     uint8_t warnings;       // Warning flags
+    
+    void fromFrame(const VeBusFrameView& frame) {
+        if (frame.command == 0x06 && frame.length >= 4) {
+            state = frame.data[0];
+            mode = frame.data[1];
+            alarm = frame.data[2];
+            warnings = frame.data[3];
+        }
+    }
 };
 
 // MK2 Protocol Error Information Structure
@@ -101,6 +127,17 @@ struct VeBusErrorInfo {
     uint8_t errorSubCode;
     uint32_t errorCounter;
     uint32_t timestamp;
+    
+    void fromFrame(const VeBusFrameView& frame) {
+        if (frame.command == 0x50 && frame.length >= 10) {
+            errorCode = frame.data[0];
+            errorSubCode = frame.data[1];
+            errorCounter = (uint32_t(frame.data[2]) << 24) | (uint32_t(frame.data[3]) << 16) |
+                           (uint32_t(frame.data[4]) << 8) | uint32_t(frame.data[5]);
+            timestamp = (uint32_t(frame.data[6]) << 24) | (uint32_t(frame.data[7]) << 16) |
+                        (uint32_t(frame.data[8]) << 8) | uint32_t(frame.data[9]);
+        }
+    }
 };
 
 // MK2 Protocol Warning Information Structure
@@ -110,6 +147,16 @@ struct VeBusWarningInfo {
     uint8_t temperatureWarning;
     uint8_t overloadWarning;
     uint8_t dcRippleWarning;
+    
+    void fromFrame(const VeBusFrameView& frame) {
+        if (frame.command == 0x51 && frame.length >= 6) {
+            warningFlags = (uint16_t(frame.data[0]) << 8) | uint16_t(frame.data[1]);
+            batteryVoltageWarning = frame.data[2];
+            temperatureWarning = frame.data[3];
+            overloadWarning = frame.data[4];
+            dcRippleWarning = frame.data[5];
+        }
+    }
 };
 
 // Basic VE.Bus Frame Structure (MK2/MK3 compatible)
@@ -199,7 +246,7 @@ struct VeBusDcInfo {
     uint8_t status;         // Device status
     uint8_t errorCode;      // Error code if any
     
-    void fromFrame(const VeBusFrame& frame) {
+    void fromFrame(const VeBusFrameView& frame) {
         if (frame.command == 0x02 && frame.length >= 8) {
             dcVoltage = ((frame.data[1] << 8) | frame.data[0]) / 100.0f;
             dcCurrent = ((frame.data[3] << 8) | frame.data[2]) / 10.0f;
@@ -220,7 +267,7 @@ struct VeBusAcInfo {
     float powerFactor;      // Power factor
     uint8_t acStatus;       // AC status flags
     
-    void fromFrame(const VeBusFrame& frame) {
+    void fromFrame(const VeBusFrameView& frame) {
         if (frame.command == 0x03 && frame.length >= 12) {
             acVoltage = ((frame.data[1] << 8) | frame.data[0]) / 100.0f;
             acCurrent = ((frame.data[3] << 8) | frame.data[2]) / 100.0f;
@@ -251,7 +298,7 @@ struct VeBusLedStatus {
     uint8_t lowBatteryLed;
     uint8_t temperatureLed;
     
-    void fromFrame(const VeBusFrame& frame) {
+    void fromFrame(const VeBusFrameView& frame) {
         if (frame.command == 0x04 && frame.length >= 6) {
             ledStatus = frame.data[0];
             switchRegister = frame.data[1];
@@ -260,12 +307,22 @@ struct VeBusLedStatus {
             inputCurrentLimit = frame.data[3] / 10.0f;
             inputConfig = frame.data[4];
         }
+        if (frame.command == 0x04 && frame.length >= 8) {
+            mainLed = frame.data[0];
+            absorbLed = frame.data[1];
+            bulkLed = frame.data[2];
+            floatLed = frame.data[3];
+            invertLed = frame.data[4];
+            overloadLed = frame.data[5];
+            lowBatteryLed = frame.data[6];
+            temperatureLed = frame.data[7];
+        }
     }
 };
 
 // ESS Power Command Message
 struct VeBusEssPowerCommand {
-    int16_t targetPower;        // Target power in W (positive = charge, negative = discharge)
+    int16_t targetPower;        // Target power in W (positive = feed into the grid, negative = charge)
     uint8_t commandId;          // Command sequence ID
     
     VeBusFrame toFrame() const {
@@ -279,6 +336,18 @@ struct VeBusEssPowerCommand {
         frame.calculateChecksum();
         return frame;
     }
+    
+    // MK3 frame 98 F7 FE nr 00 E6 37 02 83 LO HI, acknowledged with 00 E6 87
+    VeBusCommandDescriptor toCommand() const {
+        VeBusCommandDescriptor command;
+        command.command = VEBUS_CMD_SET_ESS_POWER;
+        command.flags = VEBUS_COMMAND_FLAG_MK3;
+        command.length = 3;
+        command.data[0] = VEBUS_ESS_POWER_RAM_ID;
+        command.data[1] = targetPower & 0xFF;
+        command.data[2] = (targetPower >> 8) & 0xFF;
+        return command;
+    }
 };
 
 // Input Current Limit Command
@@ -296,6 +365,15 @@ struct VeBusCurrentLimitCommand {
         frame.calculateChecksum();
         return frame;
     }
+    
+    VeBusCommandDescriptor toCommand() const {
+        VeBusCommandDescriptor command;
+        command.command = VEBUS_CMD_SET_INPUT_CURRENT;
+        command.length = 2;
+        command.data[0] = currentLimit;
+        command.data[1] = commandId;
+        return command;
+    }
 };
 
 // Switch Command (On/Off/Charger Only)
@@ -313,6 +391,15 @@ struct VeBusSwitchCommand {
         frame.calculateChecksum();
         return frame;
     }
+    
+    VeBusCommandDescriptor toCommand() const {
+        VeBusCommandDescriptor command;
+        command.command = VEBUS_CMD_SET_SWITCH;
+        command.length = 2;
+        command.data[0] = switchState;
+        command.data[1] = commandId;
+        return command;
+    }
 };
 
 // Complete VE.Bus Device State
@@ -320,12 +407,31 @@ struct VeBusDeviceState {
     VeBusDcInfo dcInfo;
     VeBusAcInfo acInfo;
     VeBusLedStatus ledStatus;
+    
+    // Results of explicit requests, time 0 = never received
+    VeBusVersionInfo versionInfo;
+    VeBusDeviceStatusInfo statusInfo;
+    VeBusErrorInfo errorInfo;
+    VeBusWarningInfo warningInfo;
+    uint32_t versionTime;
+    uint32_t statusTime;
+    uint32_t errorTime;
+    uint32_t warningTime;
+    
     uint32_t lastUpdateTime;
     bool isOnline;
     uint8_t communicationErrors;
     uint8_t switchState;  // Add missing switchState member
     
     VeBusDeviceState() {
+        memset(&versionInfo, 0, sizeof(versionInfo));
+        memset(&statusInfo, 0, sizeof(statusInfo));
+        memset(&errorInfo, 0, sizeof(errorInfo));
+        memset(&warningInfo, 0, sizeof(warningInfo));
+        versionTime = 0;
+        statusTime = 0;
+        errorTime = 0;
+        warningTime = 0;
         lastUpdateTime = 0;
         isOnline = false;
         communicationErrors = 0;
@@ -333,12 +439,12 @@ struct VeBusDeviceState {
     }
     
     void updateTimestamp() {
-        lastUpdateTime = millis();
+        lastUpdateTime = halMillis();
         isOnline = true;
     }
     
     bool isStale(uint32_t timeoutMs = 5000) const {
-        return (millis() - lastUpdateTime) > timeoutMs;
+        return (halMillis() - lastUpdateTime) > timeoutMs;
     }
 };
 
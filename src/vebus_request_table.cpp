@@ -0,0 +1,206 @@
+/*
+ * VE.Bus Pending Request Table Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_request_table.h"
+#include <string.h>
+
+// Wrap-safe "now is at or after deadline"
+static inline bool isDue(uint32_t nowMs, uint32_t deadline) {
+    return (int32_t)(nowMs - deadline) >= 0;
+}
+
+VeBusRequestTable::VeBusRequestTable() {
+    nextTicket = 1;
+    clear();
+}
+
+void VeBusRequestTable::clear() {
+    memset(entries, 0, sizeof(entries));
+}
+
+VeBusRequestTable::Entry* VeBusRequestTable::find(const VeBusRequestHandle& handle) {
+    if (!handle.isValid() || handle.slot >= VEBUS_MAX_PENDING_REQUESTS) {
+        return nullptr;
+    }
+    Entry& entry = entries[handle.slot];
+    if (entry.state == VEBUS_REQUEST_FREE || entry.ticket != handle.ticket) {
+        return nullptr;
+    }
+    return &entry;
+}
+
+void VeBusRequestTable::release(Entry& entry) {
+    entry.state = VEBUS_REQUEST_FREE;
+    entry.ticket = 0;
+    entry.callback = nullptr;
+    entry.context = nullptr;
+}
+
+VeBusRequestHandle VeBusRequestTable::add(uint8_t command, uint32_t nowMs,
+                                          VeBusResponseCallback callback, void* context,
+                                          uint32_t timeoutMs) {
+    VeBusRequestHandle handle;
+
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        Entry& entry = entries[i];
+        if (entry.state != VEBUS_REQUEST_FREE) {
+            continue;
+        }
+
+        entry.state = VEBUS_REQUEST_QUEUED;
+        entry.ticket = nextTicket;
+        entry.command = command;
+        entry.frameNumber = 0;
+        entry.deadline = nowMs + timeoutMs;
+        entry.callback = callback;
+        entry.context = context;
+        memset(&entry.response, 0, sizeof(entry.response));
+
+        if (++nextTicket == 0) {
+            nextTicket = 1;
+        }
+
+        handle.slot = i;
+        handle.ticket = entry.ticket;
+        break;
+    }
+
+    return handle;
+}
+
+bool VeBusRequestTable::markSent(const VeBusRequestHandle& handle, uint8_t frameNumber, uint32_t nowMs) {
+    Entry* entry = find(handle);
+    if (entry == nullptr || entry->state != VEBUS_REQUEST_QUEUED || isDue(nowMs, entry->deadline)) {
+        return false;
+    }
+
+    entry->state = VEBUS_REQUEST_SENT;
+    entry->frameNumber = frameNumber;
+    return true;
+}
+
+void VeBusRequestTable::markUnsent(const VeBusRequestHandle& handle) {
+    Entry* entry = find(handle);
+    if (entry != nullptr && entry->state == VEBUS_REQUEST_SENT) {
+        entry->state = VEBUS_REQUEST_QUEUED;
+        entry->frameNumber = 0;
+    }
+}
+
+bool VeBusRequestTable::complete(uint8_t command, uint8_t frameNumber, const uint8_t* data, uint8_t length,
+                                 uint32_t nowMs, VeBusResponseCallback& callback, void*& context,
+                                 VeBusResponse& response) {
+    // Oldest request first - tickets are handed out in order
+    Entry* match = nullptr;
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        Entry& entry = entries[i];
+        if (entry.state != VEBUS_REQUEST_SENT || entry.command != command) {
+            continue;
+        }
+        if (match == nullptr || (int16_t)(entry.ticket - match->ticket) < 0) {
+            match = &entry;
+        }
+    }
+    if (match == nullptr) {
+        return false;
+    }
+
+    VeBusResponse& result = match->response;
+    result.command = command;
+    result.frameNumber = frameNumber;
+    result.length = length < VEBUS_RESPONSE_MAX_DATA ? length : VEBUS_RESPONSE_MAX_DATA;
+    if (result.length > 0) {
+        memcpy(result.data, data, result.length);
+    }
+    result.timestamp = nowMs;
+
+    callback = match->callback;
+    context = match->context;
+    response = result;
+
+    if (callback != nullptr) {
+        // Delivered through the callback, nobody polls for it
+        release(*match);
+    } else {
+        match->state = VEBUS_REQUEST_COMPLETED;
+        match->deadline = nowMs + VEBUS_REQUEST_RETENTION_MS;
+    }
+    return true;
+}
+
+bool VeBusRequestTable::expire(uint32_t nowMs, VeBusResponseCallback& callback, void*& context) {
+    callback = nullptr;
+    context = nullptr;
+
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        Entry& entry = entries[i];
+        if (entry.state == VEBUS_REQUEST_FREE || !isDue(nowMs, entry.deadline)) {
+            continue;
+        }
+
+        if (entry.state == VEBUS_REQUEST_COMPLETED || entry.state == VEBUS_REQUEST_TIMED_OUT) {
+            // Result was never collected
+            release(entry);
+        } else if (entry.callback != nullptr) {
+            callback = entry.callback;
+            context = entry.context;
+            release(entry);
+            return true;
+        } else {
+            entry.state = VEBUS_REQUEST_TIMED_OUT;
+            entry.deadline = nowMs + VEBUS_REQUEST_RETENTION_MS;
+        }
+    }
+
+    return false;
+}
+
+VeBusRequestState VeBusRequestTable::poll(const VeBusRequestHandle& handle, VeBusResponse* response) {
+    Entry* entry = find(handle);
+    if (entry == nullptr) {
+        return VEBUS_REQUEST_FREE;
+    }
+
+    VeBusRequestState state = entry->state;
+    if (state == VEBUS_REQUEST_COMPLETED) {
+        if (response != nullptr) {
+            *response = entry->response;
+        }
+        release(*entry);
+    } else if (state == VEBUS_REQUEST_TIMED_OUT) {
+        release(*entry);
+    }
+    return state;
+}
+
+void VeBusRequestTable::cancel(const VeBusRequestHandle& handle) {
+    Entry* entry = find(handle);
+    if (entry != nullptr) {
+        release(*entry);
+    }
+}
+
+bool VeBusRequestTable::isPending(uint8_t command) const {
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        const Entry& entry = entries[i];
+        if (entry.command == command &&
+            (entry.state == VEBUS_REQUEST_QUEUED || entry.state == VEBUS_REQUEST_SENT)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t VeBusRequestTable::getPendingCount() const {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        if (entries[i].state == VEBUS_REQUEST_QUEUED || entries[i].state == VEBUS_REQUEST_SENT) {
+            count++;
+        }
+    }
+    return count;
+}
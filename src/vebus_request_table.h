@@ -0,0 +1,111 @@
+/*
+ * VE.Bus Pending Request Table
+ *
+ * Correlates requests sent by the VE.Bus task with the responses received
+ * later. Callers register a request and get a handle (future) they can poll,
+ * or a callback that is run from the VE.Bus task when the response arrives.
+ * Responses are matched by command; the frame number the request went out
+ * with is kept for diagnostics.
+ *
+ * The table itself does no locking and takes all timestamps from the
+ * caller (milliseconds). VeBusHandler wraps every call in its own critical
+ * section and runs callbacks outside of it.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_REQUEST_TABLE_H
+#define VEBUS_REQUEST_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEBUS_MAX_PENDING_REQUESTS 8
+#define VEBUS_REQUEST_TIMEOUT_MS 1000      // Queue wait + bus round trip
+#define VEBUS_REQUEST_RETENTION_MS 5000    // Unpolled results are dropped after this
+#define VEBUS_RESPONSE_MAX_DATA 16
+
+enum VeBusRequestState : uint8_t {
+    VEBUS_REQUEST_FREE = 0,     // Unknown handle, already collected or cancelled
+    VEBUS_REQUEST_QUEUED,       // Waiting for a transmit slot
+    VEBUS_REQUEST_SENT,         // On the bus, waiting for the response
+    VEBUS_REQUEST_COMPLETED,    // Response received
+    VEBUS_REQUEST_TIMED_OUT     // No response within the timeout
+};
+
+struct VeBusResponse {
+    uint8_t command;
+    uint8_t frameNumber;
+    uint8_t length;
+    uint8_t data[VEBUS_RESPONSE_MAX_DATA];
+    uint32_t timestamp;
+};
+
+// Runs in the VE.Bus task; response is nullptr if the request timed out
+typedef void (*VeBusResponseCallback)(const VeBusResponse* response, void* context);
+
+struct VeBusRequestHandle {
+    uint8_t slot;
+    uint16_t ticket;    // 0 = invalid handle
+
+    VeBusRequestHandle() : slot(0), ticket(0) {}
+    bool isValid() const { return ticket != 0; }
+};
+
+class VeBusRequestTable {
+private:
+    struct Entry {
+        VeBusRequestState state;
+        uint16_t ticket;
+        uint8_t command;
+        uint8_t frameNumber;
+        uint32_t deadline;
+        VeBusResponseCallback callback;
+        void* context;
+        VeBusResponse response;
+    };
+
+    Entry entries[VEBUS_MAX_PENDING_REQUESTS];
+    uint16_t nextTicket;
+
+    Entry* find(const VeBusRequestHandle& handle);
+    void release(Entry& entry);
+
+public:
+    VeBusRequestTable();
+
+    void clear();
+
+    // Register a request; returns an invalid handle if the table is full
+    VeBusRequestHandle add(uint8_t command, uint32_t nowMs,
+                           VeBusResponseCallback callback = nullptr, void* context = nullptr,
+                           uint32_t timeoutMs = VEBUS_REQUEST_TIMEOUT_MS);
+
+    // The request frame goes out now. False if the request was cancelled or
+    // expired meanwhile - the frame must not be sent then.
+    bool markSent(const VeBusRequestHandle& handle, uint8_t frameNumber, uint32_t nowMs);
+
+    // The frame marked sent did not go out: back to queued, so the retry can
+    // be marked sent again. Without a retry the request times out as queued.
+    void markUnsent(const VeBusRequestHandle& handle);
+
+    // Hand a received frame to the oldest request waiting for this command.
+    // If that request has a callback, it is returned to be run outside the lock.
+    bool complete(uint8_t command, uint8_t frameNumber, const uint8_t* data, uint8_t length,
+                  uint32_t nowMs, VeBusResponseCallback& callback, void*& context,
+                  VeBusResponse& response);
+
+    // Expire one overdue request. Returns true while there may be more; a
+    // timed out callback request is returned through callback/context.
+    bool expire(uint32_t nowMs, VeBusResponseCallback& callback, void*& context);
+
+    // Future interface: finished requests are collected (freed) by poll()
+    VeBusRequestState poll(const VeBusRequestHandle& handle, VeBusResponse* response);
+    void cancel(const VeBusRequestHandle& handle);
+
+    bool isPending(uint8_t command) const;
+    uint8_t getPendingCount() const;
+};
+
+#endif // VEBUS_REQUEST_TABLE_H
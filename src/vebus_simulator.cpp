@@ -0,0 +1,289 @@
+/*
+ * Multiplus VE.Bus Simulator - Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_simulator.h"
+
+#if HAL_POSIX
+
+#include <chrono>
+#include <string.h>
+#include "vebus_frame_writer.h"
+#include "vebus_messages.h"
+
+#define VEBUS_SIM_ADDRESS_HIGH 0x83
+#define VEBUS_SIM_ADDRESS_LOW 0x83
+#define VEBUS_SIM_SYNC_MARKER 0x55
+
+// Simulated readings
+#define VEBUS_SIM_DC_VOLTAGE 5200           // 0.01 V
+#define VEBUS_SIM_AC_VOLTAGE 23000          // 0.01 V
+#define VEBUS_SIM_AC_FREQUENCY 5000         // 0.01 Hz
+
+VeBusSimulator::VeBusSimulator()
+    : running(false), frameNumber(0), syncEndUs(0), slotOpen(false),
+      slotWindowUs(VEBUS_SIM_SLOT_WINDOW_US), essPower(0), setpointNext(0) {
+    memset(&stats, 0, sizeof(stats));
+    memset(setpoints, 0, sizeof(setpoints));
+}
+
+void VeBusSimulator::begin(Output frameOutput) {
+    if (running) {
+        return;
+    }
+    output = frameOutput;
+    running = true;
+    bus = std::thread(&VeBusSimulator::busThread, this);
+}
+
+void VeBusSimulator::end() {
+    running = false;
+    if (bus.joinable()) {
+        bus.join();
+    }
+}
+
+void VeBusSimulator::busThread() {
+    auto next = std::chrono::steady_clock::now();
+    uint32_t period = 0;
+    while (running) {
+        std::this_thread::sleep_until(next);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            sendSync();
+        }
+        if (++period % VEBUS_SIM_INFO_INTERVAL == 0) {
+            std::this_thread::sleep_until(next + std::chrono::microseconds(VEBUS_SIM_INFO_OFFSET_US));
+            std::lock_guard<std::mutex> guard(lock);
+            sendInfo();
+        }
+        next += std::chrono::microseconds(VEBUS_SIM_SYNC_PERIOD_US);
+    }
+}
+
+// Stuffing and checksum as in docs/README.md "VE.Bus send frames"; the
+// 0x55 marker of sync frames is not part of the checksum
+void VeBusSimulator::send(uint8_t frameType, const uint8_t* payload, size_t length) {
+    uint8_t wire[VEBUS_SIM_FRAME_MAX];
+    size_t pos = 0;
+    frameNumber = (frameNumber + 1) & 0x7F;
+    wire[pos++] = VEBUS_SIM_ADDRESS_HIGH;
+    wire[pos++] = VEBUS_SIM_ADDRESS_LOW;
+    wire[pos++] = frameType;
+    wire[pos++] = frameNumber;
+    uint8_t sum = frameType + frameNumber;
+
+    for (size_t i = 0; i < length && pos + 4 < sizeof(wire); i++) {
+        uint8_t value = payload[i];
+        bool marker = i == 0 && frameType == VEBUS_FRAME_TYPE_SYNC;
+        if (value >= VEBUS_STUFF_BYTE && !marker) {
+            uint8_t escaped = 0x70 | (value & 0x0F);
+            wire[pos++] = VEBUS_STUFF_BYTE;
+            wire[pos++] = escaped;
+            sum += VEBUS_STUFF_BYTE + escaped;
+        } else {
+            wire[pos++] = value;
+            if (!marker) sum += value;
+        }
+    }
+
+    uint8_t checksum = 1 - sum;
+    if (checksum > VEBUS_STUFF_BYTE) {
+        wire[pos++] = VEBUS_STUFF_BYTE;
+        wire[pos++] = checksum - VEBUS_STUFF_BYTE;
+    } else {
+        wire[pos++] = checksum;
+    }
+    wire[pos++] = VEBUS_EOF_BYTE;
+
+    // Every frame on the bus takes the slot after a sync frame
+    slotOpen = false;
+    if (output) {
+        output(wire, pos);
+    }
+}
+
+void VeBusSimulator::sendSync() {
+    // Time stamp in ~90 µs units, as seen on the bus
+    uint16_t stamp = (uint16_t)(halMicros() / 90);
+    uint8_t payload[4] = { VEBUS_SIM_SYNC_MARKER, 0x51, (uint8_t)stamp, (uint8_t)(stamp >> 8) };
+    send(VEBUS_FRAME_TYPE_SYNC, payload, sizeof(payload));
+    stats.syncFrames++;
+    syncEndUs = halMicros();    // Delivered, the handler can react from now on
+    slotOpen = true;
+}
+
+void VeBusSimulator::sendInfo() {
+    // The inverter follows the setpoint: positive feeds in, negative charges
+    int16_t acPower = essPower;
+    int16_t dcCurrent = (int16_t)((int32_t)-essPower * 1000 / VEBUS_SIM_DC_VOLTAGE);   // 0.1 A
+    uint16_t dcCurrentRaw = dcCurrent < 0 ? (uint16_t)(-dcCurrent) | 0x8000 : (uint16_t)dcCurrent;
+
+    // address, command, data, one trailing byte: the layout VeBusDcInfo::fromFrame() reads
+    uint8_t dc[11] = { 0x00, VEBUS_FRAME_DC_INFO,
+                       (uint8_t)VEBUS_SIM_DC_VOLTAGE, (uint8_t)(VEBUS_SIM_DC_VOLTAGE >> 8),
+                       (uint8_t)dcCurrentRaw, (uint8_t)(dcCurrentRaw >> 8),
+                       0xE8, 0x03, 0x00, 0x00, 0x00 };
+    send(VEBUS_FRAME_TYPE_DATA, dc, sizeof(dc));
+
+    uint16_t acCurrent = (uint16_t)((acPower < 0 ? -acPower : acPower) * 10000 / VEBUS_SIM_AC_VOLTAGE);
+    uint8_t ac[15] = { 0x00, VEBUS_FRAME_AC_INFO,
+                       (uint8_t)VEBUS_SIM_AC_VOLTAGE, (uint8_t)(VEBUS_SIM_AC_VOLTAGE >> 8),
+                       (uint8_t)acCurrent, (uint8_t)(acCurrent >> 8),
+                       (uint8_t)VEBUS_SIM_AC_FREQUENCY, (uint8_t)(VEBUS_SIM_AC_FREQUENCY >> 8),
+                       (uint8_t)acPower, (uint8_t)((uint16_t)acPower >> 8),
+                       100, 0x00, 0x00, 0x00, 0x00 };
+    send(VEBUS_FRAME_TYPE_DATA, ac, sizeof(ac));
+    stats.infoFrames += 2;
+}
+
+void VeBusSimulator::receive(const uint8_t* data, size_t length) {
+    uint32_t startUs = halMicros();
+    std::lock_guard<std::mutex> guard(lock);
+    while (length > 0) {
+        size_t taken = decoder.push(data, length);
+        data += taken;
+        length -= taken;
+
+        VeBusFrameView frame;
+        VeBusDecodeResult result;
+        while ((result = decoder.next(frame)) != VEBUS_DECODE_NEED_MORE) {
+            if (result == VEBUS_DECODE_FRAME) {
+                handleFrame(frame, startUs);
+            } else {
+                stats.checksumErrors++;
+            }
+        }
+    }
+}
+
+void VeBusSimulator::handleFrame(const VeBusFrameView& frame, uint32_t startUs) {
+    stats.hostFrames++;
+
+    // Only the first frame after a sync frame gets the slot
+    bool first = slotOpen;
+    // Read while the bus thread was delivering the sync frame: right after it
+    uint32_t offset = (int32_t)(startUs - syncEndUs) < 0 ? 0 : startUs - syncEndUs;
+    uint8_t expectedNumber = (frameNumber + 1) & 0x7F;
+    slotOpen = false;
+    if (first) {
+        slotOffset.record(offset);
+    }
+    frameNumber = frame.frameNumber & 0x7F;     // The host frame counts on the bus too
+
+    const uint8_t* p = frame.payload;
+    bool essWrite = frame.payloadLength >= 7 && p[0] == VEBUS_MK3_OWN_ID_HIGH && p[1] == VEBUS_MK3_OWN_ID_LOW &&
+                    p[2] == VEBUS_CMD_SET_ESS_POWER && p[4] == VEBUS_ESS_POWER_RAM_ID;
+    if (!essWrite) {
+        stats.otherCommands++;
+        return;
+    }
+
+    stats.essCommands++;
+    if (!first || offset > slotWindowUs) {
+        stats.slotMisses++;
+        return;
+    }
+    if (frame.frameNumber != expectedNumber) {
+        stats.numberMisses++;
+        return;
+    }
+
+    essPower = (int16_t)(p[5] | (p[6] << 8));
+    acknowledge(essPower, startUs);
+}
+
+void VeBusSimulator::acknowledge(int16_t power, uint32_t nowUs) {
+    uint8_t payload[3] = { VEBUS_MK3_OWN_ID_HIGH, VEBUS_MK3_OWN_ID_LOW, VEBUS_MK3_WRITE_RAMVAR_OK };
+    send(VEBUS_FRAME_TYPE_DATA, payload, sizeof(payload));
+    stats.essAcknowledged++;
+
+    // Newest pending entry with this value, older ones were replaced on the way
+    for (uint8_t i = 1; i <= VEBUS_SIM_SETPOINT_HISTORY; i++) {
+        Setpoint& setpoint = setpoints[(setpointNext + VEBUS_SIM_SETPOINT_HISTORY - i) % VEBUS_SIM_SETPOINT_HISTORY];
+        if (setpoint.pending && setpoint.power == power) {
+            setpoint.pending = false;
+            ackLatency.record(nowUs - setpoint.timeUs);
+            return;
+        }
+    }
+    stats.unmatchedAcks++;
+}
+
+void VeBusSimulator::noteSetpoint(int16_t power) {
+    std::lock_guard<std::mutex> guard(lock);
+    Setpoint& setpoint = setpoints[setpointNext];
+    setpoint.power = power;
+    setpoint.pending = true;
+    setpoint.timeUs = halMicros();
+    setpointNext = (setpointNext + 1) % VEBUS_SIM_SETPOINT_HISTORY;
+}
+
+void VeBusSimulator::setSlotWindow(uint32_t windowUs) {
+    std::lock_guard<std::mutex> guard(lock);
+    slotWindowUs = windowUs;
+}
+
+VeBusSimulatorStats VeBusSimulator::getStats() {
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+PerfHistogram VeBusSimulator::getAckLatency() {
+    std::lock_guard<std::mutex> guard(lock);
+    return ackLatency;
+}
+
+PerfHistogram VeBusSimulator::getSlotOffset() {
+    std::lock_guard<std::mutex> guard(lock);
+    return slotOffset;
+}
+
+int16_t VeBusSimulator::getEssPower() {
+    std::lock_guard<std::mutex> guard(lock);
+    return essPower;
+}
+
+size_t VeBusSimulatorUart::writeBytes(const uint8_t* data, size_t length) {
+    txEndUs = halMicros() + length * VEBUS_SIM_BYTE_US;
+    simulator.receive(data, length);
+    return length;
+}
+
+bool VeBusSimulatorUart::isTxComplete() {
+    return (int32_t)(halMicros() - txEndUs) >= 0;
+}
+
+void VeBusSimulatorUart::deliver(const uint8_t* data, size_t length) {
+    {
+        std::lock_guard<std::mutex> guard(rxLock);
+        for (size_t i = 0; i < length && rxCount < VEBUS_SIM_RX_SIZE; i++) {
+            rxBuffer[(rxHead + rxCount) % VEBUS_SIM_RX_SIZE] = data[i];
+            rxCount++;
+        }
+    }
+    if (onReceive) {
+        onReceive();
+    }
+}
+
+size_t VeBusSimulatorUart::available() {
+    std::lock_guard<std::mutex> guard(rxLock);
+    return rxCount;
+}
+
+size_t VeBusSimulatorUart::read(uint8_t* buffer, size_t length) {
+    std::lock_guard<std::mutex> guard(rxLock);
+    size_t count = length < rxCount ? length : rxCount;
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = rxBuffer[rxHead];
+        rxHead = (rxHead + 1) % VEBUS_SIM_RX_SIZE;
+    }
+    rxCount -= count;
+    return count;
+}
+
+#endif // HAL_POSIX
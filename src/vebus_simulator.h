@@ -0,0 +1,159 @@
+/*
+ * Multiplus VE.Bus Simulator
+ *
+ * Host side stand-in for a Multiplus, to run VeBusHandler in a closed loop
+ * on Linux (native_sim.cpp). The bus thread sends what the handler expects
+ * from the inverter:
+ *
+ *   - a sync frame every 20 ms, 83 83 FD nr 55 ..., the frame number
+ *     counts every frame on the bus
+ *   - every VEBUS_SIM_INFO_INTERVAL periods, in the middle of the period,
+ *     DC and AC info frames in the layout VeBusDcInfo / VeBusAcInfo decode
+ *
+ * Frames from the host (receive()) are checked like the Multiplus does. A
+ * 0x37 ESS write (98 F7 FE nr 00 E6 37 02 83 LO HI) is acknowledged with
+ * 83 83 FE nr 00 E6 87 only if it is the first frame after a sync frame,
+ * starts within the slot window and carries the sync frame number + 1.
+ * Anything else is counted as a slot or frame number miss and ignored, so
+ * the handler times out and retries as it would on the real bus.
+ *
+ * Times are taken when bytes change hands: a sync frame counts from its
+ * delivery to the host, a host frame from its arrival in receive(). With
+ * the in-process VeBusSimulatorUart that is the handler's transmit() call,
+ * through a pseudo terminal the time the bytes were read, pty latency
+ * included. Wire time is only modelled for the handler's TX done event
+ * (VEBUS_SIM_BYTE_US per byte).
+ *
+ * Only built for the host (hal.h HAL_POSIX).
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_SIMULATOR_H
+#define VEBUS_SIMULATOR_H
+
+#include "hal.h"
+
+#if HAL_POSIX
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "vebus_uart.h"
+#include "vebus_frame_decoder.h"
+#include "perf_histogram.h"
+
+#define VEBUS_SIM_SYNC_PERIOD_US 20000
+#define VEBUS_SIM_SLOT_WINDOW_US 2000       // Assumed, the real limit is not documented
+#define VEBUS_SIM_INFO_INTERVAL 5           // DC/AC info every 5th period (10 Hz)
+#define VEBUS_SIM_INFO_OFFSET_US 10000      // Info frames in the middle of the period
+#define VEBUS_SIM_BYTE_US 40                // 10 bits at 256000 baud
+#define VEBUS_SIM_SETPOINT_HISTORY 64       // Noted setpoints kept for the latency lookup
+#define VEBUS_SIM_FRAME_MAX 48
+#define VEBUS_SIM_RX_SIZE 1024
+
+struct VeBusSimulatorStats {
+    uint32_t syncFrames;
+    uint32_t infoFrames;
+    uint32_t hostFrames;            // Valid frames received from the host
+    uint32_t checksumErrors;        // Host frames that failed to decode
+    uint32_t essCommands;           // 0x37 ESS power writes
+    uint32_t essAcknowledged;       // Answered with 0x87
+    uint32_t slotMisses;            // Not the first frame after sync, or too late
+    uint32_t numberMisses;          // In the slot with the wrong frame number
+    uint32_t otherCommands;         // Valid frames that are not ESS writes, not answered
+    uint32_t unmatchedAcks;         // Acknowledged setpoints without a noteSetpoint() entry
+};
+
+class VeBusSimulator {
+public:
+    typedef std::function<void(const uint8_t* data, size_t length)> Output;
+
+private:
+    struct Setpoint {
+        int16_t power;
+        bool pending;
+        uint32_t timeUs;
+    };
+
+    std::thread bus;
+    std::atomic<bool> running;
+    Output output;
+
+    std::mutex lock;                // Everything below, bus thread and receive()
+    VeBusFrameDecoder decoder;
+    VeBusSimulatorStats stats;
+    uint8_t frameNumber;            // Number of the last frame on the bus
+    uint32_t syncEndUs;             // Delivery of the last sync frame
+    bool slotOpen;                  // No frame since the last sync frame
+    uint32_t slotWindowUs;
+    int16_t essPower;               // Last accepted setpoint
+    Setpoint setpoints[VEBUS_SIM_SETPOINT_HISTORY];
+    uint8_t setpointNext;
+    PerfHistogram ackLatency;       // noteSetpoint() to acknowledge, µs
+    PerfHistogram slotOffset;       // Sync frame end to host frame start, µs
+
+    void busThread();
+    void send(uint8_t frameType, const uint8_t* payload, size_t length);
+    void sendSync();
+    void sendInfo();
+    void handleFrame(const VeBusFrameView& frame, uint32_t startUs);
+    void acknowledge(int16_t power, uint32_t nowUs);
+
+public:
+    VeBusSimulator();
+    ~VeBusSimulator() { end(); }
+
+    // Starts the bus thread; output gets every frame the simulator sends
+    void begin(Output frameOutput);
+    void end();
+
+    // Bytes sent by the host, any thread, may be split anywhere
+    void receive(const uint8_t* data, size_t length);
+
+    // Submission time of a setpoint, for the setpoint to acknowledge latency
+    void noteSetpoint(int16_t power);
+
+    void setSlotWindow(uint32_t windowUs);
+
+    VeBusSimulatorStats getStats();
+    PerfHistogram getAckLatency();
+    PerfHistogram getSlotOffset();
+    int16_t getEssPower();
+};
+
+// In-process UART between the handler and the simulator. transmit() hands
+// the frame to the simulator right away; the TX done event follows after
+// the wire time of the frame.
+class VeBusSimulatorUart : public VeBusUart {
+private:
+    VeBusSimulator& simulator;
+    std::function<void(void)> onReceive;
+    uint32_t txEndUs;
+
+    std::mutex rxLock;
+    uint8_t rxBuffer[VEBUS_SIM_RX_SIZE];
+    size_t rxHead;
+    size_t rxCount;
+
+protected:
+    size_t writeBytes(const uint8_t* data, size_t length) override;
+    bool isTxComplete() override;
+
+public:
+    explicit VeBusSimulatorUart(VeBusSimulator& sim) : simulator(sim), txEndUs(0), rxHead(0), rxCount(0) {}
+
+    void setReceiveHandler(std::function<void(void)> handler) { onReceive = handler; }
+
+    // Simulator output, frames from the "Multiplus"
+    void deliver(const uint8_t* data, size_t length);
+
+    size_t available() override;
+    size_t read(uint8_t* buffer, size_t length) override;
+};
+
+#endif // HAL_POSIX
+
+#endif // VEBUS_SIMULATOR_H
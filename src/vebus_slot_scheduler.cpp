@@ -0,0 +1,77 @@
+/*
+ * VE.Bus Transmit Slot Scheduler Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_slot_scheduler.h"
+
+VeBusSlotScheduler::VeBusSlotScheduler(uint32_t windowUs) : windowUs(windowUs) {
+    reset();
+}
+
+void VeBusSlotScheduler::reset() {
+    frameNumber = 0;
+    syncSeen = false;
+    slotOpen = false;
+    slotFrameNumber = 0;
+    lastSyncTime = 0;
+    resetStatistics();
+}
+
+void VeBusSlotScheduler::resetStatistics() {
+    syncFrames = 0;
+    slotsUsed = 0;
+    slotsMissed = 0;
+    lastTxOffset = 0;
+    maxTxOffset = 0;
+}
+
+void VeBusSlotScheduler::onFrame(uint8_t frameType, uint8_t number, uint8_t marker, uint32_t nowUs) {
+    frameNumber = number & VEBUS_FRAME_NUMBER_MASK;
+
+    if (frameType != VEBUS_SYNC_FRAME_TYPE || marker != VEBUS_SYNC_MARKER) {
+        // Any other frame occupies the bus, a slot after an earlier sync frame is gone
+        slotOpen = false;
+        return;
+    }
+
+    syncFrames++;
+    syncSeen = true;
+    lastSyncTime = nowUs;
+    slotFrameNumber = (frameNumber + 1) & VEBUS_FRAME_NUMBER_MASK;
+    slotOpen = true;
+}
+
+bool VeBusSlotScheduler::acquireSlot(uint32_t nowUs, uint8_t& number) {
+    if (!slotOpen) {
+        return false;
+    }
+
+    uint32_t offset = nowUs - lastSyncTime;
+    slotOpen = false;
+
+    if (offset > windowUs) {
+        // We had something to send but woke up too late for this slot
+        slotsMissed++;
+        return false;
+    }
+
+    slotsUsed++;
+    lastTxOffset = offset;
+    if (offset > maxTxOffset) {
+        maxTxOffset = offset;
+    }
+
+    number = slotFrameNumber;
+    return true;
+}
+
+bool VeBusSlotScheduler::isSlotOpen(uint32_t nowUs) const {
+    return slotOpen && (nowUs - lastSyncTime) <= windowUs;
+}
+
+bool VeBusSlotScheduler::isSynchronized(uint32_t nowUs) const {
+    return syncSeen && (nowUs - lastSyncTime) < VEBUS_SYNC_TIMEOUT_US;
+}
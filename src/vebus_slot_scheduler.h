@@ -0,0 +1,83 @@
+/*
+ * VE.Bus Transmit Slot Scheduler
+ *
+ * The Multiplus sends a synchronization frame every 20ms. Our own data
+ * frames are only accepted if they are sent shortly after such a sync frame
+ * and carry the sync frame number + 1. This class is fed with the frames
+ * decoded from the bus, recognizes the sync frame (xx xx FD nn 55 ... FF) and
+ * opens a transmit slot right after it.
+ *
+ * The scheduler has no hardware dependencies: all timestamps are passed in
+ * by the caller (microseconds), so it can be driven from the VE.Bus task as
+ * well as from a replay of a recorded byte stream.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_SLOT_SCHEDULER_H
+#define VEBUS_SLOT_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VEBUS_SYNC_FRAME_TYPE 0xFD
+#define VEBUS_SYNC_MARKER 0x55
+#define VEBUS_FRAME_NUMBER_MASK 0x7F
+#define VEBUS_TX_SLOT_WINDOW_US 1000    // Default: transmit within 1ms after sync frame
+#define VEBUS_SYNC_TIMEOUT_US 100000    // Bus considered unsynchronized after 5 missing sync frames
+
+class VeBusSlotScheduler {
+private:
+    uint32_t windowUs;
+
+    uint8_t frameNumber;    // Number of the last frame seen on the bus
+
+    // Slot state
+    bool syncSeen;
+    bool slotOpen;
+    uint8_t slotFrameNumber;
+    uint32_t lastSyncTime;
+
+    // Statistics
+    uint32_t syncFrames;
+    uint32_t slotsUsed;
+    uint32_t slotsMissed;
+    uint32_t lastTxOffset;
+    uint32_t maxTxOffset;
+
+public:
+    explicit VeBusSlotScheduler(uint32_t windowUs = VEBUS_TX_SLOT_WINDOW_US);
+
+    void reset();
+    void setWindow(uint32_t window) { windowUs = window; }
+    uint32_t getWindow() const { return windowUs; }
+
+    // Feed one complete frame, nowUs is the time its end was received.
+    // marker is the first payload byte (0x55 for sync frames).
+    void onFrame(uint8_t frameType, uint8_t number, uint8_t marker, uint32_t nowUs);
+
+    // Another device started transmitting - the slot after the sync frame is taken
+    void onBusBusy() { slotOpen = false; }
+
+    // Take the open transmit slot if we are still inside the window.
+    // On success frameNumber receives the number our frame has to carry.
+    bool acquireSlot(uint32_t nowUs, uint8_t& frameNumber);
+
+    // True while a slot is open, without consuming it
+    bool isSlotOpen(uint32_t nowUs) const;
+
+    bool isSynchronized(uint32_t nowUs) const;
+    uint8_t getLastFrameNumber() const { return frameNumber; }
+    uint32_t getLastSyncTime() const { return lastSyncTime; }
+
+    // Statistics
+    uint32_t getSyncFrames() const { return syncFrames; }
+    uint32_t getSlotsUsed() const { return slotsUsed; }
+    uint32_t getSlotsMissed() const { return slotsMissed; }
+    uint32_t getLastTxOffset() const { return lastTxOffset; }
+    uint32_t getMaxTxOffset() const { return maxTxOffset; }
+    void resetStatistics();
+};
+
+#endif // VEBUS_SLOT_SCHEDULER_H
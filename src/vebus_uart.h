@@ -0,0 +1,86 @@
+/*
+ * VE.Bus UART Abstraction
+ *
+ * Byte transport of the VE.Bus handler. The RS485 direction is switched by
+ * the UART peripheral itself (RTS drives the transceiver enable), so
+ * transmit() only puts the frame into the TX FIFO and returns. poll()
+ * reports the TX done event, after which the bus is back in receive mode.
+ *
+ * State machine:  RX --transmit()--> TX --poll(): tx done--> RX
+ *
+ * The state handling lives in this base class; implementations only move
+ * bytes. VeBusUartEsp32 drives the real UART, a fake transport can be used
+ * to run the same transitions on the host.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_UART_H
+#define VEBUS_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum VeBusUartState : uint8_t {
+    VEBUS_UART_RX = 0,      // Receiving, transmitter disabled
+    VEBUS_UART_TX           // Frame in the TX FIFO, transmitter enabled by hardware
+};
+
+class VeBusUart {
+private:
+    VeBusUartState state;
+    uint32_t txFrames;
+    uint32_t txOverruns;
+
+protected:
+    // Put bytes into the TX FIFO, returns the number accepted without blocking
+    virtual size_t writeBytes(const uint8_t* data, size_t length) = 0;
+
+    // True once the last byte has left the shift register
+    virtual bool isTxComplete() = 0;
+
+public:
+    VeBusUart() : state(VEBUS_UART_RX), txFrames(0), txOverruns(0) {}
+    virtual ~VeBusUart() {}
+
+    // Receive side
+    virtual size_t available() = 0;
+    virtual size_t read(uint8_t* buffer, size_t length) = 0;
+
+    // Start sending a frame. Fails while the previous frame is still going
+    // out or if the FIFO did not take the whole frame.
+    bool transmit(const uint8_t* frame, size_t length) {
+        if (state == VEBUS_UART_TX) {
+            return false;
+        }
+        size_t written = writeBytes(frame, length);
+        if (written == 0) {
+            return false;
+        }
+        state = VEBUS_UART_TX;
+        txFrames++;
+        if (written != length) {
+            txOverruns++;   // Partial frame on the bus, the receiver drops it by checksum
+            return false;
+        }
+        return true;
+    }
+
+    // Check for the TX done event. Returns true exactly once per frame,
+    // when the bus went back to receive mode.
+    bool poll() {
+        if (state == VEBUS_UART_TX && isTxComplete()) {
+            state = VEBUS_UART_RX;
+            return true;
+        }
+        return false;
+    }
+
+    VeBusUartState getState() const { return state; }
+    bool isTransmitting() const { return state == VEBUS_UART_TX; }
+    uint32_t getTxFrames() const { return txFrames; }
+    uint32_t getTxOverruns() const { return txOverruns; }
+};
+
+#endif // VEBUS_UART_H
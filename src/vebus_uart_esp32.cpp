@@ -0,0 +1,79 @@
+/*
+ * VE.Bus UART on the ESP32 UART peripheral - Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_uart_esp32.h"
+#include <driver/uart.h>
+#include <driver/gpio.h>
+#include <esp_rom_gpio.h>
+#include <soc/uart_periph.h>
+
+bool VeBusUartEsp32::begin(HardwareSerial* hardwareSerial, uint8_t uartPort, long baudRate,
+                           int rxPin, int txPin, int dePin, int sePin,
+                           uint8_t rxTimeoutSymbols, std::function<void(void)> onReceive) {
+    serial = hardwareSerial;
+    port = uartPort;
+
+    serial->begin(baudRate, SERIAL_8N1, rxPin, txPin);
+
+    // RTS is the transmitter enable in RS485 half duplex mode
+    if (!serial->setPins(rxPin, txPin, -1, dePin)) {
+        Serial.println("VeBus: Failed to assign RTS to the RS485 DE pin");
+        serial->end();
+        serial = nullptr;
+        return false;
+    }
+    if (!serial->setMode(UART_MODE_RS485_HALF_DUPLEX)) {
+        Serial.println("VeBus: Failed to enable UART_MODE_RS485_HALF_DUPLEX");
+        serial->end();
+        serial = nullptr;
+        return false;
+    }
+
+    // The board has a second enable line, it follows the same RTS signal
+    if (sePin >= 0) {
+        esp_rom_gpio_pad_select_gpio(sePin);
+        gpio_set_direction((gpio_num_t)sePin, GPIO_MODE_OUTPUT);
+        esp_rom_gpio_connect_out_signal(sePin, uart_periph_signal[port].rts_sig, false, false);
+    }
+
+    // Wake the VE.Bus task from the UART RX event as soon as the bus goes idle
+    // after a frame, so the sync frame is seen without polling delay
+    serial->setRxTimeout(rxTimeoutSymbols);
+    serial->onReceive(onReceive);
+
+    Serial.printf("VeBus: RS485 half duplex on UART%d, DE:%d SE:%d driven by RTS\n", port, dePin, sePin);
+    return true;
+}
+
+void VeBusUartEsp32::end() {
+    if (serial != nullptr) {
+        serial->end();
+        serial = nullptr;
+    }
+}
+
+size_t VeBusUartEsp32::available() {
+    return serial != nullptr ? serial->available() : 0;
+}
+
+size_t VeBusUartEsp32::read(uint8_t* buffer, size_t length) {
+    return serial != nullptr ? serial->read(buffer, length) : 0;
+}
+
+size_t VeBusUartEsp32::writeBytes(const uint8_t* data, size_t length) {
+    if (serial == nullptr) {
+        return 0;
+    }
+    // Frames are shorter than the 128 byte hardware FIFO, so this does not
+    // wait for the transmission - only for FIFO space
+    return serial->write(data, length);
+}
+
+bool VeBusUartEsp32::isTxComplete() {
+    // Zero timeout: only checks the TX done state of the driver
+    return uart_wait_tx_done((uart_port_t)port, 0) == ESP_OK;
+}
@@ -0,0 +1,41 @@
+/*
+ * VE.Bus UART on the ESP32 UART peripheral
+ *
+ * Runs the UART in RS485 half duplex mode: the peripheral drives RTS while
+ * it transmits. RTS is routed to the transceiver DE pin and, through the
+ * GPIO matrix, to the SE pin as well, so no GPIO is toggled in software.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_UART_ESP32_H
+#define VEBUS_UART_ESP32_H
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <functional>
+#include "vebus_uart.h"
+
+class VeBusUartEsp32 : public VeBusUart {
+private:
+    HardwareSerial* serial;
+    uint8_t port;
+
+protected:
+    size_t writeBytes(const uint8_t* data, size_t length) override;
+    bool isTxComplete() override;
+
+public:
+    VeBusUartEsp32() : serial(nullptr), port(0) {}
+
+    bool begin(HardwareSerial* hardwareSerial, uint8_t uartPort, long baudRate,
+               int rxPin, int txPin, int dePin, int sePin,
+               uint8_t rxTimeoutSymbols, std::function<void(void)> onReceive);
+    void end();
+
+    size_t available() override;
+    size_t read(uint8_t* buffer, size_t length) override;
+};
+
+#endif // VEBUS_UART_ESP32_H
@@ -0,0 +1,155 @@
+/*
+ * VE.Bus UART on a POSIX file descriptor - Implementation
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "vebus_uart_posix.h"
+
+#if HAL_POSIX
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t speedOf(long baudRate) {
+    switch (baudRate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        default: return B0;
+    }
+}
+
+bool VeBusUartPosix::open(const char* path, long baudRate, std::function<void(void)> onReceive) {
+    int descriptor = ::open(path, O_RDWR | O_NOCTTY);
+    if (descriptor < 0) {
+        printf("VeBus: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(descriptor, &tio) == 0) {
+        cfmakeraw(&tio);
+        speed_t speed = speedOf(baudRate);
+        if (speed != B0) {
+            cfsetspeed(&tio, speed);
+        } else if (isatty(descriptor)) {
+            // 256000 baud needs termios2, set it with the adapter's tools
+            printf("VeBus: %ld baud not set on %s\n", baudRate, path);
+        }
+        tcsetattr(descriptor, TCSANOW, &tio);
+    }
+
+    if (!begin(descriptor, onReceive)) {
+        ::close(descriptor);
+        return false;
+    }
+    ownsFd = true;
+    return true;
+}
+
+bool VeBusUartPosix::begin(int descriptor, std::function<void(void)> receiveCallback) {
+    if (running) {
+        return false;
+    }
+    int flags = fcntl(descriptor, F_GETFL);
+    if (flags < 0 || fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) < 0) {
+        printf("VeBus: Invalid descriptor %d\n", descriptor);
+        return false;
+    }
+    fd = descriptor;
+    ownsFd = false;
+    onReceive = receiveCallback;
+    rxHead = 0;
+    rxCount = 0;
+    running = true;
+    reader = std::thread(&VeBusUartPosix::readerThread, this);
+    return true;
+}
+
+void VeBusUartPosix::end() {
+    running = false;
+    if (reader.joinable()) {
+        reader.join();
+    }
+    if (fd >= 0 && ownsFd) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+void VeBusUartPosix::readerThread() {
+    uint8_t chunk[256];
+    while (running) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (::poll(&pfd, 1, VEBUS_UART_POSIX_POLL_MS) <= 0) {
+            continue;
+        }
+        ssize_t count = ::read(fd, chunk, sizeof(chunk));
+        if (count <= 0) {
+            if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+                halDelayMs(VEBUS_UART_POSIX_POLL_MS);   // Other end closed, keep waiting for end()
+            }
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(rxLock);
+            for (ssize_t i = 0; i < count; i++) {
+                if (rxCount == VEBUS_UART_POSIX_RX_SIZE) {
+                    rxOverruns++;
+                    break;
+                }
+                rxBuffer[(rxHead + rxCount) % VEBUS_UART_POSIX_RX_SIZE] = chunk[i];
+                rxCount++;
+            }
+        }
+        if (onReceive) {
+            onReceive();
+        }
+    }
+}
+
+size_t VeBusUartPosix::available() {
+    std::lock_guard<std::mutex> guard(rxLock);
+    return rxCount;
+}
+
+size_t VeBusUartPosix::read(uint8_t* buffer, size_t length) {
+    std::lock_guard<std::mutex> guard(rxLock);
+    size_t count = length < rxCount ? length : rxCount;
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = rxBuffer[rxHead];
+        rxHead = (rxHead + 1) % VEBUS_UART_POSIX_RX_SIZE;
+    }
+    rxCount -= count;
+    return count;
+}
+
+size_t VeBusUartPosix::writeBytes(const uint8_t* data, size_t length) {
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t written = ::write(fd, data, length);
+    return written > 0 ? (size_t)written : 0;
+}
+
+bool VeBusUartPosix::isTxComplete() {
+    int pending = 0;
+    // Not supported on every descriptor type, then the write is done already
+    if (ioctl(fd, TIOCOUTQ, &pending) != 0) {
+        return true;
+    }
+    return pending == 0;
+}
+
+#endif // HAL_POSIX
@@ -0,0 +1,69 @@
+/*
+ * VE.Bus UART on a POSIX file descriptor
+ *
+ * Host side byte transport of the VE.Bus handler: a serial port (e.g. a USB
+ * RS485 adapter) or a pseudo terminal that a simulator holds the other end
+ * of. A reader thread moves received bytes into a buffer and calls
+ * onReceive, like the UART RX event on the ESP32. The transmitter is
+ * complete once the kernel output queue is empty.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef VEBUS_UART_POSIX_H
+#define VEBUS_UART_POSIX_H
+
+#include "hal.h"
+#include "vebus_uart.h"
+
+#if HAL_POSIX
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#define VEBUS_UART_POSIX_RX_SIZE 1024
+#define VEBUS_UART_POSIX_POLL_MS 10     // Reader thread checks for end() this often
+
+class VeBusUartPosix : public VeBusUart {
+private:
+    int fd;
+    bool ownsFd;
+    std::thread reader;
+    std::atomic<bool> running;
+    std::function<void(void)> onReceive;
+
+    std::mutex rxLock;
+    uint8_t rxBuffer[VEBUS_UART_POSIX_RX_SIZE];
+    size_t rxHead;
+    size_t rxCount;
+    uint32_t rxOverruns;
+
+    void readerThread();
+
+protected:
+    size_t writeBytes(const uint8_t* data, size_t length) override;
+    bool isTxComplete() override;
+
+public:
+    VeBusUartPosix() : fd(-1), ownsFd(false), running(false), rxHead(0), rxCount(0), rxOverruns(0) {}
+    ~VeBusUartPosix() { end(); }
+
+    // Opens a tty in raw mode; baudRate is ignored for pseudo terminals
+    bool open(const char* path, long baudRate, std::function<void(void)> onReceive);
+
+    // Uses an open descriptor, e.g. from openpty(); it is not closed by end()
+    bool begin(int descriptor, std::function<void(void)> onReceive);
+    void end();
+
+    size_t available() override;
+    size_t read(uint8_t* buffer, size_t length) override;
+
+    uint32_t getRxOverruns() const { return rxOverruns; }
+};
+
+#endif // HAL_POSIX
+
+#endif // VEBUS_UART_POSIX_H
@@ -1,4 +1,5 @@
 #include "wifi_provisioning.h"
+#include "event_log.h"
 
 const char* WiFiProvisioning::IMPROV_SERVICE_TYPE = "_improv._tcp";
 const char* WiFiProvisioning::IMPROV_SERVICE_NAME = "Victron ESS";
@@ -63,6 +64,8 @@ bool WiFiProvisioning::isConnected() {
 void WiFiProvisioning::resetWiFiCredentials() {
     preferences.clear();
     Serial.println("WiFi credentials cleared - restarting");
+    eventLog.logEvent(EVENT_RESTART);
+    eventLog.saveState();
     ESP.restart();
 }
 
@@ -0,0 +1,202 @@
+/*
+ * Battery Snapshot Tests
+ *
+ * The publishing side of PylontechCAN on the host: a writer thread feeds
+ * BMS broadcast cycles into a PylontechDecoder and publishes the decoded
+ * state through SeqLock<PylontechBatteryState> once per cycle, while reader
+ * threads take snapshots as fast as they can. Every value of a cycle is
+ * derived from the cycle number, so a snapshot mixing the voltage of one
+ * cycle with the current of another, or a power not computed from the
+ * voltage and current it is shipped with, shows up.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include "pylontech_decoder.h"
+#include "seqlock.h"
+
+#define STRESS_CYCLES 300000
+#define STRESS_READERS 3
+#define CYCLE_IDS 30000                 // Cycle number as it fits into the temperature field
+
+// The values a BMS sends in cycle n (n < CYCLE_IDS)
+struct CycleValues {
+    int16_t voltage;                    // 0.01 V
+    int16_t current;                    // 0.1 A, negative = charging
+    int16_t temperature;                // 0.1 °C, carries the cycle number
+    uint16_t soc;
+    uint16_t soh;
+    uint8_t warnings;
+};
+
+static CycleValues cycleValues(uint32_t n) {
+    CycleValues values;
+    values.voltage = (int16_t)(4800 + n % 500);
+    values.current = (int16_t)((n * 37) % 4001) - 2000;
+    values.temperature = (int16_t)n;
+    values.soc = n % 101;
+    values.soh = 90 + n % 11;
+    values.warnings = (uint8_t)(n * 13);
+    return values;
+}
+
+static void put16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+// One broadcast cycle in the order a Pylontech BMS sends it, frame k at n * 1000 + k + 1 ms
+static void feedCycle(PylontechDecoder& decoder, uint32_t n) {
+    CycleValues values = cycleValues(n % CYCLE_IDS);
+    uint32_t time = n * 1000 + 1;
+    uint8_t data[8];
+
+    const uint8_t alarms[] = {0, 0, values.warnings, 0, 3, 'P', 'N'};
+    decoder.decode(PYLONTECH_ALARMS_ID, false, false, alarms, sizeof(alarms), time++);
+
+    put16(&data[0], 532);
+    put16(&data[2], 250);
+    put16(&data[4], 250);
+    put16(&data[6], 480);
+    decoder.decode(PYLONTECH_LIMITS_ID, false, false, data, 8, time++);
+
+    put16(&data[0], values.soc);
+    put16(&data[2], values.soh);
+    decoder.decode(PYLONTECH_SOC_ID, false, false, data, 4, time++);
+
+    put16(&data[0], (uint16_t)values.voltage);
+    put16(&data[2], (uint16_t)values.current);
+    put16(&data[4], (uint16_t)values.temperature);
+    decoder.decode(PYLONTECH_MEASUREMENTS_ID, false, false, data, 6, time++);
+
+    const uint8_t request[] = {0xC0, 0x00};
+    decoder.decode(PYLONTECH_REQUEST_ID, false, false, request, sizeof(request), time++);
+
+    const uint8_t manufacturer[] = {'P', 'Y', 'L', 'O', 'N', ' ', ' ', ' '};
+    decoder.decode(PYLONTECH_MANUFACTURER_ID, false, false, manufacturer, sizeof(manufacturer), time++);
+}
+
+// Publish step of PylontechCAN::publishBatteryState()
+static void publish(SeqLock<PylontechBatteryState>& battery, PylontechDecoder& decoder) {
+    uint8_t updated = decoder.takeUpdated();
+    PylontechBatteryState snapshot = decoder.getState();
+    snapshot.updated = updated;
+    battery.write(snapshot);
+}
+
+// True if every field of the snapshot belongs to the same cycle
+static bool isConsistent(const PylontechBatteryState& state, uint32_t& cycle) {
+    int32_t id = (int32_t)lroundf(state.temperature * 10);
+    if (id < 0 || id >= CYCLE_IDS) return false;
+    CycleValues values = cycleValues(id);
+
+    if (lroundf(state.voltage * 100) != values.voltage) return false;
+    if (lroundf(state.current * 10) != values.current) return false;
+    if (state.power != (int32_t)(state.voltage * state.current)) return false;
+    if (state.soc != values.soc || state.soh != values.soh) return false;
+    if (state.warningFlags1 != values.warnings || state.modules != 3) return false;
+    if (state.updated != (1u << PYLONTECH_FRAME_COUNT) - 1) return false;
+
+    // All frames stamped within the same cycle
+    cycle = state.received[PYLONTECH_FRAME_ALARMS] / 1000;
+    if (cycle % CYCLE_IDS != (uint32_t)id) return false;
+    for (uint8_t f = 0; f < PYLONTECH_FRAME_COUNT; f++) {
+        if (state.received[f] / 1000 != cycle) return false;
+    }
+    return true;
+}
+
+struct ReaderResult {
+    uint32_t reads;
+    uint32_t inconsistent;
+    uint32_t backwards;                 // Older cycle than one read before
+};
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_cycle_values(void) {
+    PylontechDecoder decoder;
+    SeqLock<PylontechBatteryState> battery;
+    uint32_t cycle;
+    for (uint32_t n = 0; n < 2 * CYCLE_IDS; n += 997) {
+        feedCycle(decoder, n);
+        publish(battery, decoder);
+        PylontechBatteryState state = battery.read();
+        TEST_ASSERT_TRUE(isConsistent(state, cycle));
+        TEST_ASSERT_EQUAL(n, cycle);
+    }
+
+    // Half a cycle on top mixes two cycles: what readers must never see
+    feedCycle(decoder, 1);
+    const uint8_t measurements[] = {0x72, 0x14, 0x83, 0xFF, 0x02, 0x00};
+    decoder.decode(PYLONTECH_MEASUREMENTS_ID, false, false, measurements, sizeof(measurements), 2000);
+    TEST_ASSERT_FALSE(isConsistent(decoder.getState(), cycle));
+}
+
+void test_concurrent_readers(void) {
+    PylontechDecoder decoder;
+    SeqLock<PylontechBatteryState> battery;
+    feedCycle(decoder, 0);
+    publish(battery, decoder);
+
+    std::atomic<bool> done(false);
+    ReaderResult results[STRESS_READERS] = {};
+    std::thread readers[STRESS_READERS];
+    for (uint8_t r = 0; r < STRESS_READERS; r++) {
+        readers[r] = std::thread([&, r]() {
+            ReaderResult& result = results[r];
+            uint32_t last = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                PylontechBatteryState state = battery.read();
+                uint32_t cycle;
+                result.reads++;
+                if (!isConsistent(state, cycle)) {
+                    result.inconsistent++;
+                    continue;
+                }
+                if (cycle < last) {
+                    result.backwards++;
+                }
+                last = cycle;
+            }
+        });
+    }
+
+    // The CAN task: decode a whole cycle, then publish it
+    for (uint32_t n = 1; n <= STRESS_CYCLES; n++) {
+        feedCycle(decoder, n);
+        publish(battery, decoder);
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    uint32_t reads = 0;
+    for (const ReaderResult& result : results) {
+        TEST_ASSERT_EQUAL(0, result.inconsistent);
+        TEST_ASSERT_EQUAL(0, result.backwards);
+        reads += result.reads;
+    }
+    TEST_ASSERT_GREATER_THAN(1000, reads);
+    TEST_ASSERT_EQUAL(STRESS_CYCLES + 1, battery.generation());
+
+    uint32_t cycle;
+    TEST_ASSERT_TRUE(isConsistent(battery.read(), cycle));
+    TEST_ASSERT_EQUAL(STRESS_CYCLES, cycle);
+    TEST_ASSERT_EQUAL(6 * (STRESS_CYCLES + 1), decoder.getStats().decoded);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_cycle_values);
+    RUN_TEST(test_concurrent_readers);
+    return UNITY_END();
+}
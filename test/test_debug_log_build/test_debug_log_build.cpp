@@ -0,0 +1,107 @@
+/*
+ * Debug Log Build Level Tests
+ *
+ * This file is built with LOG_BUILD_LEVEL = LOG_BUILD_NONE, like the
+ * optimized firmware. Its log sites must not evaluate their arguments and
+ * must leave neither code nor their format string in the program, which is
+ * checked in the test executable itself.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#undef LOG_BUILD_LEVEL
+#define LOG_BUILD_LEVEL LOG_BUILD_NONE
+#include "debug_log.h"
+
+static uint32_t evaluated;
+static volatile bool neverTrue = false;
+
+static int32_t countedArgument() {
+    evaluated++;
+    return 42;
+}
+
+// Every level; the format strings carry a marker that is searched for below
+static void disabledSites(int32_t value) {
+    LOG_DEBUG(LOG_MODULE_VEBUS, "LOG_SITE_DISABLED_MARKER debug %d", countedArgument());
+    LOG_INFO(LOG_MODULE_VEBUS, "LOG_SITE_DISABLED_MARKER info %d %d", ++value, countedArgument());
+    LOG_SUCCESS(LOG_MODULE_ESS, "LOG_SITE_DISABLED_MARKER success %d", countedArgument());
+    LOG_WARNING(LOG_MODULE_MQTT, "LOG_SITE_DISABLED_MARKER warning %d", countedArgument());
+    LOG_ERROR(LOG_MODULE_SYSTEM, "LOG_SITE_DISABLED_MARKER error %d %d", value, countedArgument());
+}
+
+// Same call as a compiled in site, kept in the program but never run: the search has to find it
+static void enabledCall() {
+    if (neverTrue) {
+        debugLog.log(LOG_LEVEL_ERROR, LOG_MODULE_SYSTEM, "LOG_SITE_ENABLED_MARKER %d", countedArgument());
+    }
+}
+
+// The marker in upper case, built at run time so the needle itself is not in the program
+static std::string marker(const char* lower) {
+    std::string upper(lower);
+    for (char& c : upper) {
+        c = (char)toupper((unsigned char)c);
+    }
+    return upper;
+}
+
+static bool programContains(const std::string& needle) {
+    FILE* file = fopen("/proc/self/exe", "rb");
+    if (file == nullptr) {
+        TEST_IGNORE_MESSAGE("no /proc/self/exe on this host");
+    }
+    std::vector<char> program;
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        program.insert(program.end(), buffer, buffer + length);
+    }
+    fclose(file);
+    return std::search(program.begin(), program.end(), needle.begin(), needle.end()) != program.end();
+}
+
+void setUp(void) {
+    evaluated = 0;
+    for (uint8_t module = 0; module < LOG_MODULE_COUNT; module++) {
+        debugLog.setModuleLevel((LogModule)module, LOG_LEVEL_DEBUG);
+    }
+}
+
+void tearDown(void) {
+    for (uint8_t module = 0; module < LOG_MODULE_COUNT; module++) {
+        debugLog.setModuleLevel((LogModule)module, DEBUG_LOG_DEFAULT_LEVEL);
+    }
+}
+
+void test_arguments_not_evaluated(void) {
+    // Every module on at run time, the build level still wins
+    uint32_t pushed = debugLog.getStats().ring.pushed;
+    disabledSites(1);
+    enabledCall();
+    TEST_ASSERT_EQUAL(0, evaluated);
+    TEST_ASSERT_EQUAL(pushed, debugLog.getStats().ring.pushed);
+}
+
+void test_format_strings_not_emitted(void) {
+    std::string disabled = marker("log_site_disabled_marker");
+    std::string enabled = marker("log_site_enabled_marker");
+    TEST_ASSERT_TRUE(programContains(enabled));
+    TEST_ASSERT_FALSE(programContains(disabled));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_arguments_not_evaluated);
+    RUN_TEST(test_format_strings_not_emitted);
+    return UNITY_END();
+}
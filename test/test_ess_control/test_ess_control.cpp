@@ -0,0 +1,222 @@
+/*
+ * essControlStep() Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "ess_control.h"
+
+static EssControlParams params;
+static EssControlInput input;
+
+void setUp(void) {
+    params.gridTarget = 0;
+    params.maxPower = 3000;
+    params.gainPercent = ESS_CONTROL_GAIN_PERCENT;
+    params.deadband = ESS_CONTROL_DEADBAND_W;
+
+    input.meterPower = 0;
+    input.meterFresh = true;
+    input.meterValid = true;
+    input.batteryValid = true;
+    input.batteryVoltage = 50.0f;
+    input.chargeCurrentLimit = 100.0f;      // 5000 W, above maxPower
+    input.dischargeCurrentLimit = 100.0f;
+    input.lastSetpoint = 0;
+    input.meterImportOnly = false;
+}
+
+void tearDown(void) {}
+
+void test_no_meter_gives_zero(void) {
+    input.meterValid = false;
+    input.lastSetpoint = 800;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(0, output.setpoint);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_NO_METER, output.limit);
+}
+
+void test_no_battery_gives_zero(void) {
+    input.batteryValid = false;
+    input.lastSetpoint = -800;
+    input.meterPower = 500;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(0, output.setpoint);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_NO_BATTERY, output.limit);
+}
+
+void test_import_raises_discharge(void) {
+    input.meterPower = 1000;
+    input.lastSetpoint = 200;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(700, output.setpoint);
+    TEST_ASSERT_EQUAL(700, output.unclamped);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_NONE, output.limit);
+}
+
+void test_feed_in_charges(void) {
+    input.meterPower = -600;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(-300, output.setpoint);
+}
+
+void test_grid_target(void) {
+    params.gridTarget = -500;       // Feed in 500 W
+    input.meterPower = -500;
+    input.lastSetpoint = 1200;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(1200, output.setpoint);
+
+    input.meterPower = 0;
+    output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(1450, output.setpoint);
+}
+
+void test_import_only_meter_ignores_feed_in_target(void) {
+    // The impulse meter shows 0 W while feeding in: a feed-in target would
+    // integrate up to the discharge limit, so the target becomes 0
+    params.gridTarget = -500;
+    input.meterImportOnly = true;
+    input.meterPower = 0;
+    input.lastSetpoint = 400;
+    for (uint32_t i = 0; i < 50; i++) {
+        EssControlOutput output = essControlStep(params, input);
+        TEST_ASSERT_EQUAL(0, output.gridTarget);
+        TEST_ASSERT_EQUAL(400, output.setpoint);
+        input.lastSetpoint = output.setpoint;
+    }
+
+    // Import is still corrected towards 0
+    input.meterPower = 300;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(550, output.setpoint);
+
+    // Import targets are kept, and a meter with direction keeps the feed-in target
+    params.gridTarget = 200;
+    TEST_ASSERT_EQUAL(200, essControlStep(params, input).gridTarget);
+    params.gridTarget = -500;
+    input.meterImportOnly = false;
+    output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(-500, output.gridTarget);
+    TEST_ASSERT_EQUAL(400 + 400, output.setpoint);
+}
+
+void test_holds_without_fresh_sample(void) {
+    input.meterPower = 2000;
+    input.meterFresh = false;
+    input.lastSetpoint = 345;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(345, output.setpoint);
+}
+
+void test_deadband(void) {
+    input.lastSetpoint = 100;
+    input.meterPower = ESS_CONTROL_DEADBAND_W;
+    TEST_ASSERT_EQUAL(100, essControlStep(params, input).setpoint);
+    input.meterPower = -ESS_CONTROL_DEADBAND_W;
+    TEST_ASSERT_EQUAL(100, essControlStep(params, input).setpoint);
+    input.meterPower = ESS_CONTROL_DEADBAND_W + 2;
+    TEST_ASSERT_EQUAL(106, essControlStep(params, input).setpoint);
+}
+
+void test_discharge_current_limit(void) {
+    input.dischargeCurrentLimit = 10.0f;    // 500 W at 50 V
+    input.meterPower = 4000;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(500, output.setpoint);
+    TEST_ASSERT_EQUAL(2000, output.unclamped);
+    TEST_ASSERT_EQUAL(500, output.dischargeLimit);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_DISCHARGE_CURRENT, output.limit);
+}
+
+void test_charge_current_limit(void) {
+    input.chargeCurrentLimit = 20.0f;       // 1000 W at 50 V
+    input.meterPower = -3000;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(-1000, output.setpoint);
+    TEST_ASSERT_EQUAL(1000, output.chargeLimit);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_CHARGE_CURRENT, output.limit);
+}
+
+void test_zero_charge_limit_blocks_charging(void) {
+    input.chargeCurrentLimit = 0.0f;        // Battery full
+    input.meterPower = -2000;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(0, output.setpoint);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_CHARGE_CURRENT, output.limit);
+}
+
+void test_inverter_limit(void) {
+    input.meterPower = 8000;
+    input.lastSetpoint = 1000;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(3000, output.setpoint);
+    TEST_ASSERT_EQUAL(5000, output.unclamped);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_MAX_POWER, output.limit);
+
+    input.meterPower = -20000;
+    output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(-3000, output.setpoint);
+    TEST_ASSERT_EQUAL(ESS_LIMIT_MAX_POWER, output.limit);
+}
+
+void test_setpoint_fits_int16(void) {
+    params.maxPower = 100000;
+    input.batteryVoltage = 1000.0f;
+    input.dischargeCurrentLimit = 1000.0f;
+    input.meterPower = 200000;
+    EssControlOutput output = essControlStep(params, input);
+    TEST_ASSERT_EQUAL(INT16_MAX, output.setpoint);
+    TEST_ASSERT_EQUAL(INT16_MAX, output.dischargeLimit);
+}
+
+void test_closed_loop_settles(void) {
+    // House load of 1800 W, the meter sees load minus inverter output
+    int32_t load = 1800;
+    for (uint8_t i = 0; i < 20; i++) {
+        input.meterPower = load - input.lastSetpoint;
+        input.lastSetpoint = essControlStep(params, input).setpoint;
+    }
+    TEST_ASSERT_INT_WITHIN(2 * ESS_CONTROL_DEADBAND_W, load, input.lastSetpoint);
+
+    // PV surplus of 1200 W goes into the battery
+    load = -1200;
+    for (uint8_t i = 0; i < 20; i++) {
+        input.meterPower = load - input.lastSetpoint;
+        input.lastSetpoint = essControlStep(params, input).setpoint;
+    }
+    TEST_ASSERT_INT_WITHIN(2 * ESS_CONTROL_DEADBAND_W, load, input.lastSetpoint);
+}
+
+void test_limit_names(void) {
+    for (uint8_t i = ESS_LIMIT_NONE; i <= ESS_LIMIT_NO_BATTERY; i++) {
+        const char* name = essControlLimitName((EssControlLimit)i);
+        TEST_ASSERT_NOT_NULL(name);
+        for (uint8_t j = ESS_LIMIT_NONE; j < i; j++) {
+            TEST_ASSERT_TRUE(strcmp(name, essControlLimitName((EssControlLimit)j)) != 0);
+        }
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_meter_gives_zero);
+    RUN_TEST(test_no_battery_gives_zero);
+    RUN_TEST(test_import_raises_discharge);
+    RUN_TEST(test_feed_in_charges);
+    RUN_TEST(test_grid_target);
+    RUN_TEST(test_import_only_meter_ignores_feed_in_target);
+    RUN_TEST(test_holds_without_fresh_sample);
+    RUN_TEST(test_deadband);
+    RUN_TEST(test_discharge_current_limit);
+    RUN_TEST(test_charge_current_limit);
+    RUN_TEST(test_zero_charge_limit_blocks_charging);
+    RUN_TEST(test_inverter_limit);
+    RUN_TEST(test_setpoint_fits_int16);
+    RUN_TEST(test_closed_loop_settles);
+    RUN_TEST(test_limit_names);
+    return UNITY_END();
+}
@@ -0,0 +1,182 @@
+/*
+ * HaDiscovery Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "ha_discovery.h"
+
+enum { GROUP_BATTERY, GROUP_CONTROL, GROUP_COUNT };
+static const char* const groups[GROUP_COUNT] = { "battery", "control" };
+
+enum { SOC, VOLTAGE, POWER, ENABLED, STRATEGY, ENTITY_COUNT };
+static const HaEntity entities[ENTITY_COUNT] = {
+    {"soc", TELEMETRY_INT, 0, 0, GROUP_BATTERY, "sensor", "Battery SOC", "%", "battery", "measurement"},
+    {"voltage", TELEMETRY_FLOAT, 2, 0.05f, GROUP_BATTERY, "sensor", "Battery voltage", "V", "voltage", "measurement"},
+    {"power", TELEMETRY_FLOAT, 0, 20, GROUP_BATTERY, "sensor", "Battery power", "W", "power", "measurement"},
+    {"enabled", TELEMETRY_BOOL, 0, 0, GROUP_CONTROL, "binary_sensor", "Feed-in control", nullptr, nullptr, nullptr},
+    {"strategy", TELEMETRY_TEXT, 0, 0, GROUP_CONTROL, "sensor", "ESS strategy", nullptr, nullptr, nullptr},
+};
+
+static const HaDevice device = { "victron_ess_a1b2c3", "Victron ESS", "MultiPlus-II", "1.0", "ess/status" };
+
+static HaDiscovery* discovery;
+static char topic[HA_TOPIC_SIZE];
+static char payload[HA_CONFIG_SIZE];
+
+static void setValues(int32_t soc, float voltage, float power) {
+    discovery->setInt(SOC, soc);
+    discovery->setFloat(VOLTAGE, voltage);
+    discovery->setFloat(POWER, power);
+    discovery->setBool(ENABLED, true);
+    discovery->setText(STRATEGY, "self");
+}
+
+void setUp(void) {
+    discovery = new HaDiscovery(entities, ENTITY_COUNT, "ess", groups, GROUP_COUNT);
+    memset(topic, 0, sizeof(topic));
+    memset(payload, 0, sizeof(payload));
+}
+
+void tearDown(void) {
+    delete discovery;
+}
+
+void test_sensor_config(void) {
+    size_t length = discovery->serializeConfig(device, VOLTAGE, topic, sizeof(topic), payload, sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("homeassistant/sensor/victron_ess_a1b2c3/battery_voltage/config", topic);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"Battery voltage\",\"uniq_id\":\"victron_ess_a1b2c3_battery_voltage\","
+        "\"stat_t\":\"ess/battery/state\",\"val_tpl\":\"{{ value_json.voltage }}\","
+        "\"unit_of_meas\":\"V\",\"dev_cla\":\"voltage\",\"stat_cla\":\"measurement\","
+        "\"avty_t\":\"ess/status\",\"dev\":{\"ids\":[\"victron_ess_a1b2c3\"],\"name\":\"Victron ESS\","
+        "\"mf\":\"Victron Energy\",\"mdl\":\"MultiPlus-II\",\"sw\":\"1.0\"}}", payload);
+    TEST_ASSERT_EQUAL(strlen(payload), length);
+}
+
+void test_binary_sensor_config(void) {
+    // No unit or classes, the template maps the JSON bool to ON/OFF
+    HaDevice noAvailability = device;
+    noAvailability.availabilityTopic = nullptr;
+    TEST_ASSERT_GREATER_THAN(0, discovery->serializeConfig(noAvailability, ENABLED, topic, sizeof(topic), payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING("homeassistant/binary_sensor/victron_ess_a1b2c3/control_enabled/config", topic);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"Feed-in control\",\"uniq_id\":\"victron_ess_a1b2c3_control_enabled\","
+        "\"stat_t\":\"ess/control/state\",\"val_tpl\":\"{{ 'ON' if value_json.enabled else 'OFF' }}\","
+        "\"dev\":{\"ids\":[\"victron_ess_a1b2c3\"],\"name\":\"Victron ESS\","
+        "\"mf\":\"Victron Energy\",\"mdl\":\"MultiPlus-II\",\"sw\":\"1.0\"}}", payload);
+}
+
+void test_config_does_not_fit(void) {
+    size_t length = discovery->serializeConfig(device, SOC, topic, sizeof(topic), payload, sizeof(payload));
+    TEST_ASSERT_GREATER_THAN(0, length);
+
+    // One byte short for the payload or the topic: nothing, never a cut message
+    char small[HA_CONFIG_SIZE];
+    TEST_ASSERT_EQUAL(0, discovery->serializeConfig(device, SOC, topic, sizeof(topic), small, length));
+    TEST_ASSERT_EQUAL(length, discovery->serializeConfig(device, SOC, topic, sizeof(topic), small, length + 1));
+    char shortTopic[HA_TOPIC_SIZE];
+    size_t topicLength = strlen(topic);
+    TEST_ASSERT_EQUAL(0, discovery->serializeConfig(device, SOC, shortTopic, topicLength, small, sizeof(small)));
+    TEST_ASSERT_EQUAL(0, discovery->serializeConfig(device, ENTITY_COUNT, topic, sizeof(topic), small, sizeof(small)));
+}
+
+void test_every_config_fits_its_buffer(void) {
+    for (uint8_t i = 0; i < discovery->getEntityCount(); i++) {
+        TEST_ASSERT_GREATER_THAN(0, discovery->serializeConfig(device, i, topic, sizeof(topic), payload, sizeof(payload)));
+        TEST_ASSERT_EQUAL('}', payload[strlen(payload) - 1]);
+    }
+}
+
+void test_group_state(void) {
+    setValues(57, 52.314f, -648.4f);
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1000));
+
+    size_t length = discovery->serializeState(GROUP_BATTERY, topic, sizeof(topic), payload, sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("ess/battery/state", topic);
+    TEST_ASSERT_EQUAL_STRING("{\"soc\":57,\"voltage\":52.31,\"power\":-648}", payload);
+    TEST_ASSERT_EQUAL(strlen(payload), length);
+
+    discovery->serializeState(GROUP_CONTROL, topic, sizeof(topic), payload, sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("ess/control/state", topic);
+    TEST_ASSERT_EQUAL_STRING("{\"enabled\":true,\"strategy\":\"self\"}", payload);
+
+    // A state that does not fit completely is not sent at all
+    TEST_ASSERT_EQUAL(0, discovery->serializeState(GROUP_BATTERY, topic, sizeof(topic), payload, 20));
+    TEST_ASSERT_EQUAL(0, discovery->serializeState(GROUP_COUNT, topic, sizeof(topic), payload, sizeof(payload)));
+}
+
+void test_changes_within_min_interval(void) {
+    setValues(57, 52.31f, -648);
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1000));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1100));
+
+    // Changes inside the dead band never make a group due
+    setValues(57, 52.33f, -640);
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1000 + HA_MIN_INTERVAL_MS));
+
+    // A real change waits for the minimum interval, only its group is sent
+    setValues(58, 52.33f, -640);
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1000 + HA_MIN_INTERVAL_MS - 1));
+    TEST_ASSERT_EQUAL(1u << GROUP_BATTERY, discovery->takeDueGroups(1000 + HA_MIN_INTERVAL_MS));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1000 + HA_MIN_INTERVAL_MS + 1));
+
+    // The state carries the new value
+    discovery->serializeState(GROUP_BATTERY, topic, sizeof(topic), payload, sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("{\"soc\":58,\"voltage\":52.33,\"power\":-640}", payload);
+
+    // A change taken while the group is held back is still sent later
+    setValues(59, 52.33f, -640);
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(2000 + HA_MIN_INTERVAL_MS));
+    setValues(59, 52.33f, -640);
+    TEST_ASSERT_EQUAL(1u << GROUP_BATTERY, discovery->takeDueGroups(1000 + 2 * HA_MIN_INTERVAL_MS));
+}
+
+void test_heartbeat(void) {
+    setValues(57, 52.31f, -648);
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1000));
+    for (uint32_t now = 2000; now < 1000 + HA_HEARTBEAT_MS; now += 1000) {
+        setValues(57, 52.31f, -648);
+        TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(now));
+    }
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1000 + HA_HEARTBEAT_MS));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(2000 + HA_HEARTBEAT_MS));
+}
+
+void test_heartbeat_across_millis_wrap(void) {
+    uint32_t start = UINT32_MAX - 1000;
+    setValues(57, 52.31f, -648);
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(start));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(start + 2000));
+    setValues(60, 52.31f, -648);
+    TEST_ASSERT_EQUAL(1u << GROUP_BATTERY, discovery->takeDueGroups(start + HA_MIN_INTERVAL_MS));
+    TEST_ASSERT_EQUAL(1u << GROUP_CONTROL, discovery->takeDueGroups(start + HA_HEARTBEAT_MS));
+}
+
+void test_invalidate_after_reconnect(void) {
+    setValues(57, 52.31f, -648);
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1000));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1500));
+
+    // Right after the reconnect every group is due, regardless of the interval
+    discovery->invalidate();
+    TEST_ASSERT_EQUAL(0x03, discovery->takeDueGroups(1600));
+    TEST_ASSERT_EQUAL(0, discovery->takeDueGroups(1700));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_sensor_config);
+    RUN_TEST(test_binary_sensor_config);
+    RUN_TEST(test_config_does_not_fit);
+    RUN_TEST(test_every_config_fits_its_buffer);
+    RUN_TEST(test_group_state);
+    RUN_TEST(test_changes_within_min_interval);
+    RUN_TEST(test_heartbeat);
+    RUN_TEST(test_heartbeat_across_millis_wrap);
+    RUN_TEST(test_invalidate_after_reconnect);
+    return UNITY_END();
+}
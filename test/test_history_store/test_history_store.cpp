@@ -0,0 +1,249 @@
+/*
+ * HistoryStore Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "history_store.h"
+
+static HistoryStore* store;
+
+// Test signal at time t; the other signals get a constant
+static int32_t meterValue(uint32_t t) {
+    return (int32_t)(t * 7919 % 2001) - 1000;
+}
+
+static void recordMeter(uint32_t time, int32_t value) {
+    int32_t values[HISTORY_SIGNAL_COUNT] = {};
+    values[HISTORY_METER_POWER] = value;
+    values[HISTORY_BATTERY_SOC] = 50;
+    store->record(time, values);
+}
+
+static std::vector<HistoryPoint> readAll(uint8_t tier, uint32_t from = 0) {
+    std::vector<HistoryPoint> points;
+    HistoryCursor cursor;
+    HistoryPoint point;
+    store->seek(cursor, HISTORY_METER_POWER, tier, from);
+    while (store->next(cursor, point)) {
+        points.push_back(point);
+    }
+    return points;
+}
+
+// min/max/avg the way HistoryStore rounds: half away from zero
+static HistoryPoint rollup(const std::vector<uint32_t>& times, uint32_t start) {
+    HistoryPoint point = { start, INT32_MAX, INT32_MIN, 0 };
+    int64_t sum = 0;
+    for (uint32_t t : times) {
+        int32_t value = meterValue(t);
+        if (value < point.min) point.min = value;
+        if (value > point.max) point.max = value;
+        sum += value;
+    }
+    int64_t count = (int64_t)times.size();
+    point.avg = (int32_t)((sum >= 0 ? sum + count / 2 : sum - count / 2) / count);
+    return point;
+}
+
+void setUp(void) {
+    store = new HistoryStore();
+}
+
+void tearDown(void) {
+    delete store;
+}
+
+void test_int32_extremes_round_trip(void) {
+    // Deltas of the full int32 range and 5 byte varints, raw and in a rollup
+    const int32_t values[] = {INT32_MIN, INT32_MAX, INT32_MIN, 0, -1, 1, INT32_MAX, INT32_MAX, -1, INT32_MIN};
+    const uint32_t count = sizeof(values) / sizeof(values[0]);
+    for (uint32_t i = 0; i < count; i++) {
+        recordMeter(120 + i, values[i]);
+    }
+    recordMeter(180, 0);        // Closes the minute
+
+    std::vector<HistoryPoint> points = readAll(HISTORY_TIER_SECOND);
+    TEST_ASSERT_EQUAL(count + 1, points.size());
+    for (uint32_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(120 + i, points[i].time);
+        TEST_ASSERT_EQUAL(values[i], points[i].avg);
+        TEST_ASSERT_EQUAL(values[i], points[i].min);
+        TEST_ASSERT_EQUAL(values[i], points[i].max);
+    }
+
+    points = readAll(HISTORY_TIER_MINUTE);
+    TEST_ASSERT_EQUAL(1, points.size());
+    TEST_ASSERT_EQUAL(120, points[0].time);
+    TEST_ASSERT_EQUAL(INT32_MIN, points[0].min);
+    TEST_ASSERT_EQUAL(INT32_MAX, points[0].max);
+    int64_t sum = 0;
+    for (int32_t value : values) sum += value;
+    TEST_ASSERT_EQUAL((int32_t)((sum - count / 2) / count), points[0].avg);
+}
+
+void test_gap_starts_new_block(void) {
+    // A missed second: the times after it stay right
+    for (uint32_t t = 100; t < 110; t++) recordMeter(t, 5);
+    for (uint32_t t = 111; t < 115; t++) recordMeter(t, 6);
+    std::vector<HistoryPoint> points = readAll(HISTORY_TIER_SECOND);
+    TEST_ASSERT_EQUAL(14, points.size());
+    TEST_ASSERT_EQUAL(109, points[9].time);
+    TEST_ASSERT_EQUAL(111, points[10].time);
+    TEST_ASSERT_EQUAL(6, points[10].avg);
+
+    // Every gap takes a block: one run more than there are blocks drops the first run
+    uint32_t time = 1000;
+    for (uint32_t run = 0; run < HISTORY_SECOND_BLOCKS - 1; run++) {
+        for (uint32_t i = 0; i < 3; i++) recordMeter(time++, (int32_t)run);
+        time++;
+    }
+    TEST_ASSERT_EQUAL(111, store->getOldestTime(HISTORY_METER_POWER, HISTORY_TIER_SECOND));
+    points = readAll(HISTORY_TIER_SECOND);
+    TEST_ASSERT_EQUAL(4 + (HISTORY_SECOND_BLOCKS - 1) * 3, points.size());
+    TEST_ASSERT_EQUAL(111, points[0].time);
+    TEST_ASSERT_EQUAL(1000, points[4].time);
+    TEST_ASSERT_EQUAL(1004, points[7].time);
+}
+
+void test_cursor_resumes_at_oldest_after_overwrite(void) {
+    for (uint32_t t = 0; t < 300; t++) recordMeter(t, meterValue(t));
+
+    HistoryCursor cursor;
+    HistoryPoint point;
+    store->seek(cursor, HISTORY_METER_POWER, HISTORY_TIER_SECOND, 0);
+    for (uint32_t t = 0; t < 10; t++) {
+        TEST_ASSERT_TRUE(store->next(cursor, point));
+        TEST_ASSERT_EQUAL(t, point.time);
+    }
+
+    // The reader pauses while the ring goes round more than once
+    for (uint32_t t = 300; t < 5000; t++) recordMeter(t, meterValue(t));
+    uint32_t oldest = store->getOldestTime(HISTORY_METER_POWER, HISTORY_TIER_SECOND);
+    TEST_ASSERT_GREATER_THAN(300, oldest);
+
+    // It continues with the oldest block, then without a gap to the newest sample
+    uint32_t expected = oldest;
+    while (store->next(cursor, point)) {
+        TEST_ASSERT_EQUAL(expected, point.time);
+        TEST_ASSERT_EQUAL(meterValue(expected), point.avg);
+        expected++;
+    }
+    TEST_ASSERT_EQUAL(5000, expected);
+}
+
+void test_rollups(void) {
+    // Two hours and a bit with a gap of 30 s: the minute with the gap and its
+    // quarter are averaged over the samples that exist
+    std::vector<uint32_t> times;
+    for (uint32_t t = 0; t <= 2 * 3600 + 60; t++) {
+        if (t >= 100 && t < 130) continue;
+        recordMeter(t, meterValue(t));
+        times.push_back(t);
+    }
+
+    // Every finished minute and quarter (the minute at 2 h is closed by the
+    // sample at 2 h + 60 s), the running ones are not stored yet
+    const uint8_t tiers[] = {HISTORY_TIER_MINUTE, HISTORY_TIER_QUARTER};
+    for (uint8_t tier : tiers) {
+        uint32_t period = historyTierPeriod(tier);
+        std::vector<HistoryPoint> points = readAll(tier);
+        TEST_ASSERT_EQUAL(tier == HISTORY_TIER_MINUTE ? 2 * 60 + 1 : 2 * 4, points.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            uint32_t start = (uint32_t)i * period;
+            std::vector<uint32_t> inPeriod;
+            for (uint32_t t : times) {
+                if (t >= start && t < start + period) inPeriod.push_back(t);
+            }
+            HistoryPoint expected = rollup(inPeriod, start);
+            TEST_ASSERT_EQUAL(expected.time, points[i].time);
+            TEST_ASSERT_EQUAL(expected.min, points[i].min);
+            TEST_ASSERT_EQUAL(expected.max, points[i].max);
+            TEST_ASSERT_EQUAL(expected.avg, points[i].avg);
+        }
+    }
+
+    // A query from an hour back is answered from the finest tier that reaches it
+    TEST_ASSERT_EQUAL(HISTORY_TIER_SECOND, store->tierFor(HISTORY_METER_POWER, 2 * 3600));
+    TEST_ASSERT_EQUAL(HISTORY_TIER_MINUTE, store->tierFor(HISTORY_METER_POWER, 3600));
+}
+
+// The whole answer in one buffer, the reference for the chunked reads
+static std::string readJsonWhole(uint8_t tier) {
+    static char buffer[65536];
+    HistoryQuery query;
+    store->beginQuery(query, HISTORY_METER_POWER, tier, 0, 7777);
+    size_t length = store->readJson(query, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL(0, store->readJson(query, buffer, sizeof(buffer)));
+    return std::string(buffer, length);
+}
+
+void test_read_json_chunks(void) {
+    for (uint32_t t = 0; t <= 900 + 60; t++) {
+        recordMeter(t, t == 500 ? INT32_MIN : meterValue(t));
+    }
+
+    // The reference from the cursor
+    char text[64];
+    std::string expected = "{\"signal\":\"meter_power\",\"tier\":60,\"now\":7777,\"points\":[";
+    std::vector<HistoryPoint> points = readAll(HISTORY_TIER_MINUTE);
+    for (size_t i = 0; i < points.size(); i++) {
+        snprintf(text, sizeof(text), "%s[%lu,%ld,%ld,%ld]", i > 0 ? "," : "", (unsigned long)points[i].time,
+                 (long)points[i].min, (long)points[i].max, (long)points[i].avg);
+        expected += text;
+    }
+    expected += "]}";
+    std::string whole = readJsonWhole(HISTORY_TIER_MINUTE);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), whole.c_str());
+
+    const uint8_t tiers[] = {HISTORY_TIER_SECOND, HISTORY_TIER_MINUTE};
+    for (uint8_t tier : tiers) {
+        whole = readJsonWhole(tier);
+        for (size_t size = 60; size <= 200; size += 7) {
+            HistoryQuery query;
+            store->beginQuery(query, HISTORY_METER_POWER, tier, 0, 7777);
+            std::string joined;
+            char buffer[200];
+            size_t length;
+            uint32_t chunks = 0;
+            while ((length = store->readJson(query, buffer, size)) > 0) {
+                TEST_ASSERT_LESS_OR_EQUAL(size, length);
+                // Complete points only: a chunk ends after a point, the header or the footer
+                char last = buffer[length - 1];
+                TEST_ASSERT_TRUE(last == ']' || last == '[' || last == '}');
+                char first = buffer[0];
+                TEST_ASSERT_TRUE(chunks == 0 ? first == '{' : first == ',' || first == '[' || first == ']');
+                joined.append(buffer, length);
+                chunks++;
+                TEST_ASSERT_LESS_THAN(100000, chunks);
+            }
+            TEST_ASSERT_EQUAL_STRING(whole.c_str(), joined.c_str());
+        }
+    }
+
+    // A buffer too small for the header gives nothing and leaves the query as it is
+    HistoryQuery query;
+    char small[16];
+    store->beginQuery(query, HISTORY_METER_POWER, HISTORY_TIER_MINUTE, 0, 7777);
+    TEST_ASSERT_EQUAL(0, store->readJson(query, small, sizeof(small)));
+    char buffer[65536];
+    size_t length = store->readJson(query, buffer, sizeof(buffer));
+    std::string rest(buffer, length);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), rest.c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_int32_extremes_round_trip);
+    RUN_TEST(test_gap_starts_new_block);
+    RUN_TEST(test_cursor_resumes_at_oldest_after_overwrite);
+    RUN_TEST(test_rollups);
+    RUN_TEST(test_read_json_chunks);
+    return UNITY_END();
+}
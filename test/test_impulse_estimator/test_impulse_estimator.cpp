@@ -0,0 +1,294 @@
+/*
+ * ImpulseEstimator Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include "impulse_estimator.h"
+#include "ess_control.h"
+
+#define SECOND_US 1000000UL
+#define TASK_PERIOD_MS 100              // ImpulseMeter task, IMPULSE_METER_UPDATE_MS
+#define CONTROL_PERIOD_MS 20            // EssController, one VE.Bus sync period
+
+// The sample EssController keeps from publishMeterPower() / refreshMeterPower()
+struct MeterSample {
+    int32_t power;
+    uint32_t timeMs;
+    uint32_t sequence;
+};
+
+static void apply(MeterSample& sample, ImpulsePublish action, int32_t power, uint32_t nowMs) {
+    if (action == IMPULSE_PUBLISH_NEW) {
+        sample.power = power;
+        sample.sequence++;
+    }
+    if (action != IMPULSE_PUBLISH_NONE) {
+        sample.timeMs = nowMs;
+    }
+}
+
+static ImpulseEstimator* estimator;
+
+// Microseconds between pulses at a constant power
+static uint32_t intervalFor(uint32_t watts) {
+    return (uint32_t)((uint64_t)IMPULSE_METER_JOULES_PER_PULSE * SECOND_US / watts);
+}
+
+// Pulses at a constant power, the first at start; returns the time of the last
+static uint32_t pulseTrain(uint32_t start, uint32_t watts, uint32_t count) {
+    uint32_t time = start;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) {
+            time += intervalFor(watts);
+        }
+        TEST_ASSERT_TRUE(estimator->onPulse(time));
+    }
+    return time;
+}
+
+void setUp(void) {
+    estimator = new ImpulseEstimator();
+}
+
+void tearDown(void) {
+    delete estimator;
+}
+
+void test_steady_rate(void) {
+    // 360 J per pulse: 3600 W is one pulse every 100 ms
+    TEST_ASSERT_EQUAL(3600, ImpulseEstimator::powerFromInterval(100000));
+    TEST_ASSERT_EQUAL(100000, intervalFor(3600));
+
+    const uint32_t powers[] = {50, 480, 1200, 3600, 9000};
+    uint32_t time = 5 * SECOND_US;
+    for (uint32_t watts : powers) {
+        time = pulseTrain(time + intervalFor(watts), watts, 5);
+        ImpulseEstimate estimate = estimator->estimate(time + intervalFor(watts) / 2);
+        TEST_ASSERT_TRUE(estimate.valid);
+        TEST_ASSERT_FALSE(estimate.bounded);
+        TEST_ASSERT_INT32_WITHIN(1, watts, estimate.power);
+        TEST_ASSERT_EQUAL(intervalFor(watts), estimator->getIntervalUs());
+        TEST_ASSERT_EQUAL(intervalFor(watts) / 2, estimate.ageUs);
+    }
+    TEST_ASSERT_EQUAL(25, estimator->getPulses());
+    TEST_ASSERT_EQUAL(0, estimator->getRejected());
+}
+
+void test_bound_decays_after_load_drop(void) {
+    // 2400 W, then the load drops and no pulse comes
+    uint32_t last = pulseTrain(SECOND_US, 2400, 10);
+    uint32_t interval = intervalFor(2400);
+    TEST_ASSERT_EQUAL(2400, estimator->estimate(last + interval).power);
+    TEST_ASSERT_FALSE(estimator->estimate(last + interval).bounded);
+
+    // Once the next pulse is overdue the power follows 360 J / elapsed, falling
+    int32_t previous = 2400;
+    for (uint32_t elapsed = interval + 1000; elapsed < 60 * SECOND_US; elapsed += 250000) {
+        ImpulseEstimate estimate = estimator->estimate(last + elapsed);
+        TEST_ASSERT_TRUE(estimate.valid);
+        TEST_ASSERT_TRUE(estimate.bounded);
+        TEST_ASSERT_EQUAL(ImpulseEstimator::powerFromInterval(elapsed), estimate.power);
+        TEST_ASSERT_LESS_OR_EQUAL(previous, estimate.power);
+        previous = estimate.power;
+    }
+    TEST_ASSERT_EQUAL(36, estimator->estimate(last + 10 * SECOND_US).power);
+
+    // The next pulse gives the real interval again
+    uint32_t next = last + 20 * SECOND_US;
+    TEST_ASSERT_TRUE(estimator->onPulse(next));
+    ImpulseEstimate estimate = estimator->estimate(next + 1000);
+    TEST_ASSERT_FALSE(estimate.bounded);
+    TEST_ASSERT_EQUAL(18, estimate.power);
+}
+
+void test_idle_timeout(void) {
+    uint32_t last = pulseTrain(SECOND_US, 100, 3);
+
+    // Just before the timeout: 360 J over 600 s is 0.6 W, rounded down
+    ImpulseEstimate estimate = estimator->estimate(last + IMPULSE_METER_IDLE_US - 1);
+    TEST_ASSERT_TRUE(estimate.valid);
+    TEST_ASSERT_TRUE(estimate.bounded);
+    TEST_ASSERT_EQUAL(0, estimate.power);
+
+    estimate = estimator->estimate(last + IMPULSE_METER_IDLE_US);
+    TEST_ASSERT_TRUE(estimate.valid);
+    TEST_ASSERT_TRUE(estimate.bounded);
+    TEST_ASSERT_EQUAL(0, estimate.power);
+    TEST_ASSERT_EQUAL(IMPULSE_METER_IDLE_US, estimate.ageUs);
+
+    // expire() forgets the pulse, the estimate stays 0 and valid
+    estimator->expire(last + IMPULSE_METER_IDLE_US - 1);
+    TEST_ASSERT_EQUAL(IMPULSE_METER_IDLE_US - 1, estimator->estimate(last + IMPULSE_METER_IDLE_US - 1).ageUs);
+    estimator->expire(last + IMPULSE_METER_IDLE_US);
+    estimate = estimator->estimate(last + 3 * IMPULSE_METER_IDLE_US);
+    TEST_ASSERT_TRUE(estimate.valid);
+    TEST_ASSERT_EQUAL(0, estimate.power);
+    TEST_ASSERT_EQUAL(0, estimator->getIntervalUs());
+
+    // The first pulse after the pause has no interval: not valid until the second
+    uint32_t resume = last + 3 * IMPULSE_METER_IDLE_US;
+    TEST_ASSERT_TRUE(estimator->onPulse(resume));
+    TEST_ASSERT_FALSE(estimator->estimate(resume + 1000).valid);
+    TEST_ASSERT_TRUE(estimator->onPulse(resume + intervalFor(720)));
+    TEST_ASSERT_EQUAL(720, estimator->estimate(resume + intervalFor(720)).power);
+}
+
+void test_first_pulse(void) {
+    // Nothing before the first pulse
+    ImpulseEstimate estimate = estimator->estimate(1000);
+    TEST_ASSERT_FALSE(estimate.valid);
+    TEST_ASSERT_EQUAL(0, estimate.power);
+
+    // One pulse has no interval, no matter how long ago
+    TEST_ASSERT_TRUE(estimator->onPulse(SECOND_US));
+    TEST_ASSERT_FALSE(estimator->estimate(SECOND_US).valid);
+    TEST_ASSERT_FALSE(estimator->estimate(SECOND_US + 30 * SECOND_US).valid);
+    TEST_ASSERT_EQUAL(0, estimator->getIntervalUs());
+
+    // A bounce right after it is rejected and does not make an interval
+    TEST_ASSERT_FALSE(estimator->onPulse(SECOND_US + IMPULSE_METER_MIN_INTERVAL_US - 1));
+    TEST_ASSERT_EQUAL(1, estimator->getRejected());
+    TEST_ASSERT_FALSE(estimator->estimate(SECOND_US + SECOND_US).valid);
+
+    TEST_ASSERT_TRUE(estimator->onPulse(SECOND_US + 500000));
+    estimate = estimator->estimate(SECOND_US + 500000);
+    TEST_ASSERT_TRUE(estimate.valid);
+    TEST_ASSERT_EQUAL(720, estimate.power);
+    TEST_ASSERT_EQUAL(2, estimator->getPulses());
+}
+
+void test_micros_wraparound(void) {
+    // The 32 bit microsecond counter wraps every 71.6 minutes, in the middle of a train
+    uint32_t interval = intervalFor(1500);
+    uint32_t start = UINT32_MAX - 3 * interval + 1;
+    uint32_t last = pulseTrain(start, 1500, 7);
+    TEST_ASSERT_LESS_THAN(start, last);
+    ImpulseEstimate estimate = estimator->estimate(last + 1000);
+    TEST_ASSERT_TRUE(estimate.valid);
+    TEST_ASSERT_FALSE(estimate.bounded);
+    TEST_ASSERT_EQUAL(1500, estimate.power);
+    TEST_ASSERT_EQUAL(1000, estimate.ageUs);
+
+    // The bound across the wrap
+    last = UINT32_MAX - 100000;
+    TEST_ASSERT_TRUE(estimator->onPulse(last - interval));
+    TEST_ASSERT_TRUE(estimator->onPulse(last));
+    estimate = estimator->estimate(last + 4 * SECOND_US);
+    TEST_ASSERT_TRUE(estimate.bounded);
+    TEST_ASSERT_EQUAL(90, estimate.power);
+    TEST_ASSERT_EQUAL(4 * SECOND_US, estimate.ageUs);
+
+    // A bounce across the wrap is still a bounce
+    TEST_ASSERT_FALSE(estimator->onPulse(last + IMPULSE_METER_MIN_INTERVAL_US / 2));
+}
+
+void test_publish_gate(void) {
+    ImpulsePublishGate gate;
+    uint32_t last = pulseTrain(SECOND_US, 2400, 2);
+    uint32_t interval = intervalFor(2400);
+    uint32_t nowMs = last / 1000;
+
+    // Not valid yet: nothing
+    ImpulseEstimate invalid = {0, 0, false, false};
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NONE, gate.check(invalid, true, nowMs));
+
+    // A pulse always goes out, also right after the previous one
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NEW, gate.check(estimator->estimate(last), true, nowMs));
+    TEST_ASSERT_EQUAL(2400, gate.getPublished());
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NEW, gate.check(estimator->estimate(last), true, nowMs + 1));
+
+    // The same value between pulses: refreshed at the bound rate, no more often
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NONE, gate.check(estimator->estimate(last + 100000), false, nowMs + 100));
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NONE,
+                      gate.check(estimator->estimate(last + 100000), false, nowMs + IMPULSE_METER_BOUND_PUBLISH_MS));
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_REFRESH,
+                      gate.check(estimator->estimate(last + 100000), false, nowMs + 1 + IMPULSE_METER_BOUND_PUBLISH_MS));
+
+    // A falling bound is a new sample, rate limited the same way
+    uint32_t boundMs = nowMs + 1 + 2 * IMPULSE_METER_BOUND_PUBLISH_MS;
+    ImpulseEstimate bound = estimator->estimate(last + interval + 300000);
+    TEST_ASSERT_TRUE(bound.bounded);
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NEW, gate.check(bound, false, boundMs));
+    TEST_ASSERT_EQUAL(bound.power, gate.getPublished());
+    bound = estimator->estimate(last + interval + 400000);
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NONE, gate.check(bound, false, boundMs + 100));
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NEW, gate.check(bound, false, boundMs + IMPULSE_METER_BOUND_PUBLISH_MS));
+
+    // Idle at 0 W: refreshed, not new
+    ImpulseEstimate idle = estimator->estimate(last + IMPULSE_METER_IDLE_US);
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_NEW, gate.check(idle, false, boundMs + 2 * IMPULSE_METER_BOUND_PUBLISH_MS));
+    TEST_ASSERT_EQUAL(IMPULSE_PUBLISH_REFRESH, gate.check(idle, false, boundMs + 3 * IMPULSE_METER_BOUND_PUBLISH_MS));
+}
+
+void test_loop_valid_with_slow_pulses(void) {
+    // 36 W: a pulse every 10 s, twice the control loop's meter timeout. The
+    // pulses are not aligned with the task runs.
+    const uint32_t pulseMs = 10000;
+    const uint32_t offsetMs = 37;
+    ImpulsePublishGate gate;
+    MeterSample sample = {0, 0, 0};
+    uint32_t lastSequence = 0;
+    uint32_t fresh = 0;
+    uint32_t pulses = 0;
+
+    EssControlParams params = {0, 3000, ESS_CONTROL_GAIN_PERCENT, ESS_CONTROL_DEADBAND_W};
+    EssControlInput input = {};
+    input.batteryValid = true;
+    input.batteryVoltage = 50.0f;
+    input.chargeCurrentLimit = 100.0f;
+    input.dischargeCurrentLimit = 100.0f;
+
+    uint32_t nextPulseMs = offsetMs;
+    bool loopValid = false;
+    for (uint32_t nowMs = 0; nowMs < 180000; nowMs += CONTROL_PERIOD_MS) {
+        if (nowMs % TASK_PERIOD_MS == 0) {
+            // ImpulseMeter::readerTask(): pulses queued since the last run, then the estimate
+            bool newPulse = false;
+            while (nextPulseMs <= nowMs) {
+                newPulse |= estimator->onPulse(nextPulseMs * 1000);
+                nextPulseMs += pulseMs;
+                pulses++;
+            }
+            estimator->expire(nowMs * 1000);
+            ImpulseEstimate estimate = estimator->estimate(nowMs * 1000);
+            apply(sample, gate.check(estimate, newPulse, nowMs), estimate.power, nowMs);
+        }
+
+        // EssController::iterate()
+        input.meterPower = sample.power;
+        input.meterFresh = sample.sequence != lastSequence;
+        input.meterValid = sample.sequence != 0 && nowMs - sample.timeMs < ESS_CONTROL_METER_TIMEOUT_MS;
+        lastSequence = sample.sequence;
+        fresh += input.meterFresh;
+        EssControlOutput output = essControlStep(params, input);
+        input.lastSetpoint = output.setpoint;
+
+        // From the second pulse on the loop never loses the meter
+        loopValid |= input.meterValid;
+        if (loopValid) {
+            TEST_ASSERT_TRUE(input.meterValid);
+            TEST_ASSERT_NOT_EQUAL(ESS_LIMIT_NO_METER, output.limit);
+        }
+    }
+    TEST_ASSERT_TRUE(loopValid);
+    TEST_ASSERT_EQUAL(36, sample.power);
+
+    // Only the pulses are integrated, not the refreshes in between
+    TEST_ASSERT_EQUAL(pulses - 1, fresh);
+    TEST_ASSERT_EQUAL(18 * (pulses - 1), input.lastSetpoint);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_steady_rate);
+    RUN_TEST(test_bound_decays_after_load_drop);
+    RUN_TEST(test_idle_timeout);
+    RUN_TEST(test_first_pulse);
+    RUN_TEST(test_micros_wraparound);
+    RUN_TEST(test_publish_gate);
+    RUN_TEST(test_loop_valid_with_slow_pulses);
+    return UNITY_END();
+}
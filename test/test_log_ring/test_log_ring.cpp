@@ -0,0 +1,244 @@
+/*
+ * LogRing Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "log_ring.h"
+
+#define STRESS_PRODUCERS 4
+#define STRESS_RECORDS 500000           // Per producer
+
+static LogRing* ring;
+
+static const char* const STRESS_FORMAT = "producer %d record %d";
+
+static LogRecord makeRecord(uint32_t producer, uint32_t number) {
+    LogRecord record;
+    record.timeMs = number * 3 + producer;
+    record.level = (uint8_t)(number % LOG_LEVEL_COUNT);
+    record.module = (uint8_t)producer;
+    record.reserved = 0;
+    record.format = STRESS_FORMAT;
+    record.args[0] = (int32_t)producer;
+    record.args[1] = (int32_t)number;
+    record.args[2] = (int32_t)(number * 2654435761u);
+    record.args[3] = (int32_t)(record.timeMs ^ record.args[2]);
+    return record;
+}
+
+// All fields follow from producer and number, a torn copy shows
+static bool isIntact(const LogRecord& record) {
+    if (record.args[0] < 0 || record.args[0] >= STRESS_PRODUCERS) return false;
+    LogRecord expected = makeRecord(record.args[0], record.args[1]);
+    return memcmp(&expected, &record, sizeof(LogRecord)) == 0;
+}
+
+void setUp(void) {
+    ring = new LogRing();
+}
+
+void tearDown(void) {
+    delete ring;
+}
+
+void test_fifo(void) {
+    LogRecord record;
+    TEST_ASSERT_FALSE(ring->pop(record));
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(ring->push(makeRecord(1, i)));
+    }
+    for (uint32_t i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(ring->pop(record));
+        TEST_ASSERT_EQUAL(i, record.args[1]);
+        TEST_ASSERT_TRUE(isIntact(record));
+    }
+    TEST_ASSERT_FALSE(ring->pop(record));
+    TEST_ASSERT_EQUAL(10, ring->getStats().pushed);
+    TEST_ASSERT_EQUAL(0, ring->getStats().dropped);
+}
+
+void test_full_ring_drops_newest(void) {
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++) {
+        TEST_ASSERT_TRUE(ring->push(makeRecord(0, i)));
+    }
+    TEST_ASSERT_FALSE(ring->push(makeRecord(0, LOG_RING_SIZE)));
+    TEST_ASSERT_FALSE(ring->push(makeRecord(0, LOG_RING_SIZE + 1)));
+    TEST_ASSERT_EQUAL(LOG_RING_SIZE, ring->getStats().pushed);
+    TEST_ASSERT_EQUAL(2, ring->getStats().dropped);
+
+    // The records already queued are kept; one pop frees one slot
+    LogRecord record;
+    TEST_ASSERT_TRUE(ring->pop(record));
+    TEST_ASSERT_EQUAL(0, record.args[1]);
+    TEST_ASSERT_TRUE(ring->push(makeRecord(0, 1000)));
+    TEST_ASSERT_FALSE(ring->push(makeRecord(0, 1001)));
+    for (uint32_t i = 1; i < LOG_RING_SIZE; i++) {
+        TEST_ASSERT_TRUE(ring->pop(record));
+        TEST_ASSERT_EQUAL(i, record.args[1]);
+    }
+    TEST_ASSERT_TRUE(ring->pop(record));
+    TEST_ASSERT_EQUAL(1000, record.args[1]);
+    TEST_ASSERT_FALSE(ring->pop(record));
+}
+
+void test_wraps_around(void) {
+    LogRecord record;
+    for (uint32_t i = 0; i < 10 * LOG_RING_SIZE + 7; i++) {
+        TEST_ASSERT_TRUE(ring->push(makeRecord(2, i)));
+        TEST_ASSERT_TRUE(ring->pop(record));
+        TEST_ASSERT_EQUAL(i, record.args[1]);
+    }
+    TEST_ASSERT_EQUAL(0, ring->getStats().dropped);
+}
+
+void test_multiple_producers(void) {
+    // Producers race each other and a consumer that drains at its own pace.
+    // Every record pushed comes out exactly once, intact, and in push order
+    // per producer; every record not pushed is counted as dropped.
+    std::atomic<uint32_t> running(STRESS_PRODUCERS);
+    uint32_t accepted[STRESS_PRODUCERS] = {};
+    std::thread producers[STRESS_PRODUCERS];
+    for (uint32_t p = 0; p < STRESS_PRODUCERS; p++) {
+        producers[p] = std::thread([&, p]() {
+            for (uint32_t i = 0; i < STRESS_RECORDS; i++) {
+                if (ring->push(makeRecord(p, i))) {
+                    accepted[p]++;
+                } else {
+                    // Let the others run, also on a single core
+                    std::this_thread::yield();
+                }
+            }
+            running.fetch_sub(1);
+        });
+    }
+
+    uint32_t popped[STRESS_PRODUCERS] = {};
+    int32_t last[STRESS_PRODUCERS];
+    uint32_t torn = 0;
+    uint32_t outOfOrder = 0;
+    for (int32_t& number : last) {
+        number = -1;
+    }
+    LogRecord record;
+    bool finished = false;
+    for (uint32_t idle = 0;; idle++) {
+        if (!ring->pop(record)) {
+            // Empty: done after one more pass once every producer has returned
+            if (finished) {
+                break;
+            }
+            finished = running.load() == 0;
+            if (idle % 64 == 0) {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+        if (!isIntact(record)) {
+            torn++;
+            continue;
+        }
+        uint32_t p = record.args[0];
+        if (record.args[1] <= last[p]) {
+            outOfOrder++;
+        }
+        last[p] = record.args[1];
+        popped[p]++;
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+
+    TEST_ASSERT_EQUAL(0, torn);
+    TEST_ASSERT_EQUAL(0, outOfOrder);
+    LogRingStats stats = ring->getStats();
+    uint32_t total = 0;
+    for (uint32_t p = 0; p < STRESS_PRODUCERS; p++) {
+        TEST_ASSERT_EQUAL(accepted[p], popped[p]);
+        TEST_ASSERT_GREATER_THAN(0, popped[p]);
+        total += popped[p];
+    }
+    TEST_ASSERT_EQUAL(total, stats.pushed);
+    TEST_ASSERT_EQUAL(STRESS_PRODUCERS * STRESS_RECORDS, stats.pushed + stats.dropped);
+}
+
+void test_rate_limiter(void) {
+    LogRateLimiter unlimited;
+    for (uint32_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_TRUE(unlimited.allow(0));
+    }
+
+    // 10 per second, bursts of 5
+    LogRateLimiter limiter(10, 5);
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(limiter.allow(1000));
+    }
+    TEST_ASSERT_FALSE(limiter.allow(1000));
+    TEST_ASSERT_FALSE(limiter.allow(1099));
+    TEST_ASSERT_TRUE(limiter.allow(1100));
+    TEST_ASSERT_FALSE(limiter.allow(1100));
+
+    // A long pause refills to the burst, not beyond
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(limiter.allow(60000));
+    }
+    TEST_ASSERT_FALSE(limiter.allow(60000));
+
+    // Sustained: 10 per second over a minute, also across the millis() wrap
+    uint32_t allowed = 0;
+    uint32_t start = UINT32_MAX - 30000;
+    limiter.configure(10, 1);
+    for (uint32_t t = 0; t < 60000; t += 10) {
+        allowed += limiter.allow(start + t);
+    }
+    TEST_ASSERT_UINT32_WITHIN(2, 600, allowed);
+}
+
+void test_format(void) {
+    char text[LOG_TEXT_MAX];
+    LogRecord record = {};
+    record.module = LOG_MODULE_VEBUS;
+    record.format = "sent %d bytes, cmd 0x%02X";
+    record.args[0] = 12;
+    record.args[1] = 0x37;
+    TEST_ASSERT_EQUAL(strlen("[VEBUS] sent 12 bytes, cmd 0x37"), formatLogRecord(record, text, sizeof(text)));
+    TEST_ASSERT_EQUAL_STRING("[VEBUS] sent 12 bytes, cmd 0x37", text);
+
+    // Truncated to the buffer, always terminated
+    TEST_ASSERT_EQUAL(11, formatLogRecord(record, text, 12));
+    TEST_ASSERT_EQUAL_STRING("[VEBUS] sen", text);
+    TEST_ASSERT_EQUAL(4, formatLogRecord(record, text, 5));
+    TEST_ASSERT_EQUAL_STRING("[VEB", text);
+
+    record.format = nullptr;
+    record.module = 200;
+    formatLogRecord(record, text, sizeof(text));
+    TEST_ASSERT_EQUAL_STRING("[?] ", text);
+}
+
+void test_names(void) {
+    TEST_ASSERT_EQUAL_STRING("warning", logLevelName(LOG_LEVEL_WARNING));
+    TEST_ASSERT_EQUAL_STRING("unknown", logLevelName(LOG_LEVEL_COUNT));
+    TEST_ASSERT_EQUAL_STRING("CAN", logModuleName(LOG_MODULE_CAN));
+    TEST_ASSERT_EQUAL(LOG_LEVEL_ERROR, logLevelFromName("Error"));
+    TEST_ASSERT_EQUAL(LOG_MODULE_MQTT, logModuleFromName("mqtt"));
+    TEST_ASSERT_EQUAL(-1, logLevelFromName("verbose"));
+    TEST_ASSERT_EQUAL(-1, logModuleFromName(nullptr));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_fifo);
+    RUN_TEST(test_full_ring_drops_newest);
+    RUN_TEST(test_wraps_around);
+    RUN_TEST(test_multiple_producers);
+    RUN_TEST(test_rate_limiter);
+    RUN_TEST(test_format);
+    RUN_TEST(test_names);
+    return UNITY_END();
+}
@@ -0,0 +1,273 @@
+/*
+ * MqttOutbox Tests
+ *
+ * Also the reconnect backoff, and both together through a broker outage:
+ * the producer keeps publishing at the usual rate while the connect attempts
+ * follow mqttBackoffMs(), and after the broker is back the latest value of
+ * every topic goes out.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_outbox.h"
+
+static MqttOutbox outbox;
+
+void setUp(void) {
+    outbox = MqttOutbox();
+}
+
+void tearDown(void) {}
+
+static void assertPop(const char* topic, const char* payload, bool retained) {
+    MqttMessage message;
+    TEST_ASSERT_TRUE(outbox.pop(message));
+    TEST_ASSERT_EQUAL_STRING(topic, message.topic);
+    TEST_ASSERT_EQUAL_STRING(payload, message.payload);
+    TEST_ASSERT_EQUAL(strlen(payload), message.length);
+    TEST_ASSERT_EQUAL(retained, message.retained);
+}
+
+void test_empty(void) {
+    MqttMessage message;
+    TEST_ASSERT_FALSE(outbox.pop(message));
+    TEST_ASSERT_EQUAL(0, outbox.size());
+}
+
+void test_fifo_order(void) {
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push("a", "1", false));
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push("b", "2", true));
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push("c", "", false));
+    TEST_ASSERT_EQUAL(3, outbox.size());
+
+    assertPop("a", "1", false);
+    assertPop("b", "2", true);
+    assertPop("c", "", false);
+    MqttMessage message;
+    TEST_ASSERT_FALSE(outbox.pop(message));
+}
+
+void test_same_topic_replaces_in_place(void) {
+    outbox.push("a", "1", false);
+    outbox.push("b", "2", false);
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_REPLACED, outbox.push("a", "longer value", true));
+    TEST_ASSERT_EQUAL(2, outbox.size());
+
+    // Keeps its place in the queue, takes the new payload and flags
+    assertPop("a", "longer value", true);
+    assertPop("b", "2", false);
+    TEST_ASSERT_EQUAL(1, outbox.getStats().replaced);
+    TEST_ASSERT_EQUAL(3, outbox.getStats().queued);
+}
+
+void test_full_queue_drops_oldest(void) {
+    char topic[16];
+    for (uint8_t i = 0; i < MQTT_OUTBOX_SLOTS; i++) {
+        snprintf(topic, sizeof(topic), "t/%u", i);
+        TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push(topic, "x", false));
+    }
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_DROPPED_OLDEST, outbox.push("t/new", "y", false));
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_SLOTS, outbox.size());
+    TEST_ASSERT_EQUAL(1, outbox.getStats().dropped);
+
+    // A queued topic is still replaced when full
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_REPLACED, outbox.push("t/3", "z", false));
+
+    for (uint8_t i = 1; i < MQTT_OUTBOX_SLOTS; i++) {
+        snprintf(topic, sizeof(topic), "t/%u", i);
+        assertPop(topic, i == 3 ? "z" : "x", false);
+    }
+    assertPop("t/new", "y", false);
+    TEST_ASSERT_EQUAL(0, outbox.size());
+}
+
+void test_wraps_around(void) {
+    char topic[16];
+    char payload[16];
+    for (uint32_t i = 0; i < 5 * MQTT_OUTBOX_SLOTS; i++) {
+        snprintf(topic, sizeof(topic), "t/%u", i % 3);
+        snprintf(payload, sizeof(payload), "%u", i);
+        outbox.push(topic, payload, false);
+        if (i % 2 == 1) {
+            MqttMessage message;
+            TEST_ASSERT_TRUE(outbox.pop(message));
+        }
+        TEST_ASSERT_LESS_OR_EQUAL(3, outbox.size());
+    }
+}
+
+void test_too_long_is_rejected(void) {
+    char topic[MQTT_TOPIC_MAX + 1];
+    memset(topic, 't', sizeof(topic) - 1);
+    topic[MQTT_TOPIC_MAX] = '\0';
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_REJECTED, outbox.push(topic, "1", false));
+    topic[MQTT_TOPIC_MAX - 1] = '\0';
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push(topic, "1", false));
+
+    static char payload[MQTT_PAYLOAD_MAX + 1];
+    memset(payload, 'p', sizeof(payload) - 1);
+    payload[MQTT_PAYLOAD_MAX] = '\0';
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_REJECTED, outbox.push("a", payload, false));
+    payload[MQTT_PAYLOAD_MAX - 1] = '\0';
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push("a", payload, false));
+
+    TEST_ASSERT_EQUAL(2, outbox.getStats().rejected);
+    TEST_ASSERT_EQUAL(2, outbox.size());
+    MqttMessage message;
+    outbox.pop(message);
+    outbox.pop(message);
+    TEST_ASSERT_EQUAL(MQTT_PAYLOAD_MAX - 1, message.length);
+}
+
+void test_clear(void) {
+    outbox.push("a", "1", false);
+    outbox.push("b", "1", false);
+    outbox.clear();
+    TEST_ASSERT_EQUAL(0, outbox.size());
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_QUEUED, outbox.push("a", "2", false));
+    assertPop("a", "2", false);
+}
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void test_backoff_doubles_up_to_max(void) {
+    uint32_t delay = MQTT_BACKOFF_MIN_MS;
+    for (uint16_t failures = 0; failures <= 255; failures++) {
+        // random = 0 gives the lower end, half the delay the upper end
+        TEST_ASSERT_EQUAL(delay / 2, mqttBackoffMs(failures, 0));
+        TEST_ASSERT_EQUAL(delay, mqttBackoffMs(failures, delay / 2));
+        TEST_ASSERT_EQUAL(delay / 2, mqttBackoffMs(failures, delay / 2 + 1));
+        delay = delay * 2 > MQTT_BACKOFF_MAX_MS ? MQTT_BACKOFF_MAX_MS : delay * 2;
+    }
+    TEST_ASSERT_EQUAL(MQTT_BACKOFF_MAX_MS, mqttBackoffMs(6, MQTT_BACKOFF_MAX_MS / 2));
+    TEST_ASSERT_EQUAL(32000, mqttBackoffMs(5, 16000));
+}
+
+void test_backoff_jitter(void) {
+    // Devices after the same broker restart: spread over 50-100 % of the delay
+    const uint8_t failures[] = {0, 3, 10};
+    for (uint8_t f : failures) {
+        uint32_t delay = f == 0 ? MQTT_BACKOFF_MIN_MS : f == 3 ? 8000 : MQTT_BACKOFF_MAX_MS;
+        uint32_t buckets[10] = {};
+        uint32_t state = 12345;
+        for (uint32_t device = 0; device < 10000; device++) {
+            uint32_t backoff = mqttBackoffMs(f, random32(state));
+            TEST_ASSERT_GREATER_OR_EQUAL(delay / 2, backoff);
+            TEST_ASSERT_LESS_OR_EQUAL(delay, backoff);
+            buckets[(backoff - delay / 2) * 10 / (delay / 2 + 1)]++;
+        }
+        for (uint32_t count : buckets) {
+            TEST_ASSERT_UINT32_WITHIN(200, 1000, count);
+        }
+    }
+}
+
+void test_broker_outage(void) {
+    // Six state topics every second plus an event topic every 7 s; the broker
+    // is down from 10 s to 130 s
+    const uint32_t DOWN_MS = 10000;
+    const uint32_t UP_MS = 130000;
+    const uint32_t END_MS = 200000;
+    char topic[32];
+    char payload[16];
+    uint32_t latest[6] = {};
+    uint32_t delivered[6] = {};
+    uint32_t state = 99;
+
+    bool connected = true;
+    uint8_t failures = 0;
+    uint32_t nextAttempt = 0;
+    uint32_t attempts = 0;
+    uint32_t reconnectedAt = 0;
+    uint32_t maxQueued = 0;
+
+    for (uint32_t now = 0; now < END_MS; now += 100) {
+        if (now % 1000 == 0) {
+            for (uint8_t i = 0; i < 6; i++) {
+                snprintf(topic, sizeof(topic), "ess/state/%u", i);
+                latest[i] = now / 1000;
+                snprintf(payload, sizeof(payload), "%u", latest[i]);
+                TEST_ASSERT_NOT_EQUAL(MQTT_OUTBOX_REJECTED, outbox.push(topic, payload, false));
+            }
+        }
+        if (now % 7000 == 0) {
+            snprintf(topic, sizeof(topic), "ess/event/%u", now / 7000);
+            outbox.push(topic, "event", false);
+        }
+        if (outbox.size() > maxQueued) {
+            maxQueued = outbox.size();
+        }
+
+        bool brokerUp = now < DOWN_MS || now >= UP_MS;
+        if (connected && !brokerUp) {
+            connected = false;
+            failures = 0;
+            nextAttempt = now + mqttBackoffMs(0, random32(state));
+        }
+        if (!connected && (int32_t)(now - nextAttempt) >= 0) {
+            attempts++;
+            if (brokerUp) {
+                connected = true;
+                reconnectedAt = now;
+            } else {
+                if (failures < 255) failures++;
+                nextAttempt = now + mqttBackoffMs(failures, random32(state));
+            }
+        }
+        if (!connected) {
+            continue;
+        }
+
+        MqttMessage message;
+        while (outbox.pop(message)) {
+            unsigned index;
+            if (sscanf(message.topic, "ess/state/%u", &index) == 1) {
+                uint32_t value = strtoul(message.payload, nullptr, 10);
+                TEST_ASSERT_GREATER_OR_EQUAL(delivered[index], value);
+                delivered[index] = value;
+            }
+        }
+        // Once connected nothing waits, also right after the reconnect
+        for (uint8_t i = 0; i < 6; i++) {
+            TEST_ASSERT_EQUAL(latest[i], delivered[i]);
+        }
+    }
+
+    // Doubling reaches the cap within 120 s: far fewer attempts than every 5 s
+    TEST_ASSERT_GREATER_OR_EQUAL(6, attempts);
+    TEST_ASSERT_LESS_OR_EQUAL(14, attempts);
+    TEST_ASSERT_GREATER_OR_EQUAL(UP_MS, reconnectedAt);
+    TEST_ASSERT_LESS_OR_EQUAL(UP_MS + MQTT_BACKOFF_MAX_MS, reconnectedAt);
+
+    // The queue stays bounded, state topics are replaced, events pushed out
+    TEST_ASSERT_EQUAL(MQTT_OUTBOX_SLOTS, maxQueued);
+    const MqttOutboxStats& stats = outbox.getStats();
+    TEST_ASSERT_GREATER_THAN(6 * 100, stats.replaced);
+    TEST_ASSERT_GREATER_THAN(10, stats.dropped);
+    TEST_ASSERT_EQUAL(0, stats.rejected);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty);
+    RUN_TEST(test_fifo_order);
+    RUN_TEST(test_same_topic_replaces_in_place);
+    RUN_TEST(test_full_queue_drops_oldest);
+    RUN_TEST(test_wraps_around);
+    RUN_TEST(test_too_long_is_rejected);
+    RUN_TEST(test_clear);
+    RUN_TEST(test_backoff_doubles_up_to_max);
+    RUN_TEST(test_backoff_jitter);
+    RUN_TEST(test_broker_outage);
+    return UNITY_END();
+}
@@ -0,0 +1,287 @@
+/*
+ * MqttRouter Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "mqtt_router.h"
+
+// Counts heap allocations, dispatch() must not make any
+static uint32_t allocations;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* memory = malloc(size);
+    if (memory == nullptr) throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t /* size */) noexcept {
+    free(memory);
+}
+
+static uint32_t calls;
+static const char* lastTopic;
+static MqttValue lastValue;
+static bool accept;
+
+static bool onValue(const MqttRoute& /* route */, const char* topic, MqttValue value) {
+    calls++;
+    lastTopic = topic;
+    lastValue = value;
+    return accept;
+}
+
+static const MqttRoute routes[] = {
+    {"ess/set/setpoint", MQTT_VALUE_INT, -5000, 5000, nullptr, 0, onValue},
+    {"ess/set/+", MQTT_VALUE_BOOL, 0, 0, nullptr, 0, onValue},
+    {"ess/#", MQTT_VALUE_FLOAT, 0, 100, nullptr, 0, onValue},
+};
+
+void setUp(void) {
+    calls = 0;
+    lastTopic = nullptr;
+    memset(&lastValue, 0, sizeof(lastValue));
+    accept = true;
+}
+
+void tearDown(void) {}
+
+void test_exact_levels(void) {
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/b", "a/b"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b", "a/c"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b", "a/bc"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/bc", "a/b"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b", "a/b/c"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b/c", "a/b"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b", "a"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/b", "A/b"));
+}
+
+void test_single_level_wildcard(void) {
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("+", "a"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/+", "a/b"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/+/c", "a/xyz/c"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/+/c", "a//c"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("+/+", "a/b"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/+", "a/b/c"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/+", "a"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/+/c", "a/b/d"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("+", "a/b"));
+}
+
+void test_multi_level_wildcard(void) {
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("#", "a"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("#", "a/b/c"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/#", "a/b"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/#", "a/b/c"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/#", "a"));
+    TEST_ASSERT_TRUE(MqttRouter::topicMatches("a/+/#", "a/b/c/d"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/#", "ab"));
+    TEST_ASSERT_FALSE(MqttRouter::topicMatches("a/#", "b/a"));
+}
+
+void test_first_match_wins(void) {
+    MqttRouter router(routes, sizeof(routes) / sizeof(routes[0]));
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, router.dispatch("ess/set/setpoint", "-1200"));
+    TEST_ASSERT_EQUAL(-1200, lastValue.i);
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, router.dispatch("ess/set/enable", "on"));
+    TEST_ASSERT_TRUE(lastValue.b);
+    TEST_ASSERT_EQUAL_STRING("ess/set/enable", lastTopic);
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, router.dispatch("ess/feedin/target", "42.5"));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 42.5f, lastValue.f);
+    TEST_ASSERT_EQUAL(3, calls);
+}
+
+void test_results_are_counted(void) {
+    MqttRouter router(routes, sizeof(routes) / sizeof(routes[0]));
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_NO_ROUTE, router.dispatch("other/topic", "1"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_INVALID, router.dispatch("ess/set/setpoint", "abc"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, router.dispatch("ess/set/setpoint", "6000"));
+    accept = false;
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_REJECTED, router.dispatch("ess/set/setpoint", "100"));
+
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(0, router.getCount(MQTT_ROUTE_OK));
+    TEST_ASSERT_EQUAL(1, router.getCount(MQTT_ROUTE_NO_ROUTE));
+    TEST_ASSERT_EQUAL(1, router.getCount(MQTT_ROUTE_INVALID));
+    TEST_ASSERT_EQUAL(1, router.getCount(MQTT_ROUTE_OUT_OF_RANGE));
+    TEST_ASSERT_EQUAL(1, router.getCount(MQTT_ROUTE_REJECTED));
+    TEST_ASSERT_EQUAL(0, router.getCount(MQTT_ROUTE_RESULT_COUNT));
+}
+
+void test_result_names(void) {
+    TEST_ASSERT_EQUAL_STRING("ok", MqttRouter::resultName(MQTT_ROUTE_OK));
+    TEST_ASSERT_EQUAL_STRING("out of range", MqttRouter::resultName(MQTT_ROUTE_OUT_OF_RANGE));
+    TEST_ASSERT_EQUAL_STRING("unknown", MqttRouter::resultName(MQTT_ROUTE_RESULT_COUNT));
+}
+
+static const MqttEnumName modes[] = {
+    {"self", 0},
+    {"charge_only", 1},
+    {"feed_in", 5},
+};
+
+static const MqttRoute boolRoute = {"b", MQTT_VALUE_BOOL, 0, 0, nullptr, 0, onValue};
+static const MqttRoute intRoute = {"i", MQTT_VALUE_INT, -5000, 5000, nullptr, 0, onValue};
+static const MqttRoute floatRoute = {"f", MQTT_VALUE_FLOAT, -0.5f, 100, nullptr, 0, onValue};
+static const MqttRoute enumRoute = {"e", MQTT_VALUE_ENUM, 0, 0, modes, 3, onValue};
+
+static MqttRouteResult parse(const MqttRoute& route, const char* payload) {
+    memset(&lastValue, 0xA5, sizeof(lastValue));
+    return MqttRouter::parseValue(route, payload, lastValue);
+}
+
+void test_parse_bool(void) {
+    const char* const trueWords[] = {"1", "true", "TRUE", "True", "on", "ON", " on\r\n", "\ttrue "};
+    for (const char* word : trueWords) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_OK, parse(boolRoute, word), word);
+        TEST_ASSERT_TRUE(lastValue.b);
+    }
+    const char* const falseWords[] = {"0", "false", "FALSE", "off", "Off", " 0 "};
+    for (const char* word : falseWords) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_OK, parse(boolRoute, word), word);
+        TEST_ASSERT_FALSE(lastValue.b);
+    }
+    const char* const invalid[] = {"", "  ", "2", "-1", "yes", "tru", "truee", "o n", "1.0", "on off"};
+    for (const char* word : invalid) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_INVALID, parse(boolRoute, word), word);
+    }
+}
+
+void test_parse_int(void) {
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(intRoute, "-1200"));
+    TEST_ASSERT_EQUAL(-1200, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(intRoute, "  +42 \n"));
+    TEST_ASSERT_EQUAL(42, lastValue.i);
+
+    // The range is inclusive
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(intRoute, "5000"));
+    TEST_ASSERT_EQUAL(5000, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(intRoute, "-5000"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(intRoute, "5001"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(intRoute, "-5001"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(intRoute, "99999999999999999999"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(intRoute, "-99999999999999999999"));
+
+    const char* const invalid[] = {"", "abc", "12abc", "1.5", "1 2", "- 1", "0x10", "1e3"};
+    for (const char* word : invalid) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_INVALID, parse(intRoute, word), word);
+    }
+}
+
+void test_parse_float(void) {
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(floatRoute, "42.5"));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 42.5f, lastValue.f);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(floatRoute, " 7 "));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 7.0f, lastValue.f);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(floatRoute, "1e1"));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 10.0f, lastValue.f);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(floatRoute, "-.5"));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, -0.5f, lastValue.f);
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(floatRoute, "100"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(floatRoute, "100.01"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(floatRoute, "-0.51"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(floatRoute, "1e30"));
+
+    // NaN and infinity never reach a handler, whatever the range
+    const char* const invalid[] = {"nan", "NaN", "-nan", "inf", "-inf", "Infinity", "1e999", "", "4,5", "5 W", "."};
+    for (const char* word : invalid) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_INVALID, parse(floatRoute, word), word);
+    }
+    const MqttRoute wide = {"w", MQTT_VALUE_FLOAT, -INFINITY, INFINITY, nullptr, 0, onValue};
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_INVALID, parse(wide, "nan"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_INVALID, parse(wide, "inf"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(wide, "-1e30"));
+}
+
+void test_parse_enum(void) {
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(enumRoute, "charge_only"));
+    TEST_ASSERT_EQUAL(1, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(enumRoute, " FEED_IN\n"));
+    TEST_ASSERT_EQUAL(5, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(enumRoute, "Self"));
+    TEST_ASSERT_EQUAL(0, lastValue.i);
+
+    // Numbers only when they are one of the values
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, parse(enumRoute, "5"));
+    TEST_ASSERT_EQUAL(5, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(enumRoute, "2"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, parse(enumRoute, "-1"));
+
+    const char* const invalid[] = {"", "charge", "charge_onlyx", "feed in", "1.0"};
+    for (const char* word : invalid) {
+        TEST_ASSERT_EQUAL_MESSAGE(MQTT_ROUTE_INVALID, parse(enumRoute, word), word);
+    }
+}
+
+void test_handler_gets_parsed_value_only(void) {
+    static const MqttRoute table[] = {
+        {"ess/set/mode", MQTT_VALUE_ENUM, 0, 0, modes, 3, onValue},
+        {"ess/set/limit", MQTT_VALUE_FLOAT, 0, 50, nullptr, 0, onValue},
+    };
+    MqttRouter router(table, 2);
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_INVALID, router.dispatch("ess/set/limit", "nan"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OUT_OF_RANGE, router.dispatch("ess/set/limit", "50.5"));
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_INVALID, router.dispatch("ess/set/mode", "turbo"));
+    TEST_ASSERT_EQUAL(0, calls);
+
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, router.dispatch("ess/set/mode", "feed_in"));
+    TEST_ASSERT_EQUAL(5, lastValue.i);
+    TEST_ASSERT_EQUAL(MQTT_ROUTE_OK, router.dispatch("ess/set/limit", "12.5"));
+    TEST_ASSERT_FLOAT_WITHIN(0.0001f, 12.5f, lastValue.f);
+    TEST_ASSERT_EQUAL(2, calls);
+}
+
+void test_dispatch_does_not_allocate(void) {
+    MqttRouter router(routes, sizeof(routes) / sizeof(routes[0]));
+    const char* const messages[][2] = {
+        {"ess/set/setpoint", "-1200"},
+        {"ess/set/enable", "on"},
+        {"ess/feedin/target", "42.5"},
+        {"ess/feedin/target", "nan"},
+        {"other/topic", "1"},
+    };
+
+    allocations = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        for (const auto& message : messages) {
+            router.dispatch(message[0], message[1]);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL(3000, calls);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_exact_levels);
+    RUN_TEST(test_single_level_wildcard);
+    RUN_TEST(test_multi_level_wildcard);
+    RUN_TEST(test_first_match_wins);
+    RUN_TEST(test_results_are_counted);
+    RUN_TEST(test_result_names);
+    RUN_TEST(test_parse_bool);
+    RUN_TEST(test_parse_int);
+    RUN_TEST(test_parse_float);
+    RUN_TEST(test_parse_enum);
+    RUN_TEST(test_handler_gets_parsed_value_only);
+    RUN_TEST(test_dispatch_does_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,221 @@
+/*
+ * PerfHistogram Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "perf_histogram.h"
+#include "perf_monitor.h"
+
+static PerfHistogram* histogram;
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Percentile the way PerfHistogram::percentile() ranks: smallest value with at least percent of the samples
+static uint32_t exactPercentile(std::vector<uint32_t>& values, uint8_t percent) {
+    std::sort(values.begin(), values.end());
+    size_t rank = ((uint64_t)values.size() * percent + 99) / 100;
+    return values[rank == 0 ? 0 : rank - 1];
+}
+
+void setUp(void) {
+    histogram = new PerfHistogram();
+}
+
+void tearDown(void) {
+    delete histogram;
+}
+
+void test_bucket_bounds(void) {
+    TEST_ASSERT_EQUAL(0, PerfHistogram::bucketLow(0));
+    TEST_ASSERT_EQUAL(UINT32_MAX, PerfHistogram::bucketHigh(PERF_HISTOGRAM_BUCKETS - 1));
+    TEST_ASSERT_EQUAL(PERF_HISTOGRAM_BUCKETS - 1, PerfHistogram::bucketOf(UINT32_MAX));
+
+    for (uint16_t b = 0; b < PERF_HISTOGRAM_BUCKETS; b++) {
+        uint32_t low = PerfHistogram::bucketLow(b);
+        uint32_t high = PerfHistogram::bucketHigh(b);
+        TEST_ASSERT_LESS_OR_EQUAL(high, low);
+        TEST_ASSERT_EQUAL(b, PerfHistogram::bucketOf(low));
+        TEST_ASSERT_EQUAL(b, PerfHistogram::bucketOf(high));
+        if (b + 1 < PERF_HISTOGRAM_BUCKETS) {
+            // Contiguous, no value without a bucket
+            TEST_ASSERT_EQUAL(high + 1, PerfHistogram::bucketLow(b + 1));
+        }
+        // Every bucket spans at most a quarter of its lower bound
+        if (low >= PERF_HISTOGRAM_SUB_BUCKETS) {
+            TEST_ASSERT_LESS_OR_EQUAL((uint64_t)low / 4, (uint64_t)high - low + 1);
+        } else {
+            TEST_ASSERT_EQUAL(low, high);
+        }
+    }
+}
+
+void test_bucket_of_matches_bounds(void) {
+    uint32_t state = 1;
+    for (uint32_t i = 0; i < 200000; i++) {
+        // Spread over all octaves
+        uint32_t value = random32(state) >> (random32(state) % 32);
+        uint8_t b = PerfHistogram::bucketOf(value);
+        TEST_ASSERT_LESS_THAN(PERF_HISTOGRAM_BUCKETS, b);
+        TEST_ASSERT_LESS_OR_EQUAL(value, PerfHistogram::bucketLow(b));
+        TEST_ASSERT_GREATER_OR_EQUAL(value, PerfHistogram::bucketHigh(b));
+    }
+}
+
+void test_empty(void) {
+    TEST_ASSERT_EQUAL(0, histogram->getCount());
+    TEST_ASSERT_EQUAL(0, histogram->getMin());
+    TEST_ASSERT_EQUAL(0, histogram->getMax());
+    TEST_ASSERT_EQUAL(0, histogram->getMean());
+    TEST_ASSERT_EQUAL(0, histogram->percentile(50));
+}
+
+void test_count_min_max_mean(void) {
+    const uint32_t values[] = {1000, 3, 250000, 0, 1000, 77};
+    uint64_t sum = 0;
+    for (uint32_t value : values) {
+        histogram->record(value);
+        sum += value;
+    }
+    TEST_ASSERT_EQUAL(6, histogram->getCount());
+    TEST_ASSERT_EQUAL(0, histogram->getMin());
+    TEST_ASSERT_EQUAL(250000, histogram->getMax());
+    TEST_ASSERT_EQUAL(sum / 6, histogram->getMean());
+    TEST_ASSERT_EQUAL(2, histogram->getBucket(PerfHistogram::bucketOf(1000)));
+
+    // The ends are exact
+    TEST_ASSERT_EQUAL(0, histogram->percentile(0));
+    TEST_ASSERT_EQUAL(250000, histogram->percentile(100));
+    TEST_ASSERT_EQUAL(250000, histogram->percentile(200));
+
+    // A single value is reported exactly
+    PerfHistogram single;
+    single.record(12345);
+    TEST_ASSERT_EQUAL(12345, single.percentile(50));
+    TEST_ASSERT_EQUAL(12345, single.percentile(99));
+}
+
+void test_percentile_rank(void) {
+    // Values below 8 have a bucket each, 10 is the max: the percentiles of 1..10 are exact
+    for (uint32_t value = 10; value >= 1; value--) {
+        histogram->record(value);
+    }
+    TEST_ASSERT_EQUAL(1, histogram->percentile(1));
+    TEST_ASSERT_EQUAL(1, histogram->percentile(10));
+    TEST_ASSERT_EQUAL(2, histogram->percentile(11));
+    TEST_ASSERT_EQUAL(3, histogram->percentile(25));
+    TEST_ASSERT_EQUAL(5, histogram->percentile(50));
+    TEST_ASSERT_EQUAL(10, histogram->percentile(91));
+}
+
+void test_percentile_error(void) {
+    // Log-uniform, narrow, bimodal and with a long tail
+    for (uint8_t distribution = 0; distribution < 4; distribution++) {
+        PerfHistogram h;
+        std::vector<uint32_t> values;
+        uint32_t state = 1234 + distribution;
+        for (uint32_t i = 0; i < 50000; i++) {
+            uint32_t r = random32(state);
+            uint32_t value;
+            switch (distribution) {
+                case 0: value = (uint32_t)exp2((r % 28000) / 1000.0); break;
+                case 1: value = 5000 + r % 400; break;
+                case 2: value = (r & 1) ? 800 + r % 50 : 90000 + r % 9000; break;
+                default: value = (r % 100 == 0) ? 2000000 + r % 1000000 : 3000 + r % 3000; break;
+            }
+            h.record(value);
+            values.push_back(value);
+        }
+
+        const uint8_t percents[] = {1, 10, 25, 50, 75, 90, 95, 99};
+        for (uint8_t percent : percents) {
+            uint32_t exact = exactPercentile(values, percent);
+            uint32_t estimate = h.percentile(percent);
+            // Upper end of the right bucket: never below, at most 25 % above
+            TEST_ASSERT_GREATER_OR_EQUAL(exact, estimate);
+            TEST_ASSERT_LESS_OR_EQUAL((uint64_t)exact * 5 / 4 + 1, estimate);
+        }
+    }
+}
+
+void test_deferred_reset(void) {
+    uint8_t bucket = PerfHistogram::bucketOf(500);
+    uint32_t inBucket = 0;
+    for (uint32_t i = 1; i <= 100; i++) {
+        histogram->record(i * 10);
+        inBucket += PerfHistogram::bucketOf(i * 10) == bucket;
+    }
+
+    // The readers see an empty histogram at once, the data is cleared by the next record()
+    histogram->reset();
+    TEST_ASSERT_EQUAL(0, histogram->getCount());
+    TEST_ASSERT_EQUAL(0, histogram->getMax());
+    TEST_ASSERT_EQUAL(0, histogram->getMean());
+    TEST_ASSERT_EQUAL(0, histogram->percentile(50));
+    TEST_ASSERT_EQUAL(inBucket, histogram->getBucket(bucket));
+
+    histogram->record(7);
+    TEST_ASSERT_EQUAL(1, histogram->getCount());
+    TEST_ASSERT_EQUAL(7, histogram->getMin());
+    TEST_ASSERT_EQUAL(7, histogram->getMax());
+    TEST_ASSERT_EQUAL(7, histogram->getMean());
+    TEST_ASSERT_EQUAL(0, histogram->getBucket(bucket));
+}
+
+void test_reset_from_another_thread(void) {
+    // The recording thread never loses a record taken after the reset
+    std::thread recorder([]() {
+        for (uint32_t i = 0; i < 1000; i++) {
+            histogram->record(1000);
+        }
+    });
+    recorder.join();
+    std::thread resetter([]() { histogram->reset(); });
+    resetter.join();
+    std::thread second([]() {
+        for (uint32_t i = 0; i < 10; i++) {
+            histogram->record(20);
+        }
+    });
+    second.join();
+    TEST_ASSERT_EQUAL(10, histogram->getCount());
+    TEST_ASSERT_EQUAL(20, histogram->getMax());
+}
+
+void test_host_cycle_counter(void) {
+    // On the host the "cycles" of PerfScope are nanoseconds
+    uint32_t start = PerfMonitor::cycles();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    uint32_t elapsed = PerfMonitor::cycles() - start;
+    TEST_ASSERT_GREATER_OR_EQUAL(2000000, elapsed);
+    TEST_ASSERT_LESS_THAN(500000000, elapsed);
+    histogram->record(elapsed);
+    TEST_ASSERT_EQUAL(elapsed, histogram->percentile(99));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_bucket_bounds);
+    RUN_TEST(test_bucket_of_matches_bounds);
+    RUN_TEST(test_empty);
+    RUN_TEST(test_count_min_max_mean);
+    RUN_TEST(test_percentile_rank);
+    RUN_TEST(test_percentile_error);
+    RUN_TEST(test_deferred_reset);
+    RUN_TEST(test_reset_from_another_thread);
+    RUN_TEST(test_host_cycle_counter);
+    return UNITY_END();
+}
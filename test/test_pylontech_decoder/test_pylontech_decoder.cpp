@@ -0,0 +1,344 @@
+/*
+ * PylontechDecoder Tests
+ *
+ * Besides single frames, a trace in candump -L format is replayed: six
+ * broadcast cycles of a three module Pylontech stack going from charging to
+ * discharging, with inverter traffic on the same bus that the TWAI
+ * acceptance filter keeps away from the decoder.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "pylontech_decoder.h"
+
+static PylontechDecoder decoder;
+
+void setUp(void) {
+    decoder = PylontechDecoder();
+}
+
+void tearDown(void) {}
+
+static bool decode(uint32_t id, const uint8_t* data, uint8_t length, uint32_t nowMs = 1000) {
+    return decoder.decode(id, false, false, data, length, nowMs);
+}
+
+void test_initial_state(void) {
+    const PylontechBatteryState& state = decoder.getState();
+    TEST_ASSERT_EQUAL(-1, state.soc);
+    TEST_ASSERT_EQUAL(-1, state.soh);
+    TEST_ASSERT_EQUAL(UINT32_MAX, state.age(PYLONTECH_FRAME_MEASUREMENTS, 5000));
+    TEST_ASSERT_EQUAL(0, decoder.takeUpdated());
+}
+
+void test_limits(void) {
+    // 56.8 V, 50.0 A, 100.0 A, 48.0 V
+    const uint8_t data[] = {0x38, 0x02, 0xF4, 0x01, 0xE8, 0x03, 0xE0, 0x01};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_LIMITS_ID, data, sizeof(data)));
+    const PylontechBatteryState& state = decoder.getState();
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 56.8f, state.chargeVoltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 50.0f, state.chargeCurrentLimit);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 100.0f, state.dischargeCurrentLimit);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 48.0f, state.dischargeVoltage);
+}
+
+void test_limits_without_discharge_voltage(void) {
+    const uint8_t data[] = {0x38, 0x02, 0xF4, 0x01, 0xE8, 0x03};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_LIMITS_ID, data, sizeof(data)));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.0f, decoder.getState().dischargeVoltage);
+}
+
+void test_soc(void) {
+    const uint8_t data[] = {85, 0, 99, 0};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_SOC_ID, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(85, decoder.getState().soc);
+    TEST_ASSERT_EQUAL(99, decoder.getState().soh);
+}
+
+void test_measurements_and_power(void) {
+    // 52.34 V, -12.5 A (charging), 23.4 °C
+    const uint8_t data[] = {0x72, 0x14, 0x83, 0xFF, 0xEA, 0x00};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MEASUREMENTS_ID, data, sizeof(data)));
+    const PylontechBatteryState& state = decoder.getState();
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 52.34f, state.voltage);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -12.5f, state.current);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 23.4f, state.temperature);
+    TEST_ASSERT_EQUAL(-654, state.power);
+}
+
+void test_negative_temperature(void) {
+    // -5.0 °C
+    const uint8_t data[] = {0x72, 0x14, 0x00, 0x00, 0xCE, 0xFF};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MEASUREMENTS_ID, data, sizeof(data)));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, -5.0f, decoder.getState().temperature);
+}
+
+void test_alarms(void) {
+    const uint8_t data[] = {0x01, 0x02, 0x04, 0x08, 0x03};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_ALARMS_ID, data, sizeof(data)));
+    const PylontechBatteryState& state = decoder.getState();
+    TEST_ASSERT_EQUAL_HEX8(0x01, state.protectionFlags1);
+    TEST_ASSERT_EQUAL_HEX8(0x02, state.protectionFlags2);
+    TEST_ASSERT_EQUAL_HEX8(0x04, state.warningFlags1);
+    TEST_ASSERT_EQUAL_HEX8(0x08, state.warningFlags2);
+    TEST_ASSERT_EQUAL(3, state.modules);
+}
+
+void test_request_flags(void) {
+    const uint8_t data[] = {0xC0, 0x00};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_REQUEST_ID, data, sizeof(data)));
+    TEST_ASSERT_EQUAL_HEX8(0xC0, decoder.getState().requestFlags);
+}
+
+void test_manufacturer(void) {
+    const uint8_t padded[] = {'P', 'Y', 'L', 'O', 'N', ' ', ' ', ' '};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MANUFACTURER_ID, padded, sizeof(padded)));
+    TEST_ASSERT_EQUAL_STRING("PYLON", decoder.getState().manufacturer);
+
+    const uint8_t zeroPadded[] = {'P', 'Y', 'L', 0x01, 0x00, 0x00};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MANUFACTURER_ID, zeroPadded, sizeof(zeroPadded)));
+    TEST_ASSERT_EQUAL_STRING("PYL?", decoder.getState().manufacturer);
+
+    const uint8_t full[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H'};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MANUFACTURER_ID, full, sizeof(full)));
+    TEST_ASSERT_EQUAL_STRING("ABCDEFGH", decoder.getState().manufacturer);
+}
+
+void test_too_short(void) {
+    const uint8_t data[] = {0x72, 0x14, 0x83, 0xFF, 0xEA};
+    TEST_ASSERT_FALSE(decode(PYLONTECH_MEASUREMENTS_ID, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(1, decoder.getStats().tooShort);
+    TEST_ASSERT_EQUAL(0, decoder.getStats().decoded);
+    TEST_ASSERT_EQUAL(0, decoder.takeUpdated());
+}
+
+void test_ignored_frames(void) {
+    const uint8_t data[8] = {0};
+    TEST_ASSERT_FALSE(decode(0x350, data, 8));
+    TEST_ASSERT_FALSE(decode(0x35F, data, 8));
+    TEST_ASSERT_FALSE(decode(0x700, data, 8));
+    TEST_ASSERT_FALSE(decoder.decode(PYLONTECH_SOC_ID, true, false, data, 8, 1000));
+    TEST_ASSERT_FALSE(decoder.decode(PYLONTECH_SOC_ID, false, true, data, 0, 1000));
+    TEST_ASSERT_EQUAL(5, decoder.getStats().frames);
+    TEST_ASSERT_EQUAL(5, decoder.getStats().ignored);
+    TEST_ASSERT_EQUAL(-1, decoder.getState().soc);
+}
+
+void test_update_bits_and_timestamps(void) {
+    const uint8_t soc[] = {50, 0, 100, 0};
+    const uint8_t measurements[] = {0x72, 0x14, 0x00, 0x00, 0xEA, 0x00};
+    decode(PYLONTECH_SOC_ID, soc, sizeof(soc), 1000);
+    decode(PYLONTECH_MEASUREMENTS_ID, measurements, sizeof(measurements), 1200);
+
+    TEST_ASSERT_EQUAL_HEX8(PYLONTECH_UPDATED(PYLONTECH_FRAME_SOC) | PYLONTECH_UPDATED(PYLONTECH_FRAME_MEASUREMENTS),
+                           decoder.takeUpdated());
+    TEST_ASSERT_EQUAL(0, decoder.takeUpdated());
+
+    const PylontechBatteryState& state = decoder.getState();
+    TEST_ASSERT_EQUAL(1000, state.age(PYLONTECH_FRAME_SOC, 2000));
+    TEST_ASSERT_EQUAL(800, state.age(PYLONTECH_FRAME_MEASUREMENTS, 2000));
+    TEST_ASSERT_EQUAL(UINT32_MAX, state.age(PYLONTECH_FRAME_LIMITS, 2000));
+    TEST_ASSERT_EQUAL(2, decoder.getStats().decoded);
+}
+
+void test_long_frame_is_clamped(void) {
+    // DLC up to 15 is legal on the wire, only 8 data bytes exist
+    const uint8_t data[8] = {'X', 'Y', 'Z', ' ', ' ', ' ', ' ', ' '};
+    TEST_ASSERT_TRUE(decode(PYLONTECH_MANUFACTURER_ID, data, 15));
+    TEST_ASSERT_EQUAL_STRING("XYZ", decoder.getState().manufacturer);
+}
+
+static const char* const RECORDED_TRACE[] = {
+    "(1697040000.000) can0 359#0000000003504E",
+    "(1697040000.002) can0 351#1402FA00FA00E001",
+    "(1697040000.004) can0 355#4E006400",
+    "(1697040000.006) can0 356#781438FFB400",
+    "(1697040000.008) can0 35C#C000",
+    "(1697040000.010) can0 35E#50594C4F4E202020",
+    "(1697040000.998) can0 359#0000000003504E",
+    "(1697040001.000) can0 351#1402FA00FA00E001",
+    "(1697040001.002) can0 355#4E006400",
+    "(1697040001.004) can0 356#7E143DFFB500",
+    "(1697040001.006) can0 35C#C000",
+    "(1697040001.008) can0 35E#50594C4F4E202020",
+    "(1697040001.996) can0 359#0000000003504E",
+    "(1697040001.998) can0 351#1402FA00FA00E001",
+    "(1697040002.000) can0 355#4F006400",
+    "(1697040002.002) can0 305#0000000000000000",
+    "(1697040002.003) can0 356#8314AEFFB700",
+    "(1697040002.005) can0 35C#C000",
+    "(1697040002.007) can0 35E#50594C4F4E202020",
+    "(1697040002.995) can0 359#0000000003504E",
+    "(1697040002.997) can0 351#1402FA00FA00E001",
+    "(1697040002.999) can0 355#4F006400",
+    "(1697040003.001) can0 356#4E140000B700",
+    "(1697040003.003) can0 18FF50E5#0102030405060708",
+    "(1697040003.004) can0 35C#C000",
+    "(1697040003.006) can0 35E#50594C4F4E202020",
+    "(1697040003.994) can0 359#0000080003504E",
+    "(1697040003.996) can0 351#1402FA00FA00E001",
+    "(1697040003.998) can0 355#4F006400",
+    "(1697040004.000) can0 356#35147B00B800",
+    "(1697040004.002) can0 351#R",
+    "(1697040004.003) can0 35C#C000",
+    "(1697040004.005) can0 35E#50594C4F4E202020",
+    "(1697040004.993) can0 359#0000080003504E",
+    "(1697040004.995) can0 351#1402FA00FA00E001",
+    "(1697040004.997) can0 355#4E006400",
+    "(1697040004.999) can0 356#28149700BA00",
+    "(1697040005.001) can0 35C#8000",
+    "(1697040005.003) can0 35E#50594C4F4E202020",
+};
+
+struct TraceFrame {
+    uint32_t timeMs;                    // Since the first frame, plus 1 (0 means never)
+    uint32_t id;
+    bool extended;
+    bool remote;
+    uint8_t data[8];
+    uint8_t length;
+};
+
+static bool parseTraceLine(const char* line, TraceFrame& frame) {
+    unsigned seconds;
+    unsigned milliseconds;
+    char id[9];
+    char payload[17];
+    int fields = sscanf(line, "(%u.%u) can0 %8[0-9A-F]#%16[0-9A-FR]", &seconds, &milliseconds, id, payload);
+    if (fields < 3) return false;
+    if (fields == 3) payload[0] = '\0';
+
+    frame.timeMs = (seconds - 1697040000u) * 1000 + milliseconds + 1;
+    frame.id = strtoul(id, nullptr, 16);
+    frame.extended = strlen(id) == 8;
+    frame.remote = strcmp(payload, "R") == 0;
+    frame.length = 0;
+    for (const char* hex = payload; !frame.remote && hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+        char byte[3] = {hex[0], hex[1], '\0'};
+        frame.data[frame.length++] = (uint8_t)strtoul(byte, nullptr, 16);
+    }
+    return true;
+}
+
+// What the TWAI single filter does with a standard frame ID
+static bool passesFilter(uint32_t id, bool extended) {
+    if (extended) return false;
+    return (((id << 21) ^ PYLONTECH_FILTER_CODE) & ~PYLONTECH_FILTER_MASK & 0xFFE00000UL) == 0;
+}
+
+void test_acceptance_filter(void) {
+    for (uint32_t id = 0; id < 0x800; id++) {
+        TEST_ASSERT_EQUAL(id >= 0x350 && id <= 0x35F, passesFilter(id, false));
+    }
+    TEST_ASSERT_FALSE(passesFilter(0x351, true));
+}
+
+void test_recorded_cycles(void) {
+    struct Cycle {
+        float voltage;
+        float current;
+        float temperature;
+        int16_t soc;
+        int32_t power;
+        uint8_t warningFlags1;
+        uint8_t requestFlags;
+    };
+    const Cycle expected[] = {
+        {52.40f, -20.0f, 18.0f, 78, -1048, 0x00, 0xC0},
+        {52.46f, -19.5f, 18.1f, 78, -1022, 0x00, 0xC0},
+        {52.51f, -8.2f, 18.3f, 79, -430, 0x00, 0xC0},
+        {51.98f, 0.0f, 18.3f, 79, 0, 0x00, 0xC0},
+        {51.73f, 12.3f, 18.4f, 79, 636, 0x08, 0xC0},
+        {51.60f, 15.1f, 18.6f, 78, 779, 0x08, 0x80},
+    };
+    const uint8_t allFrames = (1u << PYLONTECH_FRAME_COUNT) - 1;
+
+    uint8_t cycle = 0;
+    uint32_t filtered = 0;
+    for (const char* line : RECORDED_TRACE) {
+        TraceFrame frame;
+        TEST_ASSERT_TRUE_MESSAGE(parseTraceLine(line, frame), line);
+        if (!passesFilter(frame.id, frame.extended)) {
+            filtered++;
+            continue;
+        }
+        decoder.decode(frame.id, frame.extended, frame.remote, frame.data, frame.length, frame.timeMs);
+        if (frame.id != PYLONTECH_MANUFACTURER_ID) continue;
+
+        // 0x35E ends a cycle: every frame of it is in, values from this cycle only
+        TEST_ASSERT_LESS_THAN(6, cycle);
+        const Cycle& want = expected[cycle];
+        const PylontechBatteryState& state = decoder.getState();
+        TEST_ASSERT_EQUAL_HEX8(allFrames, decoder.takeUpdated());
+        TEST_ASSERT_FLOAT_WITHIN(0.001f, want.voltage, state.voltage);
+        TEST_ASSERT_FLOAT_WITHIN(0.001f, want.current, state.current);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, want.temperature, state.temperature);
+        TEST_ASSERT_EQUAL(want.soc, state.soc);
+        TEST_ASSERT_EQUAL(100, state.soh);
+        TEST_ASSERT_EQUAL(want.power, state.power);
+        TEST_ASSERT_EQUAL_HEX8(want.warningFlags1, state.warningFlags1);
+        TEST_ASSERT_EQUAL_HEX8(0, state.protectionFlags1);
+        TEST_ASSERT_EQUAL_HEX8(want.requestFlags, state.requestFlags);
+        TEST_ASSERT_EQUAL(3, state.modules);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, 53.2f, state.chargeVoltage);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, state.chargeCurrentLimit);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, 25.0f, state.dischargeCurrentLimit);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f, 48.0f, state.dischargeVoltage);
+        TEST_ASSERT_EQUAL_STRING("PYLON", state.manufacturer);
+
+        // The whole cycle arrived within a few ms
+        for (uint8_t f = 0; f < PYLONTECH_FRAME_COUNT; f++) {
+            TEST_ASSERT_LESS_THAN(20, state.age((PylontechFrame)f, frame.timeMs));
+        }
+        cycle++;
+    }
+    TEST_ASSERT_EQUAL(6, cycle);
+
+    // The inverter keepalive and the extended frame never reach the decoder,
+    // the remote request for 0x351 does and is ignored
+    TEST_ASSERT_EQUAL(2, filtered);
+    const PylontechDecoderStats& stats = decoder.getStats();
+    TEST_ASSERT_EQUAL(37, stats.frames);
+    TEST_ASSERT_EQUAL(36, stats.decoded);
+    TEST_ASSERT_EQUAL(1, stats.ignored);
+    TEST_ASSERT_EQUAL(0, stats.tooShort);
+}
+
+void test_recorded_trace_unfiltered(void) {
+    // Without the hardware filter the decoder sorts out the foreign frames itself
+    for (const char* line : RECORDED_TRACE) {
+        TraceFrame frame;
+        TEST_ASSERT_TRUE(parseTraceLine(line, frame));
+        decoder.decode(frame.id, frame.extended, frame.remote, frame.data, frame.length, frame.timeMs);
+    }
+    const PylontechDecoderStats& stats = decoder.getStats();
+    TEST_ASSERT_EQUAL(39, stats.frames);
+    TEST_ASSERT_EQUAL(36, stats.decoded);
+    TEST_ASSERT_EQUAL(3, stats.ignored);
+    TEST_ASSERT_EQUAL(779, decoder.getState().power);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_initial_state);
+    RUN_TEST(test_limits);
+    RUN_TEST(test_limits_without_discharge_voltage);
+    RUN_TEST(test_soc);
+    RUN_TEST(test_measurements_and_power);
+    RUN_TEST(test_negative_temperature);
+    RUN_TEST(test_alarms);
+    RUN_TEST(test_request_flags);
+    RUN_TEST(test_manufacturer);
+    RUN_TEST(test_too_short);
+    RUN_TEST(test_ignored_frames);
+    RUN_TEST(test_update_bits_and_timestamps);
+    RUN_TEST(test_long_frame_is_clamped);
+    RUN_TEST(test_acceptance_filter);
+    RUN_TEST(test_recorded_cycles);
+    RUN_TEST(test_recorded_trace_unfiltered);
+    return UNITY_END();
+}
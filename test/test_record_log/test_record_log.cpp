@@ -0,0 +1,529 @@
+/*
+ * RecordLog Tests
+ *
+ * The log runs on SimulatedFlash, a NOR flash in RAM: erase sets a sector to
+ * 0xFF, writes can only clear bits, and every erase is counted per sector.
+ * Power loss is injected at a chosen flash operation: that write stores only
+ * the start or the end of its data plus one partly programmed byte, that
+ * erase leaves the sector half erased, and every later operation fails until
+ * power returns.
+ * The workload is cut at every flash operation in turn; after each cut a new
+ * RecordLog mounts the flash and the surviving records are checked against
+ * what had been flushed before the cut.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "record_log.h"
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_SECTORS 8
+#define WORKLOAD_STEPS 1500         // Fills the flash more than twice
+#define WEAR_STEPS 60000
+
+// Record types as EventLog uses them: keyed snapshots below RECORD_LOG_KEYS
+#define TYPE_SNAPSHOT 0
+#define TYPE_SETTINGS 1
+#define TYPE_EVENT 16
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+class SimulatedFlash : public LogFlash {
+private:
+    uint8_t memory[FLASH_SECTORS * FLASH_SECTOR_SIZE];
+    uint32_t eraseCounts[FLASH_SECTORS];
+    uint32_t operations;
+    uint32_t cutAt;                 // Operation that loses power, UINT32_MAX = never
+    bool keepPower;                 // The failed operation is a write error, not a power loss
+    bool powered;
+    uint32_t random;
+
+    bool step() {
+        if (!powered) {
+            return false;
+        }
+        return operations++ != cutAt;
+    }
+
+public:
+    uint32_t writes;
+    uint32_t bitsSet;               // Writes that tried to turn a 0 bit back into 1
+
+    SimulatedFlash() : operations(0), cutAt(UINT32_MAX), keepPower(false), powered(true), random(0x1234567), writes(0), bitsSet(0) {
+        memset(memory, 0xFF, sizeof(memory));
+        memset(eraseCounts, 0, sizeof(eraseCounts));
+    }
+
+    void cutPowerAt(uint32_t operation, uint32_t seed) {
+        operations = 0;
+        cutAt = operation;
+        keepPower = false;
+        random = seed | 1;
+    }
+
+    void failAt(uint32_t operation) {
+        cutPowerAt(operation, 99);
+        keepPower = true;
+    }
+
+    void powerOn() {
+        powered = true;
+        cutAt = UINT32_MAX;
+    }
+
+    bool isPowered() const { return powered; }
+    uint32_t getOperations() const { return operations; }
+    uint32_t getEraseCount(uint8_t sector) const { return eraseCounts[sector]; }
+
+    uint32_t getSize() const override { return sizeof(memory); }
+    uint32_t getSectorSize() const override { return FLASH_SECTOR_SIZE; }
+
+    bool read(uint32_t address, void* data, size_t length) override {
+        if (!powered || address + length > sizeof(memory)) {
+            return false;
+        }
+        memcpy(data, &memory[address], length);
+        return true;
+    }
+
+    bool write(uint32_t address, const void* data, size_t length) override {
+        TEST_ASSERT_LESS_OR_EQUAL(sizeof(memory), address + length);
+        const uint8_t* bytes = (const uint8_t*)data;
+        bool complete = step();
+        if (!complete && !powered) {
+            return false;
+        }
+        size_t start = 0;
+        size_t end = length;
+        if (!complete && length > 0) {
+            // Either the start or the end of the data got programmed
+            size_t count = random32(random) % length;
+            if (random32(random) % 2 == 0) {
+                end = count;
+            } else {
+                start = length - count;
+            }
+        }
+        for (size_t i = start; i < end; i++) {
+            bitsSet += (bytes[i] & ~memory[address + i]) != 0;
+            memory[address + i] &= bytes[i];
+        }
+        writes++;
+        if (!complete) {
+            // One more byte partly programmed
+            size_t partial = start > 0 ? start - 1 : end;
+            if (partial < length) {
+                memory[address + partial] &= bytes[partial] | (uint8_t)random32(random);
+            }
+            powered = keepPower;
+        }
+        return complete;
+    }
+
+    bool eraseSector(uint32_t address) override {
+        TEST_ASSERT_EQUAL(0, address % FLASH_SECTOR_SIZE);
+        uint8_t sector = address / FLASH_SECTOR_SIZE;
+        bool complete = step();
+        if (!complete && !powered) {
+            return false;
+        }
+        uint8_t* data = &memory[address];
+        if (complete) {
+            memset(data, 0xFF, FLASH_SECTOR_SIZE);
+        } else {
+            // Half erased: a random part of the sector is back to 0xFF, at
+            // worst everything but the segment header
+            uint32_t start = random32(random) % 2 == 0 ? RECORD_LOG_SEGMENT_HEADER : 0;
+            for (uint32_t i = start; i < FLASH_SECTOR_SIZE; i++) {
+                if (start > 0 || random32(random) % 2 == 0) {
+                    data[i] = 0xFF;
+                }
+            }
+            powered = keepPower;
+        }
+        eraseCounts[sector]++;
+        return complete;
+    }
+};
+
+// Self-checking payloads: number, length and a fill derived from both
+struct Payload {
+    uint32_t number;
+    uint8_t fill[96];
+};
+
+static uint16_t fillPayload(Payload& payload, uint32_t number, uint16_t length) {
+    payload.number = number;
+    for (uint16_t i = 0; i + 4u < length; i++) {
+        payload.fill[i] = (uint8_t)(number * 31 + i + length);
+    }
+    return length;
+}
+
+static bool checkPayload(const Payload& payload, uint16_t length) {
+    if (length < 4 || length > sizeof(Payload)) {
+        return false;
+    }
+    for (uint16_t i = 0; i + 4u < length; i++) {
+        if (payload.fill[i] != (uint8_t)(payload.number * 31 + i + length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the writer knows: appended numbers and those that were flushed
+struct Progress {
+    uint32_t event;
+    uint32_t snapshot;
+    uint32_t durableEvent;
+    uint32_t durableSnapshot;
+    uint32_t firstEventAfterMount;
+};
+
+static SimulatedFlash* flash;
+
+// One step of the EventLog pattern: settings once, then mostly events, a
+// snapshot every 10th step, a flush every 5th. The settings record is only
+// kept by compaction. False once the flash failed.
+static bool workloadStep(RecordLog& log, Progress& progress, uint32_t step, uint32_t& random) {
+    Payload payload;
+    bool ok;
+    if (step == 1 && !log.append(TYPE_SETTINGS, &payload, fillPayload(payload, 1000, 40))) {
+        return false;
+    }
+    if (step % 10 == 0) {
+        progress.snapshot++;
+        ok = log.append(TYPE_SNAPSHOT, &payload, fillPayload(payload, progress.snapshot, 64));
+    } else {
+        progress.event++;
+        uint16_t length = 4 + random32(random) % (sizeof(payload.fill) + 1);
+        ok = log.append(TYPE_EVENT, &payload, fillPayload(payload, progress.event, length));
+    }
+    if (ok && step % 5 == 0) {
+        ok = log.flush();
+        if (ok) {
+            progress.durableEvent = progress.event;
+            progress.durableSnapshot = progress.snapshot;
+        }
+    }
+    return ok;
+}
+
+// Records after a mount: nothing torn, durable data complete
+static void verify(RecordLog& log, const Progress& progress) {
+    Payload payload;
+    uint16_t length;
+    if (log.readLatest(TYPE_SNAPSHOT, &payload, sizeof(payload), length)) {
+        TEST_ASSERT_TRUE(checkPayload(payload, length));
+        TEST_ASSERT_GREATER_OR_EQUAL(progress.durableSnapshot, payload.number);
+        TEST_ASSERT_LESS_OR_EQUAL(progress.snapshot, payload.number);
+    } else {
+        TEST_ASSERT_EQUAL(0, progress.durableSnapshot);
+    }
+    if (progress.durableEvent > 0) {
+        TEST_ASSERT_TRUE(log.readLatest(TYPE_SETTINGS, &payload, sizeof(payload), length));
+        TEST_ASSERT_EQUAL(1000, payload.number);
+        TEST_ASSERT_TRUE(checkPayload(payload, length));
+    }
+
+    LogCursor cursor;
+    LogRecordInfo info;
+    log.rewind(cursor);
+    uint32_t last = 0;
+    uint32_t events = 0;
+    while (log.next(cursor, info, &payload, sizeof(payload))) {
+        TEST_ASSERT_TRUE(checkPayload(payload, info.length));
+        if (info.type != TYPE_EVENT) {
+            TEST_ASSERT_TRUE(info.type == TYPE_SNAPSHOT || info.type == TYPE_SETTINGS);
+            continue;
+        }
+        TEST_ASSERT_LESS_OR_EQUAL(progress.event, payload.number);
+        if (events > 0) {
+            // Oldest first; flushed events have no gaps, the unflushed tail
+            // of an earlier power loss may be missing
+            TEST_ASSERT_GREATER_THAN(last, payload.number);
+            if (payload.number <= progress.durableEvent && payload.number < progress.firstEventAfterMount) {
+                TEST_ASSERT_EQUAL(last + 1, payload.number);
+            }
+        }
+        last = payload.number;
+        events++;
+    }
+    if (progress.durableEvent > 0) {
+        TEST_ASSERT_GREATER_OR_EQUAL(progress.durableEvent, last);
+    }
+}
+
+void setUp(void) {
+    flash = new SimulatedFlash();
+}
+
+void tearDown(void) {
+    delete flash;
+}
+
+void test_mount_blank_flash(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_TRUE(log.mount());
+    RecordLogStats stats = log.getStats();
+    TEST_ASSERT_EQUAL(FLASH_SECTORS, stats.segments);
+    TEST_ASSERT_EQUAL(0, stats.records);
+    TEST_ASSERT_EQUAL(0, stats.tornRecords);
+
+    Payload payload;
+    uint16_t length;
+    TEST_ASSERT_FALSE(log.readLatest(TYPE_SNAPSHOT, &payload, sizeof(payload), length));
+    LogCursor cursor;
+    LogRecordInfo info;
+    log.rewind(cursor);
+    TEST_ASSERT_FALSE(log.next(cursor, info, &payload, sizeof(payload)));
+}
+
+void test_append_read_and_remount(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_TRUE(log.mount());
+    Payload payload;
+    TEST_ASSERT_TRUE(log.append(TYPE_SNAPSHOT, &payload, fillPayload(payload, 1, 64)));
+    uint32_t writes = flash->writes;                // Opening the first segment
+    TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, 1, 10)));
+    TEST_ASSERT_TRUE(log.append(TYPE_SNAPSHOT, &payload, fillPayload(payload, 2, 64)));
+    TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, 2, 4)));
+    TEST_ASSERT_GREATER_THAN(0, log.getBuffered());
+    TEST_ASSERT_EQUAL(writes, flash->writes);       // All in the RAM buffer
+
+    // readLatest() flushes the buffer
+    uint16_t length;
+    TEST_ASSERT_TRUE(log.readLatest(TYPE_SNAPSHOT, &payload, sizeof(payload), length));
+    TEST_ASSERT_EQUAL(2, payload.number);
+    TEST_ASSERT_EQUAL(64, length);
+    TEST_ASSERT_EQUAL(0, log.getBuffered());
+    TEST_ASSERT_EQUAL(writes + 1, flash->writes);
+
+    RecordLog remounted(flash);
+    TEST_ASSERT_TRUE(remounted.mount());
+    TEST_ASSERT_EQUAL(4, remounted.getStats().records);
+    TEST_ASSERT_TRUE(remounted.readLatest(TYPE_SNAPSHOT, &payload, sizeof(payload), length));
+    TEST_ASSERT_EQUAL(2, payload.number);
+    TEST_ASSERT_FALSE(remounted.readLatest(TYPE_SETTINGS, &payload, sizeof(payload), length));
+
+    LogCursor cursor;
+    LogRecordInfo info;
+    remounted.rewind(cursor);
+    const uint8_t types[] = {TYPE_SNAPSHOT, TYPE_EVENT, TYPE_SNAPSHOT, TYPE_EVENT};
+    const uint32_t numbers[] = {1, 1, 2, 2};
+    for (uint8_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(remounted.next(cursor, info, &payload, sizeof(payload)));
+        TEST_ASSERT_EQUAL(types[i], info.type);
+        TEST_ASSERT_EQUAL(numbers[i], payload.number);
+        TEST_ASSERT_TRUE(checkPayload(payload, info.length));
+    }
+    TEST_ASSERT_FALSE(remounted.next(cursor, info, &payload, sizeof(payload)));
+
+    // The cursor stays at the head and sees records appended later
+    TEST_ASSERT_TRUE(remounted.append(TYPE_EVENT, &payload, fillPayload(payload, 3, 20)));
+    TEST_ASSERT_TRUE(remounted.flush());
+    TEST_ASSERT_TRUE(remounted.next(cursor, info, &payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL(3, payload.number);
+}
+
+void test_rejects_oversized_record(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_FALSE(log.append(TYPE_EVENT, "x", 1));         // Not mounted
+    TEST_ASSERT_TRUE(log.mount());
+    static uint8_t large[RECORD_LOG_MAX_PAYLOAD + 1];
+    TEST_ASSERT_FALSE(log.append(TYPE_SNAPSHOT, large, sizeof(large)));
+    TEST_ASSERT_TRUE(log.append(TYPE_SNAPSHOT, large, RECORD_LOG_MAX_PAYLOAD));
+
+    uint16_t length;
+    TEST_ASSERT_TRUE(log.readLatest(TYPE_SNAPSHOT, large, sizeof(large), length));
+    TEST_ASSERT_EQUAL(RECORD_LOG_MAX_PAYLOAD, length);
+    TEST_ASSERT_FALSE(log.readLatest(TYPE_SNAPSHOT, large, 10, length));
+}
+
+void test_keyed_records_survive_compaction(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_TRUE(log.mount());
+    Payload payload;
+    TEST_ASSERT_TRUE(log.append(TYPE_SETTINGS, &payload, fillPayload(payload, 77, 40)));
+
+    // Events only, until every segment was reused a few times
+    for (uint32_t i = 1; i <= FLASH_SECTORS * 3 * FLASH_SECTOR_SIZE / 64; i++) {
+        TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, i, 56)));
+    }
+    TEST_ASSERT_TRUE(log.flush());
+    RecordLogStats stats = log.getStats();
+    TEST_ASSERT_GREATER_OR_EQUAL(2, stats.compactedRecords);
+    TEST_ASSERT_EQUAL(FLASH_SECTORS - 1, stats.usedSegments);
+
+    uint16_t length;
+    RecordLog remounted(flash);
+    TEST_ASSERT_TRUE(remounted.mount());
+    TEST_ASSERT_TRUE(remounted.readLatest(TYPE_SETTINGS, &payload, sizeof(payload), length));
+    TEST_ASSERT_EQUAL(77, payload.number);
+    TEST_ASSERT_TRUE(checkPayload(payload, length));
+    TEST_ASSERT_EQUAL(0, flash->bitsSet);
+}
+
+void test_write_error_skips_rest_of_segment(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_TRUE(log.mount());
+    Payload payload;
+    TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, 1, 40)));
+    TEST_ASSERT_TRUE(log.flush());
+    TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, 2, 40)));
+
+    // The flush writes part of the record and fails, the flash stays usable
+    flash->failAt(0);
+    TEST_ASSERT_FALSE(log.flush());
+    TEST_ASSERT_TRUE(flash->isPowered());
+    for (uint32_t i = 3; i <= 10; i++) {
+        TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, i, 40)));
+    }
+    TEST_ASSERT_TRUE(log.flush());
+    TEST_ASSERT_EQUAL(0, flash->bitsSet);
+
+    // Nothing is written over the failed record
+    RecordLog remounted(flash);
+    TEST_ASSERT_TRUE(remounted.mount());
+    LogCursor cursor;
+    LogRecordInfo info;
+    remounted.rewind(cursor);
+    const uint32_t numbers[] = {1, 3, 4, 5, 6, 7, 8, 9, 10};
+    for (uint32_t number : numbers) {
+        TEST_ASSERT_TRUE(remounted.next(cursor, info, &payload, sizeof(payload)));
+        TEST_ASSERT_TRUE(checkPayload(payload, info.length));
+        TEST_ASSERT_EQUAL(number, payload.number);
+    }
+    TEST_ASSERT_FALSE(remounted.next(cursor, info, &payload, sizeof(payload)));
+}
+
+void test_power_loss_at_every_operation(void) {
+    // Count the flash operations of the whole workload once
+    uint32_t total;
+    {
+        SimulatedFlash reference;
+        RecordLog log(&reference);
+        TEST_ASSERT_TRUE(log.mount());
+        Progress progress = {};
+        uint32_t random = 42;
+        for (uint32_t step = 1; step <= WORKLOAD_STEPS; step++) {
+            TEST_ASSERT_TRUE(workloadStep(log, progress, step, random));
+        }
+        TEST_ASSERT_TRUE(log.flush());
+        total = reference.getOperations();
+        TEST_ASSERT_GREATER_THAN(0, log.getStats().compactedRecords);
+    }
+    TEST_ASSERT_GREATER_THAN(100, total);
+
+    uint32_t torn = 0;
+    for (uint32_t cut = 0; cut < total; cut++) {
+        delete flash;
+        flash = new SimulatedFlash();
+        flash->cutPowerAt(cut, cut * 2654435761u);
+
+        RecordLog log(flash);
+        Progress progress = {};
+        uint32_t random = 42;
+        bool running = log.mount();
+        for (uint32_t step = 1; running && step <= WORKLOAD_STEPS; step++) {
+            running = workloadStep(log, progress, step, random);
+        }
+        running = running && log.flush();
+        TEST_ASSERT_FALSE(running);
+        TEST_ASSERT_FALSE(flash->isPowered());
+
+        // Power returns: the log mounts and nothing flushed before the cut is lost
+        flash->powerOn();
+        RecordLog recovered(flash);
+        TEST_ASSERT_TRUE(recovered.mount());
+        torn += recovered.getStats().tornRecords > 0;
+        verify(recovered, progress);
+
+        // And it keeps working
+        progress.firstEventAfterMount = progress.event + 1;
+        for (uint32_t step = 1; step <= 300; step++) {
+            TEST_ASSERT_TRUE(workloadStep(recovered, progress, step, random));
+        }
+        TEST_ASSERT_TRUE(recovered.flush());
+        RecordLog again(flash);
+        TEST_ASSERT_TRUE(again.mount());
+        verify(again, progress);
+        Payload payload;
+        uint16_t length;
+        TEST_ASSERT_TRUE(again.readLatest(TYPE_SNAPSHOT, &payload, sizeof(payload), length));
+        TEST_ASSERT_EQUAL(progress.snapshot, payload.number);
+        TEST_ASSERT_EQUAL(0, flash->bitsSet);
+    }
+    TEST_ASSERT_GREATER_THAN(total / 2, torn);
+}
+
+void test_wear_leveling(void) {
+    RecordLog log(flash);
+    TEST_ASSERT_TRUE(log.mount());
+    Progress progress = {};
+    uint32_t random = 7;
+    Payload payload;
+    TEST_ASSERT_TRUE(log.append(TYPE_SETTINGS, &payload, fillPayload(payload, 1000, 40)));
+    uint32_t appendedBytes = 0;
+    for (uint32_t step = 1; step <= WEAR_STEPS; step++) {
+        // Events as they come; only the RAM buffer decides when to write
+        progress.event++;
+        uint16_t length = 4 + random32(random) % (sizeof(payload.fill) + 1);
+        TEST_ASSERT_TRUE(log.append(TYPE_EVENT, &payload, fillPayload(payload, progress.event, length)));
+        appendedBytes += RECORD_LOG_RECORD_HEADER + ((length + 3u) & ~3u);
+        if (step % 100 == 0) {
+            progress.snapshot++;
+            TEST_ASSERT_TRUE(log.append(TYPE_SNAPSHOT, &payload, fillPayload(payload, progress.snapshot, 64)));
+            appendedBytes += RECORD_LOG_RECORD_HEADER + 64;
+        }
+    }
+    TEST_ASSERT_TRUE(log.flush());
+
+    // Erases are spread evenly over the sectors
+    uint32_t minErases = UINT32_MAX;
+    uint32_t maxErases = 0;
+    uint32_t erases = 0;
+    for (uint8_t i = 0; i < FLASH_SECTORS; i++) {
+        uint32_t count = flash->getEraseCount(i);
+        minErases = count < minErases ? count : minErases;
+        maxErases = count > maxErases ? count : maxErases;
+        erases += count;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(minErases + 1, maxErases);
+
+    // Compaction adds little: about one erase per segment worth of data
+    uint32_t segmentsWritten = appendedBytes / (FLASH_SECTOR_SIZE - RECORD_LOG_SEGMENT_HEADER);
+    TEST_ASSERT_GREATER_OR_EQUAL(segmentsWritten - FLASH_SECTORS, erases);
+    TEST_ASSERT_LESS_OR_EQUAL(segmentsWritten * 11 / 10 + FLASH_SECTORS, erases);
+
+    // Writes are batched: about one per buffer, plus the segment headers
+    uint32_t buffers = appendedBytes / (RECORD_LOG_BUFFER_SIZE - sizeof(Payload) - RECORD_LOG_RECORD_HEADER) + 1;
+    TEST_ASSERT_LESS_OR_EQUAL(buffers + 2 * erases, flash->writes);
+    TEST_ASSERT_LESS_THAN(WEAR_STEPS / 3, flash->writes);
+    TEST_ASSERT_EQUAL(0, flash->bitsSet);
+
+    RecordLog remounted(flash);
+    TEST_ASSERT_TRUE(remounted.mount());
+    verify(remounted, {progress.event, progress.snapshot, progress.event, progress.snapshot, 0});
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_mount_blank_flash);
+    RUN_TEST(test_append_read_and_remount);
+    RUN_TEST(test_rejects_oversized_record);
+    RUN_TEST(test_keyed_records_survive_compaction);
+    RUN_TEST(test_write_error_skips_rest_of_segment);
+    RUN_TEST(test_power_loss_at_every_operation);
+    RUN_TEST(test_wear_leveling);
+    return UNITY_END();
+}
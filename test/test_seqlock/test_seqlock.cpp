@@ -0,0 +1,193 @@
+/*
+ * SeqLock Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "seqlock.h"
+
+#define STRESS_WRITES 2000000
+#define STRESS_READERS 3
+
+// Every field follows from the sequence number, a mix of two writes shows
+struct StressSnapshot {
+    uint32_t sequence;
+    uint32_t words[30];
+    uint32_t check;
+};
+
+static void fillSnapshot(StressSnapshot& snapshot, uint32_t sequence) {
+    snapshot.sequence = sequence;
+    uint32_t check = sequence;
+    for (uint32_t i = 0; i < 30; i++) {
+        snapshot.words[i] = sequence * 2654435761u + i;
+        check ^= snapshot.words[i];
+    }
+    snapshot.check = check;
+}
+
+static bool isConsistent(const StressSnapshot& snapshot) {
+    uint32_t check = snapshot.sequence;
+    for (uint32_t i = 0; i < 30; i++) {
+        if (snapshot.words[i] != snapshot.sequence * 2654435761u + i) {
+            return false;
+        }
+        check ^= snapshot.words[i];
+    }
+    return check == snapshot.check;
+}
+
+struct ReaderResult {
+    uint32_t reads;
+    uint32_t torn;
+    uint32_t backwards;     // Older snapshot than one read before
+};
+
+struct Snapshot {
+    uint32_t sequence;
+    int32_t values[15];
+    float voltage;
+};
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_initial_value_is_zero(void) {
+    SeqLock<Snapshot> lock;
+    Snapshot snapshot = lock.read();
+    TEST_ASSERT_EQUAL(0, snapshot.sequence);
+    TEST_ASSERT_EQUAL(0, snapshot.values[14]);
+    TEST_ASSERT_EQUAL(0, lock.generation());
+}
+
+void test_read_returns_last_write(void) {
+    SeqLock<Snapshot> lock;
+    Snapshot written;
+    memset(&written, 0, sizeof(written));
+    for (uint32_t i = 1; i <= 3; i++) {
+        written.sequence = i;
+        written.values[i] = -(int32_t)i;
+        written.voltage = 50.0f + i;
+        lock.write(written);
+    }
+
+    Snapshot snapshot = lock.read();
+    TEST_ASSERT_EQUAL_MEMORY(&written, &snapshot, sizeof(Snapshot));
+
+    Snapshot tried;
+    TEST_ASSERT_TRUE(lock.tryRead(tried));
+    TEST_ASSERT_EQUAL_MEMORY(&written, &tried, sizeof(Snapshot));
+}
+
+void test_generation_counts_writes(void) {
+    SeqLock<uint32_t> lock;
+    for (uint32_t i = 1; i <= 100; i++) {
+        lock.write(i * 7);
+        TEST_ASSERT_EQUAL(i, lock.generation());
+        TEST_ASSERT_EQUAL(i * 7, lock.read());
+    }
+}
+
+static void runStress(bool useTryRead) {
+    SeqLock<StressSnapshot> lock;
+    StressSnapshot initial;
+    fillSnapshot(initial, 0);
+    lock.write(initial);
+
+    std::atomic<bool> done(false);
+    ReaderResult results[STRESS_READERS] = {};
+    std::thread readers[STRESS_READERS];
+    for (uint8_t r = 0; r < STRESS_READERS; r++) {
+        readers[r] = std::thread([&, r]() {
+            ReaderResult& result = results[r];
+            uint32_t last = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                StressSnapshot snapshot;
+                if (useTryRead) {
+                    if (!lock.tryRead(snapshot)) {
+                        continue;
+                    }
+                } else {
+                    snapshot = lock.read();
+                }
+                result.reads++;
+                if (!isConsistent(snapshot)) {
+                    result.torn++;
+                }
+                if (snapshot.sequence < last) {
+                    result.backwards++;
+                }
+                last = snapshot.sequence;
+            }
+        });
+    }
+
+    StressSnapshot snapshot;
+    for (uint32_t i = 1; i <= STRESS_WRITES; i++) {
+        fillSnapshot(snapshot, i);
+        lock.write(snapshot);
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    uint32_t reads = 0;
+    for (const ReaderResult& result : results) {
+        TEST_ASSERT_EQUAL(0, result.torn);
+        TEST_ASSERT_EQUAL(0, result.backwards);
+        reads += result.reads;
+    }
+    TEST_ASSERT_GREATER_THAN(1000, reads);
+    TEST_ASSERT_EQUAL(STRESS_WRITES + 1, lock.generation());
+    TEST_ASSERT_EQUAL(STRESS_WRITES, lock.read().sequence);
+}
+
+void test_stress_read(void) {
+    runStress(false);
+}
+
+void test_stress_try_read(void) {
+    runStress(true);
+}
+
+void test_reader_waits_for_busy_writer(void) {
+    // A writer that never pauses: read() falls back to sleeping and still
+    // gets consistent copies
+    SeqLock<StressSnapshot> lock;
+    StressSnapshot initial;
+    fillSnapshot(initial, 0);
+    lock.write(initial);
+
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+        StressSnapshot snapshot;
+        for (uint32_t i = 1; !done.load(std::memory_order_relaxed); i++) {
+            fillSnapshot(snapshot, i);
+            lock.write(snapshot);
+        }
+    });
+
+    for (uint32_t i = 0; i < 2000; i++) {
+        TEST_ASSERT_TRUE(isConsistent(lock.read()));
+    }
+    done = true;
+    writer.join();
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_initial_value_is_zero);
+    RUN_TEST(test_read_returns_last_write);
+    RUN_TEST(test_generation_counts_writes);
+    RUN_TEST(test_stress_read);
+    RUN_TEST(test_stress_try_read);
+    RUN_TEST(test_reader_waits_for_busy_writer);
+    return UNITY_END();
+}
@@ -0,0 +1,293 @@
+/*
+ * Signal Stream Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "signal_stream.h"
+
+#define SYNC_MS 20                      // One sample per sync frame
+#define STRESS_SAMPLES 2000000
+
+static StreamSampleRing* ring;
+
+// Every value follows from the sample number, a mix of two samples shows
+static StreamSample makeSample(uint32_t sequence, uint32_t timeMs) {
+    StreamSample sample;
+    sample.timeMs = timeMs;
+    for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+        sample.values[i] = (int16_t)(sequence * 31 + i * 1000);
+    }
+    return sample;
+}
+
+static void pushSamples(uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; i++) {
+        ring->push(makeSample(i, i * SYNC_MS));
+    }
+}
+
+static uint16_t readU16(const uint8_t* data) {
+    return (uint16_t)(data[0] | data[1] << 8);
+}
+
+static uint32_t readU32(const uint8_t* data) {
+    return (uint32_t)readU16(data) | (uint32_t)readU16(data + 2) << 16;
+}
+
+// Checks the frame and that sample n of it is ring sample first + n * step
+static void assertBatch(const StreamBatch* batch, uint8_t mask, uint8_t count, uint32_t first, uint32_t step) {
+    TEST_ASSERT_NOT_NULL(batch);
+    uint8_t signals = 0;
+    for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+        if (mask & (1 << i)) signals++;
+    }
+    TEST_ASSERT_EQUAL(STREAM_BATCH_HEADER + count * (2 + 2 * signals), batch->length);
+    TEST_ASSERT_EQUAL(STREAM_FRAME_BATCH, batch->data[0]);
+    TEST_ASSERT_EQUAL(mask, batch->data[1]);
+    TEST_ASSERT_EQUAL(count, batch->data[2]);
+    TEST_ASSERT_EQUAL(first * SYNC_MS, readU32(&batch->data[4]));
+
+    const uint8_t* in = &batch->data[STREAM_BATCH_HEADER];
+    for (uint8_t n = 0; n < count; n++) {
+        uint32_t sequence = first + n * step;
+        StreamSample expected = makeSample(sequence, sequence * SYNC_MS);
+        TEST_ASSERT_EQUAL(n * step * SYNC_MS, readU16(in));
+        in += 2;
+        for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+            if (!(mask & (1 << i))) continue;
+            TEST_ASSERT_EQUAL(expected.values[i], (int16_t)readU16(in));
+            in += 2;
+        }
+    }
+}
+
+void setUp(void) {
+    ring = new StreamSampleRing();
+}
+
+void tearDown(void) {
+    delete ring;
+}
+
+void test_decimation(void) {
+    StreamBatcher batcher;
+    const uint16_t rates[] = {100, 50, 25, 10, 7, 1};
+    const uint16_t rounded[] = {50, 50, 25, 10, 7, 1};
+    for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        batcher.subscribe(STREAM_ALL_SIGNALS, rates[i], 0);
+        TEST_ASSERT_EQUAL(rounded[i], batcher.getRateHz());
+    }
+
+    // 10 Hz: every fifth sync frame, two samples to a batch of 200 ms
+    pushSamples(0, 3);
+    batcher.subscribe(STREAM_ALL_SIGNALS, 10, ring->getHead());
+    pushSamples(3, 20);
+    batcher.collect(*ring);
+    TEST_ASSERT_EQUAL(2, batcher.getQueuedBatches());
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 2, 3, 5);
+    batcher.pop();
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 2, 13, 5);
+    batcher.pop();
+    TEST_ASSERT_NULL(batcher.front());
+
+    // The count carries over from one collect to the next
+    pushSamples(23, 5);
+    batcher.collect(*ring);
+    TEST_ASSERT_NULL(batcher.front());
+    pushSamples(28, 5);
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 2, 23, 5);
+
+    // 1 Hz: one sample per batch
+    batcher.subscribe(STREAM_ALL_SIGNALS, 1, ring->getHead());
+    pushSamples(33, 60);
+    batcher.collect(*ring);
+    TEST_ASSERT_EQUAL(2, batcher.getQueuedBatches());
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 1, 33, 50);
+    batcher.pop();
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 1, 83, 50);
+    TEST_ASSERT_EQUAL(0, batcher.getLostSamples());
+}
+
+void test_signal_mask(void) {
+    StreamBatcher batcher;
+    uint8_t mask = 1 << STREAM_AC_POWER | 1 << STREAM_METER_POWER;
+    batcher.subscribe(mask | 0x80, 50, 0);
+    TEST_ASSERT_EQUAL(mask, batcher.getSignalMask());
+    pushSamples(0, STREAM_BATCH_MAX_SAMPLES);
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), mask, STREAM_BATCH_MAX_SAMPLES, 0, 1);
+
+    // One signal, all signals
+    batcher.subscribe(1 << STREAM_DC_VOLTAGE, 50, ring->getHead());
+    pushSamples(STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES);
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), 1 << STREAM_DC_VOLTAGE, STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES, 1);
+
+    batcher.subscribe(STREAM_ALL_SIGNALS, 50, ring->getHead());
+    pushSamples(2 * STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES);
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, STREAM_BATCH_MAX_SAMPLES, 2 * STREAM_BATCH_MAX_SAMPLES, 1);
+    TEST_ASSERT_EQUAL(STREAM_BATCH_MAX_BYTES, batcher.front()->length);
+
+    // No signal or rate 0 unsubscribes and nothing is collected
+    batcher.subscribe(0x80, 50, ring->getHead());
+    TEST_ASSERT_FALSE(batcher.isSubscribed());
+    batcher.subscribe(STREAM_ALL_SIGNALS, 0, ring->getHead());
+    TEST_ASSERT_FALSE(batcher.isSubscribed());
+    pushSamples(3 * STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES);
+    batcher.collect(*ring);
+    TEST_ASSERT_NULL(batcher.front());
+
+    TEST_ASSERT_EQUAL(STREAM_METER_POWER, streamSignalFromName("meter_power"));
+    TEST_ASSERT_EQUAL(-1, streamSignalFromName("meter"));
+    TEST_ASSERT_EQUAL_STRING("dc_voltage", streamSignalName(STREAM_DC_VOLTAGE));
+}
+
+void test_flush_at_size_and_timeout(void) {
+    StreamBatcher batcher;
+    batcher.subscribe(STREAM_ALL_SIGNALS, 50, 0);
+
+    // A batch is finished with its last sample, not with the next one
+    pushSamples(0, STREAM_BATCH_MAX_SAMPLES - 1);
+    batcher.collect(*ring);
+    TEST_ASSERT_NULL(batcher.front());
+    pushSamples(STREAM_BATCH_MAX_SAMPLES - 1, 1);
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, STREAM_BATCH_MAX_SAMPLES, 0, 1);
+    batcher.pop();
+
+    // After a pause longer than the 16 bit offset the running batch is sent as it is
+    pushSamples(STREAM_BATCH_MAX_SAMPLES, 3);
+    batcher.collect(*ring);
+    TEST_ASSERT_NULL(batcher.front());
+    uint32_t resumeMs = (STREAM_BATCH_MAX_SAMPLES + 3) * SYNC_MS + UINT16_MAX;
+    ring->push(makeSample(0, resumeMs));
+    batcher.collect(*ring);
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 3, STREAM_BATCH_MAX_SAMPLES, 1);
+    batcher.pop();
+    TEST_ASSERT_NULL(batcher.front());
+
+    // The sample after the pause starts the next batch
+    for (uint32_t i = 1; i < STREAM_BATCH_MAX_SAMPLES; i++) {
+        ring->push(makeSample(i, resumeMs + i * SYNC_MS));
+    }
+    batcher.collect(*ring);
+    const StreamBatch* batch = batcher.front();
+    TEST_ASSERT_NOT_NULL(batch);
+    TEST_ASSERT_EQUAL(STREAM_BATCH_MAX_SAMPLES, batch->data[2]);
+    TEST_ASSERT_EQUAL(resumeMs, readU32(&batch->data[4]));
+    TEST_ASSERT_EQUAL(0, readU16(&batch->data[STREAM_BATCH_HEADER]));
+}
+
+void test_drop_oldest_with_gap(void) {
+    StreamBatcher batcher;
+    batcher.subscribe(STREAM_ALL_SIGNALS, 50, 0);
+
+    // The client takes nothing: six batches, the last four are kept
+    uint32_t batches = STREAM_CLIENT_BATCHES + 2;
+    for (uint32_t i = 0; i < batches; i++) {
+        pushSamples(i * STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES);
+        batcher.collect(*ring);
+    }
+    TEST_ASSERT_EQUAL(STREAM_CLIENT_BATCHES, batcher.getQueuedBatches());
+    TEST_ASSERT_EQUAL(2, batcher.getDroppedBatches());
+
+    // The oldest one left reports the two before it, the others none
+    for (uint32_t i = 2; i < batches; i++) {
+        const StreamBatch* batch = batcher.front();
+        assertBatch(batch, STREAM_ALL_SIGNALS, STREAM_BATCH_MAX_SAMPLES, i * STREAM_BATCH_MAX_SAMPLES, 1);
+        TEST_ASSERT_EQUAL(i == 2 ? 2 : 0, batch->data[3]);
+        batcher.pop();
+    }
+    TEST_ASSERT_NULL(batcher.front());
+
+    // Once it takes batches again no more are dropped
+    pushSamples(batches * STREAM_BATCH_MAX_SAMPLES, STREAM_BATCH_MAX_SAMPLES);
+    batcher.collect(*ring);
+    TEST_ASSERT_EQUAL(0, batcher.front()->data[3]);
+    batcher.pop();
+
+    // The gap saturates
+    uint32_t sequence = (batches + 1) * STREAM_BATCH_MAX_SAMPLES;
+    for (uint32_t i = 0; i < 300 + STREAM_CLIENT_BATCHES; i++) {
+        pushSamples(sequence, STREAM_BATCH_MAX_SAMPLES);
+        sequence += STREAM_BATCH_MAX_SAMPLES;
+        batcher.collect(*ring);
+    }
+    TEST_ASSERT_EQUAL(2 + 300, batcher.getDroppedBatches());
+    TEST_ASSERT_EQUAL(255, batcher.front()->data[3]);
+    TEST_ASSERT_EQUAL(0, batcher.getLostSamples());
+}
+
+void test_reader_overtaken(void) {
+    StreamSample sample;
+    TEST_ASSERT_FALSE(ring->read(0, sample));
+    pushSamples(0, STREAM_RING_SIZE + 10);
+    uint32_t head = ring->getHead();
+    TEST_ASSERT_FALSE(ring->read(head, sample));
+    TEST_ASSERT_TRUE(ring->read(head - 1, sample));
+    TEST_ASSERT_EQUAL((head - 1) * SYNC_MS, sample.timeMs);
+    TEST_ASSERT_TRUE(ring->read(head - STREAM_RING_SIZE, sample));
+    TEST_ASSERT_EQUAL((head - STREAM_RING_SIZE) * SYNC_MS, sample.timeMs);
+    TEST_ASSERT_FALSE(ring->read(head - STREAM_RING_SIZE - 1, sample));
+    TEST_ASSERT_FALSE(ring->read(0, sample));
+
+    // A batcher that was not called for too long continues with the oldest sample in the ring
+    StreamBatcher batcher;
+    batcher.subscribe(STREAM_ALL_SIGNALS, 1, head);
+    pushSamples(head, STREAM_RING_SIZE + 36);
+    batcher.collect(*ring);
+    TEST_ASSERT_EQUAL(36, batcher.getLostSamples());
+    TEST_ASSERT_EQUAL(2, batcher.getQueuedBatches());
+    assertBatch(batcher.front(), STREAM_ALL_SIGNALS, 1, head + 36, 50);
+
+    // The writer overtakes a reader on the oldest slot: it is refused or comes out whole
+    delete ring;
+    ring = new StreamSampleRing();
+    std::atomic<bool> writing(true);
+    std::thread writer([&]() {
+        for (uint32_t i = 0; i < STRESS_SAMPLES; i++) {
+            ring->push(makeSample(i, i));
+        }
+        writing = false;
+    });
+
+    uint32_t reads = 0;
+    uint32_t refused = 0;
+    uint32_t torn = 0;
+    while (writing) {
+        uint32_t head = ring->getHead();
+        if (head < STREAM_RING_SIZE) continue;
+        uint32_t sequence = head - STREAM_RING_SIZE;
+        if (!ring->read(sequence, sample)) {
+            refused++;
+            continue;
+        }
+        reads++;
+        StreamSample expected = makeSample(sequence, sequence);
+        bool whole = sample.timeMs == sequence;
+        for (uint8_t i = 0; i < STREAM_SIGNAL_COUNT; i++) {
+            whole = whole && sample.values[i] == expected.values[i];
+        }
+        if (!whole) torn++;
+    }
+    writer.join();
+    TEST_ASSERT_EQUAL(0, torn);
+    TEST_ASSERT_GREATER_THAN(0, reads + refused);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_decimation);
+    RUN_TEST(test_signal_mask);
+    RUN_TEST(test_flush_at_size_and_timeout);
+    RUN_TEST(test_drop_oldest_with_gap);
+    RUN_TEST(test_reader_overtaken);
+    return UNITY_END();
+}
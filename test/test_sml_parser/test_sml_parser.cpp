@@ -0,0 +1,536 @@
+/*
+ * SmlParser Tests
+ *
+ * Telegrams are put together by SmlWriter in the layout of an eHZ meter:
+ * open response, get list response with the OBIS entries, close response,
+ * escape framing, padding and CRC16/X.25. They are replayed through the
+ * parser byte by byte, in random chunks and with corruptions.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "sml_parser.h"
+
+#define SML_WRITER_SIZE 1024
+#define REPLAY_TELEGRAMS 1000
+
+#define SML_UNIT_WH 0x1E
+#define SML_UNIT_W 0x1B
+
+static const uint8_t OBIS_CONSUMPTION[] = {0x01, 0x00, 0x01, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_FEED_IN[] = {0x01, 0x00, 0x02, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_POWER[] = {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF};
+static const uint8_t OBIS_POWER_L1[] = {0x01, 0x00, 0x24, 0x07, 0x00, 0xFF};
+static const uint8_t OBIS_POWER_L2[] = {0x01, 0x00, 0x38, 0x07, 0x00, 0xFF};
+static const uint8_t OBIS_POWER_L3[] = {0x01, 0x00, 0x4C, 0x07, 0x00, 0xFF};
+static const uint8_t OBIS_MANUFACTURER[] = {0x81, 0x81, 0xC7, 0x82, 0x03, 0xFF};
+static const uint8_t OBIS_SERVER_ID[] = {0x01, 0x00, 0x00, 0x00, 0x09, 0xFF};
+static const uint8_t SERVER_ID[] = {0x09, 0x01, 0x45, 0x4D, 0x48, 0x00, 0x00, 0x7A, 0xC5, 0x1B};
+
+struct MeterValues {
+    uint64_t consumptionWh10;   // 0.1 Wh, scaler -1
+    uint64_t feedInWh10;
+    int32_t power;              // W, scaler 0
+    int32_t powerL1;
+    int32_t powerL2;
+    int32_t powerL3;
+    uint32_t runtime;
+};
+
+// SML TLV encoder, only what the telegrams below need
+class SmlWriter {
+private:
+    uint8_t body[SML_WRITER_SIZE];
+    size_t bodyLength;
+
+    void put(uint8_t byte) {
+        TEST_ASSERT_LESS_THAN(SML_WRITER_SIZE, bodyLength);
+        body[bodyLength++] = byte;
+    }
+
+    void number(uint8_t type, uint64_t value, uint8_t bytes) {
+        put((uint8_t)(type | (bytes + 1)));
+        for (uint8_t i = bytes; i > 0; i--) {
+            put((uint8_t)(value >> (8 * (i - 1))));
+        }
+    }
+
+public:
+    SmlWriter() : bodyLength(0) {}
+
+    void list(uint8_t elements) { put(0x70 | elements); }
+    void optional() { put(0x01); }
+    void endOfMessage() { put(0x00); }
+    void unsigned8(uint8_t value) { number(0x60, value, 1); }
+    void unsigned16(uint16_t value) { number(0x60, value, 2); }
+    void unsigned32(uint32_t value) { number(0x60, value, 4); }
+    void unsigned64(uint64_t value) { number(0x60, value, 8); }
+    void integer8(int8_t value) { number(0x50, (uint8_t)value, 1); }
+    void integer32(int32_t value) { number(0x50, (uint32_t)value, 4); }
+
+    void octets(const void* data, size_t length) {
+        if (length + 1 < 16) {
+            put((uint8_t)(length + 1));
+        } else {
+            put((uint8_t)(0x80 | ((length + 2) >> 4)));
+            put((uint8_t)((length + 2) & 0x0F));
+        }
+        for (size_t i = 0; i < length; i++) {
+            put(((const uint8_t*)data)[i]);
+        }
+    }
+
+    // Escape framing, 1B1B1B1B in the data doubled, padding to 4 bytes, CRC
+    size_t frame(uint8_t* out, size_t size) {
+        size_t pos = 0;
+        uint16_t crc = 0xFFFF;
+        auto emit = [&](uint8_t byte) {
+            TEST_ASSERT_LESS_THAN(size, pos);
+            out[pos++] = byte;
+            crc = SmlParser::crc16(crc, byte);
+        };
+
+        for (uint8_t i = 0; i < 4; i++) emit(0x1B);
+        for (uint8_t i = 0; i < 4; i++) emit(0x01);
+        uint8_t run = 0;
+        for (size_t i = 0; i < bodyLength; i++) {
+            emit(body[i]);
+            run = body[i] == 0x1B ? run + 1 : 0;
+            if (run == 4) {
+                for (uint8_t j = 0; j < 4; j++) emit(0x1B);
+                run = 0;
+            }
+        }
+        uint8_t padding = (uint8_t)((4 - pos % 4) % 4);
+        for (uint8_t i = 0; i < padding; i++) emit(0x00);
+        for (uint8_t i = 0; i < 4; i++) emit(0x1B);
+        emit(0x1A);
+        emit(padding);
+        crc ^= 0xFFFF;
+        TEST_ASSERT_LESS_THAN(size - 1, pos);
+        out[pos++] = (uint8_t)crc;             // Low byte first
+        out[pos++] = (uint8_t)(crc >> 8);
+        return pos;
+    }
+};
+
+static void openResponse(SmlWriter& writer, uint8_t transaction) {
+    const uint8_t transactionId[] = {0x00, 0x42, 0x31, transaction};
+    const uint8_t fileId[] = {0x00, 0x00, 0x42, 0x31};
+    writer.list(6);
+    writer.octets(transactionId, sizeof(transactionId));
+    writer.unsigned8(0);                    // groupNo
+    writer.unsigned8(0);                    // abortOnError
+    writer.list(2);
+    writer.unsigned16(0x0101);              // SML_PublicOpen.Res
+    writer.list(6);
+    writer.optional();                      // codepage
+    writer.optional();                      // clientId
+    writer.octets(fileId, sizeof(fileId));
+    writer.octets(SERVER_ID, sizeof(SERVER_ID));
+    writer.optional();                      // refTime
+    writer.optional();                      // smlVersion
+    writer.unsigned16(0x1234);              // Message CRC, the parser relies on the telegram CRC
+    writer.endOfMessage();
+}
+
+static void entry(SmlWriter& writer, const uint8_t* obis, uint8_t unit, int8_t scaler) {
+    writer.list(7);
+    writer.octets(obis, 6);
+    writer.optional();                      // status
+    writer.optional();                      // valTime
+    writer.unsigned8(unit);
+    writer.integer8(scaler);
+}
+
+static void listResponse(SmlWriter& writer, uint8_t transaction, const MeterValues& values) {
+    const uint8_t transactionId[] = {0x00, 0x42, 0x32, transaction};
+    const uint8_t status[] = {0x00, 0x01, 0x01, 0x82};
+    writer.list(6);
+    writer.octets(transactionId, sizeof(transactionId));
+    writer.unsigned8(0);
+    writer.unsigned8(0);
+    writer.list(2);
+    writer.unsigned16(0x0701);              // SML_GetList.Res
+    writer.list(7);
+    writer.optional();                      // clientId
+    writer.octets(SERVER_ID, sizeof(SERVER_ID));
+    writer.optional();                      // listName
+    writer.list(2);                         // actSensorTime: secIndex
+    writer.unsigned8(1);
+    writer.unsigned32(values.runtime);
+    writer.list(9);                         // valList
+
+    writer.list(7);
+    writer.octets(OBIS_MANUFACTURER, 6);
+    writer.optional();
+    writer.optional();
+    writer.optional();
+    writer.optional();
+    writer.octets("EMH", 3);
+    writer.optional();
+
+    writer.list(7);
+    writer.octets(OBIS_SERVER_ID, 6);
+    writer.optional();
+    writer.optional();
+    writer.optional();
+    writer.optional();
+    writer.octets(SERVER_ID, sizeof(SERVER_ID));
+    writer.optional();
+
+    // 1.8.0 with status word and seconds index
+    writer.list(7);
+    writer.octets(OBIS_CONSUMPTION, 6);
+    writer.octets(status, sizeof(status));
+    writer.list(2);
+    writer.unsigned8(1);
+    writer.unsigned32(values.runtime);
+    writer.unsigned8(SML_UNIT_WH);
+    writer.integer8(-1);
+    writer.unsigned64(values.consumptionWh10);
+    writer.optional();
+
+    entry(writer, OBIS_FEED_IN, SML_UNIT_WH, -1);
+    writer.unsigned64(values.feedInWh10);
+    writer.optional();
+
+    // Tariff register we do not decode
+    const uint8_t tariff[] = {0x01, 0x00, 0x01, 0x08, 0x01, 0xFF};
+    entry(writer, tariff, SML_UNIT_WH, -1);
+    writer.unsigned64(12345);
+    writer.optional();
+
+    entry(writer, OBIS_POWER, SML_UNIT_W, 0);
+    writer.integer32(values.power);
+    writer.optional();
+    entry(writer, OBIS_POWER_L1, SML_UNIT_W, 0);
+    writer.integer32(values.powerL1);
+    writer.optional();
+    entry(writer, OBIS_POWER_L2, SML_UNIT_W, 0);
+    writer.integer32(values.powerL2);
+    writer.optional();
+    entry(writer, OBIS_POWER_L3, SML_UNIT_W, 0);
+    writer.integer32(values.powerL3);
+    writer.optional();
+
+    writer.optional();                      // listSignature
+    writer.optional();                      // actGatewayTime
+    writer.unsigned16(0x5678);
+    writer.endOfMessage();
+}
+
+static void closeResponse(SmlWriter& writer, uint8_t transaction) {
+    const uint8_t transactionId[] = {0x00, 0x42, 0x33, transaction};
+    writer.list(6);
+    writer.octets(transactionId, sizeof(transactionId));
+    writer.unsigned8(0);
+    writer.unsigned8(0);
+    writer.list(2);
+    writer.unsigned16(0x0201);              // SML_PublicClose.Res
+    writer.list(1);
+    writer.optional();
+    writer.unsigned16(0x9ABC);
+    writer.endOfMessage();
+}
+
+static size_t telegram(uint8_t* out, size_t size, const MeterValues& values, uint8_t transaction = 1) {
+    SmlWriter writer;
+    openResponse(writer, transaction);
+    listResponse(writer, transaction, values);
+    closeResponse(writer, transaction);
+    return writer.frame(out, size);
+}
+
+static const MeterValues METER = {123456789, 45678, -1234, 100, -1500, 166, 0x01020304};
+
+// Wire image of telegram(METER), kept to catch changes on both sides
+static const uint8_t RECORDED[] = {
+    0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01, 0x76, 0x05, 0x00, 0x42,
+    0x31, 0x01, 0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x01, 0x01, 0x76, 0x01,
+    0x01, 0x05, 0x00, 0x00, 0x42, 0x31, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48,
+    0x00, 0x00, 0x7A, 0xC5, 0x1B, 0x01, 0x01, 0x63, 0x12, 0x34, 0x00, 0x76,
+    0x05, 0x00, 0x42, 0x32, 0x01, 0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x07,
+    0x01, 0x77, 0x01, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48, 0x00, 0x00, 0x7A,
+    0xC5, 0x1B, 0x01, 0x72, 0x62, 0x01, 0x65, 0x01, 0x02, 0x03, 0x04, 0x79,
+    0x77, 0x07, 0x81, 0x81, 0xC7, 0x82, 0x03, 0xFF, 0x01, 0x01, 0x01, 0x01,
+    0x04, 0x45, 0x4D, 0x48, 0x01, 0x77, 0x07, 0x01, 0x00, 0x00, 0x00, 0x09,
+    0xFF, 0x01, 0x01, 0x01, 0x01, 0x0B, 0x09, 0x01, 0x45, 0x4D, 0x48, 0x00,
+    0x00, 0x7A, 0xC5, 0x1B, 0x01, 0x77, 0x07, 0x01, 0x00, 0x01, 0x08, 0x00,
+    0xFF, 0x05, 0x00, 0x01, 0x01, 0x82, 0x72, 0x62, 0x01, 0x65, 0x01, 0x02,
+    0x03, 0x04, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x07,
+    0x5B, 0xCD, 0x15, 0x01, 0x77, 0x07, 0x01, 0x00, 0x02, 0x08, 0x00, 0xFF,
+    0x01, 0x01, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xB2, 0x6E, 0x01, 0x77, 0x07, 0x01, 0x00, 0x01, 0x08, 0x01, 0xFF,
+    0x01, 0x01, 0x62, 0x1E, 0x52, 0xFF, 0x69, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x30, 0x39, 0x01, 0x77, 0x07, 0x01, 0x00, 0x10, 0x07, 0x00, 0xFF,
+    0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0xFF, 0xFF, 0xFB, 0x2E, 0x01,
+    0x77, 0x07, 0x01, 0x00, 0x24, 0x07, 0x00, 0xFF, 0x01, 0x01, 0x62, 0x1B,
+    0x52, 0x00, 0x55, 0x00, 0x00, 0x00, 0x64, 0x01, 0x77, 0x07, 0x01, 0x00,
+    0x38, 0x07, 0x00, 0xFF, 0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0xFF,
+    0xFF, 0xFA, 0x24, 0x01, 0x77, 0x07, 0x01, 0x00, 0x4C, 0x07, 0x00, 0xFF,
+    0x01, 0x01, 0x62, 0x1B, 0x52, 0x00, 0x55, 0x00, 0x00, 0x00, 0xA6, 0x01,
+    0x01, 0x01, 0x63, 0x56, 0x78, 0x00, 0x76, 0x05, 0x00, 0x42, 0x33, 0x01,
+    0x62, 0x00, 0x62, 0x00, 0x72, 0x63, 0x02, 0x01, 0x71, 0x01, 0x63, 0x9A,
+    0xBC, 0x00, 0x00, 0x00, 0x1B, 0x1B, 0x1B, 0x1B, 0x1A, 0x02, 0x21, 0x0F
+};
+
+static SmlParser* parser;
+static uint8_t wire[SML_WRITER_SIZE + 64];
+
+static SmlParseEvent feedAll(const uint8_t* data, size_t length) {
+    SmlParseEvent last = SML_EVENT_NONE;
+    for (size_t i = 0; i < length; i++) {
+        SmlParseEvent event = parser->feed(data[i]);
+        if (event != SML_EVENT_NONE) {
+            TEST_ASSERT_EQUAL(SML_EVENT_NONE, last);    // One event per telegram
+            last = event;
+        }
+    }
+    return last;
+}
+
+// Unity leaves out double assertions unless UNITY_INCLUDE_DOUBLE is set
+static void assertNear(double expected, double actual) {
+    TEST_ASSERT_TRUE_MESSAGE(fabs(expected - actual) < 1e-6, "double value differs");
+}
+
+static void assertReadings(const MeterValues& values) {
+    const SmlReadings& readings = parser->getReadings();
+    TEST_ASSERT_EQUAL_HEX16(SML_FIELD_CONSUMPTION | SML_FIELD_FEED_IN | SML_FIELD_POWER | SML_FIELD_POWER_L1 |
+                            SML_FIELD_POWER_L2 | SML_FIELD_POWER_L3 | SML_FIELD_MANUFACTURER |
+                            SML_FIELD_STATUS | SML_FIELD_RUNTIME, readings.fields);
+    assertNear(values.consumptionWh10 / 10000.0, readings.consumption);
+    assertNear(values.feedInWh10 / 10000.0, readings.feedIn);
+    assertNear(values.power, readings.power);
+    assertNear(values.powerL1, readings.powerL1);
+    assertNear(values.powerL2, readings.powerL2);
+    assertNear(values.powerL3, readings.powerL3);
+    TEST_ASSERT_EQUAL(values.runtime, readings.runtime);
+}
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void setUp(void) {
+    parser = new SmlParser();
+}
+
+void tearDown(void) {
+    delete parser;
+}
+
+void test_crc16_x25(void) {
+    // Check value of CRC-16/X-25
+    uint16_t crc = 0xFFFF;
+    for (const char* p = "123456789"; *p; p++) {
+        crc = SmlParser::crc16(crc, (uint8_t)*p);
+    }
+    TEST_ASSERT_EQUAL_HEX16(0x906E, crc ^ 0xFFFF);
+}
+
+void test_telegram(void) {
+    size_t length = telegram(wire, sizeof(wire), METER);
+    TEST_ASSERT_EQUAL(0, length % 4);
+
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire, length));
+    assertReadings(METER);
+    const SmlReadings& readings = parser->getReadings();
+    TEST_ASSERT_EQUAL_STRING("EMH", readings.manufacturer);
+    TEST_ASSERT_EQUAL(4, readings.statusLength);
+    TEST_ASSERT_EQUAL_HEX8(0x82, readings.status[3]);
+    TEST_ASSERT_EQUAL(1, parser->getTelegrams());
+    TEST_ASSERT_EQUAL(0, parser->getCrcErrors());
+    TEST_ASSERT_EQUAL(0, parser->getFormatErrors());
+}
+
+void test_recorded_telegram(void) {
+    TEST_ASSERT_EQUAL(sizeof(RECORDED), telegram(wire, sizeof(wire), METER));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(RECORDED, wire, sizeof(RECORDED));
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(RECORDED, sizeof(RECORDED)));
+    assertReadings(METER);
+}
+
+void test_push_stops_at_event(void) {
+    size_t length = telegram(wire, sizeof(wire), METER);
+    const uint8_t noise[] = {0x00, 0x1B, 0x1B, 0x42};
+    uint8_t stream[2 * sizeof(wire)];
+    memcpy(stream, noise, sizeof(noise));
+    memcpy(stream + sizeof(noise), wire, length);
+    memcpy(stream + sizeof(noise) + length, wire, length);
+    size_t total = sizeof(noise) + 2 * length;
+
+    SmlParseEvent event;
+    size_t consumed = parser->push(stream, total, event);
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, event);
+    TEST_ASSERT_EQUAL(sizeof(noise) + length, consumed);
+    consumed += parser->push(stream + consumed, total - consumed, event);
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, event);
+    TEST_ASSERT_EQUAL(total, consumed);
+    TEST_ASSERT_EQUAL(0, parser->push(stream, 0, event));
+    TEST_ASSERT_EQUAL(SML_EVENT_NONE, event);
+    TEST_ASSERT_EQUAL(2, parser->getTelegrams());
+}
+
+void test_crc_error_keeps_readings(void) {
+    size_t length = telegram(wire, sizeof(wire), METER);
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire, length));
+
+    MeterValues other = METER;
+    other.power = 999;
+    length = telegram(wire, sizeof(wire), other, 2);
+    wire[length - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL(SML_EVENT_CRC_ERROR, feedAll(wire, length));
+    TEST_ASSERT_EQUAL(1, parser->getCrcErrors());
+    assertReadings(METER);
+}
+
+void test_escaped_sequence_in_data(void) {
+    // A power reading of 0x1B1B1B1B W puts four escape bytes into the data
+    MeterValues values = METER;
+    values.power = 0x1B1B1B1B;
+    size_t length = telegram(wire, sizeof(wire), values);
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire, length));
+    assertNear(0x1B1B1B1B, parser->getReadings().power);
+
+    // Three escape bytes are plain data
+    values.power = 0x001B1B1B;
+    length = telegram(wire, sizeof(wire), values);
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire, length));
+    assertNear(0x001B1B1B, parser->getReadings().power);
+}
+
+void test_restart_and_bad_escape(void) {
+    size_t length = telegram(wire, sizeof(wire), METER);
+
+    // Cut off telegram, the next start sequence begins a new one
+    TEST_ASSERT_EQUAL(SML_EVENT_NONE, feedAll(wire, length / 2));
+    TEST_ASSERT_EQUAL(SML_EVENT_FORMAT_ERROR, feedAll(wire, 8));
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire + 8, length - 8));
+    assertReadings(METER);
+
+    // Unknown escape command
+    const uint8_t bad[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01,
+                           0x76, 0x1B, 0x1B, 0x1B, 0x1B, 0x55};
+    TEST_ASSERT_EQUAL(SML_EVENT_FORMAT_ERROR, feedAll(bad, sizeof(bad)));
+    TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, feedAll(wire, length));
+    TEST_ASSERT_EQUAL(2, parser->getFormatErrors());
+    TEST_ASSERT_EQUAL(2, parser->getTelegrams());
+}
+
+void test_broken_structure(void) {
+    // Good CRC around a list that never closes
+    SmlWriter writer;
+    writer.list(3);
+    writer.unsigned8(1);
+    size_t length = writer.frame(wire, sizeof(wire));
+    TEST_ASSERT_EQUAL(SML_EVENT_FORMAT_ERROR, feedAll(wire, length));
+
+    // Nesting deeper than the stack
+    SmlWriter deep;
+    for (uint8_t i = 0; i <= SML_MAX_DEPTH; i++) {
+        deep.list(1);
+    }
+    deep.unsigned8(1);
+    length = deep.frame(wire, sizeof(wire));
+    TEST_ASSERT_EQUAL(SML_EVENT_FORMAT_ERROR, feedAll(wire, length));
+    TEST_ASSERT_EQUAL(2, parser->getFormatErrors());
+    TEST_ASSERT_EQUAL(0, parser->getTelegrams());
+}
+
+void test_replay_stream(void) {
+    // A meter sending every second, read in UART sized chunks, with line
+    // noise between telegrams and flipped bits in some of them
+    static uint8_t stream[REPLAY_TELEGRAMS * 400];
+    static MeterValues sent[REPLAY_TELEGRAMS];
+    static bool corrupted[REPLAY_TELEGRAMS];
+    uint32_t random = 0xC0FFEE;
+    size_t total = 0;
+    uint32_t expectedCrcErrors = 0;
+
+    for (uint32_t t = 0; t < REPLAY_TELEGRAMS; t++) {
+        MeterValues& values = sent[t];
+        values = METER;
+        values.consumptionWh10 += t * 7;
+        values.power = (int32_t)(random32(random) % 20000) - 10000;
+        values.powerL1 = values.power / 3;
+        values.runtime += t;
+
+        if (t % 10 == 3) {
+            for (uint8_t i = random32(random) % 8; i > 0; i--) {
+                stream[total++] = (uint8_t)random32(random);
+            }
+        }
+        size_t length = telegram(stream + total, sizeof(stream) - total, values, (uint8_t)t);
+        corrupted[t] = t % 17 == 5;
+        if (corrupted[t]) {
+            // Bit flip in the message body, the escape framing stays intact
+            size_t at = 8 + random32(random) % (length - 24);
+            uint8_t flipped = stream[total + at] ^ (uint8_t)(1 << (random32(random) % 8));
+            if (stream[total + at] != 0x1B && flipped != 0x1B) {
+                stream[total + at] = flipped;
+                expectedCrcErrors++;
+            } else {
+                corrupted[t] = false;
+            }
+        }
+        total += length;
+        TEST_ASSERT_LESS_THAN(sizeof(stream) - 400, total);
+    }
+
+    uint32_t t = 0;
+    uint32_t good = 0;
+    size_t pos = 0;
+    while (pos < total) {
+        size_t chunk = 1 + random32(random) % 64;
+        if (chunk > total - pos) {
+            chunk = total - pos;
+        }
+        size_t end = pos + chunk;
+        while (pos < end) {
+            SmlParseEvent event;
+            pos += parser->push(stream + pos, end - pos, event);
+            if (event == SML_EVENT_NONE) {
+                continue;
+            }
+            TEST_ASSERT_LESS_THAN(REPLAY_TELEGRAMS, t);
+            if (corrupted[t]) {
+                TEST_ASSERT_EQUAL(SML_EVENT_CRC_ERROR, event);
+            } else {
+                TEST_ASSERT_EQUAL(SML_EVENT_TELEGRAM, event);
+                assertReadings(sent[t]);
+                good++;
+            }
+            t++;
+        }
+    }
+
+    TEST_ASSERT_EQUAL(REPLAY_TELEGRAMS, t);
+    TEST_ASSERT_EQUAL(REPLAY_TELEGRAMS - expectedCrcErrors, good);
+    TEST_ASSERT_GREATER_THAN(0, expectedCrcErrors);
+    TEST_ASSERT_EQUAL(good, parser->getTelegrams());
+    TEST_ASSERT_EQUAL(expectedCrcErrors, parser->getCrcErrors());
+    TEST_ASSERT_EQUAL(0, parser->getFormatErrors());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc16_x25);
+    RUN_TEST(test_telegram);
+    RUN_TEST(test_recorded_telegram);
+    RUN_TEST(test_push_stops_at_event);
+    RUN_TEST(test_crc_error_keeps_readings);
+    RUN_TEST(test_escaped_sequence_in_data);
+    RUN_TEST(test_restart_and_bad_escape);
+    RUN_TEST(test_broken_structure);
+    RUN_TEST(test_replay_stream);
+    return UNITY_END();
+}
@@ -0,0 +1,344 @@
+/*
+ * TelemetryPublisher Tests
+ *
+ * Binary frames are decoded the way the dashboard does it: with nothing but
+ * the field ids, types and decimals of the schema message.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "telemetry_fields.h"
+
+struct SchemaField {
+    std::string key;
+    char type;
+    uint8_t decimals;
+};
+
+struct Schema {
+    uint16_t id;
+    std::vector<SchemaField> fields;
+};
+
+struct DecodedValue {
+    char type;
+    int32_t raw;                // i and f, b as 0/1
+    double value;               // raw / 10^decimals
+    std::string text;
+};
+
+// Small table for the change detection, one field per type
+enum TestFieldId : uint8_t { T_VOLTAGE, T_TARGET, T_POWER, T_ONLINE, T_NAME, T_FIELD_COUNT };
+
+static const TelemetryField testFields[T_FIELD_COUNT] = {
+    {"voltage", TELEMETRY_FLOAT, 2, 0.05f},
+    {"target", TELEMETRY_FLOAT, 0, 0},
+    {"power", TELEMETRY_INT, 0, 0},
+    {"online", TELEMETRY_BOOL, 0, 0},
+    {"name", TELEMETRY_TEXT, 0, 0},
+};
+
+static TelemetryPublisher* telemetry;
+static SystemData* data;
+static PylontechBatteryState battery;
+
+// {"schema":{"id":<id>,"fields":[["battery_soc","i",0],...]}}
+static Schema parseSchema() {
+    static char buffer[2048];
+    size_t length = telemetry->serializeSchema(buffer, sizeof(buffer));
+    TEST_ASSERT_GREATER_THAN(0, length);
+    TEST_ASSERT_EQUAL(strlen(buffer), length);
+
+    Schema schema;
+    unsigned id = 0;
+    int used = 0;
+    TEST_ASSERT_EQUAL(1, sscanf(buffer, "{\"schema\":{\"id\":%u,\"fields\":[%n", &id, &used));
+    TEST_ASSERT_GREATER_THAN(0, used);
+    schema.id = (uint16_t)id;
+
+    const char* in = buffer + used;
+    while (*in == '[') {
+        char key[64];
+        char type;
+        unsigned decimals;
+        TEST_ASSERT_EQUAL(3, sscanf(in, "[\"%63[^\"]\",\"%c\",%u]%n", key, &type, &decimals, &used));
+        schema.fields.push_back({key, type, (uint8_t)decimals});
+        in += used;
+        if (*in == ',') in++;
+    }
+    TEST_ASSERT_EQUAL_STRING("]}}", in);
+    return schema;
+}
+
+static uint32_t readLe(const uint8_t* in, uint8_t bytes) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// Field id = position in the schema, the mask says which ones follow
+static std::map<std::string, DecodedValue> decodeFrame(const uint8_t* frame, size_t length, const Schema& schema) {
+    TEST_ASSERT_GREATER_OR_EQUAL(TELEMETRY_FRAME_HEADER, length);
+    TEST_ASSERT_EQUAL(TELEMETRY_FRAME_VALUES, frame[0]);
+    TEST_ASSERT_EQUAL(schema.id, readLe(&frame[1], 2));
+    uint64_t mask = readLe(&frame[3], 4) | (uint64_t)readLe(&frame[7], 4) << 32;
+
+    std::map<std::string, DecodedValue> values;
+    const uint8_t* in = frame + TELEMETRY_FRAME_HEADER;
+    for (size_t id = 0; id < 64; id++) {
+        if (!(mask & (1ULL << id))) continue;
+        TEST_ASSERT_LESS_THAN(schema.fields.size(), id);
+        const SchemaField& field = schema.fields[id];
+
+        DecodedValue value = {field.type, 0, 0, ""};
+        switch (field.type) {
+            case 'i':
+            case 'f':
+                value.raw = (int32_t)readLe(in, 4);
+                value.value = value.raw / pow(10, field.decimals);
+                in += 4;
+                break;
+            case 'b':
+                value.raw = *in++;
+                value.value = value.raw;
+                break;
+            case 't': {
+                uint8_t textLength = *in++;
+                value.text.assign((const char*)in, textLength);
+                in += textLength;
+                break;
+            }
+            default:
+                TEST_FAIL_MESSAGE("unknown field type");
+        }
+        values[field.key] = value;
+    }
+    TEST_ASSERT_EQUAL(length, (size_t)(in - frame));
+    return values;
+}
+
+void setUp(void) {
+    telemetry = new TelemetryPublisher(telemetryFields, TM_FIELD_COUNT);
+    data = new SystemData();
+    memset(&battery, 0, sizeof(battery));
+
+    battery.soc = 57;
+    battery.soh = 98;
+    battery.voltage = 52.31f;
+    battery.current = -12.4f;
+    battery.power = -648;               // Discharging
+    battery.temperature = 21.5f;
+    battery.chargeVoltage = 53.2f;
+    battery.chargeCurrentLimit = 74.0f;
+    battery.dischargeCurrentLimit = 100.0f;
+    battery.protectionFlags1 = 0x80;
+    battery.warningFlags2 = 0x04;
+    strcpy(battery.manufacturer, "PYLON");
+
+    data->multiplus.dcVoltage = 52.37f;
+    data->multiplus.dcCurrent = -22.2f;
+    data->multiplus.acFrequency = 49.98f;
+    data->multiplus.powerFactor = 0.97f;
+    data->multiplus.pinverterFiltered = -1480;
+    data->multiplus.pmainsFiltered = 35;
+    data->multiplus.esspower = -1500;
+    data->essControl.secondsInMaxStrategy = 86400;
+    strcpy(data->essControl.essStrategy, "max_feed_in");
+}
+
+void tearDown(void) {
+    delete data;
+    delete telemetry;
+}
+
+void test_schema_matches_table(void) {
+    Schema schema = parseSchema();
+    TEST_ASSERT_EQUAL(telemetry->getSchemaId(), schema.id);
+    TEST_ASSERT_EQUAL(TM_FIELD_COUNT, schema.fields.size());
+
+    static const char typeNames[] = { 'i', 'f', 'b', 't' };
+    for (uint8_t i = 0; i < TM_FIELD_COUNT; i++) {
+        const SchemaField& field = schema.fields[i];
+        TEST_ASSERT_EQUAL_STRING(telemetryFields[i].key, field.key.c_str());
+        TEST_ASSERT_EQUAL(typeNames[telemetryFields[i].type], field.type);
+        TEST_ASSERT_EQUAL(telemetryFields[i].type == TELEMETRY_FLOAT ? telemetryFields[i].decimals : 0, field.decimals);
+    }
+}
+
+void test_snapshot_round_trip(void) {
+    sampleSystemTelemetry(*telemetry, *data, battery);
+    telemetry->setBool(TM_VEBUS_ONLINE, true);
+    telemetry->setFloat(TM_VEBUS_QUALITY, NAN);
+    telemetry->setInt(TM_VEBUS_FRAMES_SENT, 123456789);
+    telemetry->setFloat(TM_FEEDIN_TARGET, -800.0f);
+    telemetry->setText(TM_MQTT_SERVER, "192.168.1.10");
+
+    uint8_t frame[512];
+    size_t length = telemetry->serializeBinary(frame, sizeof(frame), telemetry->allFields());
+    TEST_ASSERT_GREATER_THAN(0, length);
+    Schema schema = parseSchema();
+    std::map<std::string, DecodedValue> values = decodeFrame(frame, length, schema);
+    TEST_ASSERT_EQUAL(TM_FIELD_COUNT, values.size());
+
+    // Signed integers and floats scaled by their decimals, e.g. the DC voltage in cV
+    TEST_ASSERT_EQUAL(57, values["battery_soc"].raw);
+    TEST_ASSERT_EQUAL(-648, values["battery_power"].raw);
+    TEST_ASSERT_EQUAL(5231, values["battery_voltage"].raw);
+    TEST_ASSERT_EQUAL(-124, values["battery_current"].raw);
+    TEST_ASSERT_EQUAL(215, values["battery_temperature"].raw);
+    TEST_ASSERT_EQUAL(0x80, values["battery_protectionFlags1"].raw);
+    TEST_ASSERT_EQUAL(0x04, values["battery_warningFlags2"].raw);
+    TEST_ASSERT_EQUAL(5237, values["multiplusDcVoltage"].raw);
+    TEST_ASSERT_EQUAL(-222, values["multiplusDcCurrent"].raw);
+    TEST_ASSERT_EQUAL(4998, values["multiplusAcFrequency"].raw);
+    TEST_ASSERT_EQUAL(97, values["multiplusPowerFactor"].raw);
+    TEST_ASSERT_EQUAL(-1480, values["multiplusPinverterFiltered"].raw);
+    TEST_ASSERT_EQUAL(-1500, values["multiplusESSpower"].raw);
+    TEST_ASSERT_EQUAL(-1500, values["feedInControl_current"].raw);
+    TEST_ASSERT_EQUAL(86400, values["secondsInMaxStrategy"].raw);
+    TEST_ASSERT_EQUAL('A', values["switchMode"].raw);
+    TEST_ASSERT_EQUAL(123456789, values["veBus_framesSent"].raw);
+    TEST_ASSERT_EQUAL(-800, values["feedInControl_target"].raw);
+    TEST_ASSERT_EQUAL(TELEMETRY_NO_VALUE, values["veBus_communicationQuality"].raw);
+    TEST_ASSERT_EQUAL(1, values["veBus_isOnline"].raw);
+    TEST_ASSERT_EQUAL(0, values["mqtt_connected"].raw);
+    TEST_ASSERT_TRUE(fabs(values["multiplusDcVoltage"].value - 52.37) < 1e-9);
+
+    std::string text = values["battery_manufacturer"].text;
+    TEST_ASSERT_EQUAL_STRING("PYLON", text.c_str());
+    text = values["essPowerStrategy"].text;
+    TEST_ASSERT_EQUAL_STRING("max_feed_in", text.c_str());
+    text = values["mqtt_server"].text;
+    TEST_ASSERT_EQUAL_STRING("192.168.1.10", text.c_str());
+
+    // Little endian: schema id, the 45 bit mask, then battery_soc, battery_voltage,
+    // battery_current and battery_power
+    const uint8_t header[] = {
+        TELEMETRY_FRAME_VALUES,
+        (uint8_t)schema.id, (uint8_t)(schema.id >> 8),
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1F, 0x00, 0x00,
+        57, 0x00, 0x00, 0x00,
+        0x6F, 0x14, 0x00, 0x00,
+        0x84, 0xFF, 0xFF, 0xFF,
+        0x78, 0xFD, 0xFF, 0xFF
+    };
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(header, frame, sizeof(header));
+
+    // Too small a buffer gets nothing rather than half a frame
+    TEST_ASSERT_EQUAL(0, telemetry->serializeBinary(frame, length - 1, telemetry->allFields()));
+}
+
+void test_change_frame_round_trip(void) {
+    sampleSystemTelemetry(*telemetry, *data, battery);
+    telemetry->takeChanges();
+
+    battery.power = -700;
+    data->multiplus.dcVoltage = 52.51f;
+    sampleSystemTelemetry(*telemetry, *data, battery);
+    uint64_t changes = telemetry->takeChanges();
+    TEST_ASSERT_TRUE(changes == (1ULL << TM_BATTERY_POWER | 1ULL << TM_MP_DC_VOLTAGE |
+                                 1ULL << TM_BMS_POWER_AVERAGE));
+
+    uint8_t frame[64];
+    size_t length = telemetry->serializeBinary(frame, sizeof(frame), changes);
+    TEST_ASSERT_EQUAL(TELEMETRY_FRAME_HEADER + 3 * 4, length);
+    std::map<std::string, DecodedValue> values = decodeFrame(frame, length, parseSchema());
+    TEST_ASSERT_EQUAL(3, values.size());
+    TEST_ASSERT_EQUAL(-700, values["battery_power"].raw);
+    TEST_ASSERT_EQUAL(-700, values["bmsPowerAverage"].raw);
+    TEST_ASSERT_EQUAL(5251, values["multiplusDcVoltage"].raw);
+}
+
+void test_deadband(void) {
+    TelemetryPublisher publisher(testFields, T_FIELD_COUNT);
+    publisher.setFloat(T_VOLTAGE, 52.30f);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == publisher.allFields());
+
+    // Measured from the value last sent, so slow drift is sent once it adds up
+    const float steps[] = {52.33f, 52.26f, 52.34f, 52.36f, 52.40f, 52.42f, 52.30f};
+    const bool sent[] = {false, false, false, true, false, true, true};
+    for (uint8_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        publisher.setFloat(T_VOLTAGE, steps[i]);
+        TEST_ASSERT_TRUE(publisher.takeChanges() == (sent[i] ? 1ULL << T_VOLTAGE : 0));
+    }
+
+    // No value and back
+    publisher.setFloat(T_VOLTAGE, NAN);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 1ULL << T_VOLTAGE);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 0);
+    publisher.setFloat(T_VOLTAGE, 52.30f);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 1ULL << T_VOLTAGE);
+
+    // Without a dead band every change counts
+    publisher.setFloat(T_TARGET, 0.001f);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 1ULL << T_TARGET);
+    publisher.setFloat(T_TARGET, 0.001f);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 0);
+}
+
+void test_delta(void) {
+    TelemetryPublisher publisher(testFields, T_FIELD_COUNT);
+    char json[128];
+
+    // Everything once, then nothing while nothing changes
+    publisher.setFloat(T_VOLTAGE, 52.3f);
+    publisher.setInt(T_POWER, -648);
+    publisher.setText(T_NAME, "PYLON");
+    uint64_t changes = publisher.takeChanges();
+    TEST_ASSERT_TRUE(changes == publisher.allFields());
+    TEST_ASSERT_GREATER_THAN(0, publisher.serializeJson(json, sizeof(json), changes));
+    TEST_ASSERT_EQUAL_STRING("{\"voltage\":52.30,\"target\":0,\"power\":-648,\"online\":false,\"name\":\"PYLON\"}", json);
+    TEST_ASSERT_TRUE(changes == 0);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 0);
+
+    // Only the fields that changed
+    publisher.setInt(T_POWER, -700);
+    publisher.setBool(T_ONLINE, true);
+    publisher.setText(T_NAME, "PYLON");
+    changes = publisher.takeChanges();
+    TEST_ASSERT_TRUE(changes == (1ULL << T_POWER | 1ULL << T_ONLINE));
+    TEST_ASSERT_GREATER_THAN(0, publisher.serializeJson(json, sizeof(json), changes));
+    TEST_ASSERT_EQUAL_STRING("{\"power\":-700,\"online\":true}", json);
+
+    publisher.setText(T_NAME, "PYLON \"US\"");
+    changes = publisher.takeChanges();
+    TEST_ASSERT_TRUE(changes == 1ULL << T_NAME);
+    TEST_ASSERT_GREATER_THAN(0, publisher.serializeJson(json, sizeof(json), changes));
+    TEST_ASSERT_EQUAL_STRING("{\"name\":\"PYLON \\\"US\\\"\"}", json);
+
+    // Fields that did not fit stay set; invalidated, they come again with the next changes
+    publisher.setInt(T_POWER, -1234567);
+    publisher.setText(T_NAME, "P");
+    changes = publisher.takeChanges();
+    uint64_t unsent = changes;
+    TEST_ASSERT_GREATER_THAN(0, publisher.serializeJson(json, 16, unsent));
+    TEST_ASSERT_EQUAL_STRING("{\"name\":\"P\"}", json);
+    TEST_ASSERT_TRUE(unsent == 1ULL << T_POWER);
+    publisher.invalidate(unsent);
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 1ULL << T_POWER);
+
+    // A new client gets everything again
+    publisher.invalidate();
+    TEST_ASSERT_TRUE(publisher.takeChanges() == publisher.allFields());
+    TEST_ASSERT_TRUE(publisher.takeChanges() == 0);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_schema_matches_table);
+    RUN_TEST(test_snapshot_round_trip);
+    RUN_TEST(test_change_frame_round_trip);
+    RUN_TEST(test_deadband);
+    RUN_TEST(test_delta);
+    return UNITY_END();
+}
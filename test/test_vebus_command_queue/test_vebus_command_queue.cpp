@@ -0,0 +1,302 @@
+/*
+ * VeBusCommandQueue Tests
+ *
+ * Priority classes, setpoint coalescing and retries, plus a burst of
+ * setpoints run against a simulated bus: one transmit slot per 20 ms sync
+ * frame, a setpoint on the wire holds back newer ones until it is
+ * acknowledged or times out, the way VeBusHandler::processTransmitSlot()
+ * uses the queue. The setpoint-to-wire latency is collected in a
+ * PerfHistogram.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include "vebus_command_queue.h"
+#include "vebus_messages.h"
+#include "perf_histogram.h"
+
+#define SYNC_PERIOD_US 20000
+#define SLOT_OFFSET_US 300          // Task wake-up after the sync frame
+#define ACK_DELAY_US 1500           // The Multiplus answers within the period
+#define ACK_LOSS_INTERVAL 7         // Every 7th acknowledgment is lost
+#define BURSTS 20
+#define BURST_SETPOINTS 200         // One per millisecond
+#define BURST_GAP_US 500000
+
+static VeBusCommandQueue* queue;
+
+static VeBusCommandDescriptor setpoint(int16_t power, uint32_t queuedUs = 0) {
+    VeBusEssPowerCommand cmd;
+    cmd.targetPower = power;
+    cmd.commandId = 0;
+    VeBusCommandDescriptor command = cmd.toCommand();
+    command.flags |= VEBUS_COMMAND_FLAG_WAIT_RESPONSE;
+    command.queuedUs = queuedUs;
+    return command;
+}
+
+static int16_t powerOf(const VeBusCommandDescriptor& command) {
+    return (int16_t)(command.data[1] | (command.data[2] << 8));
+}
+
+static VeBusCommandDescriptor plain(uint8_t command) {
+    VeBusCommandDescriptor descriptor;
+    descriptor.command = command;
+    return descriptor;
+}
+
+void setUp(void) {
+    queue = new VeBusCommandQueue();
+}
+
+void tearDown(void) {
+    delete queue;
+}
+
+void test_priority_order(void) {
+    TEST_ASSERT_TRUE(queue->push(plain(VEBUS_CMD_GET_VERSION), VEBUS_PRIORITY_DIAGNOSTIC));
+    TEST_ASSERT_TRUE(queue->push(plain(VEBUS_CMD_SET_SWITCH), VEBUS_PRIORITY_CONTROL));
+    TEST_ASSERT_TRUE(queue->push(setpoint(100), VEBUS_PRIORITY_SETPOINT));
+    TEST_ASSERT_TRUE(queue->push(plain(VEBUS_CMD_GET_LED_STATUS), VEBUS_PRIORITY_DIAGNOSTIC));
+    TEST_ASSERT_EQUAL(4, queue->size());
+
+    VeBusCommandDescriptor command;
+    VeBusCommandPriority priority;
+    TEST_ASSERT_TRUE(queue->pop(command, &priority));
+    TEST_ASSERT_EQUAL(VEBUS_PRIORITY_SETPOINT, priority);
+    TEST_ASSERT_EQUAL(100, powerOf(command));
+    TEST_ASSERT_TRUE(queue->pop(command, &priority));
+    TEST_ASSERT_EQUAL(VEBUS_PRIORITY_CONTROL, priority);
+    TEST_ASSERT_TRUE(queue->pop(command, &priority));
+    TEST_ASSERT_EQUAL_HEX8(VEBUS_CMD_GET_VERSION, command.command);
+    TEST_ASSERT_TRUE(queue->pop(command, &priority));
+    TEST_ASSERT_EQUAL_HEX8(VEBUS_CMD_GET_LED_STATUS, command.command);
+    TEST_ASSERT_FALSE(queue->pop(command, &priority));
+    TEST_ASSERT_TRUE(queue->isEmpty());
+}
+
+void test_setpoints_coalesce(void) {
+    for (int16_t power = -500; power <= 500; power += 100) {
+        TEST_ASSERT_TRUE(queue->push(setpoint(power), VEBUS_PRIORITY_SETPOINT));
+    }
+    TEST_ASSERT_EQUAL(1, queue->size());
+    TEST_ASSERT_EQUAL(10, queue->getCoalesced());
+
+    VeBusCommandDescriptor command;
+    TEST_ASSERT_TRUE(queue->pop(command));
+    TEST_ASSERT_EQUAL(500, powerOf(command));
+    TEST_ASSERT_TRUE(command.waitForResponse());
+    TEST_ASSERT_FALSE(queue->pop(command));
+}
+
+void test_skip_classes_above_first(void) {
+    queue->push(setpoint(42), VEBUS_PRIORITY_SETPOINT);
+    TEST_ASSERT_TRUE(queue->isEmpty(VEBUS_PRIORITY_CONTROL));
+    queue->push(plain(VEBUS_CMD_GET_VERSION), VEBUS_PRIORITY_DIAGNOSTIC);
+    TEST_ASSERT_FALSE(queue->isEmpty(VEBUS_PRIORITY_CONTROL));
+
+    // While a setpoint waits for its acknowledgment the next one is held back
+    VeBusCommandDescriptor command;
+    VeBusCommandPriority priority;
+    TEST_ASSERT_TRUE(queue->pop(command, &priority, VEBUS_PRIORITY_CONTROL));
+    TEST_ASSERT_EQUAL(VEBUS_PRIORITY_DIAGNOSTIC, priority);
+    TEST_ASSERT_FALSE(queue->pop(command, &priority, VEBUS_PRIORITY_CONTROL));
+    TEST_ASSERT_EQUAL(1, queue->size(VEBUS_PRIORITY_SETPOINT));
+}
+
+void test_full_lanes_drop(void) {
+    for (uint8_t i = 0; i < VEBUS_CONTROL_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(queue->push(plain(i), VEBUS_PRIORITY_CONTROL));
+    }
+    TEST_ASSERT_FALSE(queue->push(plain(0xFF), VEBUS_PRIORITY_CONTROL));
+    for (uint8_t i = 0; i < VEBUS_DIAGNOSTIC_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(queue->push(plain(i), VEBUS_PRIORITY_DIAGNOSTIC));
+    }
+    TEST_ASSERT_FALSE(queue->push(plain(0xFF), VEBUS_PRIORITY_DIAGNOSTIC));
+    TEST_ASSERT_EQUAL(2, queue->getDropped());
+    TEST_ASSERT_EQUAL(VEBUS_CONTROL_QUEUE_SIZE + VEBUS_DIAGNOSTIC_QUEUE_SIZE, queue->size());
+
+    // FIFO within a class, across the ring wrap
+    VeBusCommandDescriptor command;
+    queue->pop(command);
+    TEST_ASSERT_TRUE(queue->push(plain(10), VEBUS_PRIORITY_CONTROL));
+    for (uint8_t i = 1; i < VEBUS_CONTROL_QUEUE_SIZE; i++) {
+        TEST_ASSERT_TRUE(queue->pop(command));
+        TEST_ASSERT_EQUAL(i, command.command);
+    }
+    TEST_ASSERT_TRUE(queue->pop(command));
+    TEST_ASSERT_EQUAL(10, command.command);
+
+    queue->resetStatistics();
+    TEST_ASSERT_EQUAL(0, queue->getDropped());
+}
+
+void test_retry_goes_first(void) {
+    queue->push(plain(1), VEBUS_PRIORITY_CONTROL);
+    queue->push(plain(2), VEBUS_PRIORITY_CONTROL);
+    VeBusCommandDescriptor command;
+    queue->pop(command);
+    TEST_ASSERT_TRUE(queue->pushRetry(command, VEBUS_PRIORITY_CONTROL));
+    queue->push(plain(3), VEBUS_PRIORITY_CONTROL);
+
+    for (uint8_t expected = 1; expected <= 3; expected++) {
+        TEST_ASSERT_TRUE(queue->pop(command));
+        TEST_ASSERT_EQUAL(expected, command.command);
+    }
+}
+
+void test_retry_never_replaces_newer_setpoint(void) {
+    VeBusCommandDescriptor sent;
+    queue->push(setpoint(100), VEBUS_PRIORITY_SETPOINT);
+    queue->pop(sent);
+
+    // Not acknowledged, and a newer setpoint arrived meanwhile
+    queue->push(setpoint(200), VEBUS_PRIORITY_SETPOINT);
+    TEST_ASSERT_FALSE(queue->pushRetry(sent, VEBUS_PRIORITY_SETPOINT));
+    TEST_ASSERT_EQUAL(1, queue->getCoalesced());
+
+    VeBusCommandDescriptor command;
+    TEST_ASSERT_TRUE(queue->pop(command));
+    TEST_ASSERT_EQUAL(200, powerOf(command));
+
+    // Nothing newer: the retry goes out again
+    TEST_ASSERT_TRUE(queue->pushRetry(command, VEBUS_PRIORITY_SETPOINT));
+    TEST_ASSERT_TRUE(queue->pop(command));
+    TEST_ASSERT_EQUAL(200, powerOf(command));
+}
+
+void test_clear(void) {
+    queue->push(setpoint(1), VEBUS_PRIORITY_SETPOINT);
+    queue->push(plain(1), VEBUS_PRIORITY_CONTROL);
+    queue->clear();
+    TEST_ASSERT_TRUE(queue->isEmpty());
+    TEST_ASSERT_EQUAL(0, queue->size());
+}
+
+void test_setpoint_burst_latency(void) {
+    // Control loop setpoints at 1 kHz in bursts, a switch command and a
+    // status request with each burst. Every 7th acknowledgment is lost, and
+    // that of the final setpoint of every other burst, which then has to be
+    // retried as nothing newer replaces it
+    PerfHistogram latency;
+    uint32_t nextSyncUs = 0;
+    uint32_t ackUs = 0;
+    uint32_t timeoutUs = 0;
+    bool waiting = false;
+    bool ackLost = false;
+    VeBusCommandDescriptor pending;
+    int16_t newest = 0;
+    uint32_t newestUs = 0;
+    int16_t lastOnWire = 0;
+    uint32_t setpointsSent = 0;
+    uint32_t retries = 0;
+    uint32_t retryAttempts = 0;
+    uint32_t stale = 0;
+    uint32_t late = 0;
+    uint32_t controlSent = 0;
+    uint32_t diagnosticsSent = 0;
+    uint32_t endUs = BURSTS * BURST_GAP_US;
+
+    for (uint32_t nowUs = 0; nowUs < endUs; nowUs += 100) {
+        uint32_t burstUs = nowUs % BURST_GAP_US;
+        if (burstUs < BURST_SETPOINTS * 1000 && burstUs % 1000 == 0) {
+            newest = (int16_t)(((nowUs / 1000) * 37) % 6000) - 3000;
+            newestUs = nowUs;
+            TEST_ASSERT_TRUE(queue->push(setpoint(newest, nowUs), VEBUS_PRIORITY_SETPOINT));
+            if (burstUs == 50000) {
+                TEST_ASSERT_TRUE(queue->push(plain(VEBUS_CMD_SET_SWITCH), VEBUS_PRIORITY_CONTROL));
+                TEST_ASSERT_TRUE(queue->push(plain(VEBUS_CMD_GET_VERSION), VEBUS_PRIORITY_DIAGNOSTIC));
+            }
+        }
+
+        // Acknowledgment or timeout of the setpoint on the wire
+        if (waiting && !ackLost && (int32_t)(nowUs - ackUs) >= 0) {
+            waiting = false;
+        } else if (waiting && (int32_t)(nowUs - timeoutUs) >= 0) {
+            waiting = false;
+            if (pending.retryCount < VEBUS_MAX_RETRY_COUNT) {
+                pending.retryCount++;
+                retryAttempts++;
+                retries += queue->pushRetry(pending, VEBUS_PRIORITY_SETPOINT);
+            }
+        }
+
+        if ((int32_t)(nowUs - (nextSyncUs + SLOT_OFFSET_US)) < 0) {
+            continue;
+        }
+        nextSyncUs += SYNC_PERIOD_US;
+
+        VeBusCommandDescriptor command;
+        VeBusCommandPriority priority;
+        VeBusCommandPriority first = waiting ? VEBUS_PRIORITY_CONTROL : VEBUS_PRIORITY_SETPOINT;
+        if (!queue->pop(command, &priority, first)) {
+            continue;
+        }
+        if (priority == VEBUS_PRIORITY_CONTROL) {
+            controlSent++;
+            continue;
+        }
+        if (priority == VEBUS_PRIORITY_DIAGNOSTIC) {
+            // Control commands always go first
+            TEST_ASSERT_EQUAL(0, queue->size(VEBUS_PRIORITY_CONTROL));
+            diagnosticsSent++;
+            continue;
+        }
+
+        // Only the newest value ever goes on the wire, retries included
+        if (powerOf(command) != newest || command.queuedUs != newestUs) {
+            stale++;
+        }
+        // One slot per sync period: a setpoint waits at most one period plus
+        // the wake-up offset, and an acknowledgment timeout for each retry or
+        // if it was held back by a write whose acknowledgment got lost
+        uint32_t waitedUs = nowUs - command.queuedUs;
+        uint32_t timeouts = command.retryCount + (ackLost && command.retryCount == 0 ? 1 : 0);
+        uint32_t boundUs = SYNC_PERIOD_US + SLOT_OFFSET_US + timeouts * (VEBUS_ACK_TIMEOUT_MS * 1000 + SYNC_PERIOD_US);
+        if (waitedUs > boundUs) {
+            late++;
+        }
+        latency.record(waitedUs);
+        lastOnWire = powerOf(command);
+        setpointsSent++;
+        pending = command;
+        waiting = true;
+        bool finalSetpoint = burstUs >= BURST_SETPOINTS * 1000 && command.retryCount == 0;
+        ackLost = setpointsSent % ACK_LOSS_INTERVAL == 0 || (finalSetpoint && (nowUs / BURST_GAP_US) % 2 == 1);
+        ackUs = nowUs + ACK_DELAY_US;
+        timeoutUs = nowUs + VEBUS_ACK_TIMEOUT_MS * 1000;
+    }
+
+    TEST_ASSERT_EQUAL(0, stale);
+    TEST_ASSERT_EQUAL(newest, lastOnWire);
+    TEST_ASSERT_EQUAL(BURSTS, controlSent);
+    TEST_ASSERT_EQUAL(BURSTS, diagnosticsSent);
+    TEST_ASSERT_EQUAL(0, queue->getDropped());
+    TEST_ASSERT_TRUE(queue->isEmpty());
+    TEST_ASSERT_GREATER_OR_EQUAL(BURSTS / 2, retries);
+
+    TEST_ASSERT_EQUAL(0, late);
+    TEST_ASSERT_EQUAL(setpointsSent, latency.getCount());
+    TEST_ASSERT_LESS_OR_EQUAL(SYNC_PERIOD_US + SLOT_OFFSET_US, latency.percentile(50));
+    TEST_ASSERT_GREATER_THAN(VEBUS_ACK_TIMEOUT_MS * 1000, latency.getMax());     // The retries
+
+    // Every setpoint was either replaced by a newer one or sent; retries
+    // that found a newer setpoint count as coalesced as well
+    uint32_t replaced = queue->getCoalesced() - (retryAttempts - retries);
+    TEST_ASSERT_EQUAL(BURSTS * BURST_SETPOINTS - replaced + retries, setpointsSent);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_priority_order);
+    RUN_TEST(test_setpoints_coalesce);
+    RUN_TEST(test_skip_classes_above_first);
+    RUN_TEST(test_full_lanes_drop);
+    RUN_TEST(test_retry_goes_first);
+    RUN_TEST(test_retry_never_replaces_newer_setpoint);
+    RUN_TEST(test_clear);
+    RUN_TEST(test_setpoint_burst_latency);
+    return UNITY_END();
+}
@@ -0,0 +1,315 @@
+/*
+ * VeBusFrameDecoder Tests
+ *
+ * Frames are built by hand or with VeBusMk3Writer and fed to the decoder in
+ * one piece, byte by byte and through rxSpace()/commit().
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "vebus_frame_decoder.h"
+#include "vebus_frame_writer.h"
+
+#define MAX_FRAMES 8
+
+// Decoded frames of one feed() call, copied out of the decoder buffer
+struct Decoded {
+    VeBusDecodeResult results[MAX_FRAMES];
+    VeBusFrameView views[MAX_FRAMES];
+    uint8_t payloads[MAX_FRAMES][VEBUS_DECODER_BUFFER_SIZE];
+    uint8_t count;
+};
+
+static VeBusFrameDecoder decoder;
+static Decoded decoded;
+
+static void collect(VeBusDecodeResult result, const VeBusFrameView& view) {
+    TEST_ASSERT_LESS_THAN(MAX_FRAMES, decoded.count);
+    decoded.results[decoded.count] = result;
+    if (result == VEBUS_DECODE_FRAME) {
+        decoded.views[decoded.count] = view;
+        memcpy(decoded.payloads[decoded.count], view.payload, view.payloadLength);
+    }
+    decoded.count++;
+}
+
+// Feeds the bytes in chunks of chunkSize and collects everything but NEED_MORE
+static void feed(const uint8_t* bytes, size_t length, size_t chunkSize) {
+    size_t offset = 0;
+    while (offset < length) {
+        size_t chunk = length - offset < chunkSize ? length - offset : chunkSize;
+        size_t taken = decoder.push(&bytes[offset], chunk);
+        offset += taken;
+        VeBusFrameView view;
+        VeBusDecodeResult result;
+        while ((result = decoder.next(view)) != VEBUS_DECODE_NEED_MORE) {
+            collect(result, view);
+        }
+        if (taken == 0) {
+            TEST_FAIL_MESSAGE("decoder does not take bytes");
+        }
+    }
+}
+
+// Sync frame 83 83 FD nr 55 <data> <checksum> FF, the 0x55 marker is not summed
+static size_t buildSyncFrame(uint8_t* out, uint8_t number, const uint8_t* data, uint8_t length) {
+    size_t n = 0;
+    out[n++] = 0x83;
+    out[n++] = 0x83;
+    out[n++] = VEBUS_FRAME_TYPE_SYNC;
+    out[n++] = number;
+    out[n++] = 0x55;
+    uint8_t sum = VEBUS_FRAME_TYPE_SYNC + number;
+    for (uint8_t i = 0; i < length; i++) {
+        out[n++] = data[i];
+        sum += data[i];
+    }
+    out[n++] = 1 - sum;
+    out[n++] = VEBUS_EOF_BYTE;
+    return n;
+}
+
+static size_t buildEssFrame(uint8_t* out, uint8_t number, uint8_t lo, uint8_t hi) {
+    VeBusMk3Writer writer(out, VEBUS_MK3_TEMPLATE_ESS_POWER, number);
+    writer.put(0x83);
+    writer.put(lo);
+    writer.put(hi);
+    return writer.finish();
+}
+
+void setUp(void) {
+    decoder.reset();
+    memset(&decoded, 0, sizeof(decoded));
+}
+
+void tearDown(void) {}
+
+void test_data_frame(void) {
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+    size_t length = buildEssFrame(frame, 0x21, 0x2C, 0x01);
+
+    feed(frame, length, length);
+
+    TEST_ASSERT_EQUAL(1, decoded.count);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+    const VeBusFrameView& view = decoded.views[0];
+    TEST_ASSERT_EQUAL_HEX16(0x98F7, view.sourceAddress);
+    TEST_ASSERT_EQUAL_HEX8(VEBUS_FRAME_TYPE_DATA, view.frameType);
+    TEST_ASSERT_EQUAL(0x21, view.frameNumber);
+    TEST_ASSERT_FALSE(view.isSyncFrame());
+    const uint8_t expected[] = {0x00, 0xE6, 0x37, 0x02, 0x83, 0x2C, 0x01};
+    TEST_ASSERT_EQUAL(sizeof(expected), view.payloadLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, decoded.payloads[0], sizeof(expected));
+    TEST_ASSERT_EQUAL_HEX8(0x00, view.address);
+    TEST_ASSERT_EQUAL_HEX8(0xE6, view.command);
+    TEST_ASSERT_EQUAL(4, view.length);
+}
+
+void test_stuffed_bytes_are_restored(void) {
+    // -1 W = FF FF, both bytes go out as FA 7F
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+    size_t length = buildEssFrame(frame, 5, 0xFF, 0xFF);
+    const uint8_t stuffed[] = {0xFA, 0x7F, 0xFA, 0x7F};
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(stuffed, &frame[9], sizeof(stuffed));
+
+    feed(frame, length, length);
+
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+    TEST_ASSERT_EQUAL(7, decoded.views[0].payloadLength);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, decoded.payloads[0][5]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, decoded.payloads[0][6]);
+}
+
+void test_every_stuffable_value(void) {
+    for (uint16_t value = VEBUS_STUFF_BYTE; value <= 0xFF; value++) {
+        setUp();
+        uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+        size_t length = buildEssFrame(frame, 1, (uint8_t)value, 0x00);
+        feed(frame, length, length);
+        TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+        TEST_ASSERT_EQUAL_HEX8(value, decoded.payloads[0][5]);
+    }
+}
+
+void test_escaped_checksum(void) {
+    // Find a setpoint whose checksum is above 0xFA and goes out as FA, cs - FA
+    bool escapedSeen = false;
+    bool plainFaSeen = false;
+    for (uint16_t lo = 0; lo < 0xFA; lo++) {
+        setUp();
+        uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+        size_t length = buildEssFrame(frame, 0, (uint8_t)lo, 0x00);
+        bool escaped = frame[length - 3] == VEBUS_STUFF_BYTE && frame[length - 2] < 0x70;
+        bool plainFa = frame[length - 2] == VEBUS_STUFF_BYTE;
+
+        feed(frame, length, length);
+        TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+        if (escaped) {
+            TEST_ASSERT_EQUAL_HEX8(VEBUS_STUFF_BYTE + frame[length - 2], decoded.views[0].checksum);
+            escapedSeen = true;
+        }
+        if (plainFa) {
+            TEST_ASSERT_EQUAL_HEX8(VEBUS_STUFF_BYTE, decoded.views[0].checksum);
+            plainFaSeen = true;
+        }
+    }
+    TEST_ASSERT_TRUE(escapedSeen);
+    TEST_ASSERT_TRUE(plainFaSeen);
+}
+
+void test_sync_frame_checksum_skips_marker(void) {
+    const uint8_t data[] = {0x00, 0x00, 0x00, 0x00, 0x14, 0x80};
+    uint8_t frame[32];
+    size_t length = buildSyncFrame(frame, 0x47, data, sizeof(data));
+
+    feed(frame, length, length);
+
+    TEST_ASSERT_EQUAL(1, decoded.count);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+    TEST_ASSERT_TRUE(decoded.views[0].isSyncFrame());
+    TEST_ASSERT_EQUAL_HEX16(0x8383, decoded.views[0].sourceAddress);
+    TEST_ASSERT_EQUAL(0x47, decoded.views[0].frameNumber);
+    TEST_ASSERT_EQUAL_HEX8(0x55, decoded.payloads[0][0]);
+    TEST_ASSERT_EQUAL(1 + sizeof(data), decoded.views[0].payloadLength);
+}
+
+void test_sync_frame_with_marker_summed_fails(void) {
+    const uint8_t data[] = {0x00, 0x14, 0x80};
+    uint8_t frame[32];
+    size_t length = buildSyncFrame(frame, 0x10, data, sizeof(data));
+    frame[length - 2] -= 0x55;      // Checksum as if the marker counted
+
+    feed(frame, length, length);
+
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_CHECKSUM_ERROR, decoded.results[0]);
+}
+
+void test_data_frame_sums_0x55(void) {
+    // Only sync frames skip the 0x55, in a data frame it is an ordinary byte
+    uint8_t frame[] = {0x83, 0x83, VEBUS_FRAME_TYPE_DATA, 0x01, 0x55, 0x10, 0x00, VEBUS_EOF_BYTE};
+    frame[6] = (uint8_t)(1 - (VEBUS_FRAME_TYPE_DATA + 0x01 + 0x55 + 0x10));
+
+    feed(frame, sizeof(frame), sizeof(frame));
+
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+    TEST_ASSERT_FALSE(decoded.views[0].isSyncFrame());
+    TEST_ASSERT_EQUAL_HEX8(0x55, decoded.payloads[0][0]);
+}
+
+void test_checksum_error_then_recovery(void) {
+    uint8_t stream[2 * VEBUS_MK3_FRAME_SIZE(3)];
+    size_t first = buildEssFrame(stream, 1, 0x10, 0x00);
+    stream[9] ^= 0x01;      // Corrupt a data byte
+    size_t second = buildEssFrame(&stream[first], 2, 0x20, 0x00);
+
+    feed(stream, first + second, first + second);
+
+    TEST_ASSERT_EQUAL(2, decoded.count);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_CHECKSUM_ERROR, decoded.results[0]);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[1]);
+    TEST_ASSERT_EQUAL(2, decoded.views[1].frameNumber);
+    TEST_ASSERT_EQUAL_HEX8(0x20, decoded.payloads[1][5]);
+}
+
+void test_too_short_frame_is_an_error(void) {
+    const uint8_t frame[] = {0x83, 0x83, VEBUS_FRAME_TYPE_DATA, VEBUS_EOF_BYTE};
+
+    feed(frame, sizeof(frame), sizeof(frame));
+
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_CHECKSUM_ERROR, decoded.results[0]);
+}
+
+void test_byte_by_byte_equals_bulk(void) {
+    uint8_t stream[64];
+    const uint8_t data[] = {0x01, 0xFB, 0x80};
+    size_t length = buildSyncFrame(stream, 0x7F, data, sizeof(data));
+    length += buildEssFrame(&stream[length], 0, 0xFE, 0xFF);
+
+    feed(stream, length, length);
+    Decoded bulk = decoded;
+
+    setUp();
+    feed(stream, length, 1);
+
+    TEST_ASSERT_EQUAL(2, bulk.count);
+    TEST_ASSERT_EQUAL(bulk.count, decoded.count);
+    for (uint8_t i = 0; i < bulk.count; i++) {
+        TEST_ASSERT_EQUAL(bulk.results[i], decoded.results[i]);
+        TEST_ASSERT_EQUAL(bulk.views[i].payloadLength, decoded.views[i].payloadLength);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(bulk.payloads[i], decoded.payloads[i], bulk.views[i].payloadLength);
+    }
+}
+
+void test_rx_space_and_commit(void) {
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+    size_t length = buildEssFrame(frame, 9, 0xE8, 0x03);
+
+    size_t capacity;
+    uint8_t* space = decoder.rxSpace(capacity);
+    TEST_ASSERT_EQUAL(VEBUS_DECODER_BUFFER_SIZE, capacity);
+    memcpy(space, frame, length);
+    decoder.commit(length);
+
+    VeBusFrameView view;
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoder.next(view));
+    TEST_ASSERT_EQUAL(9, view.frameNumber);
+    TEST_ASSERT_EQUAL_HEX8(0xE8, view.payload[5]);
+    TEST_ASSERT_EQUAL_HEX8(0x03, view.payload[6]);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_NEED_MORE, decoder.next(view));
+    TEST_ASSERT_FALSE(decoder.isInFrame());
+}
+
+void test_partial_frame_and_abort(void) {
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+    size_t length = buildEssFrame(frame, 3, 0x01, 0x02);
+
+    feed(frame, 6, 6);
+    TEST_ASSERT_EQUAL(0, decoded.count);
+    TEST_ASSERT_TRUE(decoder.isInFrame());
+
+    decoder.abortFrame();
+    TEST_ASSERT_FALSE(decoder.isInFrame());
+
+    feed(frame, length, length);
+    TEST_ASSERT_EQUAL(1, decoded.count);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+}
+
+void test_overflow_resynchronizes(void) {
+    uint8_t noise[3 * VEBUS_DECODER_BUFFER_SIZE];
+    memset(noise, 0x11, sizeof(noise));
+    noise[sizeof(noise) - 1] = VEBUS_EOF_BYTE;
+
+    feed(noise, sizeof(noise), 16);
+
+    TEST_ASSERT_EQUAL(1, decoded.count);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_OVERFLOW, decoded.results[0]);
+
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(3)];
+    size_t length = buildEssFrame(frame, 4, 0x05, 0x06);
+    memset(&decoded, 0, sizeof(decoded));
+    feed(frame, length, length);
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoded.results[0]);
+    TEST_ASSERT_EQUAL(4, decoded.views[0].frameNumber);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_data_frame);
+    RUN_TEST(test_stuffed_bytes_are_restored);
+    RUN_TEST(test_every_stuffable_value);
+    RUN_TEST(test_escaped_checksum);
+    RUN_TEST(test_sync_frame_checksum_skips_marker);
+    RUN_TEST(test_sync_frame_with_marker_summed_fails);
+    RUN_TEST(test_data_frame_sums_0x55);
+    RUN_TEST(test_checksum_error_then_recovery);
+    RUN_TEST(test_too_short_frame_is_an_error);
+    RUN_TEST(test_byte_by_byte_equals_bulk);
+    RUN_TEST(test_rx_space_and_commit);
+    RUN_TEST(test_partial_frame_and_abort);
+    RUN_TEST(test_overflow_resynchronizes);
+    return UNITY_END();
+}
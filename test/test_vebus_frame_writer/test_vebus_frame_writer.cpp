@@ -0,0 +1,154 @@
+/*
+ * VeBusMk3Writer and MK3 Template Tests
+ *
+ * The single pass writer is compared against the two pass encoding of
+ * docs/README.md: byte replacement first, then the checksum over the wire
+ * bytes.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "vebus_frame_writer.h"
+#include "vebus_frame_decoder.h"
+#include "vebus_slot_scheduler.h"
+
+// Reference encoding: stuff the data, then sum the wire bytes from index 2
+static size_t referenceEncode(uint8_t* out, uint8_t command, uint8_t frameNumber,
+                              const uint8_t* data, uint8_t length) {
+    const uint8_t header[] = {0x98, 0xF7, VEBUS_FRAME_TYPE_DATA, frameNumber,
+                              VEBUS_MK3_OWN_ID_HIGH, VEBUS_MK3_OWN_ID_LOW, command, VEBUS_MK3_FLAGS_RAMVAR};
+    size_t n = 0;
+    for (uint8_t b : header) {
+        out[n++] = b;
+    }
+    for (uint8_t i = 0; i < length; i++) {
+        if (data[i] >= VEBUS_STUFF_BYTE) {
+            out[n++] = VEBUS_STUFF_BYTE;
+            out[n++] = 0x70 | (data[i] & 0x0F);
+        } else {
+            out[n++] = data[i];
+        }
+    }
+    uint8_t sum = 0;
+    for (size_t i = 2; i < n; i++) {
+        sum += out[i];
+    }
+    uint8_t checksum = 1 - sum;
+    if (checksum > VEBUS_STUFF_BYTE) {
+        out[n++] = VEBUS_STUFF_BYTE;
+        out[n++] = checksum - VEBUS_STUFF_BYTE;
+    } else {
+        out[n++] = checksum;
+    }
+    out[n++] = VEBUS_EOF_BYTE;
+    return n;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_template_layout(void) {
+    const VeBusMk3Template& t = VEBUS_MK3_TEMPLATE_ESS_POWER;
+    const uint8_t expected[] = {0x98, 0xF7, 0xFE, 0x00, 0x00, 0xE6, 0x37, 0x02};
+    TEST_ASSERT_EQUAL(VEBUS_MK3_TEMPLATE_SIZE, t.length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, t.bytes, sizeof(expected));
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)(0xFE + 0x00 + 0xE6 + 0x37 + 0x02), t.sum);
+}
+
+void test_template_with_fixed_data(void) {
+    const VeBusMk3Template& t = VEBUS_MK3_TEMPLATE_STATUS_REQUEST;
+    const uint8_t data[] = {0x04, 0x0E, 0x00, 0x00};
+    TEST_ASSERT_EQUAL(VEBUS_MK3_TEMPLATE_SIZE + 4, t.length);
+    TEST_ASSERT_EQUAL_HEX8(0x30, t.bytes[6]);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, &t.bytes[VEBUS_MK3_TEMPLATE_SIZE], sizeof(data));
+
+    uint8_t sum = 0;
+    for (uint8_t i = 2; i < t.length; i++) {
+        sum += t.bytes[i];
+    }
+    TEST_ASSERT_EQUAL_HEX8(sum, t.sum);
+}
+
+void test_template_plain_check(void) {
+    TEST_ASSERT_TRUE(vebusMk3TemplateIsPlain(vebusMk3Template(0x30, 2, 0x04, 0xF9)));
+    TEST_ASSERT_FALSE(vebusMk3TemplateIsPlain(vebusMk3Template(0x30, 2, 0x04, 0xFA)));
+    TEST_ASSERT_FALSE(vebusMk3TemplateIsPlain(vebusMk3Template(0xFF)));
+    // Bytes past the used length are not looked at
+    VeBusMk3Template t = vebusMk3Template(0x30, 1, 0x04);
+    t.bytes[VEBUS_MK3_TEMPLATE_SIZE + 1] = 0xFF;
+    TEST_ASSERT_TRUE(vebusMk3TemplateIsPlain(t));
+}
+
+void test_status_request_matches_reference(void) {
+    uint8_t written[VEBUS_MK3_FRAME_SIZE(0)];
+    uint8_t reference[VEBUS_MK3_FRAME_SIZE(0) + 8];
+    const uint8_t data[] = {0x04, 0x0E, 0x00, 0x00};
+
+    for (uint8_t number = 0; number <= VEBUS_FRAME_NUMBER_MASK; number++) {
+        VeBusMk3Writer writer(written, VEBUS_MK3_TEMPLATE_STATUS_REQUEST, number);
+        size_t length = writer.finish();
+        size_t expected = referenceEncode(reference, 0x30, number, data, sizeof(data));
+        TEST_ASSERT_EQUAL(expected, length);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(reference, written, length);
+    }
+}
+
+void test_every_ess_setpoint_matches_reference(void) {
+    uint8_t written[VEBUS_MK3_FRAME_SIZE(3)];
+    uint8_t reference[VEBUS_MK3_FRAME_SIZE(3) + 8];
+
+    for (uint32_t value = 0; value <= 0xFFFF; value++) {
+        uint8_t number = (uint8_t)(value & VEBUS_FRAME_NUMBER_MASK);
+        const uint8_t data[] = {0x83, (uint8_t)value, (uint8_t)(value >> 8)};
+        VeBusMk3Writer writer(written, VEBUS_MK3_TEMPLATE_ESS_POWER, number);
+        writer.put(data, sizeof(data));
+        size_t length = writer.finish();
+        size_t expected = referenceEncode(reference, 0x37, number, data, sizeof(data));
+
+        TEST_ASSERT_EQUAL(expected, length);
+        TEST_ASSERT_LESS_OR_EQUAL(VEBUS_MK3_FRAME_SIZE(3), length);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(reference, written, length);
+    }
+}
+
+void test_writer_output_decodes(void) {
+    VeBusFrameDecoder decoder;
+    uint8_t frame[VEBUS_MK3_FRAME_SIZE(8)];
+    uint32_t state = 12345;
+
+    for (uint32_t i = 0; i < 5000; i++) {
+        uint8_t data[8];
+        for (uint8_t& b : data) {
+            state = state * 1103515245 + 12345;
+            b = (uint8_t)(state >> 16);
+        }
+        VeBusMk3Writer writer(frame, VEBUS_MK3_TEMPLATE_RAM_READ, (uint8_t)(i & VEBUS_FRAME_NUMBER_MASK));
+        writer.put(data, sizeof(data));
+        size_t length = writer.finish();
+        TEST_ASSERT_LESS_OR_EQUAL(VEBUS_MK3_FRAME_SIZE(8), length);
+
+        decoder.reset();
+        TEST_ASSERT_EQUAL(length, decoder.push(frame, length));
+        VeBusFrameView view;
+        TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoder.next(view));
+        TEST_ASSERT_EQUAL(i & VEBUS_FRAME_NUMBER_MASK, view.frameNumber);
+        TEST_ASSERT_EQUAL(4 + sizeof(data), view.payloadLength);
+        TEST_ASSERT_EQUAL_HEX8(0x30, view.payload[2]);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(data, &view.payload[4], sizeof(data));
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_template_layout);
+    RUN_TEST(test_template_with_fixed_data);
+    RUN_TEST(test_template_plain_check);
+    RUN_TEST(test_status_request_matches_reference);
+    RUN_TEST(test_every_ess_setpoint_matches_reference);
+    RUN_TEST(test_writer_output_decodes);
+    return UNITY_END();
+}
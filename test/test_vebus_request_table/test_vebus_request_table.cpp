@@ -0,0 +1,488 @@
+/*
+ * VE.Bus Request Table Tests
+ *
+ * Request/response correlation against a fake Multiplus. Time is simulated
+ * in milliseconds: callers submit requests, one queued request goes out per
+ * sync period (20 ms) the way the VE.Bus task sends it, and the fake
+ * Multiplus answers every request after a random delay. Answers are real
+ * wire frames that go through VeBusFrameDecoder before they reach the
+ * table. Each answer carries the serial number of its request, so a
+ * response handed to the wrong caller shows.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "vebus_request_table.h"
+#include "vebus_frame_decoder.h"
+#include "vebus_messages.h"
+
+#define SYNC_PERIOD_MS 20
+#define FAKE_DELAY_MIN_MS 5
+#define FAKE_DELAY_MAX_MS 500
+#define FAKE_MAX_ANSWERS 16
+#define SIM_DURATION_MS 4000000     // ~84000 requests, the ticket counter wraps
+
+static const uint8_t commands[] = {
+    VEBUS_CMD_GET_VERSION, VEBUS_CMD_GET_LED_STATUS, VEBUS_CMD_GET_DEVICE_STATUS,
+    VEBUS_CMD_GET_ERROR_INFO, VEBUS_CMD_GET_WARNING_INFO
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Answers requests after a random delay. The Multiplus works through the
+// requests of one command in order; different commands may overtake.
+class FakeMultiplus {
+private:
+    struct Answer {
+        uint32_t dueMs;
+        uint8_t command;
+        uint16_t serial;
+        uint32_t order;     // Same due time: first come, first served
+    };
+
+    Answer answers[FAKE_MAX_ANSWERS];
+    uint8_t count;
+    uint32_t lastDueMs[COMMAND_COUNT];
+    uint8_t frameNumber;
+    uint32_t random;
+    uint32_t requests;
+
+    static uint8_t commandIndex(uint8_t command) {
+        for (uint8_t i = 0; i < COMMAND_COUNT; i++) {
+            if (commands[i] == command) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    static void put(uint8_t* wire, size_t& pos, uint8_t& sum, uint8_t value) {
+        if (value >= VEBUS_STUFF_BYTE) {
+            uint8_t escaped = 0x70 | (value & 0x0F);
+            wire[pos++] = VEBUS_STUFF_BYTE;
+            wire[pos++] = escaped;
+            sum += VEBUS_STUFF_BYTE + escaped;
+        } else {
+            wire[pos++] = value;
+            sum += value;
+        }
+    }
+
+public:
+    explicit FakeMultiplus(uint32_t seed) : count(0), frameNumber(0), random(seed), requests(0) {
+        memset(lastDueMs, 0, sizeof(lastDueMs));
+    }
+
+    void request(uint8_t command, uint16_t serial, uint32_t nowMs) {
+        TEST_ASSERT_LESS_THAN(FAKE_MAX_ANSWERS, count);
+        uint32_t dueMs = nowMs + FAKE_DELAY_MIN_MS + random32(random) % (FAKE_DELAY_MAX_MS - FAKE_DELAY_MIN_MS);
+        uint8_t index = commandIndex(command);
+        if ((int32_t)(dueMs - lastDueMs[index]) < 0) {
+            dueMs = lastDueMs[index];
+        }
+        lastDueMs[index] = dueMs;
+        answers[count++] = {dueMs, command, serial, requests++};
+    }
+
+    // Wire image of the next answer due, 83 83 FE nr 00 <command> <serial> 00 cs FF;
+    // the decoder leaves the trailing byte out of the data, as for info frames
+    size_t answer(uint32_t nowMs, uint8_t* wire) {
+        uint8_t next = count;
+        for (uint8_t i = 0; i < count; i++) {
+            if ((int32_t)(nowMs - answers[i].dueMs) >= 0 &&
+                (next == count || (int32_t)(answers[i].dueMs - answers[next].dueMs) < 0 ||
+                 (answers[i].dueMs == answers[next].dueMs && answers[i].order < answers[next].order))) {
+                next = i;
+            }
+        }
+        if (next == count) {
+            return 0;
+        }
+        Answer answer = answers[next];
+        answers[next] = answers[--count];
+
+        frameNumber = (frameNumber + 1) & 0x7F;
+        // The header is not stuffed, the frame number stays below 0x80
+        size_t pos = 0;
+        wire[pos++] = 0x83;
+        wire[pos++] = 0x83;
+        wire[pos++] = VEBUS_FRAME_TYPE_DATA;
+        wire[pos++] = frameNumber;
+        uint8_t sum = VEBUS_FRAME_TYPE_DATA + frameNumber;
+        put(wire, pos, sum, 0x00);
+        put(wire, pos, sum, answer.command);
+        put(wire, pos, sum, (uint8_t)answer.serial);
+        put(wire, pos, sum, (uint8_t)(answer.serial >> 8));
+        put(wire, pos, sum, 0x00);
+        uint8_t checksum = 1 - sum;
+        if (checksum > VEBUS_STUFF_BYTE) {
+            wire[pos++] = VEBUS_STUFF_BYTE;
+            wire[pos++] = checksum - VEBUS_STUFF_BYTE;
+        } else {
+            wire[pos++] = checksum;
+        }
+        wire[pos++] = VEBUS_EOF_BYTE;
+        return pos;
+    }
+
+    uint8_t getOutstanding() const { return count; }
+};
+
+struct Caller {
+    VeBusRequestHandle handle;
+    uint8_t command;
+    uint16_t serial;
+    bool active;
+    bool sent;
+};
+
+struct CallbackResult {
+    uint32_t completed;
+    uint32_t timedOut;
+    uint32_t wrong;
+    uint16_t expectedSerial;
+};
+
+static VeBusRequestTable* table;
+
+static void onResponse(const VeBusResponse* response, void* context) {
+    CallbackResult* result = (CallbackResult*)context;
+    if (response == nullptr) {
+        result->timedOut++;
+        return;
+    }
+    result->completed++;
+    uint16_t serial = response->length >= 2 ? (uint16_t)(response->data[0] | (response->data[1] << 8)) : 0;
+    if (serial != result->expectedSerial) {
+        result->wrong++;
+    }
+}
+
+static bool deliver(const uint8_t* wire, size_t length, uint32_t nowMs) {
+    VeBusFrameDecoder decoder;
+    decoder.push(wire, length);
+    VeBusFrameView frame;
+    TEST_ASSERT_EQUAL(VEBUS_DECODE_FRAME, decoder.next(frame));
+
+    VeBusResponseCallback callback;
+    void* context;
+    VeBusResponse response;
+    bool matched = table->complete(frame.command, frame.frameNumber, frame.data, frame.length,
+                                   nowMs, callback, context, response);
+    if (matched && callback != nullptr) {
+        callback(&response, context);
+    }
+    return matched;
+}
+
+void setUp(void) {
+    table = new VeBusRequestTable();
+}
+
+void tearDown(void) {
+    delete table;
+}
+
+void test_poll_lifecycle(void) {
+    VeBusRequestHandle handle = table->add(VEBUS_CMD_GET_VERSION, 100);
+    TEST_ASSERT_TRUE(handle.isValid());
+    TEST_ASSERT_TRUE(table->isPending(VEBUS_CMD_GET_VERSION));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_QUEUED, table->poll(handle, nullptr));
+
+    TEST_ASSERT_TRUE(table->markSent(handle, 0x12, 120));
+    TEST_ASSERT_FALSE(table->markSent(handle, 0x13, 121));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_SENT, table->poll(handle, nullptr));
+
+    // Answers to other commands do not complete it
+    const uint8_t data[] = {0x01, 0x02, 0x03};
+    VeBusResponseCallback callback;
+    void* context;
+    VeBusResponse response;
+    TEST_ASSERT_FALSE(table->complete(VEBUS_CMD_GET_LED_STATUS, 0x13, data, sizeof(data), 150,
+                                      callback, context, response));
+    TEST_ASSERT_TRUE(table->complete(VEBUS_CMD_GET_VERSION, 0x14, data, sizeof(data), 160,
+                                     callback, context, response));
+    TEST_ASSERT_NULL(callback);
+    TEST_ASSERT_FALSE(table->isPending(VEBUS_CMD_GET_VERSION));
+
+    VeBusResponse polled;
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(handle, &polled));
+    TEST_ASSERT_EQUAL_HEX8(VEBUS_CMD_GET_VERSION, polled.command);
+    TEST_ASSERT_EQUAL(0x14, polled.frameNumber);
+    TEST_ASSERT_EQUAL(3, polled.length);
+    TEST_ASSERT_EQUAL_MEMORY(data, polled.data, sizeof(data));
+    TEST_ASSERT_EQUAL(160, polled.timestamp);
+
+    // Collected, the handle is stale now
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_FREE, table->poll(handle, nullptr));
+    TEST_ASSERT_EQUAL(0, table->getPendingCount());
+}
+
+void test_oldest_request_gets_the_response(void) {
+    VeBusRequestHandle first = table->add(VEBUS_CMD_GET_ERROR_INFO, 0);
+    VeBusRequestHandle second = table->add(VEBUS_CMD_GET_ERROR_INFO, 0);
+    // The second one goes out first, it is still the younger request
+    TEST_ASSERT_TRUE(table->markSent(second, 1, 20));
+    TEST_ASSERT_TRUE(table->markSent(first, 3, 40));
+
+    const uint8_t a[] = {0xAA};
+    const uint8_t b[] = {0xBB};
+    VeBusResponseCallback callback;
+    void* context;
+    VeBusResponse response;
+    TEST_ASSERT_TRUE(table->complete(VEBUS_CMD_GET_ERROR_INFO, 4, a, 1, 50, callback, context, response));
+    TEST_ASSERT_TRUE(table->complete(VEBUS_CMD_GET_ERROR_INFO, 5, b, 1, 60, callback, context, response));
+
+    VeBusResponse polled;
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(first, &polled));
+    TEST_ASSERT_EQUAL_HEX8(0xAA, polled.data[0]);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(second, &polled));
+    TEST_ASSERT_EQUAL_HEX8(0xBB, polled.data[0]);
+}
+
+void test_full_table(void) {
+    VeBusRequestHandle handles[VEBUS_MAX_PENDING_REQUESTS];
+    for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+        handles[i] = table->add(VEBUS_CMD_GET_VERSION, 0);
+        TEST_ASSERT_TRUE(handles[i].isValid());
+    }
+    TEST_ASSERT_FALSE(table->add(VEBUS_CMD_GET_VERSION, 0).isValid());
+    TEST_ASSERT_EQUAL(VEBUS_MAX_PENDING_REQUESTS, table->getPendingCount());
+
+    table->cancel(handles[3]);
+    VeBusRequestHandle reused = table->add(VEBUS_CMD_GET_VERSION, 0);
+    TEST_ASSERT_EQUAL(3, reused.slot);
+    // The old handle of the slot must not see the new request
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_FREE, table->poll(handles[3], nullptr));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_QUEUED, table->poll(reused, nullptr));
+}
+
+void test_cancelled_request_is_not_sent(void) {
+    VeBusRequestHandle handle = table->add(VEBUS_CMD_GET_VERSION, 0);
+    table->cancel(handle);
+    TEST_ASSERT_FALSE(table->markSent(handle, 1, 20));
+    TEST_ASSERT_FALSE(table->isPending(VEBUS_CMD_GET_VERSION));
+}
+
+void test_failed_send_is_sent_again(void) {
+    // processTransmitSlot(): marked sent, then the UART did not take the frame
+    VeBusRequestHandle handle = table->add(VEBUS_CMD_GET_VERSION, 0);
+    TEST_ASSERT_TRUE(table->markSent(handle, 1, 20));
+    table->markUnsent(handle);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_QUEUED, table->poll(handle, nullptr));
+    TEST_ASSERT_TRUE(table->isPending(VEBUS_CMD_GET_VERSION));
+
+    // Nothing is on the wire, a response now is not for it
+    const uint8_t data[] = {0x00};
+    VeBusResponseCallback callback;
+    void* context;
+    VeBusResponse response;
+    TEST_ASSERT_FALSE(table->complete(VEBUS_CMD_GET_VERSION, 2, data, 1, 30, callback, context, response));
+
+    // The retry in the next slot goes out and gets the response
+    TEST_ASSERT_TRUE(table->markSent(handle, 3, 40));
+    TEST_ASSERT_TRUE(table->complete(VEBUS_CMD_GET_VERSION, 4, data, 1, 45, callback, context, response));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(handle, &response));
+    TEST_ASSERT_EQUAL(4, response.frameNumber);
+
+    // A completed or cancelled request stays as it is
+    VeBusRequestHandle completed = table->add(VEBUS_CMD_GET_VERSION, 100);
+    table->markSent(completed, 5, 120);
+    table->complete(VEBUS_CMD_GET_VERSION, 6, data, 1, 125, callback, context, response);
+    table->markUnsent(completed);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(completed, nullptr));
+    VeBusRequestHandle cancelled = table->add(VEBUS_CMD_GET_VERSION, 100);
+    table->markSent(cancelled, 7, 140);
+    table->cancel(cancelled);
+    table->markUnsent(cancelled);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_FREE, table->poll(cancelled, nullptr));
+
+    // Without a retry it times out like a request that never got a slot
+    VeBusRequestHandle dropped = table->add(VEBUS_CMD_GET_VERSION, 200);
+    TEST_ASSERT_TRUE(table->markSent(dropped, 9, 220));
+    table->markUnsent(dropped);
+    TEST_ASSERT_FALSE(table->expire(200 + VEBUS_REQUEST_TIMEOUT_MS, callback, context));
+    TEST_ASSERT_FALSE(table->markSent(dropped, 11, 200 + VEBUS_REQUEST_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_TIMED_OUT, table->poll(dropped, nullptr));
+    TEST_ASSERT_EQUAL(0, table->getPendingCount());
+}
+
+void test_timeout_and_late_response(void) {
+    VeBusRequestHandle polled = table->add(VEBUS_CMD_GET_VERSION, 0);
+    CallbackResult result = {};
+    table->add(VEBUS_CMD_GET_LED_STATUS, 0, onResponse, &result);
+    VeBusRequestHandle expired = table->add(VEBUS_CMD_GET_ERROR_INFO, 0);
+    TEST_ASSERT_TRUE(table->markSent(polled, 1, 20));
+
+    // A request still queued at its deadline is not sent any more
+    TEST_ASSERT_FALSE(table->markSent(expired, 2, VEBUS_REQUEST_TIMEOUT_MS));
+
+    VeBusResponseCallback callback;
+    void* context;
+    TEST_ASSERT_FALSE(table->expire(VEBUS_REQUEST_TIMEOUT_MS - 1, callback, context));
+    TEST_ASSERT_NULL(callback);
+
+    // The callback request is handed back first, the others time out
+    TEST_ASSERT_TRUE(table->expire(VEBUS_REQUEST_TIMEOUT_MS, callback, context));
+    TEST_ASSERT_TRUE(callback == onResponse);
+    callback(nullptr, context);
+    TEST_ASSERT_FALSE(table->expire(VEBUS_REQUEST_TIMEOUT_MS, callback, context));
+    TEST_ASSERT_NULL(callback);
+    TEST_ASSERT_EQUAL(1, result.timedOut);
+
+    // The Multiplus answers too late, nobody waits for it
+    const uint8_t data[] = {0x00};
+    VeBusResponse response;
+    TEST_ASSERT_FALSE(table->complete(VEBUS_CMD_GET_VERSION, 3, data, 1, VEBUS_REQUEST_TIMEOUT_MS + 10,
+                                      callback, context, response));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_TIMED_OUT, table->poll(polled, nullptr));
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_FREE, table->poll(polled, nullptr));
+
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_TIMED_OUT, table->poll(expired, nullptr));
+    TEST_ASSERT_EQUAL(0, table->getPendingCount());
+}
+
+void test_uncollected_result_is_dropped(void) {
+    VeBusRequestHandle collected = table->add(VEBUS_CMD_GET_VERSION, 0);
+    VeBusRequestHandle forgotten = table->add(VEBUS_CMD_GET_VERSION, 0);
+    table->markSent(collected, 1, 20);
+    table->markSent(forgotten, 3, 40);
+    const uint8_t data[] = {0x00};
+    VeBusResponseCallback callback;
+    void* context;
+    VeBusResponse response;
+    table->complete(VEBUS_CMD_GET_VERSION, 2, data, 1, 100, callback, context, response);
+    table->complete(VEBUS_CMD_GET_VERSION, 4, data, 1, 100, callback, context, response);
+
+    table->expire(100 + VEBUS_REQUEST_RETENTION_MS - 1, callback, context);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_COMPLETED, table->poll(collected, nullptr));
+    table->expire(100 + VEBUS_REQUEST_RETENTION_MS, callback, context);
+    TEST_ASSERT_EQUAL(VEBUS_REQUEST_FREE, table->poll(forgotten, nullptr));
+}
+
+void test_fake_multiplus_random_delays(void) {
+    FakeMultiplus multiplus(0x2468ACE1);
+    Caller callers[VEBUS_MAX_PENDING_REQUESTS] = {};
+    CallbackResult results[VEBUS_MAX_PENDING_REQUESTS] = {};
+    VeBusRequestHandle queue[VEBUS_MAX_PENDING_REQUESTS];   // Waiting for a slot, oldest first
+    uint8_t queued = 0;
+    uint32_t random = 0x13579BDF;
+    uint16_t serial = 0;
+    uint32_t submitted = 0;
+    uint32_t polledOk = 0;
+    uint32_t callbacksOk = 0;
+    uint32_t wrong = 0;
+    uint8_t wire[32];
+
+    for (uint32_t now = 0; now < SIM_DURATION_MS; now++) {
+        // Callers come and go; half of them poll, half take a callback
+        uint8_t slot = random32(random) % VEBUS_MAX_PENDING_REQUESTS;
+        Caller& caller = callers[slot];
+        if (!caller.active && random32(random) % 10 == 0) {
+            caller.command = commands[random32(random) % COMMAND_COUNT];
+            caller.serial = ++serial;
+            bool useCallback = slot % 2 == 1;
+            results[slot].expectedSerial = caller.serial;
+            caller.handle = table->add(caller.command, now, useCallback ? onResponse : nullptr,
+                                       useCallback ? &results[slot] : nullptr);
+            // One caller per slot, the table always has room
+            TEST_ASSERT_TRUE(caller.handle.isValid());
+            submitted++;
+            caller.active = true;
+            caller.sent = false;
+            TEST_ASSERT_LESS_THAN(VEBUS_MAX_PENDING_REQUESTS, queued);
+            queue[queued++] = caller.handle;
+        }
+
+        // One frame per sync period, the oldest queued request
+        if (now % SYNC_PERIOD_MS == 0 && queued > 0) {
+            VeBusRequestHandle handle = queue[0];
+            memmove(&queue[0], &queue[1], --queued * sizeof(queue[0]));
+            for (Caller& c : callers) {
+                if (c.active && c.handle.slot == handle.slot && c.handle.ticket == handle.ticket) {
+                    TEST_ASSERT_TRUE(table->markSent(handle, (uint8_t)(now / SYNC_PERIOD_MS) & 0x7F, now));
+                    multiplus.request(c.command, c.serial, now);
+                    c.sent = true;
+                }
+            }
+        }
+
+        size_t length;
+        while ((length = multiplus.answer(now, wire)) > 0) {
+            TEST_ASSERT_TRUE(deliver(wire, length, now));
+        }
+
+        VeBusResponseCallback callback;
+        void* context;
+        while (table->expire(now, callback, context)) {
+            callback(nullptr, context);
+        }
+
+        for (uint8_t i = 0; i < VEBUS_MAX_PENDING_REQUESTS; i++) {
+            Caller& c = callers[i];
+            if (!c.active) {
+                continue;
+            }
+            if (i % 2 == 1) {
+                // Callback requests are released by the table on completion
+                if (results[i].completed + results[i].timedOut > 0 &&
+                    table->poll(c.handle, nullptr) == VEBUS_REQUEST_FREE) {
+                    callbacksOk += results[i].completed;
+                    wrong += results[i].wrong;
+                    TEST_ASSERT_EQUAL(0, results[i].timedOut);
+                    results[i] = CallbackResult();
+                    c.active = false;
+                }
+                continue;
+            }
+            VeBusResponse response;
+            VeBusRequestState state = table->poll(c.handle, &response);
+            if (state == VEBUS_REQUEST_COMPLETED) {
+                TEST_ASSERT_TRUE(c.sent);
+                TEST_ASSERT_EQUAL_HEX8(c.command, response.command);
+                TEST_ASSERT_EQUAL(2, response.length);
+                if ((uint16_t)(response.data[0] | (response.data[1] << 8)) != c.serial) {
+                    wrong++;
+                }
+                polledOk++;
+                c.active = false;
+            } else {
+                TEST_ASSERT_TRUE(state == VEBUS_REQUEST_QUEUED || state == VEBUS_REQUEST_SENT);
+            }
+        }
+    }
+
+    TEST_ASSERT_EQUAL(0, wrong);
+    TEST_ASSERT_GREATER_THAN(UINT16_MAX, submitted);   // The ticket counter wrapped
+    // Every request that went out was answered and handed to its caller
+    uint32_t open = 0;
+    for (const Caller& c : callers) {
+        open += c.active;
+    }
+    TEST_ASSERT_EQUAL(submitted, polledOk + callbacksOk + open);
+    TEST_ASSERT_GREATER_THAN(submitted / 3, polledOk);
+    TEST_ASSERT_GREATER_THAN(submitted / 3, callbacksOk);
+    TEST_ASSERT_LESS_OR_EQUAL(VEBUS_MAX_PENDING_REQUESTS, multiplus.getOutstanding());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_poll_lifecycle);
+    RUN_TEST(test_oldest_request_gets_the_response);
+    RUN_TEST(test_full_table);
+    RUN_TEST(test_cancelled_request_is_not_sent);
+    RUN_TEST(test_failed_send_is_sent_again);
+    RUN_TEST(test_timeout_and_late_response);
+    RUN_TEST(test_uncollected_result_is_dropped);
+    RUN_TEST(test_fake_multiplus_random_delays);
+    return UNITY_END();
+}
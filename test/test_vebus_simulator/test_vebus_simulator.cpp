@@ -0,0 +1,121 @@
+/*
+ * VE.Bus Closed Loop Tests
+ *
+ * VeBusHandler against VeBusSimulator over the in-process UART, the setup
+ * of native_sim.cpp. Needs the native-sim environment:
+ *
+ *   pio test -e native-sim
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "vebus_handler.h"
+#include "vebus_simulator.h"
+
+#define SETPOINTS 100
+#define ACK_TIMEOUT_MS 2000             // Leaves room for timeouts and retransmissions
+#define STREAM_MS 3000
+
+extern VeBusHandler veBusHandler;
+
+static VeBusSimulator* simulator;
+static VeBusSimulatorUart* uart;
+
+// Every ESS write the simulator received was either acknowledged or counted as a miss,
+// the handler's periodic status requests aside
+static void assertBusAccounting(const VeBusSimulatorStats& sim) {
+    TEST_ASSERT_EQUAL(0, sim.checksumErrors);
+    TEST_ASSERT_EQUAL(0, sim.unmatchedAcks);
+    TEST_ASSERT_EQUAL(sim.essCommands, sim.essAcknowledged + sim.slotMisses + sim.numberMisses);
+    TEST_ASSERT_GREATER_THAN(0, sim.syncFrames);
+}
+
+void setUp(void) {
+    simulator = new VeBusSimulator();
+    uart = new VeBusSimulatorUart(*simulator);
+    uart->setReceiveHandler([]() { veBusHandler.onUartReceive(); });
+    simulator->begin([](const uint8_t* data, size_t length) { uart->deliver(data, length); });
+    TEST_ASSERT_TRUE(veBusHandler.begin(uart));
+}
+
+void tearDown(void) {
+    veBusHandler.end();
+    simulator->end();
+    delete uart;
+    delete simulator;
+}
+
+void test_every_setpoint_acknowledged(void) {
+    // One setpoint at a time: each one has to reach the Multiplus and come back acknowledged
+    for (uint32_t i = 0; i < SETPOINTS; i++) {
+        int16_t power = (int16_t)(i * 37 % 2000) - 1000;
+        simulator->noteSetpoint(power);
+        TEST_ASSERT_TRUE(veBusHandler.sendEssPowerCommand(power));
+
+        uint32_t waitedMs = 0;
+        while (veBusHandler.getStatistics().setpointsAcknowledged < i + 1 && waitedMs < ACK_TIMEOUT_MS) {
+            halDelayMs(1);
+            waitedMs++;
+        }
+        TEST_ASSERT_EQUAL(i + 1, veBusHandler.getStatistics().setpointsAcknowledged);
+        TEST_ASSERT_EQUAL(power, simulator->getEssPower());
+    }
+
+    halDelayMs(100);
+    VeBusSimulatorStats sim = simulator->getStats();
+    VeBusStatistics handler = veBusHandler.getStatistics();
+    assertBusAccounting(sim);
+    TEST_ASSERT_EQUAL(SETPOINTS, sim.essAcknowledged);
+    TEST_ASSERT_EQUAL(SETPOINTS, handler.setpointsAcknowledged);
+    TEST_ASSERT_EQUAL(0, handler.commandsCoalesced);
+    TEST_ASSERT_EQUAL(SETPOINTS, simulator->getAckLatency().getCount());
+}
+
+void test_setpoint_on_every_sync(void) {
+    // Like EssController: a new setpoint on every sync notification
+    std::atomic<bool> producing(true);
+    std::atomic<uint32_t> submitted(0);
+    std::atomic<int16_t> last(0);
+    std::thread producer([&]() {
+        veBusHandler.setSyncListener(halTaskCurrent());
+        uint32_t count = 0;
+        while (producing) {
+            if (halTaskNotifyTake(100) == 0) {
+                continue;
+            }
+            int16_t power = (int16_t)(count++ % 2000) - 1000;
+            simulator->noteSetpoint(power);
+            if (veBusHandler.sendEssPowerCommand(power)) {
+                last = power;
+                submitted++;
+            }
+        }
+        veBusHandler.setSyncListener(nullptr);
+    });
+    halDelayMs(STREAM_MS);
+    producing = false;
+    producer.join();
+    halDelayMs(200);                    // Last acknowledgment, retransmission included
+
+    VeBusSimulatorStats sim = simulator->getStats();
+    VeBusStatistics handler = veBusHandler.getStatistics();
+    assertBusAccounting(sim);
+    TEST_ASSERT_EQUAL(sim.essAcknowledged, handler.setpointsAcknowledged);
+    TEST_ASSERT_EQUAL(sim.essAcknowledged, simulator->getAckLatency().getCount());
+
+    // Each submitted setpoint was acknowledged or replaced by a newer one before it was sent
+    TEST_ASSERT_GREATER_THAN(STREAM_MS * 1000 / VEBUS_SIM_SYNC_PERIOD_US / 2, submitted.load());
+    TEST_ASSERT_EQUAL(submitted.load(), handler.setpointsAcknowledged + handler.commandsCoalesced);
+    TEST_ASSERT_EQUAL(last.load(), simulator->getEssPower());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_setpoint_acknowledged);
+    RUN_TEST(test_setpoint_on_every_sync);
+    return UNITY_END();
+}
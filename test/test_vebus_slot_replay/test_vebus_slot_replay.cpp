@@ -0,0 +1,262 @@
+/*
+ * VE.Bus Transmit Slot Replay
+ *
+ * Replays timestamped byte streams through VeBusFrameDecoder and
+ * VeBusSlotScheduler the way the VE.Bus task does: every UART RX event
+ * hands a chunk of bytes to the decoder, decoded frames go to the
+ * scheduler with the time of the event, a partial frame marks the bus busy,
+ * and the task tries to take the slot when it wakes up. The transmit
+ * offsets are collected in a PerfHistogram and checked against the window.
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include <string.h>
+#include "vebus_frame_decoder.h"
+#include "vebus_slot_scheduler.h"
+#include "perf_histogram.h"
+
+#define SYNC_PERIOD_US 20000
+#define REPLAY_PERIODS 2000
+
+enum ReplayStep : uint8_t {
+    STEP_RX,        // Bytes arrive, one UART RX event
+    STEP_TX         // The task wakes up with a frame to send
+};
+
+struct ReplayEvent {
+    ReplayStep step;
+    uint32_t timeUs;
+    uint8_t length;
+    uint8_t bytes[16];
+};
+
+class SlotReplay {
+public:
+    VeBusFrameDecoder decoder;
+    VeBusSlotScheduler scheduler;
+    PerfHistogram offsets;
+    uint8_t lastSyncNumber = 0;
+    uint32_t transmitted = 0;
+    uint32_t wrongNumbers = 0;
+    uint32_t checksumErrors = 0;
+
+    void rx(const uint8_t* bytes, size_t length, uint32_t timeUs) {
+        size_t offset = 0;
+        while (offset < length) {
+            offset += decoder.push(&bytes[offset], length - offset);
+            VeBusFrameView frame;
+            VeBusDecodeResult result;
+            while ((result = decoder.next(frame)) != VEBUS_DECODE_NEED_MORE) {
+                if (result == VEBUS_DECODE_CHECKSUM_ERROR) {
+                    checksumErrors++;
+                }
+                if (result != VEBUS_DECODE_FRAME) {
+                    continue;
+                }
+                uint8_t marker = frame.payloadLength > 0 ? frame.payload[0] : 0;
+                scheduler.onFrame(frame.frameType, frame.frameNumber, marker, timeUs);
+                if (frame.isSyncFrame()) {
+                    lastSyncNumber = frame.frameNumber;
+                }
+            }
+        }
+        if (decoder.isInFrame()) {
+            scheduler.onBusBusy();
+        }
+    }
+
+    bool tx(uint32_t timeUs) {
+        uint8_t number;
+        if (!scheduler.acquireSlot(timeUs, number)) {
+            return false;
+        }
+        transmitted++;
+        offsets.record(scheduler.getLastTxOffset());
+        if (number != ((lastSyncNumber + 1) & VEBUS_FRAME_NUMBER_MASK)) {
+            wrongNumbers++;
+        }
+        return true;
+    }
+
+    void run(const ReplayEvent* events, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (events[i].step == STEP_RX) {
+                rx(events[i].bytes, events[i].length, events[i].timeUs);
+            } else {
+                tx(events[i].timeUs);
+            }
+        }
+    }
+};
+
+static SlotReplay* replay;
+
+// Sync frame as in docs/README.md, 83 83 FD nr 55 51 18 02 cs FF
+static size_t syncFrame(uint8_t* out, uint8_t number) {
+    const uint8_t frame[] = {0x83, 0x83, 0xFD, number, 0x55, 0x51, 0x18, 0x02, 0x00, 0xFF};
+    memcpy(out, frame, sizeof(frame));
+    out[8] = (uint8_t)(1 - (0xFD + number + 0x51 + 0x18 + 0x02));
+    return sizeof(frame);
+}
+
+// Multiplus info frame 83 83 FE nr 20 01 02 03 cs FF
+static size_t infoFrame(uint8_t* out, uint8_t number) {
+    const uint8_t frame[] = {0x83, 0x83, 0xFE, number, 0x20, 0x01, 0x02, 0x03, 0x00, 0xFF};
+    memcpy(out, frame, sizeof(frame));
+    out[8] = (uint8_t)(1 - (0xFE + number + 0x20 + 0x01 + 0x02 + 0x03));
+    return sizeof(frame);
+}
+
+static uint32_t random32(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void setUp(void) {
+    replay = new SlotReplay();
+}
+
+void tearDown(void) {
+    delete replay;
+}
+
+void test_recorded_trace(void) {
+    static const ReplayEvent trace[] = {
+        // Sync frame of the docs, we send 300 us after it
+        {STEP_RX, 0, 10, {0x83, 0x83, 0xFD, 0x02, 0x55, 0x51, 0x18, 0x02, 0x97, 0xFF}},
+        {STEP_TX, 300, 0, {}},
+        // Sync frame split over two RX events, the first one does not open a slot
+        {STEP_RX, 19900, 5, {0x83, 0x83, 0xFD, 0x04, 0x55}},
+        {STEP_TX, 19950, 0, {}},
+        {STEP_RX, 20000, 5, {0x51, 0x18, 0x02, 0x95, 0xFF}},
+        {STEP_TX, 20250, 0, {}},
+        // The Multiplus answers right after the sync frame, the slot is gone
+        {STEP_RX, 40000, 10, {0x83, 0x83, 0xFD, 0x06, 0x55, 0x51, 0x18, 0x02, 0x93, 0xFF}},
+        {STEP_RX, 40150, 10, {0x83, 0x83, 0xFE, 0x07, 0x20, 0x01, 0x02, 0x03, 0xD6, 0xFF}},
+        {STEP_TX, 40400, 0, {}},
+        // Woke up too late
+        {STEP_RX, 60000, 10, {0x83, 0x83, 0xFD, 0x08, 0x55, 0x51, 0x18, 0x02, 0x91, 0xFF}},
+        {STEP_TX, 61500, 0, {}},
+        // Corrupted sync frame
+        {STEP_RX, 80000, 10, {0x83, 0x83, 0xFD, 0x09, 0x55, 0x51, 0x19, 0x02, 0x90, 0xFF}},
+        {STEP_TX, 80200, 0, {}},
+    };
+
+    replay->run(trace, sizeof(trace) / sizeof(trace[0]));
+
+    TEST_ASSERT_EQUAL(2, replay->transmitted);
+    TEST_ASSERT_EQUAL(0, replay->wrongNumbers);
+    TEST_ASSERT_EQUAL(1, replay->checksumErrors);
+    TEST_ASSERT_EQUAL(4, replay->scheduler.getSyncFrames());
+    TEST_ASSERT_EQUAL(1, replay->scheduler.getSlotsMissed());
+    TEST_ASSERT_EQUAL(300, replay->scheduler.getMaxTxOffset());
+    TEST_ASSERT_EQUAL(250, replay->scheduler.getLastTxOffset());
+    TEST_ASSERT_EQUAL(2, replay->offsets.getCount());
+    TEST_ASSERT_EQUAL(250, replay->offsets.getMin());
+    TEST_ASSERT_EQUAL(300, replay->offsets.getMax());
+}
+
+void test_long_trace_offset_histogram(void) {
+    // Bus trace with sync jitter, other devices taking some slots and a task
+    // wake-up latency of 50..650 us with a few late outliers
+    uint32_t state = 0x12345678;
+    uint8_t number = 0;
+    uint32_t expectedSent = 0;
+    uint32_t expectedMissed = 0;
+    PerfHistogram expected;
+    uint8_t bytes[16];
+
+    for (uint32_t period = 0; period < REPLAY_PERIODS; period++) {
+        uint32_t syncUs = period * SYNC_PERIOD_US + random32(state) % 100;
+        size_t length = syncFrame(bytes, number);
+        uint8_t syncNumber = number;
+        number = (number + 1) & VEBUS_FRAME_NUMBER_MASK;
+
+        uint32_t roll = random32(state) % 100;
+        uint32_t latency = 50 + random32(state) % 600;
+        if (roll < 2) {
+            latency += VEBUS_TX_SLOT_WINDOW_US;
+        }
+
+        if (roll >= 2 && roll < 7) {
+            // The sync frame arrives in two RX events
+            replay->rx(bytes, 4, syncUs - 40);
+            TEST_ASSERT_FALSE(replay->tx(syncUs - 20));
+            replay->rx(&bytes[4], length - 4, syncUs);
+        } else {
+            replay->rx(bytes, length, syncUs);
+        }
+
+        if (roll >= 7 && roll < 12) {
+            // Another device sends before we wake up
+            length = infoFrame(bytes, number);
+            number = (number + 1) & VEBUS_FRAME_NUMBER_MASK;
+            replay->rx(bytes, length, syncUs + latency / 2);
+            TEST_ASSERT_FALSE(replay->tx(syncUs + latency));
+            continue;
+        }
+
+        bool sent = replay->tx(syncUs + latency);
+        if (latency > VEBUS_TX_SLOT_WINDOW_US) {
+            TEST_ASSERT_FALSE(sent);
+            expectedMissed++;
+            continue;
+        }
+        TEST_ASSERT_TRUE(sent);
+        TEST_ASSERT_EQUAL(syncNumber, replay->lastSyncNumber);
+        expectedSent++;
+        expected.record(latency);
+        number = (number + 1) & VEBUS_FRAME_NUMBER_MASK;    // Our frame counts as well
+    }
+
+    TEST_ASSERT_EQUAL(REPLAY_PERIODS, replay->scheduler.getSyncFrames());
+    TEST_ASSERT_EQUAL(expectedSent, replay->transmitted);
+    TEST_ASSERT_EQUAL(expectedMissed, replay->scheduler.getSlotsMissed());
+    TEST_ASSERT_EQUAL(0, replay->wrongNumbers);
+    TEST_ASSERT_EQUAL(0, replay->checksumErrors);
+    TEST_ASSERT_GREATER_THAN(REPLAY_PERIODS * 8 / 10, expectedSent);
+
+    // Offsets are the wake-up latency, all inside the window
+    const PerfHistogram& offsets = replay->offsets;
+    TEST_ASSERT_EQUAL(expectedSent, offsets.getCount());
+    TEST_ASSERT_LESS_OR_EQUAL(VEBUS_TX_SLOT_WINDOW_US, offsets.getMax());
+    TEST_ASSERT_EQUAL(replay->scheduler.getMaxTxOffset(), offsets.getMax());
+    TEST_ASSERT_EQUAL(expected.getMin(), offsets.getMin());
+    TEST_ASSERT_EQUAL(expected.getMean(), offsets.getMean());
+    TEST_ASSERT_EQUAL(expected.percentile(50), offsets.percentile(50));
+    TEST_ASSERT_EQUAL(expected.percentile(99), offsets.percentile(99));
+    TEST_ASSERT_GREATER_OR_EQUAL(50, offsets.getMin());
+    TEST_ASSERT_LESS_OR_EQUAL(650, offsets.percentile(99));
+}
+
+void test_narrow_window(void) {
+    // With a 200 us window most of the same latencies miss their slot
+    replay->scheduler.setWindow(200);
+    uint8_t bytes[16];
+    uint32_t state = 99;
+    uint32_t late = 0;
+    for (uint32_t period = 0; period < 500; period++) {
+        uint32_t syncUs = period * SYNC_PERIOD_US;
+        replay->rx(bytes, syncFrame(bytes, (uint8_t)(period * 2) & VEBUS_FRAME_NUMBER_MASK), syncUs);
+        uint32_t latency = 50 + random32(state) % 600;
+        late += latency > 200;
+        replay->tx(syncUs + latency);
+    }
+    TEST_ASSERT_EQUAL(late, replay->scheduler.getSlotsMissed());
+    TEST_ASSERT_EQUAL(500 - late, replay->transmitted);
+    TEST_ASSERT_LESS_OR_EQUAL(200, replay->offsets.getMax());
+    TEST_ASSERT_EQUAL(0, replay->wrongNumbers);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_recorded_trace);
+    RUN_TEST(test_long_trace_offset_histogram);
+    RUN_TEST(test_narrow_window);
+    return UNITY_END();
+}
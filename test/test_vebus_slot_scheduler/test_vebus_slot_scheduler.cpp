@@ -0,0 +1,156 @@
+/*
+ * VeBusSlotScheduler Tests
+ *
+ * SPDX-FileCopyrightText: © 2023 PV Baxi <pv-baxi@gmx.de>
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <unity.h>
+#include "vebus_slot_scheduler.h"
+
+#define DATA_FRAME_TYPE 0xFE
+
+static VeBusSlotScheduler scheduler;
+
+void setUp(void) {
+    scheduler.setWindow(VEBUS_TX_SLOT_WINDOW_US);
+    scheduler.reset();
+}
+
+void tearDown(void) {}
+
+void test_no_slot_before_sync(void) {
+    uint8_t number = 0xAA;
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(1000, number));
+    TEST_ASSERT_EQUAL_HEX8(0xAA, number);
+    TEST_ASSERT_FALSE(scheduler.isSynchronized(1000));
+    TEST_ASSERT_EQUAL(0, scheduler.getSlotsMissed());
+}
+
+void test_slot_after_sync_frame(void) {
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 0x10, VEBUS_SYNC_MARKER, 50000);
+    TEST_ASSERT_TRUE(scheduler.isSlotOpen(50100));
+
+    uint8_t number;
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(50400, number));
+    TEST_ASSERT_EQUAL(0x11, number);
+    TEST_ASSERT_EQUAL(1, scheduler.getSyncFrames());
+    TEST_ASSERT_EQUAL(1, scheduler.getSlotsUsed());
+    TEST_ASSERT_EQUAL(400, scheduler.getLastTxOffset());
+    TEST_ASSERT_EQUAL(0x10, scheduler.getLastFrameNumber());
+    TEST_ASSERT_EQUAL(50000, scheduler.getLastSyncTime());
+
+    // One frame per slot
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(50500, number));
+    TEST_ASSERT_FALSE(scheduler.isSlotOpen(50500));
+    TEST_ASSERT_EQUAL(0, scheduler.getSlotsMissed());
+}
+
+void test_frame_number_wraps(void) {
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 0x7F, VEBUS_SYNC_MARKER, 0);
+    uint8_t number;
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(10, number));
+    TEST_ASSERT_EQUAL(0x00, number);
+
+    // The high bit of the number is not part of it
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 0x85, VEBUS_SYNC_MARKER, 20000);
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(20010, number));
+    TEST_ASSERT_EQUAL(0x06, number);
+}
+
+void test_late_acquire_is_a_miss(void) {
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 1, VEBUS_SYNC_MARKER, 1000);
+    TEST_ASSERT_TRUE(scheduler.isSlotOpen(1000 + VEBUS_TX_SLOT_WINDOW_US));
+    TEST_ASSERT_FALSE(scheduler.isSlotOpen(1001 + VEBUS_TX_SLOT_WINDOW_US));
+
+    uint8_t number;
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(1001 + VEBUS_TX_SLOT_WINDOW_US, number));
+    TEST_ASSERT_EQUAL(1, scheduler.getSlotsMissed());
+    TEST_ASSERT_EQUAL(0, scheduler.getSlotsUsed());
+
+    // The missed slot is gone, the next sync frame opens a new one
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(1002 + VEBUS_TX_SLOT_WINDOW_US, number));
+    TEST_ASSERT_EQUAL(1, scheduler.getSlotsMissed());
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 2, VEBUS_SYNC_MARKER, 21000);
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(21000 + VEBUS_TX_SLOT_WINDOW_US, number));
+    TEST_ASSERT_EQUAL(3, number);
+}
+
+void test_window_setting(void) {
+    scheduler.setWindow(2000);
+    TEST_ASSERT_EQUAL(2000, scheduler.getWindow());
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 1, VEBUS_SYNC_MARKER, 0);
+    uint8_t number;
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(1800, number));
+}
+
+void test_other_frames_close_the_slot(void) {
+    uint8_t number;
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 1, VEBUS_SYNC_MARKER, 0);
+    scheduler.onFrame(DATA_FRAME_TYPE, 2, 0x00, 200);
+    TEST_ASSERT_FALSE(scheduler.isSlotOpen(300));
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(300, number));
+    TEST_ASSERT_EQUAL(2, scheduler.getLastFrameNumber());
+
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 3, VEBUS_SYNC_MARKER, 20000);
+    scheduler.onBusBusy();
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(20100, number));
+
+    // A 0xFD frame without the 0x55 marker is not a sync frame
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 4, 0x00, 40000);
+    TEST_ASSERT_FALSE(scheduler.acquireSlot(40100, number));
+    TEST_ASSERT_EQUAL(2, scheduler.getSyncFrames());
+    TEST_ASSERT_EQUAL(0, scheduler.getSlotsMissed());
+}
+
+void test_synchronization_timeout(void) {
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 1, VEBUS_SYNC_MARKER, 5000);
+    TEST_ASSERT_TRUE(scheduler.isSynchronized(5000 + VEBUS_SYNC_TIMEOUT_US - 1));
+    TEST_ASSERT_FALSE(scheduler.isSynchronized(5000 + VEBUS_SYNC_TIMEOUT_US));
+}
+
+void test_time_wraps(void) {
+    // micros() wraps after 71 minutes
+    uint32_t syncTime = 0xFFFFFF00;
+    scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, 9, VEBUS_SYNC_MARKER, syncTime);
+    TEST_ASSERT_TRUE(scheduler.isSynchronized(syncTime + 0x200));
+    TEST_ASSERT_TRUE(scheduler.isSlotOpen(syncTime + 0x200));
+
+    uint8_t number;
+    TEST_ASSERT_TRUE(scheduler.acquireSlot(syncTime + 0x200, number));
+    TEST_ASSERT_EQUAL(0x200, scheduler.getLastTxOffset());
+}
+
+void test_statistics(void) {
+    const uint32_t offsets[] = {100, 700, 300};
+    uint8_t number;
+    for (uint8_t i = 0; i < 3; i++) {
+        uint32_t sync = i * 20000;
+        scheduler.onFrame(VEBUS_SYNC_FRAME_TYPE, i, VEBUS_SYNC_MARKER, sync);
+        TEST_ASSERT_TRUE(scheduler.acquireSlot(sync + offsets[i], number));
+    }
+    TEST_ASSERT_EQUAL(3, scheduler.getSlotsUsed());
+    TEST_ASSERT_EQUAL(300, scheduler.getLastTxOffset());
+    TEST_ASSERT_EQUAL(700, scheduler.getMaxTxOffset());
+
+    scheduler.resetStatistics();
+    TEST_ASSERT_EQUAL(0, scheduler.getSlotsUsed());
+    TEST_ASSERT_EQUAL(0, scheduler.getMaxTxOffset());
+    TEST_ASSERT_EQUAL(0, scheduler.getSyncFrames());
+    // Synchronization survives a statistics reset
+    TEST_ASSERT_TRUE(scheduler.isSynchronized(40400));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_slot_before_sync);
+    RUN_TEST(test_slot_after_sync_frame);
+    RUN_TEST(test_frame_number_wraps);
+    RUN_TEST(test_late_acquire_is_a_miss);
+    RUN_TEST(test_window_setting);
+    RUN_TEST(test_other_frames_close_the_slot);
+    RUN_TEST(test_synchronization_timeout);
+    RUN_TEST(test_time_wraps);
+    RUN_TEST(test_statistics);
+    return UNITY_END();
+}